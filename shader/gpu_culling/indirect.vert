@@ -0,0 +1,51 @@
+#version 430 core
+
+// texshad.vert / shadow.vert for IndirectBatch draws: the model matrix comes
+// from the instance SSBO, indexed by the per-instance objectId. DEPTH_ONLY
+// transforms into light space for the shadow pass (with shadow.frag);
+// otherwise the outputs match texshad.frag.
+
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec2 texCoords;
+layout (location = 3) in uint objectId;
+
+layout(std430, binding = 0) readonly buffer Instances {
+  mat4 models[];
+};
+
+layout(std140) uniform Camera {
+  mat4 prespective;
+  mat4 view;
+  vec4 viewPos;
+};
+
+layout(std140) uniform Light {
+  mat4 lightSpaceMatrix;
+  mat4 lightView;
+  mat4 lightProjection;
+  vec4 lightPos;
+  vec4 shadowScale;
+};
+
+#ifndef DEPTH_ONLY
+out VS_OUT {
+  vec3 FragPos;
+  vec3 Normal;
+  vec2 TexCoords;
+  vec4 FragPosLightSpace;
+} vs_out;
+#endif
+
+void main() {
+  mat4 model = models[objectId];
+#ifdef DEPTH_ONLY
+  gl_Position = lightSpaceMatrix * model * vec4(pos, 1.0);
+#else
+  vs_out.FragPos = vec3(model * vec4(pos, 1.0));
+  vs_out.Normal = transpose(inverse(mat3(model))) * normal;
+  vs_out.TexCoords = texCoords;
+  vs_out.FragPosLightSpace = lightSpaceMatrix * vec4(vs_out.FragPos, 1.0);
+  gl_Position = prespective * view * vec4(vs_out.FragPos, 1.0);
+#endif
+}
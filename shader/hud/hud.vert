@@ -0,0 +1,17 @@
+#version 330 core
+
+layout (location = 0) in vec2 pos; // pixels, origin top-left
+layout (location = 1) in vec2 uv;
+layout (location = 2) in vec4 color;
+
+out vec2 TexCoords;
+out vec4 Color;
+
+uniform vec2 screenSize;
+
+void main() {
+  vec2 ndc = pos / screenSize * 2.0 - 1.0;
+  gl_Position = vec4(ndc.x, -ndc.y, 0, 1);
+  TexCoords = uv;
+  Color = color;
+}
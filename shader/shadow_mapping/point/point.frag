@@ -0,0 +1,14 @@
+#version 330 core
+
+layout(std140) uniform PointLight {
+  mat4 faceMatrices[6];
+  vec4 pointLightPos;
+  vec4 pointLightRange; // x: near, y: far
+};
+
+in vec4 FragPos;
+
+// linear distance to the light in [0, 1], so lookups need no projection
+void main() {
+  gl_FragDepth = length(FragPos.xyz - pointLightPos.xyz) / pointLightRange.y;
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+layout(location = 0) in vec3 pos;
+
+layout(std140) uniform Object {
+  mat4 model;
+};
+
+// world space; point.geom projects per cubemap face
+void main() {
+  gl_Position = model * vec4(pos, 1.0);
+}
@@ -0,0 +1,23 @@
+#version 330 core
+
+layout(location = 0) in vec3 pos;
+
+layout(std140) uniform PointLight {
+  mat4 faceMatrices[6];
+  vec4 pointLightPos;
+  vec4 pointLightRange; // x: near, y: far
+};
+
+layout(std140) uniform Object {
+  mat4 model;
+};
+
+// Cubemap face of the current pass (six-pass reference path)
+uniform int face;
+
+out vec4 FragPos;
+
+void main() {
+  FragPos = model * vec4(pos, 1.0);
+  gl_Position = faceMatrices[face] * FragPos;
+}
@@ -2,10 +2,19 @@
 
 layout(location = 0) in vec3 pos;
 
-uniform mat4 lightSpaceMatrix;
-uniform mat4 lightProjection;
+layout(std140) uniform Light {
+  mat4 lightSpaceMatrix;
+  mat4 lightView;
+  mat4 lightProjection;
+  vec4 lightPos;
+  vec4 shadowScale;
+};
+
+layout(std140) uniform Object {
+  mat4 model;
+};
 
 
 void main() {
-  gl_Position = lightProjection * lightSpaceMatrix * vec4(pos, 1.0);
+  gl_Position = lightSpaceMatrix * model * vec4(pos, 1.0);
 }
@@ -10,20 +10,179 @@ in VS_OUT {
 } fs_in;
 
 struct Material {
+#ifdef TEXTURE_ARRAYS
+  sampler2DArray diffuse_page;
+  sampler2DArray specular_page;
+  int diffuse_layer;   // -1: mesh has no diffuse map
+  int specular_layer;  // -1: mesh has no specular map
+#else
   sampler2D texture_specular1;
   sampler2D texture_specular2;
   sampler2D texture_diffuse1;
   sampler2D texture_diffuse2;
   sampler2D texture_normalMap1;
   sampler2D texture_normalMap2;
+#endif
 };
 uniform Material material;
 
+vec3 material_diffuse(vec2 uv) {
+#ifdef TEXTURE_ARRAYS
+  if (material.diffuse_layer < 0)
+    return vec3(1.0);
+  return texture(material.diffuse_page, vec3(uv, material.diffuse_layer)).rgb;
+#else
+  return texture(material.texture_diffuse1, uv).rgb;
+#endif
+}
+
+float material_specular(vec2 uv) {
+#ifdef TEXTURE_ARRAYS
+  if (material.specular_layer < 0)
+    return 0.0;
+  return texture(material.specular_page, vec3(uv, material.specular_layer)).r;
+#else
+  return texture(material.texture_specular1, uv).r;
+#endif
+}
+
 uniform sampler2D shadowMap;
 // uniform sampler2DShadow shadowMap;
 
-uniform vec3 lightPos;
-uniform vec3 viewPos;
+layout(std140) uniform Camera {
+  mat4 prespective;
+  mat4 view;
+  vec4 viewPos;
+};
+
+layout(std140) uniform Light {
+  mat4 lightSpaceMatrix;
+  mat4 lightView;
+  mat4 lightProjection;
+  vec4 lightPos;
+  vec4 shadowScale; // xy: part of shadowMap the shadow pass rendered to
+};
+
+#ifdef VIRTUAL_SHADOWS
+// Filled by VirtualShadowMap, see virtual_shadow.hh. VSM_PAGES, VSM_LEVELS
+// and VSM_POOL_PAGES come in as defines.
+uniform sampler2D shadowPool;
+uniform usampler2D shadowPageTable; // mip L: level L pages; x, y slot, z valid
+
+// Depth from the finest rendered page covering `uv`; 1.0 (unshadowed)
+// until even the coarsest page is rendered.
+float virtual_shadow_depth(vec2 uv) {
+  for (int level = 0; level < VSM_LEVELS; level++) {
+    int pages = VSM_PAGES >> level;
+    vec2 pageCoords = uv * float(pages);
+    uvec4 entry = texelFetch(shadowPageTable,
+                             min(ivec2(pageCoords), ivec2(pages - 1)), level);
+    if (entry.z == 0u)
+      continue;
+    // stay off the neighbouring slot's texels
+    vec2 inPage = clamp(fract(pageCoords), vec2(0.001), vec2(0.999));
+    return texture(shadowPool, (vec2(entry.xy) + inPage) /
+                                   float(VSM_POOL_PAGES)).r;
+  }
+  return 1.0;
+}
+#endif
+
+#ifdef POINT_SHADOWS
+uniform samplerCube pointShadowMap;
+
+layout(std140) uniform PointLight {
+  mat4 faceMatrices[6];
+  vec4 pointLightPos;
+  vec4 pointLightRange; // x: near, y: far
+};
+
+float point_shadow_calculation(vec3 fragPos, float dot_normal_lightDir) {
+  vec3 lightToFrag = fragPos - pointLightPos.xyz;
+  // stored as distance / far, see point.frag
+  float closestDepth = texture(pointShadowMap, lightToFrag).r * pointLightRange.y;
+  float shadow_bias = max(0.1 * (1.0 - dot_normal_lightDir), 0.02);
+  return (length(lightToFrag) > closestDepth + shadow_bias) ? 1.0 : 0.0;
+}
+#endif
+
+#ifdef SHADOW_ATLAS
+// Must match MAX_ATLAS_LIGHTS in uniform_ring.hh
+#define MAX_ATLAS_LIGHTS 64
+uniform sampler2D shadowAtlas;
+
+layout(std140) uniform ShadowAtlas {
+  mat4 atlasLightSpaceMatrices[MAX_ATLAS_LIGHTS];
+  vec4 atlasRects[MAX_ATLAS_LIGHTS];     // atlas uv x, y, w, h; w == 0: none
+  vec4 atlasPositions[MAX_ATLAS_LIGHTS]; // w: range
+  vec4 atlasColors[MAX_ATLAS_LIGHTS];
+  ivec4 atlasCount;
+};
+
+// Spot lights: lit inside the light's frustum, shadowed through its tile.
+vec3 atlas_lighting(vec3 fragPos, vec3 normal) {
+  vec3 result = vec3(0.0);
+  for (int i = 0; i < atlasCount.x; i++) {
+    vec4 lightSpace = atlasLightSpaceMatrices[i] * vec4(fragPos, 1.0);
+    if (lightSpace.w <= 0.0)
+      continue;
+    vec3 projCoords = lightSpace.xyz / lightSpace.w;
+    if (any(greaterThan(abs(projCoords), vec3(1.0))))
+      continue;
+    projCoords = projCoords * 0.5 + 0.5;
+
+    vec3 toLight = atlasPositions[i].xyz - fragPos;
+    float dot_normal_lightDir = dot(normal, normalize(toLight));
+    float shadow = 0.0;
+    if (atlasRects[i].z > 0.0) {
+      vec2 uv = atlasRects[i].xy + projCoords.xy * atlasRects[i].zw;
+      float closestDepth = texture(shadowAtlas, uv).r;
+      float shadow_bias = max(0.002 * (1.0 - dot_normal_lightDir), 0.0005);
+      shadow = (projCoords.z > closestDepth + shadow_bias) ? 1.0 : 0.0;
+    }
+    float falloff = clamp(1.0 - length(toLight) / atlasPositions[i].w, 0.0, 1.0);
+    result += (1.0 - shadow) * max(dot_normal_lightDir, 0.0) * falloff *
+              falloff * atlasColors[i].rgb;
+  }
+  return result;
+}
+#endif
+
+#ifdef CLUSTERED
+// Filled by LightClusters, see clustered.hh
+uniform usamplerBuffer clusterGrid;    // offset, count per cluster
+uniform usamplerBuffer clusterIndices;
+uniform samplerBuffer clusterLights;   // position + radius, color per light
+uniform ivec3 clusterCounts;
+uniform vec4 clusterParams;            // near, far, slices / log(far / near)
+uniform vec4 clusterViewport;
+
+vec3 clustered_lighting(vec3 fragPos, vec3 normal) {
+  float depth = -(view * vec4(fragPos, 1.0)).z;
+  int slice = int(log(max(depth, clusterParams.x) / clusterParams.x) *
+                  clusterParams.z);
+  slice = min(slice, clusterCounts.z - 1);
+  ivec2 tile = ivec2((gl_FragCoord.xy - clusterViewport.xy) /
+                     clusterViewport.zw * vec2(clusterCounts.xy));
+  tile = clamp(tile, ivec2(0), clusterCounts.xy - 1);
+  int cluster = (slice * clusterCounts.y + tile.y) * clusterCounts.x + tile.x;
+
+  uvec2 range = texelFetch(clusterGrid, cluster).rg;
+  vec3 result = vec3(0.0);
+  for (uint i = 0u; i < range.y; i++) {
+    int light = int(texelFetch(clusterIndices, int(range.x + i)).r);
+    vec4 positionRadius = texelFetch(clusterLights, 2 * light);
+    vec3 toLight = positionRadius.xyz - fragPos;
+    float distance = length(toLight);
+    if (distance >= positionRadius.w)
+      continue;
+    float falloff = 1.0 - distance / positionRadius.w;
+    result += max(dot(normal, toLight / distance), 0.0) * falloff * falloff *
+              texelFetch(clusterLights, 2 * light + 1).rgb;
+  }
+  return result;
+}
+#endif
 
 float shadow_calculation(vec4 fragPosLightSpace, float dot_normal_lightDir) {
   // prespective divide
@@ -33,8 +192,16 @@ float shadow_calculation(vec4 fragPosLightSpace, float dot_normal_lightDir) {
     return 0.0;
   // [-1, 1] -> [0, 1]
   projCoords = projCoords * 0.5 + 0.5;
+  // outside the rendered region the texels are stale, not border
+  if (any(lessThan(projCoords.xy, vec2(0.0))) ||
+      any(greaterThan(projCoords.xy, vec2(1.0))))
+    return 0.0;
   // closest depth value from the light's prespective
-  float closestDepth = texture(shadowMap, projCoords.xy).r;
+#ifdef VIRTUAL_SHADOWS
+  float closestDepth = virtual_shadow_depth(projCoords.xy);
+#else
+  float closestDepth = texture(shadowMap, projCoords.xy * shadowScale.xy).r;
+#endif
   // float closestDepth = shadow2D(shadowMap, vec3(projCoords.xy, 0.0)).r;
   // current depth of the fragment from light's prespective
   float currentDepth = projCoords.z;
@@ -45,26 +212,45 @@ float shadow_calculation(vec4 fragPosLightSpace, float dot_normal_lightDir) {
 
 void main() {
   vec3 normal = normalize(fs_in.Normal);
-  vec3 diffuseColor = texture(material.texture_diffuse1, fs_in.TexCoords).rgb;
-  float specularIntensity = texture(material.texture_specular1, fs_in.TexCoords).r;
+  vec3 diffuseColor = material_diffuse(fs_in.TexCoords);
+  float specularIntensity = material_specular(fs_in.TexCoords);
   vec3 lightColor = vec3(1.0);
   
   // ambient
   vec3 ambient = 0.15 * diffuseColor;
 
   //diffuse
-  vec3 lightDir = normalize(lightPos - fs_in.FragPos);
+  vec3 lightDir = normalize(lightPos.xyz - fs_in.FragPos);
   float dot_normal_lightDir = dot(normal, lightDir);
   float diff = max(dot_normal_lightDir, 0.0);
   vec3 diffuse = diff * lightColor;
   
   // specular
-  vec3 viewDir = normalize(lightPos - fs_in.FragPos);
+  vec3 viewDir = normalize(lightPos.xyz - fs_in.FragPos);
   vec3 halfwayDir = normalize(lightDir + viewDir);
   float spec = specularIntensity * pow(max(dot(normal, halfwayDir), 0.0), 64);
   vec3 specular = spec * lightColor;
 
   float shadow = shadow_calculation(fs_in.FragPosLightSpace, dot_normal_lightDir);
   vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * diffuseColor;
+
+#ifdef CLUSTERED
+  lighting += clustered_lighting(fs_in.FragPos, normal) * diffuseColor;
+#endif
+
+#ifdef SHADOW_ATLAS
+  lighting += atlas_lighting(fs_in.FragPos, normal) * diffuseColor;
+#endif
+
+#ifdef POINT_SHADOWS
+  vec3 pointDir = normalize(pointLightPos.xyz - fs_in.FragPos);
+  float pointDistance = length(pointLightPos.xyz - fs_in.FragPos);
+  float attenuation = 1.0 / (1.0 + 0.09 * pointDistance +
+                             0.032 * pointDistance * pointDistance);
+  float dot_normal_pointDir = dot(normal, pointDir);
+  float pointShadow = point_shadow_calculation(fs_in.FragPos, dot_normal_pointDir);
+  lighting += (1.0 - pointShadow) * max(dot_normal_pointDir, 0.0) *
+              attenuation * lightColor * diffuseColor;
+#endif
   FragColor = vec4(lighting, 1.0);
 }
@@ -14,10 +14,23 @@ out VS_OUT {
 
 
 // uniform mat4 mvp;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 prespective;
-uniform mat4 lightSpaceMatrix;
+layout(std140) uniform Camera {
+  mat4 prespective;
+  mat4 view;
+  vec4 viewPos;
+};
+
+layout(std140) uniform Light {
+  mat4 lightSpaceMatrix;
+  mat4 lightView;
+  mat4 lightProjection;
+  vec4 lightPos;
+  vec4 shadowScale;
+};
+
+layout(std140) uniform Object {
+  mat4 model;
+};
 // out gl_PerVertex { vec4 gl_Position; };
 
 
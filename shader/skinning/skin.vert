@@ -0,0 +1,42 @@
+#version 330 core
+
+// GpuSkinning's transform feedback pass: one point per vertex, one instance
+// per character, nothing rasterized. The outputs are captured interleaved,
+// so the buffer they fill has Vertex's layout and texshad.vert/shadow.vert
+// draw it as is. Positions and normals stay in model space; the character's
+// instance transform is still the Object block's.
+
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec2 texCoords;
+layout (location = 3) in uvec4 joints;
+layout (location = 4) in vec4 weights;
+
+out vec3 skinnedPos;
+out vec3 skinnedNormal;
+out vec2 skinnedTexCoords;
+
+// Four RGBA32F texels (columns) per matrix; each character has
+// paletteStride matrices, and this mesh's bones start at paletteOffset.
+uniform samplerBuffer palettes;
+uniform int paletteStride;
+uniform int paletteOffset;
+
+mat4 joint_matrix(uint joint) {
+  int base = 4 * (gl_InstanceID * paletteStride + paletteOffset + int(joint));
+  return mat4(texelFetch(palettes, base), texelFetch(palettes, base + 1),
+              texelFetch(palettes, base + 2), texelFetch(palettes, base + 3));
+}
+
+void main() {
+  // Vertices no bone moves keep their bind pose
+  mat4 skin = mat4(1.0);
+  if (dot(weights, vec4(1.0)) > 0.0)
+    skin = weights.x * joint_matrix(joints.x) +
+           weights.y * joint_matrix(joints.y) +
+           weights.z * joint_matrix(joints.z) +
+           weights.w * joint_matrix(joints.w);
+  skinnedPos = vec3(skin * vec4(pos, 1.0));
+  skinnedNormal = normalize(mat3(skin) * normal);
+  skinnedTexCoords = texCoords;
+}
@@ -0,0 +1,381 @@
+#pragma once
+
+// Heap allocation tracker: replaces the global operator new and delete and
+// counts the current frame's allocations by profiler zone and by call site,
+// so a frame that should allocate nothing can be checked to. Only threads
+// that opt in are counted -- the render thread, and pool workers while they
+// run its parallelFor() chunks -- so background imports can allocate as
+// they like.
+//
+// Build with -DSHADOW_ALLOC_TRACKING (cmake -DSHADOW_ALLOC_TRACKING=ON) to
+// enable it; otherwise every ALLOC_* macro expands to nothing and this header
+// declares no code at all. The operators are defined here, so only one
+// translation unit per program may include it -- each program of this repo
+// is a single one, and profiler.hh includes it.
+//
+//   ALLOC_TRACK_THREAD();                   // count this thread from here
+//   ALLOC_FRAME();                          // frame start: reset counters
+//   auto counts{DefaultAllocTracker.frame()}; // this frame so far
+//   DefaultAllocTracker.report(std::clog);  // its zones and call sites
+//
+// PROFILE_SCOPE zones double as allocation zones (with or without
+// SHADOW_PROFILE); allocations outside any go to "(no zone)". A call site is
+// the first frame of the allocation's stack outside the standard library,
+// symbolized only when reported (glibc's backtrace; the CMake option links
+// with -rdynamic so that gives names instead of addresses). With
+// SHADOW_PROFILE as well, the profiler's own event storage is counted like
+// anything else.
+
+#ifdef SHADOW_ALLOC_TRACKING
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <iostream>
+#include <new>
+
+class AllocTracker {
+public:
+  struct Counts {
+    std::size_t allocations{0};
+    std::size_t bytes{0};
+    std::size_t frees{0};
+  };
+
+  // Whether a thread's allocations are counted, and in which zone.
+  struct Context {
+    bool tracked;
+    const char *zone;
+  };
+  static auto context() -> Context { return Context{tracked, current}; }
+
+  // Counts the thread's allocations until the end of scope; with a Context,
+  // as those of the thread it was taken on (ThreadPool::parallelFor).
+  class Track {
+  public:
+    Track() : Track{Context{true, current}} {}
+    explicit Track(const Context &context) : previous{AllocTracker::context()} {
+      tracked = context.tracked;
+      current = context.zone;
+    }
+    ~Track() {
+      tracked = previous.tracked;
+      current = previous.zone;
+    }
+    Track(const Track &) = delete;
+    Track &operator=(const Track &) = delete;
+
+  private:
+    Context previous;
+  };
+
+  // Attributes the thread's allocations to `name` until the end of scope.
+  class Zone {
+  public:
+    explicit Zone(const char *name) : previous{current} { current = name; }
+    ~Zone() { current = previous; }
+    Zone(const Zone &) = delete;
+    Zone &operator=(const Zone &) = delete;
+
+  private:
+    const char *previous;
+  };
+
+  // Allocations of this thread aren't counted until the end of scope
+  // (reporting, for one).
+  class Pause {
+  public:
+    Pause() { paused++; }
+    ~Pause() { paused--; }
+    Pause(const Pause &) = delete;
+    Pause &operator=(const Pause &) = delete;
+  };
+
+  auto beginFrame() -> void;
+  auto frame() const -> Counts;
+  auto total() const -> Counts;
+  // The frame's zones and its `maxSites` busiest call sites, by count.
+  auto report(std::ostream &out, std::size_t maxSites = 8) -> void;
+
+  auto record(std::size_t bytes) -> void;
+  // Frees what the operators allocated (std::free), counting it
+  auto release(void *p) -> void;
+
+private:
+  static constexpr std::size_t ZONES = 64, SITES = 512, DEPTH = 10;
+
+  struct ZoneCount {
+    const char *name;
+    std::size_t allocations, bytes;
+  };
+  struct Site {
+    std::array<void *, DEPTH> frames;
+    int depth;
+    const char *zone;
+    std::size_t allocations, bytes;
+  };
+
+  static thread_local const char *current;
+  static thread_local bool tracked;
+  static thread_local int paused;
+
+  // Zero-initialized before any constructor runs, so allocations made
+  // during static initialization are safe to count
+  mutable std::atomic_flag lock = ATOMIC_FLAG_INIT;
+  Counts frame_, total_;
+  std::array<ZoneCount, ZONES> zones;
+  std::array<Site, SITES> sites;
+  std::size_t droppedSites{0}; // the table was full
+
+  auto acquire() const -> void {
+    while (lock.test_and_set(std::memory_order_acquire))
+      ;
+  }
+  auto releaseLock() const -> void { lock.clear(std::memory_order_release); }
+  static auto symbol(void *address, char *out, std::size_t size) -> bool;
+};
+
+thread_local const char *AllocTracker::current{nullptr};
+thread_local bool AllocTracker::tracked{false};
+thread_local int AllocTracker::paused{0};
+
+static AllocTracker DefaultAllocTracker;
+
+auto AllocTracker::beginFrame() -> void {
+  acquire();
+  frame_ = {};
+  for (auto &z : zones)
+    z = {};
+  for (auto &s : sites)
+    s = {};
+  droppedSites = 0;
+  releaseLock();
+}
+
+auto AllocTracker::frame() const -> Counts {
+  acquire();
+  const auto counts{frame_};
+  releaseLock();
+  return counts;
+}
+
+auto AllocTracker::total() const -> Counts {
+  acquire();
+  const auto counts{total_};
+  releaseLock();
+  return counts;
+}
+
+auto AllocTracker::record(std::size_t bytes) -> void {
+  if (!tracked || paused)
+    return;
+  Pause pause; // backtrace() may allocate the first time it runs
+  std::array<void *, DEPTH + 1> stack;
+  // [0] is this function
+  const int depth{backtrace(stack.data(), stack.size()) - 1};
+  const char *zone{current ? current : "(no zone)"};
+
+  std::uintptr_t hash{reinterpret_cast<std::uintptr_t>(zone)};
+  for (int i = 0; i < depth; i++)
+    hash = hash * 31 + reinterpret_cast<std::uintptr_t>(stack[i + 1]);
+
+  acquire();
+  frame_.allocations++;
+  frame_.bytes += bytes;
+  total_.allocations++;
+  total_.bytes += bytes;
+  for (std::size_t i = 0; i < ZONES; i++) {
+    auto &z{zones[(reinterpret_cast<std::uintptr_t>(zone) / 8 + i) % ZONES]};
+    if (!z.name || z.name == zone) {
+      z.name = zone;
+      z.allocations++;
+      z.bytes += bytes;
+      break;
+    }
+  }
+  bool placed{false};
+  for (std::size_t i = 0; i < SITES && !placed; i++) {
+    auto &s{sites[(hash + i) % SITES]};
+    if (!s.allocations) {
+      s.depth = std::max(depth, 0);
+      std::copy(stack.begin() + 1, stack.begin() + 1 + s.depth,
+                s.frames.begin());
+      s.zone = zone;
+    } else if (s.zone != zone || s.depth != depth ||
+               !std::equal(s.frames.begin(), s.frames.begin() + s.depth,
+                           stack.begin() + 1))
+      continue;
+    s.allocations++;
+    s.bytes += bytes;
+    placed = true;
+  }
+  droppedSites += !placed;
+  releaseLock();
+}
+
+auto AllocTracker::release(void *p) -> void {
+  if (!p)
+    return;
+  std::free(p);
+  if (!tracked || paused)
+    return;
+  acquire();
+  frame_.frees++;
+  total_.frees++;
+  releaseLock();
+}
+
+// "name+offset" from backtrace_symbols' "binary(name+offset) [address]",
+// demangled; false for frames of the standard library and the operators,
+// which say nothing about who allocated.
+auto AllocTracker::symbol(void *address, char *out, std::size_t size)
+    -> bool {
+  char **symbols{backtrace_symbols(&address, 1)}; // malloc'd, not new'd
+  if (!symbols) {
+    std::snprintf(out, size, "%p", address);
+    return true;
+  }
+  const char *text{symbols[0]};
+  const char *open{std::strchr(text, '(')};
+  const char *plus{open ? std::strchr(open, '+') : nullptr};
+  bool useful{true};
+  if (open && plus && plus > open + 1) {
+    char mangled[512];
+    const std::size_t n{std::min<std::size_t>(plus - open - 1,
+                                              sizeof mangled - 1)};
+    std::memcpy(mangled, open + 1, n);
+    mangled[n] = '\0';
+    int status{0};
+    char *demangled{abi::__cxa_demangle(mangled, nullptr, nullptr, &status)};
+    const char *name{status == 0 && demangled ? demangled : mangled};
+    useful = std::strncmp(name, "std::", 5) &&
+             std::strncmp(name, "__gnu_cxx::", 11) &&
+             std::strncmp(name, "operator new", 12) &&
+             std::strncmp(name, "AllocTracker::", 14);
+    std::snprintf(out, size, "%s", name);
+    std::free(demangled);
+  } else
+    std::snprintf(out, size, "%s", text);
+  std::free(symbols);
+  return useful;
+}
+
+auto AllocTracker::report(std::ostream &out, std::size_t maxSites) -> void {
+  Pause pause;
+  acquire();
+  auto zonesCopy{zones};
+  auto sitesCopy{sites};
+  const auto counts{frame_};
+  const auto dropped{droppedSites};
+  releaseLock();
+
+  out << "LOG::AllocTracker::\"Frame Allocations\": " << counts.allocations
+      << " allocations, " << counts.bytes << " bytes, " << counts.frees
+      << " frees" << std::endl;
+  std::sort(zonesCopy.begin(), zonesCopy.end(),
+            [](auto &a, auto &b) { return a.allocations > b.allocations; });
+  for (auto &z : zonesCopy)
+    if (z.allocations)
+      out << "  zone " << z.name << ": " << z.allocations << " allocations, "
+          << z.bytes << " bytes" << std::endl;
+  std::sort(sitesCopy.begin(), sitesCopy.end(),
+            [](auto &a, auto &b) { return a.allocations > b.allocations; });
+  for (std::size_t i = 0; i < std::min(maxSites, SITES); i++) {
+    auto &s{sitesCopy[i]};
+    if (!s.allocations)
+      break;
+    char name[512] = "(unknown)";
+    for (int f = 0; f < s.depth; f++)
+      if (symbol(s.frames[f], name, sizeof name))
+        break;
+    out << "  site " << name << " [" << s.zone << "]: " << s.allocations
+        << " allocations, " << s.bytes << " bytes" << std::endl;
+  }
+  if (dropped)
+    out << "  " << dropped << " allocations at sites past the table's "
+        << SITES << std::endl;
+}
+
+// Replacements for every global allocation function the program can reach.
+// Aligned sizes are rounded up, as std::aligned_alloc requires.
+auto operator new(std::size_t bytes) -> void * {
+  void *p{std::malloc(bytes ? bytes : 1)};
+  if (!p)
+    throw std::bad_alloc{};
+  DefaultAllocTracker.record(bytes);
+  return p;
+}
+auto operator new[](std::size_t bytes) -> void * {
+  return ::operator new(bytes);
+}
+auto operator new(std::size_t bytes, const std::nothrow_t &) noexcept
+    -> void * {
+  void *p{std::malloc(bytes ? bytes : 1)};
+  if (p)
+    DefaultAllocTracker.record(bytes);
+  return p;
+}
+auto operator new[](std::size_t bytes, const std::nothrow_t &tag) noexcept
+    -> void * {
+  return ::operator new(bytes, tag);
+}
+auto operator new(std::size_t bytes, std::align_val_t alignment) -> void * {
+  const auto a{static_cast<std::size_t>(alignment)};
+  void *p{std::aligned_alloc(a, (std::max<std::size_t>(bytes, 1) + a - 1) /
+                                    a * a)};
+  if (!p)
+    throw std::bad_alloc{};
+  DefaultAllocTracker.record(bytes);
+  return p;
+}
+auto operator new[](std::size_t bytes, std::align_val_t alignment)
+    -> void * {
+  return ::operator new(bytes, alignment);
+}
+auto operator delete(void *p) noexcept -> void {
+  DefaultAllocTracker.release(p);
+}
+auto operator delete[](void *p) noexcept -> void {
+  DefaultAllocTracker.release(p);
+}
+auto operator delete(void *p, std::size_t) noexcept -> void {
+  DefaultAllocTracker.release(p);
+}
+auto operator delete[](void *p, std::size_t) noexcept -> void {
+  DefaultAllocTracker.release(p);
+}
+auto operator delete(void *p, std::align_val_t) noexcept -> void {
+  DefaultAllocTracker.release(p);
+}
+auto operator delete[](void *p, std::align_val_t) noexcept -> void {
+  DefaultAllocTracker.release(p);
+}
+auto operator delete(void *p, std::size_t, std::align_val_t) noexcept -> void {
+  DefaultAllocTracker.release(p);
+}
+auto operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+    -> void {
+  DefaultAllocTracker.release(p);
+}
+
+#define ALLOC_CONCAT_(a, b) a##b
+#define ALLOC_CONCAT(a, b) ALLOC_CONCAT_(a, b)
+#define ALLOC_ZONE(name)                                                       \
+  AllocTracker::Zone ALLOC_CONCAT(alloc_zone_, __LINE__) { name }
+#define ALLOC_TRACK_THREAD()                                                   \
+  AllocTracker::Track ALLOC_CONCAT(alloc_track_, __LINE__) {}
+#define ALLOC_FRAME() DefaultAllocTracker.beginFrame()
+
+#else
+
+#define ALLOC_ZONE(name)
+#define ALLOC_TRACK_THREAD()
+#define ALLOC_FRAME() static_cast<void>(0)
+
+#endif
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <assimp/scene.h>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Skeletal animation on the CPU. A Skeleton is the node hierarchy of a model
+// flattened parents first, with the clips that move it; a Pose holds one
+// local transform per node. Clips are sampled into poses, poses are blended
+// (nlerp), and modelSpace() chains them into per-node matrices for the
+// skinning palette. Quaternions are glm::vec4 (x, y, z, w) so translation,
+// rotation and scale all blend as one SSE register each.
+struct JointTransform {
+  glm::vec4 translation{0.0f, 0.0f, 0.0f, 0.0f};
+  glm::vec4 rotation{0.0f, 0.0f, 0.0f, 1.0f};
+  glm::vec4 scale{1.0f, 1.0f, 1.0f, 0.0f};
+
+  auto matrix() const -> glm::mat4;
+  // Translation, rotation and scale of a matrix without shear.
+  static auto fromMatrix(const glm::mat4 &m) -> JointTransform;
+
+  // a + (b - a) * w per component.
+  static auto lerp(const glm::vec4 &a, const glm::vec4 &b, float w)
+      -> glm::vec4;
+  // Quaternion lerp along the shorter arc, renormalized.
+  static auto nlerp(const glm::vec4 &a, const glm::vec4 &b, float w)
+      -> glm::vec4;
+  // a * b, column by column.
+  static auto multiply(const glm::mat4 &a, const glm::mat4 &b) -> glm::mat4;
+};
+
+using Pose = std::vector<JointTransform>;
+
+class AnimationClip {
+public:
+  // Keyframes of one property of one node, times in seconds, increasing
+  struct Track {
+    std::vector<float> times;
+    std::vector<glm::vec4> values;
+
+    // The keys around `time` and the weight of the second, clamped to the
+    // ends of the track.
+    auto locate(float time, std::size_t &a, std::size_t &b) const -> float;
+  };
+  struct Channel {
+    int node;
+    Track translation, rotation, scale;
+  };
+
+  std::string name;
+  float duration{0.0f}; // seconds
+  std::vector<Channel> channels;
+
+  // Overwrites the nodes the clip animates with their transforms at `time`
+  // seconds, wrapped to the clip's length; the others keep what `pose` had.
+  auto sample(float time, Pose &pose) const -> void;
+};
+
+class Skeleton {
+public:
+  struct Node {
+    std::string name;
+    int parent; // -1 for the root; always before the node itself
+    JointTransform bind;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<AnimationClip> clips;
+  // Undoes the root node's transform, which the model's instance replaces
+  glm::mat4 rootInverse{1.0f};
+
+  // nullptr if the scene has neither bones nor animations.
+  static auto fromAssimp(const aiScene *scene) -> std::unique_ptr<Skeleton>;
+  static auto toGlm(const aiMatrix4x4 &m) -> glm::mat4;
+
+  // Index of the node called `name`, -1 if there is none.
+  auto find(const std::string &name) const -> int;
+  auto bindPose() const -> Pose;
+  // Model-space matrix of every node of `pose`, parents first.
+  auto modelSpace(const Pose &pose, std::vector<glm::mat4> &out) const
+      -> void;
+  // a <- a + (b - a) * w, joint by joint.
+  static auto blend(Pose &a, const Pose &b, float w) -> void;
+};
+
+auto JointTransform::matrix() const -> glm::mat4 {
+  const float x{rotation.x}, y{rotation.y}, z{rotation.z}, w{rotation.w};
+  return glm::mat4(
+      glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + z * w),
+                2.0f * (x * z - y * w), 0.0f) *
+          scale.x,
+      glm::vec4(2.0f * (x * y - z * w), 1.0f - 2.0f * (x * x + z * z),
+                2.0f * (y * z + x * w), 0.0f) *
+          scale.y,
+      glm::vec4(2.0f * (x * z + y * w), 2.0f * (y * z - x * w),
+                1.0f - 2.0f * (x * x + y * y), 0.0f) *
+          scale.z,
+      glm::vec4(translation.x, translation.y, translation.z, 1.0f));
+}
+
+auto JointTransform::fromMatrix(const glm::mat4 &m) -> JointTransform {
+  JointTransform t;
+  t.translation = glm::vec4(m[3].x, m[3].y, m[3].z, 0.0f);
+  const glm::vec3 sx{m[0]}, sy{m[1]}, sz{m[2]};
+  t.scale = glm::vec4(glm::length(sx), glm::length(sy), glm::length(sz), 0.0f);
+  const glm::vec3 c0{sx / t.scale.x}, c1{sy / t.scale.y}, c2{sz / t.scale.z};
+  // Shepperd's method: start from the largest of w, x, y, z
+  const float trace{c0.x + c1.y + c2.z};
+  if (trace > 0.0f) {
+    const float s{0.5f / std::sqrt(trace + 1.0f)};
+    t.rotation = glm::vec4((c1.z - c2.y) * s, (c2.x - c0.z) * s,
+                           (c0.y - c1.x) * s, 0.25f / s);
+  } else if (c0.x > c1.y && c0.x > c2.z) {
+    const float s{2.0f * std::sqrt(1.0f + c0.x - c1.y - c2.z)};
+    t.rotation = glm::vec4(0.25f * s, (c1.x + c0.y) / s, (c2.x + c0.z) / s,
+                           (c1.z - c2.y) / s);
+  } else if (c1.y > c2.z) {
+    const float s{2.0f * std::sqrt(1.0f + c1.y - c0.x - c2.z)};
+    t.rotation = glm::vec4((c1.x + c0.y) / s, 0.25f * s, (c2.y + c1.z) / s,
+                           (c2.x - c0.z) / s);
+  } else {
+    const float s{2.0f * std::sqrt(1.0f + c2.z - c0.x - c1.y)};
+    t.rotation = glm::vec4((c2.x + c0.z) / s, (c2.y + c1.z) / s, 0.25f * s,
+                           (c0.y - c1.x) / s);
+  }
+  return t;
+}
+
+auto JointTransform::lerp(const glm::vec4 &a, const glm::vec4 &b, float w)
+    -> glm::vec4 {
+#if defined(__SSE2__)
+  const __m128 va{_mm_loadu_ps(&a.x)};
+  glm::vec4 r;
+  _mm_storeu_ps(&r.x, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&b.x),
+                                                           va),
+                                                _mm_set1_ps(w))));
+  return r;
+#else
+  return a + (b - a) * w;
+#endif
+}
+
+auto JointTransform::nlerp(const glm::vec4 &a, const glm::vec4 &b, float w)
+    -> glm::vec4 {
+#if defined(__SSE2__)
+  // Horizontal sum into every lane, without SSE4.1's dpps
+  auto dot{[](__m128 u, __m128 v) {
+    __m128 d{_mm_mul_ps(u, v)};
+    d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
+  }};
+  const __m128 va{_mm_loadu_ps(&a.x)};
+  __m128 vb{_mm_loadu_ps(&b.x)};
+  // q and -q are the same rotation; flip b onto a's hemisphere
+  vb = _mm_xor_ps(vb, _mm_and_ps(dot(va, vb), _mm_set1_ps(-0.0f)));
+  const __m128 r{
+      _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), _mm_set1_ps(w)))};
+  glm::vec4 q;
+  _mm_storeu_ps(&q.x, _mm_div_ps(r, _mm_sqrt_ps(dot(r, r))));
+  return q;
+#else
+  const glm::vec4 r{a + ((glm::dot(a, b) < 0.0f ? b * -1.0f : b) - a) * w};
+  return r / std::sqrt(glm::dot(r, r));
+#endif
+}
+
+auto JointTransform::multiply(const glm::mat4 &a, const glm::mat4 &b)
+    -> glm::mat4 {
+#if defined(__SSE2__)
+  const __m128 a0{_mm_loadu_ps(&a[0].x)}, a1{_mm_loadu_ps(&a[1].x)},
+      a2{_mm_loadu_ps(&a[2].x)}, a3{_mm_loadu_ps(&a[3].x)};
+  glm::mat4 r;
+  for (int c = 0; c < 4; c++) {
+    const __m128 col{_mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(b[c].x)),
+                   _mm_mul_ps(a1, _mm_set1_ps(b[c].y))),
+        _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(b[c].z)),
+                   _mm_mul_ps(a3, _mm_set1_ps(b[c].w))))};
+    _mm_storeu_ps(&r[c].x, col);
+  }
+  return r;
+#else
+  return a * b;
+#endif
+}
+
+auto AnimationClip::Track::locate(float time, std::size_t &a,
+                                  std::size_t &b) const -> float {
+  auto next{std::upper_bound(times.begin(), times.end(), time)};
+  if (next == times.begin()) {
+    a = b = 0;
+    return 0.0f;
+  }
+  if (next == times.end()) {
+    a = b = times.size() - 1;
+    return 0.0f;
+  }
+  b = next - times.begin();
+  a = b - 1;
+  return (time - times[a]) / (times[b] - times[a]);
+}
+
+auto AnimationClip::sample(float time, Pose &pose) const -> void {
+  if (duration > 0.0f) {
+    time = std::fmod(time, duration);
+    if (time < 0.0f)
+      time += duration;
+  }
+  std::size_t a, b;
+  for (auto &c : channels) {
+    auto &joint{pose[c.node]};
+    if (!c.translation.times.empty()) {
+      const float w{c.translation.locate(time, a, b)};
+      joint.translation = JointTransform::lerp(c.translation.values[a],
+                                               c.translation.values[b], w);
+    }
+    if (!c.rotation.times.empty()) {
+      const float w{c.rotation.locate(time, a, b)};
+      joint.rotation = JointTransform::nlerp(c.rotation.values[a],
+                                             c.rotation.values[b], w);
+    }
+    if (!c.scale.times.empty()) {
+      const float w{c.scale.locate(time, a, b)};
+      joint.scale =
+          JointTransform::lerp(c.scale.values[a], c.scale.values[b], w);
+    }
+  }
+}
+
+auto Skeleton::toGlm(const aiMatrix4x4 &m) -> glm::mat4 {
+  // Assimp is row-major
+  return glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1),
+                   glm::vec4(m.a2, m.b2, m.c2, m.d2),
+                   glm::vec4(m.a3, m.b3, m.c3, m.d3),
+                   glm::vec4(m.a4, m.b4, m.c4, m.d4));
+}
+
+auto Skeleton::fromAssimp(const aiScene *scene) -> std::unique_ptr<Skeleton> {
+  bool bones{false};
+  for (uint i = 0; i < scene->mNumMeshes; i++)
+    bones = bones || scene->mMeshes[i]->mNumBones > 0;
+  if (!bones && !scene->mNumAnimations)
+    return nullptr;
+
+  auto skeleton{std::make_unique<Skeleton>()};
+  // Depth-first, so a parent always precedes its children
+  std::vector<std::pair<const aiNode *, int>> stack{{scene->mRootNode, -1}};
+  while (!stack.empty()) {
+    auto [node, parent] = stack.back();
+    stack.pop_back();
+    const int index{static_cast<int>(skeleton->nodes.size())};
+    skeleton->nodes.push_back(
+        Node{node->mName.C_Str(), parent,
+             JointTransform::fromMatrix(toGlm(node->mTransformation))});
+    for (uint i = node->mNumChildren; i-- > 0;)
+      stack.push_back({node->mChildren[i], index});
+  }
+  skeleton->rootInverse =
+      glm::inverse(toGlm(scene->mRootNode->mTransformation));
+
+  for (uint i = 0; i < scene->mNumAnimations; i++) {
+    auto *source{scene->mAnimations[i]};
+    const double ticks{source->mTicksPerSecond > 0.0 ? source->mTicksPerSecond
+                                                     : 25.0};
+    AnimationClip clip;
+    clip.name = source->mName.C_Str();
+    clip.duration = static_cast<float>(source->mDuration / ticks);
+    for (uint c = 0; c < source->mNumChannels; c++) {
+      auto *channel{source->mChannels[c]};
+      const int node{skeleton->find(channel->mNodeName.C_Str())};
+      if (node < 0)
+        continue;
+      AnimationClip::Channel out{node, {}, {}, {}};
+      for (uint k = 0; k < channel->mNumPositionKeys; k++) {
+        auto &key{channel->mPositionKeys[k]};
+        out.translation.times.push_back(static_cast<float>(key.mTime / ticks));
+        out.translation.values.push_back(
+            glm::vec4(key.mValue.x, key.mValue.y, key.mValue.z, 0.0f));
+      }
+      for (uint k = 0; k < channel->mNumRotationKeys; k++) {
+        auto &key{channel->mRotationKeys[k]};
+        out.rotation.times.push_back(static_cast<float>(key.mTime / ticks));
+        out.rotation.values.push_back(glm::vec4(
+            key.mValue.x, key.mValue.y, key.mValue.z, key.mValue.w));
+      }
+      for (uint k = 0; k < channel->mNumScalingKeys; k++) {
+        auto &key{channel->mScalingKeys[k]};
+        out.scale.times.push_back(static_cast<float>(key.mTime / ticks));
+        out.scale.values.push_back(
+            glm::vec4(key.mValue.x, key.mValue.y, key.mValue.z, 0.0f));
+      }
+      clip.channels.push_back(std::move(out));
+    }
+    skeleton->clips.push_back(std::move(clip));
+  }
+  return skeleton;
+}
+
+auto Skeleton::find(const std::string &name) const -> int {
+  for (std::size_t i = 0; i < nodes.size(); i++)
+    if (nodes[i].name == name)
+      return i;
+  return -1;
+}
+
+auto Skeleton::bindPose() const -> Pose {
+  Pose pose(nodes.size());
+  for (std::size_t i = 0; i < nodes.size(); i++)
+    pose[i] = nodes[i].bind;
+  return pose;
+}
+
+auto Skeleton::modelSpace(const Pose &pose, std::vector<glm::mat4> &out) const
+    -> void {
+  out.resize(nodes.size());
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    const auto local{pose[i].matrix()};
+    const int parent{nodes[i].parent};
+    out[i] = parent < 0 ? local : JointTransform::multiply(out[parent], local);
+  }
+}
+
+auto Skeleton::blend(Pose &a, const Pose &b, float w) -> void {
+  for (std::size_t i = 0; i < a.size(); i++) {
+    a[i].translation =
+        JointTransform::lerp(a[i].translation, b[i].translation, w);
+    a[i].rotation = JointTransform::nlerp(a[i].rotation, b[i].rotation, w);
+    a[i].scale = JointTransform::lerp(a[i].scale, b[i].scale, w);
+  }
+}
@@ -6,9 +6,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "input.hh"
+#include "redraw.hh"
 #include "utils.hh"
 
 
+#include <algorithm>
+#include <cmath>
 #include <functional>
 
 
@@ -72,11 +76,13 @@ public:
 
   auto updateVectors() -> void;
 
-  auto renderloopUpdateView(Utils::GLFWwindowUniquePtr &window, float deltaTime) -> void;
+  // Only reads `input`, never GLFW, so recorded input replays exactly.
+  auto renderloopUpdateView(const InputFrame &input) -> void;
 
-  auto processKeyboard(Utils::GLFWwindowUniquePtr &window, float deltaTime) -> void;
+  auto processKeyboard(const InputFrame &input) -> void;
   auto processCurosr(float dx, float dy) -> void;
-  auto mouseCallback(GLFWwindow *, double x, double y) -> void;
+  // Moves the camera to `position` looking at `target`, e.g. along a path.
+  auto place(const glm::vec3 &position, const glm::vec3 &target) -> void;
 private:
   // Default camera values
   static constexpr auto YAW            = -90.0f;
@@ -127,26 +133,16 @@ auto FPSCamera::updateVectors() -> void {
   updateCameraUp();
 }
 
-auto FPSCamera::renderloopUpdateView(Utils::GLFWwindowUniquePtr &window, float deltaTime) -> void {
+auto FPSCamera::renderloopUpdateView(const InputFrame &input) -> void {
   // The order of the function call DO matter!
-  processKeyboard(window, deltaTime); // move camera -> update cameraPos
+  if (input.cursorDx != 0.0f || input.cursorDy != 0.0f)
+    processCurosr(input.cursorDx, input.cursorDy); // update cameraFwd
+  processKeyboard(input); // move camera -> update cameraPos
   updateViewMatrix();
 }
-
-auto FPSCamera::mouseCallback(GLFWwindow *, double x, double y) -> void {
-    static float lastX, lastY;
-    static bool first = true;
-    if (__builtin_expect(first, 0)) { // unlikely to be true
-      lastX = x;
-      lastY = y;
-      first = false;
-    }
-    processCurosr(x - lastX, -y + lastY);
-    lastX = x;
-    lastY = y;
-}
 // TODO: the sensitvity felt for each axis will depend on aspect ratio. FIX PLS
 auto FPSCamera::processCurosr(float dx, float dy) -> void {
+  DefaultRedraw.request();
   float v = mouseSensitivity * 0.2f; //* deltaTime;
   dx *= v;
   dy *= v;
@@ -161,19 +157,36 @@ auto FPSCamera::processCurosr(float dx, float dy) -> void {
   updateVectors();   // update cameraUp, cameraRight and cameraFwd
 }
 
+auto FPSCamera::place(const glm::vec3 &position, const glm::vec3 &target)
+    -> void {
+  cameraPos = position;
+  auto dir{target - position};
+  if (glm::length(dir) > 0.0f) {
+    dir = glm::normalize(dir);
+    yaw = glm::degrees(std::atan2(dir.z, dir.x));
+    pitch = std::clamp(glm::degrees(std::asin(dir.y)), -89.0f, 89.0f);
+  }
+  updateVectors();
+  updateViewMatrix();
+  DefaultRedraw.request();
+}
+
 // PLS call this after calling processCursor (so that the cameraFwd is updated).
-auto FPSCamera::processKeyboard(Utils::GLFWwindowUniquePtr &window, float deltaTime) -> void {
-  float v = movementSpeed * deltaTime;
-  if (glfwGetKey(window.get(), GLFW_KEY_W) == GLFW_PRESS)
+auto FPSCamera::processKeyboard(const InputFrame &input) -> void {
+  const auto previousPos{cameraPos};
+  float v = movementSpeed * input.deltaTime;
+  if (input.down(Key::W))
     cameraPos += cameraFwd * v;
-  if (glfwGetKey(window.get(), GLFW_KEY_D) == GLFW_PRESS)
+  if (input.down(Key::D))
     cameraPos += cameraRight * v;
-  if (glfwGetKey(window.get(), GLFW_KEY_A) == GLFW_PRESS)
+  if (input.down(Key::A))
     cameraPos -= cameraRight * v;
-  if (glfwGetKey(window.get(), GLFW_KEY_S) == GLFW_PRESS)
+  if (input.down(Key::S))
     cameraPos -= cameraFwd * v;
-  if (glfwGetKey(window.get(), GLFW_KEY_SPACE) == GLFW_PRESS)
+  if (input.down(Key::Space))
     cameraPos += worldUp * v;
-  if (glfwGetKey(window.get(), GLFW_KEY_C) == GLFW_PRESS)
+  if (input.down(Key::C))
     cameraPos -= worldUp * v;
+  if (cameraPos != previousPos)
+    DefaultRedraw.request();
 }
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gpu_registry.hh"
+#include "profiler.hh"
+#include "shader.hh"
+#include "thread_pool.hh"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+struct ClusterLight {
+  glm::vec3 position;
+  float radius;
+  glm::vec3 color;
+};
+
+// Clustered forward shading. The view frustum is cut into X x Y screen tiles
+// and Z exponential depth slices; build() assigns every light to the
+// clusters its sphere touches on the thread pool (SIMD sphere/AABB tests over
+// the lights of each slice), upload() streams the result into three buffer
+// textures and the `CLUSTERED` variant of texshad.frag only loops over the
+// lights of its fragment's cluster:
+//
+//   clusterGrid     RG32UI   (offset, count) into clusterIndices, per cluster
+//   clusterIndices  R32UI    light indices
+//   clusterLights   RGBA32F  two texels per light: position + radius, color
+class LightClusters {
+public:
+  static constexpr int X = 16, Y = 9, Z = 24;
+  static constexpr int CLUSTERS = X * Y * Z;
+
+  struct Stats {
+    uint lights{0};
+    std::size_t indices{0};
+    uint maxPerCluster{0};
+    float buildMs{0.0f};
+  };
+
+  LightClusters(float nearPlane = 0.1f, float farPlane = 100.0f,
+                uint threads = std::thread::hardware_concurrency());
+  LightClusters(const LightClusters &) = delete;
+  LightClusters &operator=(const LightClusters &) = delete;
+
+  auto destory() -> void;
+
+  auto build(const std::vector<ClusterLight> &lights, const glm::mat4 &view,
+             const glm::mat4 &projection) -> void;
+  auto upload() -> void;
+  // Binds the three buffer textures to units firstUnit.. firstUnit + 2 and
+  // sets the cluster uniforms of `shader`, which must be in use.
+  auto bind(const Shader &shader, GLuint firstUnit) const -> void;
+
+  auto stats() const -> const Stats & { return stats_; }
+
+  const float nearPlane, farPlane;
+
+private:
+  struct Bounds {
+    glm::vec3 min, max;
+  };
+  // Structure-of-arrays copy of one slice's candidate lights, padded to the
+  // SIMD width with lights that never pass.
+  struct Candidates {
+    std::vector<float> x, y, z, radius2;
+    std::vector<std::uint32_t> ids;
+    auto clear() -> void;
+    auto push(const glm::vec3 &p, float r, std::uint32_t id) -> void;
+    auto pad(std::size_t lanes) -> void;
+  };
+
+  ThreadPool pool;
+  glm::mat4 projection{0.0f};
+  std::vector<Bounds> clusterBounds; // view space, rebuilt on new projection
+  std::vector<glm::vec4> viewLights; // view-space center + radius
+  std::vector<Candidates> candidates;               // per chunk
+  std::vector<std::vector<std::uint32_t>> indices;  // per chunk
+  std::array<uint, Z> sliceChunk;
+  std::vector<std::uint32_t> grid; // 2 per cluster
+  std::vector<glm::vec4> lightTexels;
+  Stats stats_;
+
+  BufferHandle gridBuffer, indexBuffer, lightBuffer;
+  // views of the buffers, no storage of their own
+  TextureHandle gridTexture, indexTexture, lightTexture;
+
+  auto sliceDepth(int slice) const -> float;
+  auto buildBounds(const glm::mat4 &projection) -> void;
+  auto assignSlice(int slice, Candidates &c, std::vector<std::uint32_t> &out)
+      -> void;
+  static auto uploadBuffer(BufferHandle buffer, const void *data,
+                           std::size_t bytes) -> void;
+};
+
+LightClusters::LightClusters(float nearPlane, float farPlane, uint threads)
+    : nearPlane{nearPlane}, farPlane{farPlane}, pool{threads},
+      clusterBounds(CLUSTERS), candidates(pool.size()), indices(pool.size()),
+      grid(2 * CLUSTERS) {
+  std::array<BufferHandle *, 3> buffers{&gridBuffer, &indexBuffer,
+                                        &lightBuffer};
+  std::array<TextureHandle *, 3> textures{&gridTexture, &indexTexture,
+                                          &lightTexture};
+  const std::array<GLenum, 3> formats{GL_RG32UI, GL_R32UI, GL_RGBA32F};
+  for (int i = 0; i < 3; i++) {
+    *buffers[i] = DefaultGpuRegistry.create<GpuKind::Buffer>(16);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]->name());
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    *textures[i] = DefaultGpuRegistry.create<GpuKind::Texture>();
+    glBindTexture(GL_TEXTURE_BUFFER, textures[i]->name());
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]->name());
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+auto LightClusters::destory() -> void {
+  for (auto *b : {&gridBuffer, &indexBuffer, &lightBuffer})
+    DefaultGpuRegistry.release(*b);
+  for (auto *t : {&gridTexture, &indexTexture, &lightTexture})
+    DefaultGpuRegistry.release(*t);
+}
+
+// Distance from the eye to the near side of `slice`; slice Z is farPlane.
+auto LightClusters::sliceDepth(int slice) const -> float {
+  return nearPlane * std::pow(farPlane / nearPlane, slice / float(Z));
+}
+
+// Cluster AABBs in view space: the four tile corner rays cut at the slice's
+// near and far depths.
+auto LightClusters::buildBounds(const glm::mat4 &proj) -> void {
+  projection = proj;
+  const glm::mat4 inverse{glm::inverse(proj)};
+  auto ray{[&](float ndcX, float ndcY) {
+    glm::vec4 p{inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f)};
+    return glm::vec3(p.x, p.y, p.z) / -p.z; // scaled to z == -1
+  }};
+  for (int z = 0; z < Z; z++) {
+    const float d0{sliceDepth(z)}, d1{sliceDepth(z + 1)};
+    for (int y = 0; y < Y; y++)
+      for (int x = 0; x < X; x++) {
+        Bounds b{glm::vec3(std::numeric_limits<float>::max()),
+                 glm::vec3(-std::numeric_limits<float>::max())};
+        for (int c = 0; c < 4; c++) {
+          const auto dir{ray(-1.0f + 2.0f * (x + (c & 1)) / X,
+                             -1.0f + 2.0f * (y + (c >> 1)) / Y)};
+          for (float d : {d0, d1}) {
+            b.min = glm::min(b.min, dir * d);
+            b.max = glm::max(b.max, dir * d);
+          }
+        }
+        clusterBounds[(z * Y + y) * X + x] = b;
+      }
+  }
+}
+
+auto LightClusters::Candidates::clear() -> void {
+  x.clear();
+  y.clear();
+  z.clear();
+  radius2.clear();
+  ids.clear();
+}
+
+auto LightClusters::Candidates::push(const glm::vec3 &p, float r,
+                                     std::uint32_t id) -> void {
+  x.push_back(p.x);
+  y.push_back(p.y);
+  z.push_back(p.z);
+  radius2.push_back(r * r);
+  ids.push_back(id);
+}
+
+auto LightClusters::Candidates::pad(std::size_t lanes) -> void {
+  while (ids.size() % lanes) {
+    push(glm::vec3(0.0f), 0.0f, 0);
+    radius2.back() = -1.0f; // d^2 >= 0 never passes
+  }
+}
+
+auto LightClusters::build(const std::vector<ClusterLight> &lights,
+                          const glm::mat4 &view, const glm::mat4 &proj)
+    -> void {
+  PROFILE_SCOPE("LightClusters::build");
+  auto start{std::chrono::steady_clock::now()};
+  if (proj != projection)
+    buildBounds(proj);
+
+  viewLights.resize(lights.size());
+  lightTexels.resize(2 * lights.size());
+  for (std::size_t i = 0; i < lights.size(); i++) {
+    auto &l{lights[i]};
+    glm::vec4 p{view * glm::vec4(l.position, 1.0f)};
+    viewLights[i] = glm::vec4(p.x, p.y, p.z, l.radius);
+    lightTexels[2 * i] = glm::vec4(l.position, l.radius);
+    lightTexels[2 * i + 1] = glm::vec4(l.color, 0.0f);
+  }
+
+  for (auto &i : indices) // parallelFor may use fewer chunks than last time
+    i.clear();
+  pool.parallelFor(Z, [&](std::size_t begin, std::size_t end, uint chunk) {
+    auto &out{indices[chunk]};
+    for (auto z = begin; z < end; z++) {
+      sliceChunk[z] = chunk;
+      assignSlice(z, candidates[chunk], out);
+    }
+  });
+
+  // Chunk-relative offsets -> offsets into the concatenated index buffer
+  std::vector<std::size_t> base(indices.size(), 0);
+  for (std::size_t c = 1; c < indices.size(); c++)
+    base[c] = base[c - 1] + indices[c - 1].size();
+  stats_ = Stats{};
+  stats_.lights = lights.size();
+  for (int cluster = 0; cluster < CLUSTERS; cluster++) {
+    grid[2 * cluster] += base[sliceChunk[cluster / (X * Y)]];
+    stats_.maxPerCluster =
+        std::max<uint>(stats_.maxPerCluster, grid[2 * cluster + 1]);
+  }
+  for (auto &i : indices)
+    stats_.indices += i.size();
+  stats_.buildMs = std::chrono::duration<float, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+}
+
+auto LightClusters::assignSlice(int slice, Candidates &c,
+                                std::vector<std::uint32_t> &out) -> void {
+  // Lights whose sphere reaches this slice's depth range
+  const float d0{slice ? sliceDepth(slice) : 0.0f};
+  const float d1{slice + 1 == Z ? std::numeric_limits<float>::max()
+                                : sliceDepth(slice + 1)};
+  c.clear();
+  for (std::size_t i = 0; i < viewLights.size(); i++) {
+    auto &l{viewLights[i]};
+    if (-l.z + l.w >= d0 && -l.z - l.w <= d1)
+      c.push(glm::vec3(l.x, l.y, l.z), l.w, i);
+  }
+#if defined(__AVX2__)
+  constexpr std::size_t LANES = 8;
+#elif defined(__SSE2__)
+  constexpr std::size_t LANES = 4;
+#else
+  constexpr std::size_t LANES = 1;
+#endif
+  const std::size_t count{c.ids.size()};
+  c.pad(LANES);
+
+  for (int tile = 0; tile < X * Y; tile++) {
+    const int cluster{slice * X * Y + tile};
+    const auto &b{clusterBounds[cluster]};
+    grid[2 * cluster] = out.size();
+    // the outermost slices also take everything nearer/farther
+    const float minZ{slice + 1 == Z ? -std::numeric_limits<float>::max()
+                                    : b.min.z};
+    const float maxZ{slice == 0 ? std::numeric_limits<float>::max() : b.max.z};
+    for (std::size_t i = 0; i < count; i += LANES) {
+#if defined(__AVX2__)
+      const __m256 zero{_mm256_setzero_ps()};
+      auto axis{[&](const float *v, float lo, float hi) {
+        const __m256 p{_mm256_loadu_ps(v + i)};
+        const __m256 d{_mm256_add_ps(
+            _mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps(lo), p), zero),
+            _mm256_max_ps(_mm256_sub_ps(p, _mm256_set1_ps(hi)), zero))};
+        return _mm256_mul_ps(d, d);
+      }};
+      const __m256 d2{_mm256_add_ps(
+          _mm256_add_ps(axis(c.x.data(), b.min.x, b.max.x),
+                        axis(c.y.data(), b.min.y, b.max.y)),
+          axis(c.z.data(), minZ, maxZ))};
+      int mask{_mm256_movemask_ps(_mm256_cmp_ps(
+          d2, _mm256_loadu_ps(c.radius2.data() + i), _CMP_LE_OQ))};
+#elif defined(__SSE2__)
+      const __m128 zero{_mm_setzero_ps()};
+      auto axis{[&](const float *v, float lo, float hi) {
+        const __m128 p{_mm_loadu_ps(v + i)};
+        const __m128 d{
+            _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(lo), p), zero),
+                       _mm_max_ps(_mm_sub_ps(p, _mm_set1_ps(hi)), zero))};
+        return _mm_mul_ps(d, d);
+      }};
+      const __m128 d2{
+          _mm_add_ps(_mm_add_ps(axis(c.x.data(), b.min.x, b.max.x),
+                                axis(c.y.data(), b.min.y, b.max.y)),
+                     axis(c.z.data(), minZ, maxZ))};
+      int mask{_mm_movemask_ps(
+          _mm_cmple_ps(d2, _mm_loadu_ps(c.radius2.data() + i)))};
+#else
+      auto axis{[&](float p, float lo, float hi) {
+        const float d{std::max(lo - p, 0.0f) + std::max(p - hi, 0.0f)};
+        return d * d;
+      }};
+      int mask{axis(c.x[i], b.min.x, b.max.x) +
+                       axis(c.y[i], b.min.y, b.max.y) +
+                       axis(c.z[i], minZ, maxZ) <=
+                   c.radius2[i]
+                   ? 1
+                   : 0};
+#endif
+      for (; mask; mask &= mask - 1)
+        out.push_back(c.ids[i + __builtin_ctz(mask)]);
+    }
+    grid[2 * cluster + 1] = out.size() - grid[2 * cluster];
+  }
+}
+
+// Orphans the buffer so the GPU can keep reading last frame's copy.
+auto LightClusters::uploadBuffer(BufferHandle buffer, const void *data,
+                                 std::size_t bytes) -> void {
+  const auto size{std::max<std::size_t>(bytes, 16)};
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer.name());
+  glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+  DefaultGpuRegistry.setBytes(buffer, size);
+  if (data)
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+}
+
+auto LightClusters::upload() -> void {
+  PROFILE_SCOPE("LightClusters::upload");
+  uploadBuffer(gridBuffer, grid.data(), grid.size() * sizeof(std::uint32_t));
+  uploadBuffer(lightBuffer, lightTexels.data(),
+               lightTexels.size() * sizeof(glm::vec4));
+  uploadBuffer(indexBuffer, nullptr, stats_.indices * sizeof(std::uint32_t));
+  std::size_t offset{0};
+  for (auto &i : indices) {
+    glBufferSubData(GL_TEXTURE_BUFFER, offset * sizeof(std::uint32_t),
+                    i.size() * sizeof(std::uint32_t), i.data());
+    offset += i.size();
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+auto LightClusters::bind(const Shader &shader, GLuint firstUnit) const
+    -> void {
+  const std::array<std::pair<const char *, TextureHandle>, 3> samplers{{
+      {"clusterGrid", gridTexture},
+      {"clusterIndices", indexTexture},
+      {"clusterLights", lightTexture},
+  }};
+  for (GLuint i = 0; i < samplers.size(); i++) {
+    glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+    glBindTexture(GL_TEXTURE_BUFFER, samplers[i].second.name());
+    glUniform1i(shader.getUniform(samplers[i].first), firstUnit + i);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glUniform3i(shader.getUniform("clusterCounts"), X, Y, Z);
+  glUniform4f(shader.getUniform("clusterParams"), nearPlane, farPlane,
+              Z / std::log(farPlane / nearPlane), 0.0f);
+  glUniform4f(shader.getUniform("clusterViewport"), viewport[0], viewport[1],
+              viewport[2], viewport[3]);
+}
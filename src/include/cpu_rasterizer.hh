@@ -0,0 +1,398 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "model.hh"
+#include "profiler.hh"
+#include "thread_pool.hh"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Depth-only software rasterizer, used as an alternative Light backend and to
+// check GPU shadow maps offline.
+//
+// submit() transforms, clips (near/far), culls and bins triangles into
+// TILE x TILE screen tiles on the thread pool; rasterize() then fills the
+// tiles in parallel, 8 (AVX2) or 4 (SSE2) pixels at a time. The output
+// follows GL conventions: y = 0 is the bottom row, samples at pixel centers,
+// counter-clockwise front faces, GL_LESS, and vertices snapped to 1/256 px.
+class CpuDepthRasterizer {
+public:
+  enum class Cull { None, Back, Front };
+
+  static constexpr int TILE = 64;
+
+  CpuDepthRasterizer(int width, int height,
+                     uint threads = std::thread::hardware_concurrency());
+
+  auto clear(float depth = 1.0f) -> void;
+  auto submit(const std::vector<Vertex> &vertices,
+              const std::vector<uint> &indices, const glm::mat4 &mvp,
+              Cull cull = Cull::None) -> void;
+  auto rasterize() -> void;
+  // submit() every mesh of the model, then rasterize()
+  auto render(const Model &model, const glm::mat4 &mvp, Cull cull = Cull::None)
+      -> void;
+
+  auto depth() const -> const std::vector<float> & { return depthBuffer; }
+  auto uploadTo(GLuint depthTexture) const -> void;
+  // Number of texels whose GL_DEPTH_COMPONENT16 values differ, and the
+  // largest difference in D16 units.
+  auto compareDepth16(const std::vector<float> &other) const
+      -> std::pair<std::size_t, int>;
+  static auto readDepthTexture(GLuint depthTexture, int width, int height)
+      -> std::vector<float>;
+
+  auto threadCount() const -> uint { return pool.size(); }
+
+  const int width, height;
+  std::size_t trianglesSubmitted{0}; // since the last clear()
+  std::size_t trianglesBinned{0};    // survived clipping and culling
+
+private:
+  struct Triangle {
+    // Edge k runs from (ax[k], ay[k]) by (dx[k], dy[k]); edge 0 weights the
+    // third vertex, edge 2 the second.
+    std::array<float, 3> ax, ay, dx, dy;
+    std::array<bool, 3> topLeft;
+    float z0, dz1, dz2, invArea;
+    int minX, minY, maxX, maxY;
+  };
+
+  ThreadPool pool;
+  const int tilesX, tilesY;
+  std::vector<float> depthBuffer;
+  // Per parallelFor chunk, so binning needs no locks.
+  std::vector<std::vector<Triangle>> triangles;
+  std::vector<std::vector<std::vector<std::uint32_t>>> bins;
+
+  auto setupTriangle(const std::array<glm::vec4, 3> &clip, Cull cull,
+                     uint chunk) -> void;
+  auto emitTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c,
+                    Cull cull, uint chunk) -> void;
+  auto rasterizeTile(int tile) -> void;
+  auto rasterizeTriangle(const Triangle &t, int x0, int y0, int x1, int y1)
+      -> void;
+};
+
+CpuDepthRasterizer::CpuDepthRasterizer(int width, int height, uint threads)
+    : width{width}, height{height}, pool{threads}, tilesX{width / TILE},
+      tilesY{height / TILE}, depthBuffer(width * height, 1.0f),
+      triangles(pool.size()), bins(pool.size()) {
+  if (width % TILE || height % TILE)
+    throw std::runtime_error{"CpuDepthRasterizer: size must be a multiple of " +
+                             std::to_string(TILE)};
+  for (auto &b : bins)
+    b.resize(tilesX * tilesY);
+}
+
+auto CpuDepthRasterizer::clear(float depth) -> void {
+  std::fill(begin(depthBuffer), end(depthBuffer), depth);
+  for (auto &t : triangles)
+    t.clear();
+  for (auto &b : bins)
+    for (auto &tile : b)
+      tile.clear();
+  trianglesSubmitted = trianglesBinned = 0;
+}
+
+auto CpuDepthRasterizer::render(const Model &model, const glm::mat4 &mvp,
+                                Cull cull) -> void {
+  PROFILE_SCOPE("CpuDepthRasterizer::render");
+  for (auto &m : model.meshes)
+    submit(m.vertices, m.indices, mvp, cull);
+  rasterize();
+}
+
+auto CpuDepthRasterizer::submit(const std::vector<Vertex> &vertices,
+                                const std::vector<uint> &indices,
+                                const glm::mat4 &mvp, Cull cull) -> void {
+  const std::size_t count{indices.size() / 3};
+  trianglesSubmitted += count;
+  pool.parallelFor(count, [&](std::size_t begin, std::size_t end, uint chunk) {
+    std::array<glm::vec4, 3> clip;
+    for (std::size_t i = begin; i < end; i++) {
+      for (int k = 0; k < 3; k++)
+        clip[k] = mvp * glm::vec4(vertices[indices[3 * i + k]].position, 1.0f);
+      setupTriangle(clip, cull, chunk);
+    }
+  });
+}
+
+// Sutherland-Hodgman against the near (z >= -w) and far (z <= w) planes, then
+// a triangle fan. x/y are handled by clamping the bounding box.
+auto CpuDepthRasterizer::setupTriangle(const std::array<glm::vec4, 3> &clip,
+                                       Cull cull, uint chunk) -> void {
+  auto inside{[](const glm::vec4 &v, int plane) {
+    return plane == 0 ? v.z >= -v.w : v.z <= v.w;
+  }};
+  bool allInside{true};
+  for (auto &v : clip)
+    allInside = allInside && inside(v, 0) && inside(v, 1);
+  if (allInside) {
+    emitTriangle(clip[0], clip[1], clip[2], cull, chunk);
+    return;
+  }
+
+  std::array<glm::vec4, 5> poly{clip[0], clip[1], clip[2]}, next;
+  int n{3};
+  for (int plane = 0; plane < 2 && n; plane++) {
+    int m{0};
+    for (int i = 0; i < n; i++) {
+      auto &a{poly[i]};
+      auto &b{poly[(i + 1) % n]};
+      // signed distances to the plane
+      float da{plane == 0 ? a.z + a.w : a.w - a.z};
+      float db{plane == 0 ? b.z + b.w : b.w - b.z};
+      if (da >= 0)
+        next[m++] = a;
+      if ((da >= 0) != (db >= 0))
+        next[m++] = a + (b - a) * (da / (da - db));
+    }
+    poly = next;
+    n = m;
+  }
+  for (int i = 1; i + 1 < n; i++)
+    emitTriangle(poly[0], poly[i], poly[i + 1], cull, chunk);
+}
+
+auto CpuDepthRasterizer::emitTriangle(const glm::vec4 &a, const glm::vec4 &b,
+                                      const glm::vec4 &c, Cull cull,
+                                      uint chunk) -> void {
+  std::array<glm::vec3, 3> s;
+  const std::array<const glm::vec4 *, 3> v{&a, &b, &c};
+  for (int k = 0; k < 3; k++) {
+    float iw{1.0f / v[k]->w};
+    // viewport transform, snapped to 8 bits of sub-pixel precision
+    s[k].x = std::round((v[k]->x * iw * 0.5f + 0.5f) * width * 256.0f) / 256.0f;
+    s[k].y = std::round((v[k]->y * iw * 0.5f + 0.5f) * height * 256.0f) / 256.0f;
+    s[k].z = v[k]->z * iw * 0.5f + 0.5f;
+  }
+  float area{(s[1].x - s[0].x) * (s[2].y - s[0].y) -
+             (s[2].x - s[0].x) * (s[1].y - s[0].y)};
+  if (area == 0.0f)
+    return;
+  const bool front{area > 0.0f}; // counter-clockwise
+  if ((cull == Cull::Back && !front) || (cull == Cull::Front && front))
+    return;
+  if (!front) {
+    std::swap(s[1], s[2]);
+    area = -area;
+  }
+
+  Triangle t;
+  float minX{std::min({s[0].x, s[1].x, s[2].x})};
+  float maxX{std::max({s[0].x, s[1].x, s[2].x})};
+  float minY{std::min({s[0].y, s[1].y, s[2].y})};
+  float maxY{std::max({s[0].y, s[1].y, s[2].y})};
+  // pixels whose centers (i + 0.5) fall inside the bounds; clamp in float
+  // first, vertices far outside the viewport would overflow an int
+  auto pixel{[](float v, int size) {
+    return static_cast<int>(std::clamp(v, -1.0f, static_cast<float>(size)));
+  }};
+  t.minX = std::max(0, pixel(std::ceil(minX - 0.5f), width));
+  t.minY = std::max(0, pixel(std::ceil(minY - 0.5f), height));
+  t.maxX = std::min(width - 1, pixel(std::floor(maxX - 0.5f), width));
+  t.maxY = std::min(height - 1, pixel(std::floor(maxY - 0.5f), height));
+  if (t.minX > t.maxX || t.minY > t.maxY)
+    return;
+
+  for (int k = 0; k < 3; k++) {
+    auto &p{s[k]};
+    auto &q{s[(k + 1) % 3]};
+    t.ax[k] = p.x;
+    t.ay[k] = p.y;
+    t.dx[k] = q.x - p.x;
+    t.dy[k] = q.y - p.y;
+    // y points up, so "top" edges run right to left and "left" edges down
+    t.topLeft[k] = t.dy[k] < 0.0f || (t.dy[k] == 0.0f && t.dx[k] < 0.0f);
+  }
+  t.z0 = s[0].z;
+  t.dz1 = s[1].z - s[0].z;
+  t.dz2 = s[2].z - s[0].z;
+  t.invArea = 1.0f / area;
+
+  auto &tris{triangles[chunk]};
+  auto index{static_cast<std::uint32_t>(tris.size())};
+  tris.push_back(t);
+  for (int ty = t.minY / TILE; ty <= t.maxY / TILE; ty++)
+    for (int tx = t.minX / TILE; tx <= t.maxX / TILE; tx++)
+      bins[chunk][ty * tilesX + tx].push_back(index);
+}
+
+auto CpuDepthRasterizer::rasterize() -> void {
+  for (auto &t : triangles)
+    trianglesBinned += t.size();
+  const std::size_t tileCount{static_cast<std::size_t>(tilesX) * tilesY};
+  std::atomic<std::size_t> nextTile{0};
+  pool.parallelFor(pool.size(), [&](std::size_t, std::size_t, uint) {
+    for (std::size_t tile; (tile = nextTile++) < tileCount;)
+      rasterizeTile(tile);
+  });
+  for (auto &t : triangles)
+    t.clear();
+  for (auto &b : bins)
+    for (auto &tile : b)
+      tile.clear();
+}
+
+auto CpuDepthRasterizer::rasterizeTile(int tile) -> void {
+  const int x0{(tile % tilesX) * TILE}, y0{(tile / tilesX) * TILE};
+  for (std::size_t c = 0; c < bins.size(); c++)
+    for (auto index : bins[c][tile])
+      rasterizeTriangle(triangles[c][index], x0, y0, x0 + TILE, y0 + TILE);
+}
+
+// Fills the part of `t` inside [x0, x1) x [y0, y1). Edge k at pixel center p
+// is E = dx * (p.y - ay) - dy * (p.x - ax); the pixel is covered when every
+// E > 0, or E == 0 on a top-left edge.
+auto CpuDepthRasterizer::rasterizeTriangle(const Triangle &t, int x0, int y0,
+                                           int x1, int y1) -> void {
+  const int xmin{std::max(t.minX, x0)}, xmax{std::min(t.maxX, x1 - 1)};
+  const int ymin{std::max(t.minY, y0)}, ymax{std::min(t.maxY, y1 - 1)};
+
+#if defined(__AVX2__)
+  constexpr int LANES = 8;
+  const __m256 laneCenters{_mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f,
+                                          6.5f, 7.5f)};
+  const __m256i laneIndex{_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)};
+  const __m256 zero{_mm256_setzero_ps()};
+  for (int y = ymin; y <= ymax; y++) {
+    const float py{y + 0.5f};
+    __m256 rowE[3], dy[3], ax[3];
+    for (int k = 0; k < 3; k++) {
+      rowE[k] = _mm256_set1_ps(t.dx[k] * (py - t.ay[k]));
+      dy[k] = _mm256_set1_ps(t.dy[k]);
+      ax[k] = _mm256_set1_ps(t.ax[k]);
+    }
+    float *row{depthBuffer.data() + y * width};
+    for (int x = xmin & ~(LANES - 1); x <= xmax; x += LANES) {
+      const __m256 px{_mm256_add_ps(_mm256_set1_ps(x), laneCenters)};
+      const __m256i xi{_mm256_add_epi32(_mm256_set1_epi32(x), laneIndex)};
+      __m256 mask{_mm256_castsi256_ps(_mm256_and_si256(
+          _mm256_cmpgt_epi32(xi, _mm256_set1_epi32(xmin - 1)),
+          _mm256_cmpgt_epi32(_mm256_set1_epi32(xmax + 1), xi)))};
+      __m256 e[3];
+      for (int k = 0; k < 3; k++) {
+        e[k] = _mm256_sub_ps(rowE[k],
+                             _mm256_mul_ps(dy[k], _mm256_sub_ps(px, ax[k])));
+        mask = _mm256_and_ps(mask, t.topLeft[k]
+                                       ? _mm256_cmp_ps(e[k], zero, _CMP_GE_OQ)
+                                       : _mm256_cmp_ps(e[k], zero, _CMP_GT_OQ));
+      }
+      if (_mm256_testz_ps(mask, mask))
+        continue;
+      const __m256 z{_mm256_add_ps(
+          _mm256_set1_ps(t.z0),
+          _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(e[2], _mm256_set1_ps(t.dz1)),
+                                      _mm256_mul_ps(e[0], _mm256_set1_ps(t.dz2))),
+                        _mm256_set1_ps(t.invArea)))};
+      const __m256 old{_mm256_loadu_ps(row + x)};
+      mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, old, _CMP_LT_OQ));
+      _mm256_storeu_ps(row + x, _mm256_blendv_ps(old, z, mask));
+    }
+  }
+#elif defined(__SSE2__)
+  constexpr int LANES = 4;
+  const __m128 laneCenters{_mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f)};
+  const __m128i laneIndex{_mm_setr_epi32(0, 1, 2, 3)};
+  const __m128 zero{_mm_setzero_ps()};
+  for (int y = ymin; y <= ymax; y++) {
+    const float py{y + 0.5f};
+    __m128 rowE[3], dy[3], ax[3];
+    for (int k = 0; k < 3; k++) {
+      rowE[k] = _mm_set1_ps(t.dx[k] * (py - t.ay[k]));
+      dy[k] = _mm_set1_ps(t.dy[k]);
+      ax[k] = _mm_set1_ps(t.ax[k]);
+    }
+    float *row{depthBuffer.data() + y * width};
+    for (int x = xmin & ~(LANES - 1); x <= xmax; x += LANES) {
+      const __m128 px{_mm_add_ps(_mm_set1_ps(x), laneCenters)};
+      const __m128i xi{_mm_add_epi32(_mm_set1_epi32(x), laneIndex)};
+      __m128 mask{_mm_castsi128_ps(
+          _mm_and_si128(_mm_cmpgt_epi32(xi, _mm_set1_epi32(xmin - 1)),
+                        _mm_cmplt_epi32(xi, _mm_set1_epi32(xmax + 1))))};
+      __m128 e[3];
+      for (int k = 0; k < 3; k++) {
+        e[k] = _mm_sub_ps(rowE[k], _mm_mul_ps(dy[k], _mm_sub_ps(px, ax[k])));
+        mask = _mm_and_ps(mask, t.topLeft[k] ? _mm_cmpge_ps(e[k], zero)
+                                             : _mm_cmpgt_ps(e[k], zero));
+      }
+      if (!_mm_movemask_ps(mask))
+        continue;
+      const __m128 z{_mm_add_ps(
+          _mm_set1_ps(t.z0),
+          _mm_mul_ps(_mm_add_ps(_mm_mul_ps(e[2], _mm_set1_ps(t.dz1)),
+                                _mm_mul_ps(e[0], _mm_set1_ps(t.dz2))),
+                     _mm_set1_ps(t.invArea)))};
+      const __m128 old{_mm_loadu_ps(row + x)};
+      mask = _mm_and_ps(mask, _mm_cmplt_ps(z, old));
+      _mm_storeu_ps(row + x,
+                    _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, old)));
+    }
+  }
+#else
+  for (int y = ymin; y <= ymax; y++) {
+    const float py{y + 0.5f};
+    float *row{depthBuffer.data() + y * width};
+    for (int x = xmin; x <= xmax; x++) {
+      const float px{x + 0.5f};
+      std::array<float, 3> e;
+      bool covered{true};
+      for (int k = 0; k < 3; k++) {
+        e[k] = t.dx[k] * (py - t.ay[k]) - t.dy[k] * (px - t.ax[k]);
+        covered = covered && (t.topLeft[k] ? e[k] >= 0.0f : e[k] > 0.0f);
+      }
+      if (!covered)
+        continue;
+      const float z{t.z0 + (e[2] * t.dz1 + e[0] * t.dz2) * t.invArea};
+      if (z < row[x])
+        row[x] = z;
+    }
+  }
+#endif
+}
+
+auto CpuDepthRasterizer::uploadTo(GLuint depthTexture) const -> void {
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_DEPTH_COMPONENT,
+                  GL_FLOAT, depthBuffer.data());
+}
+
+auto CpuDepthRasterizer::compareDepth16(const std::vector<float> &other) const
+    -> std::pair<std::size_t, int> {
+  std::size_t mismatches{0};
+  int maxDiff{0};
+  for (std::size_t i = 0; i < std::min(other.size(), depthBuffer.size()); i++) {
+    auto a{static_cast<int>(std::lround(depthBuffer[i] * 65535.0f))};
+    auto b{static_cast<int>(std::lround(other[i] * 65535.0f))};
+    if (a != b) {
+      mismatches++;
+      maxDiff = std::max(maxDiff, std::abs(a - b));
+    }
+  }
+  return {mismatches, maxDiff};
+}
+
+auto CpuDepthRasterizer::readDepthTexture(GLuint depthTexture, int width,
+                                          int height) -> std::vector<float> {
+  std::vector<float> out(static_cast<std::size_t>(width) * height);
+  glBindTexture(GL_TEXTURE_2D, depthTexture);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, out.data());
+  return out;
+}
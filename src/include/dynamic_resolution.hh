@@ -0,0 +1,288 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "gpu_registry.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+namespace fs = std::filesystem;
+
+// GL_TIME_ELAPSED of one pass, read back without stalling: queries rotate
+// through a small ring and a result is picked up once the GPU has it, a
+// couple of frames late.
+class GpuPassTimer {
+public:
+  GpuPassTimer() { glGenQueries(queries.size(), queries.data()); }
+  GpuPassTimer(const GpuPassTimer &) = delete;
+  GpuPassTimer &operator=(const GpuPassTimer &) = delete;
+
+  auto destory() -> void { glDeleteQueries(queries.size(), queries.data()); }
+
+  // One begin()/end() pair per frame. A pass whose slot is still pending is
+  // not timed.
+  auto begin() -> void;
+  auto end() -> void;
+  // Latest available result, 0 until the first one arrives.
+  auto ms() const -> float { return latestMs; }
+
+private:
+  static constexpr std::size_t RING = 4;
+  std::array<GLuint, RING> queries{};
+  std::array<bool, RING> pending{};
+  std::size_t next{0};
+  bool timing{false};
+  float latestMs{0.0f};
+};
+
+auto GpuPassTimer::begin() -> void {
+  // Collect whatever finished, oldest first
+  for (std::size_t i = 0; i < RING; i++) {
+    auto slot{(next + i) % RING};
+    if (!pending[slot])
+      continue;
+    GLint available{GL_FALSE};
+    glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      break;
+    GLuint64 ns;
+    glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &ns);
+    latestMs = ns * 1e-6f;
+    pending[slot] = false;
+  }
+  timing = !pending[next];
+  if (timing)
+    glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+}
+
+auto GpuPassTimer::end() -> void {
+  if (!timing)
+    return;
+  glEndQuery(GL_TIME_ELAPSED);
+  pending[next] = true;
+  next = (next + 1) % RING;
+  timing = false;
+}
+
+// Offscreen color + depth target the scene renders into at a fraction of the
+// window size, then upscaled to the backbuffer. Storage is allocated for the
+// full window once and only reallocated when the window grows, so changing
+// the scale costs nothing but a viewport.
+class ScaledTarget {
+public:
+  FramebufferHandle fbo;
+  TextureHandle color, depth;
+
+  // Binds the target with its viewport set to `scale` of `width` x `height`,
+  // growing the storage first if needed.
+  auto bind(int width, int height, float scale) -> void;
+  // Stretches the rendered region over the default framebuffer, bound
+  // afterwards with a full-window viewport.
+  auto blitToDefault() -> void;
+  auto destory() -> void;
+
+private:
+  int capacityWidth{0}, capacityHeight{0};
+  int width{0}, height{0};             // window
+  int scaledWidth{0}, scaledHeight{0}; // rendered region
+  auto allocate(int w, int h) -> void;
+};
+
+auto ScaledTarget::allocate(int w, int h) -> void {
+  destory();
+  capacityWidth = w;
+  capacityHeight = h;
+  const std::size_t texels{static_cast<std::size_t>(w) * h};
+  color = DefaultGpuRegistry.create<GpuKind::Texture>(texels * 4);
+  glBindTexture(GL_TEXTURE_2D, color.name());
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  depth = DefaultGpuRegistry.create<GpuKind::Texture>(texels * 4);
+  glBindTexture(GL_TEXTURE_2D, depth.name());
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0,
+               GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  fbo = DefaultGpuRegistry.create<GpuKind::Framebuffer>();
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo.name());
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color.name(), 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth.name(), 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    std::cerr << "ERROR::ScaledTarget::allocate -> incomplete framebuffer "
+              << w << 'x' << h << '.' << std::endl;
+}
+
+auto ScaledTarget::bind(int w, int h, float scale) -> void {
+  if (w > capacityWidth || h > capacityHeight)
+    allocate(std::max(w, capacityWidth), std::max(h, capacityHeight));
+  width = w;
+  height = h;
+  scaledWidth = std::max(1, static_cast<int>(std::lround(w * scale)));
+  scaledHeight = std::max(1, static_cast<int>(std::lround(h * scale)));
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo.name());
+  glViewport(0, 0, scaledWidth, scaledHeight);
+}
+
+auto ScaledTarget::blitToDefault() -> void {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo.name());
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, scaledWidth, scaledHeight, 0, 0, width, height,
+                    GL_COLOR_BUFFER_BIT, GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, width, height);
+}
+
+auto ScaledTarget::destory() -> void {
+  DefaultGpuRegistry.release(fbo);
+  DefaultGpuRegistry.release(color);
+  DefaultGpuRegistry.release(depth);
+  capacityWidth = capacityHeight = 0;
+}
+
+// Keeps the GPU time of the shadow and scene passes under a target by
+// trading resolution: the scene render-target scale and the directional
+// shadow map size, both clamped to [min, max].
+//
+// Hysteresis: the budget has a dead band (headroom * target .. target),
+// going over must persist for `downFrames` frames before anything drops and
+// staying under the band for `upFrames` (longer) before anything rises.
+// After a change the controller waits `settleFrames`, since the timers it
+// reads lag a few frames behind. Over budget, the shadow map shrinks first
+// if its pass takes more than `shadowShare` of the time, otherwise the
+// scene scale drops in proportion to the overshoot; with room to spare the
+// scene scale recovers first, then the shadow map.
+class DynamicResolution {
+public:
+  struct Config {
+    float targetMs{1000.0f / 60.0f};
+    float headroom{0.8f};
+    float minScale{0.5f}, maxScale{1.0f};
+    float scaleStep{0.05f};
+    int minShadow{256}, maxShadow{1024};
+    int shadowStep{128};
+    float shadowShare{0.3f};
+    int downFrames{5}, upFrames{30}, settleFrames{4};
+  };
+
+  // One line of the per-frame log
+  struct Sample {
+    std::uint64_t frame;
+    float shadowMs, sceneMs;
+    int shadowSize;
+    float sceneScale;
+  };
+
+  explicit DynamicResolution(const Config &config);
+
+  // Feeds this frame's pass timings; the new sizes apply to the next frame.
+  auto update(float shadowMs, float sceneMs) -> void;
+  auto sceneScale() const -> float { return scale; }
+  auto shadowSize() const -> int { return shadow; }
+  // Logs every following frame to `file` as CSV:
+  // frame,shadow_ms,scene_ms,shadow_size,scene_scale. Samples are appended
+  // a batch at a time; closeLog() writes the rest.
+  auto openLog(const fs::path &file) -> bool;
+  auto closeLog() -> bool;
+
+private:
+  static constexpr std::size_t LOG_BATCH = 256;
+
+  Config config;
+  float scale;
+  int shadow;
+  int overFrames{0}, underFrames{0}, settle{0};
+  std::uint64_t frame{0};
+  std::ofstream log;
+  std::array<Sample, LOG_BATCH> samples;
+  std::size_t sampleCount{0};
+
+  auto flushLog() -> void;
+};
+
+DynamicResolution::DynamicResolution(const Config &config)
+    : config{config}, scale{config.maxScale}, shadow{config.maxShadow} {}
+
+auto DynamicResolution::update(float shadowMs, float sceneMs) -> void {
+  if (log.is_open()) {
+    samples[sampleCount++] = Sample{frame, shadowMs, sceneMs, shadow, scale};
+    if (sampleCount == samples.size())
+      flushLog();
+  }
+  frame++;
+  const float total{shadowMs + sceneMs};
+  if (settle > 0) { // the timers still report the old sizes
+    settle--;
+    return;
+  }
+  if (total <= 0.0f) // no results yet
+    return;
+  overFrames = total > config.targetMs ? overFrames + 1 : 0;
+  underFrames = total < config.headroom * config.targetMs ? underFrames + 1 : 0;
+
+  const float oldScale{scale};
+  const int oldShadow{shadow};
+  if (overFrames >= config.downFrames) {
+    if (shadowMs > config.shadowShare * total && shadow > config.minShadow)
+      shadow = std::max(config.minShadow, shadow - config.shadowStep);
+    else // pixel count goes with scale^2
+      scale = std::max(config.minScale,
+                       std::min(scale - config.scaleStep,
+                                scale * std::sqrt(config.targetMs / total)));
+  } else if (underFrames >= config.upFrames) {
+    if (scale < config.maxScale)
+      scale = std::min(config.maxScale, scale + config.scaleStep);
+    else
+      shadow = std::min(config.maxShadow, shadow + config.shadowStep);
+  }
+  if (scale != oldScale || shadow != oldShadow) {
+    overFrames = underFrames = 0;
+    settle = config.settleFrames;
+    std::clog << "LOG::DynamicResolution::\"Resolution Changed\": GPU "
+              << total << " ms (shadow " << shadowMs << ", scene " << sceneMs
+              << ") against " << config.targetMs << " ms, shadow map "
+              << oldShadow << " -> " << shadow << ", scene scale "
+              << oldScale << " -> " << scale << std::endl;
+  }
+}
+
+auto DynamicResolution::openLog(const fs::path &file) -> bool {
+  log.open(file);
+  if (!log) {
+    std::cerr << "ERROR::DynamicResolution::openLog -> cannot write " << file
+              << '.' << std::endl;
+    log.close();
+    return false;
+  }
+  log << "frame,shadow_ms,scene_ms,shadow_size,scene_scale\n";
+  return true;
+}
+
+auto DynamicResolution::flushLog() -> void {
+  for (std::size_t i = 0; i < sampleCount; i++) {
+    auto &s{samples[i]};
+    log << s.frame << ',' << s.shadowMs << ',' << s.sceneMs << ','
+        << s.shadowSize << ',' << s.sceneScale << '\n';
+  }
+  sampleCount = 0;
+}
+
+auto DynamicResolution::closeLog() -> bool {
+  if (!log.is_open())
+    return false;
+  flushLog();
+  log.close();
+  if (!log)
+    std::cerr << "ERROR::DynamicResolution::closeLog -> writing the log "
+                 "failed."
+              << std::endl;
+  return static_cast<bool>(log);
+}
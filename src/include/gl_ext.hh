@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <iostream>
+
+// GL 4.3 entry points and enums the GL 3.3 core loader doesn't provide:
+// compute shaders, shader storage buffers and indirect multi-draws. They are
+// resolved at runtime by GLExt::load() and are only usable when it returns
+// true, i.e. the context is 4.3+ or exposes the matching ARB extensions.
+// Mesa (llvmpipe included) hands out its highest core version for the 3.3
+// core context the renderer asks for.
+
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+
+namespace GLExt {
+
+using PFNDISPATCHCOMPUTE = void(APIENTRYP)(GLuint, GLuint, GLuint);
+using PFNMEMORYBARRIER = void(APIENTRYP)(GLbitfield);
+using PFNMULTIDRAWELEMENTSINDIRECT = void(APIENTRYP)(GLenum, GLenum,
+                                                     const void *, GLsizei,
+                                                     GLsizei);
+
+static PFNDISPATCHCOMPUTE dispatchCompute{nullptr};
+static PFNMEMORYBARRIER memoryBarrier{nullptr};
+static PFNMULTIDRAWELEMENTSINDIRECT multiDrawElementsIndirect{nullptr};
+
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER.
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+inline auto hasExtension(const char *name) -> bool {
+  GLint n{0};
+  glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+  for (GLint i = 0; i < n; i++)
+    if (!std::strcmp(reinterpret_cast<const char *>(
+                         glGetStringi(GL_EXTENSIONS, i)),
+                     name))
+      return true;
+  return false;
+}
+
+// Call once after gladLoadGLLoader(), with the same loader. Returns whether
+// the 4.3 path can be used; logs why not otherwise.
+inline auto load(GLADloadproc loader) -> bool {
+  static bool loaded{false}, available{false};
+  if (loaded)
+    return available;
+  loaded = true;
+
+  GLint major{0}, minor{0};
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  const bool core43{major > 4 || (major == 4 && minor >= 3)};
+  if (!core43 && !(hasExtension("GL_ARB_compute_shader") &&
+                   hasExtension("GL_ARB_shader_storage_buffer_object") &&
+                   hasExtension("GL_ARB_multi_draw_indirect") &&
+                   hasExtension("GL_ARB_base_instance"))) {
+    std::cerr << "ERROR::GLExt::load -> GL " << major << '.' << minor
+              << " lacks compute shaders or indirect multi-draws." << std::endl;
+    return false;
+  }
+  dispatchCompute =
+      reinterpret_cast<PFNDISPATCHCOMPUTE>(loader("glDispatchCompute"));
+  memoryBarrier = reinterpret_cast<PFNMEMORYBARRIER>(loader("glMemoryBarrier"));
+  multiDrawElementsIndirect = reinterpret_cast<PFNMULTIDRAWELEMENTSINDIRECT>(
+      loader("glMultiDrawElementsIndirect"));
+  available = dispatchCompute && memoryBarrier && multiDrawElementsIndirect;
+  if (!available)
+    std::cerr << "ERROR::GLExt::load -> GL 4.3 entry points not found."
+              << std::endl;
+  return available;
+}
+
+} // namespace GLExt
@@ -0,0 +1,679 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "vertex.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+namespace fs = std::filesystem;
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+  explicit MappedFile(const fs::path &path);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  auto data() const -> const std::uint8_t * { return data_; }
+  auto size() const -> std::size_t { return size_; }
+  explicit operator bool() const { return data_ != nullptr; }
+
+private:
+  const std::uint8_t *data_{nullptr};
+  std::size_t size_{0};
+};
+
+MappedFile::MappedFile(const fs::path &path) {
+  int fd{::open(path.c_str(), O_RDONLY)};
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *p{::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+    if (p != MAP_FAILED) {
+      data_ = static_cast<const std::uint8_t *>(p);
+      size_ = st.st_size;
+    }
+  }
+  ::close(fd); // the mapping stays valid
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    ::munmap(const_cast<std::uint8_t *>(data_), size_);
+}
+
+// Just enough JSON for glTF: strings are views into the source text and are
+// not unescaped, which glTF keys and the values we read never need.
+class JsonValue {
+public:
+  enum class Type { Null, Bool, Number, String, Array, Object };
+
+  Type type{Type::Null};
+  bool boolean{false};
+  double number{0.0};
+  std::string_view string;
+  std::vector<JsonValue> items;
+  std::vector<std::pair<std::string_view, JsonValue>> members;
+
+  // Missing keys and out of range indices give a Null value.
+  auto operator[](std::string_view key) const -> const JsonValue &;
+  auto operator[](std::size_t i) const -> const JsonValue &;
+  auto size() const -> std::size_t { return items.size(); }
+  auto isNull() const -> bool { return type == Type::Null; }
+  // Integer value, `fallback` if this isn't a number a long can hold.
+  auto integer(long fallback = -1) const -> long {
+    constexpr double lowest{static_cast<double>(
+        std::numeric_limits<long>::min())}; // -2^63, exact
+    return type == Type::Number && number >= lowest && number < -lowest
+               ? static_cast<long>(number)
+               : fallback;
+  }
+
+  // Returns false on malformed input.
+  static auto parse(std::string_view text, JsonValue &out) -> bool;
+
+private:
+  static const JsonValue null;
+  struct Parser;
+};
+
+const JsonValue JsonValue::null{};
+
+auto JsonValue::operator[](std::string_view key) const -> const JsonValue & {
+  for (auto &[k, v] : members)
+    if (k == key)
+      return v;
+  return null;
+}
+
+auto JsonValue::operator[](std::size_t i) const -> const JsonValue & {
+  return i < items.size() ? items[i] : null;
+}
+
+struct JsonValue::Parser {
+  std::string_view s;
+  std::size_t p{0};
+
+  auto skip() -> void {
+    while (p < s.size() &&
+           (s[p] == ' ' || s[p] == '\t' || s[p] == '\n' || s[p] == '\r'))
+      p++;
+  }
+  auto literal(std::string_view word) -> bool {
+    if (s.substr(p, word.size()) != word)
+      return false;
+    p += word.size();
+    return true;
+  }
+  auto string(std::string_view &out) -> bool {
+    if (p >= s.size() || s[p] != '"')
+      return false;
+    auto start{++p};
+    for (; p < s.size() && s[p] != '"'; p++)
+      if (s[p] == '\\')
+        p++;
+    if (p >= s.size())
+      return false;
+    out = s.substr(start, p++ - start);
+    return true;
+  }
+  auto number(double &out) -> bool {
+    auto start{p};
+    while (p < s.size() && std::strchr("+-0123456789.eE", s[p]))
+      p++;
+    // the text isn't null-terminated, strtod needs a copy
+    std::array<char, 64> buf{};
+    if (p == start || p - start >= buf.size())
+      return false;
+    std::memcpy(buf.data(), s.data() + start, p - start);
+    char *end;
+    out = std::strtod(buf.data(), &end);
+    return end == buf.data() + (p - start);
+  }
+  auto value(JsonValue &v, int depth) -> bool {
+    if (depth > 64)
+      return false;
+    skip();
+    if (p >= s.size())
+      return false;
+    switch (s[p]) {
+    case '{': {
+      v.type = Type::Object;
+      p++;
+      skip();
+      if (p < s.size() && s[p] == '}')
+        return ++p, true;
+      for (;;) {
+        skip();
+        std::string_view key;
+        if (!string(key))
+          return false;
+        skip();
+        if (p >= s.size() || s[p++] != ':')
+          return false;
+        v.members.emplace_back(key, JsonValue{});
+        if (!value(v.members.back().second, depth + 1))
+          return false;
+        skip();
+        if (p < s.size() && s[p] == ',') {
+          p++;
+          continue;
+        }
+        return p < s.size() && s[p++] == '}';
+      }
+    }
+    case '[': {
+      v.type = Type::Array;
+      p++;
+      skip();
+      if (p < s.size() && s[p] == ']')
+        return ++p, true;
+      for (;;) {
+        v.items.emplace_back();
+        if (!value(v.items.back(), depth + 1))
+          return false;
+        skip();
+        if (p < s.size() && s[p] == ',') {
+          p++;
+          continue;
+        }
+        return p < s.size() && s[p++] == ']';
+      }
+    }
+    case '"':
+      v.type = Type::String;
+      return string(v.string);
+    case 't':
+      v.type = Type::Bool;
+      v.boolean = true;
+      return literal("true");
+    case 'f':
+      v.type = Type::Bool;
+      return literal("false");
+    case 'n':
+      return literal("null");
+    default:
+      v.type = Type::Number;
+      return number(v.number);
+    }
+  }
+};
+
+auto JsonValue::parse(std::string_view text, JsonValue &out) -> bool {
+  Parser parser{text};
+  out = JsonValue{};
+  if (!parser.value(out, 0))
+    return false;
+  parser.skip();
+  return parser.p == text.size() || text[parser.p] == '\0';
+}
+
+// A binary glTF 2.0 file, mapped and validated. Nothing is copied: the JSON
+// is parsed in place, embedded images point into the mapping and every
+// primitive whose accessors the renderer can read directly is described by
+// offsets into one GL buffer, filled straight from the spans of the binary
+// chunk those accessors read (`spans`, images left out). Primitives in any
+// other layout are repacked into Vertex arrays by repack().
+//
+// Like the Assimp path, node transforms are ignored: every primitive of
+// every mesh is loaded in mesh space.
+class GlbFile {
+public:
+  // How one vertex attribute reads from the binary chunk; components == 0
+  // means the primitive doesn't have it.
+  struct Attribute {
+    GLint components{0};
+    GLenum type{GL_FLOAT};
+    GLboolean normalized{GL_FALSE};
+    GLsizei stride{0};
+    GLintptr offset{0};
+  };
+
+  struct Primitive {
+    bool direct{false}; // readable straight from the binary chunk
+    std::array<Attribute, 3> attributes; // position, normal, texCoords
+    GLenum indexType{GL_UNSIGNED_INT};
+    GLintptr indexOffset{0};
+    GLsizei indexCount{0};
+    glm::vec3 boundsMin{0.0f}, boundsMax{0.0f};
+    int image{-1}; // base color image, -1 if none
+    // !direct only, filled by repack()
+    std::vector<Vertex> vertices;
+    std::vector<uint> indices;
+  };
+
+  struct Image {
+    const std::uint8_t *data;
+    std::size_t size;
+  };
+
+  // `size` bytes of the binary chunk from `source` go to `offset` in the
+  // direct primitives' GL buffer. Sorted by both; 4-byte aligned.
+  struct Span {
+    std::size_t source, size, offset;
+  };
+
+  // nullptr, with the reason on std::cerr, if the file can't be used.
+  static auto open(const fs::path &path) -> std::unique_ptr<GlbFile>;
+
+  auto bin() const -> std::pair<const std::uint8_t *, std::size_t> {
+    return {binData, binSize};
+  }
+  // Converts primitive `i` into vertices/indices; no-op for direct ones.
+  // Independent per primitive, so they can run in parallel.
+  auto repack(std::size_t i) -> void;
+
+  std::vector<Primitive> primitives;
+  std::vector<Image> images;
+  std::vector<Span> spans;
+  std::size_t bufferSize{0}; // of the direct primitives' GL buffer
+
+private:
+  struct Accessor {
+    const std::uint8_t *data{nullptr}; // first element
+    std::size_t offset{0};             // of `data` in the binary chunk
+    std::size_t count{0}, stride{0};
+    int components{0};
+    GLenum type{0};
+    bool normalized{false};
+    bool hasBounds{false};
+    glm::vec3 min{0.0f}, max{0.0f};
+  };
+
+  explicit GlbFile(const fs::path &path) : file{path} {}
+
+  MappedFile file;
+  JsonValue json;
+  const std::uint8_t *binData{nullptr};
+  std::size_t binSize{0};
+  std::vector<std::array<long, 4>> primitiveAccessors; // pos, normal, uv, idx
+
+  static auto componentSize(GLenum type) -> std::size_t;
+  static auto componentCount(std::string_view type) -> int;
+  auto accessor(long index, Accessor &out) const -> bool;
+  auto readFloats(const Accessor &a, std::size_t i, float *out) const -> void;
+  auto readIndex(const Accessor &a, std::size_t i) const -> uint;
+  auto loadPrimitive(const JsonValue &primitive, Primitive &out,
+                     std::array<long, 4> &accessors) const -> bool;
+  auto layoutBuffer() -> void;
+};
+
+auto GlbFile::componentSize(GLenum type) -> std::size_t {
+  switch (type) {
+  case GL_BYTE:
+  case GL_UNSIGNED_BYTE:
+    return 1;
+  case GL_SHORT:
+  case GL_UNSIGNED_SHORT:
+    return 2;
+  case GL_UNSIGNED_INT:
+  case GL_FLOAT:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+auto GlbFile::componentCount(std::string_view type) -> int {
+  if (type == "SCALAR")
+    return 1;
+  if (type == "VEC2")
+    return 2;
+  if (type == "VEC3")
+    return 3;
+  if (type == "VEC4")
+    return 4;
+  return 0; // matrices aren't used by meshes
+}
+
+auto GlbFile::open(const fs::path &path) -> std::unique_ptr<GlbFile> {
+  std::unique_ptr<GlbFile> glb{new GlbFile{path}};
+  auto fail{[&](const char *why) {
+    std::cerr << "ERROR::GlbFile::open -> " << path << ": " << why << '.'
+              << std::endl;
+    return nullptr;
+  }};
+  const auto &f{glb->file};
+  if (!f)
+    return fail("cannot map the file");
+  auto u32{[&](std::size_t at) {
+    std::uint32_t v;
+    std::memcpy(&v, f.data() + at, 4);
+    return v;
+  }};
+  if (f.size() < 20 || u32(0) != 0x46546C67 /* glTF */ || u32(4) != 2)
+    return fail("not a binary glTF 2.0 file");
+  const std::size_t length{std::min<std::size_t>(u32(8), f.size())};
+
+  // Chunks: JSON first, then an optional BIN
+  std::string_view jsonText;
+  for (std::size_t at = 12; at + 8 <= length;) {
+    const std::size_t chunkSize{u32(at)}, chunkType{u32(at + 4)};
+    if (at + 8 + chunkSize > length)
+      return fail("chunk runs past the end of the file");
+    if (chunkType == 0x4E4F534A /* JSON */ && jsonText.empty())
+      jsonText = {reinterpret_cast<const char *>(f.data() + at + 8), chunkSize};
+    else if (chunkType == 0x004E4942 /* BIN */ && !glb->binData) {
+      glb->binData = f.data() + at + 8;
+      glb->binSize = chunkSize;
+    }
+    at += 8 + (chunkSize + 3) / 4 * 4;
+  }
+  if (jsonText.empty() || !JsonValue::parse(jsonText, glb->json))
+    return fail("missing or malformed JSON chunk");
+  const auto &json{glb->json};
+  if (json["buffers"].size() > 1 || !json["buffers"][0]["uri"].isNull())
+    return fail("external buffers are not supported");
+
+  for (std::size_t i = 0; i < json["images"].size(); i++) {
+    const auto &image{json["images"][i]};
+    const auto &view{json["bufferViews"][image["bufferView"].integer()]};
+    const auto offset{view["byteOffset"].integer(0)};
+    const auto size{view["byteLength"].integer(0)};
+    if (view.isNull() || offset < 0 || size <= 0 ||
+        static_cast<std::size_t>(offset) > glb->binSize ||
+        static_cast<std::size_t>(size) > glb->binSize - offset) {
+      glb->images.push_back(Image{nullptr, 0}); // decodes as a failed load
+      continue;
+    }
+    glb->images.push_back(Image{glb->binData + offset,
+                                static_cast<std::size_t>(size)});
+  }
+
+  const auto &meshes{json["meshes"]};
+  for (std::size_t m = 0; m < meshes.size(); m++)
+    for (std::size_t p = 0; p < meshes[m]["primitives"].size(); p++) {
+      Primitive primitive;
+      std::array<long, 4> accessors{};
+      if (!glb->loadPrimitive(meshes[m]["primitives"][p], primitive,
+                              accessors)) {
+        std::cerr << "ERROR::GlbFile::open -> " << path << ": skipping mesh "
+                  << m << " primitive " << p << '.' << std::endl;
+        continue;
+      }
+      glb->primitives.push_back(std::move(primitive));
+      glb->primitiveAccessors.push_back(accessors);
+    }
+  glb->layoutBuffer();
+  return glb;
+}
+
+// Gathers the bytes the direct primitives' accessors read into `spans`,
+// merged where they touch, and moves the primitives' offsets from the binary
+// chunk to the GL buffer. Spans start and end on 4-byte boundaries, so the
+// moved offsets stay as aligned as they were.
+auto GlbFile::layoutBuffer() -> void {
+  std::vector<std::pair<std::size_t, std::size_t>> used; // [begin, end)
+  for (std::size_t i = 0; i < primitives.size(); i++) {
+    if (!primitives[i].direct)
+      continue;
+    for (auto id : primitiveAccessors[i]) {
+      Accessor a;
+      if (id < 0 || !accessor(id, a))
+        continue;
+      const std::size_t end{a.offset + a.stride * (a.count - 1) +
+                            componentSize(a.type) * a.components};
+      used.emplace_back(a.offset / 4 * 4, std::min((end + 3) / 4 * 4, binSize));
+    }
+  }
+  std::sort(used.begin(), used.end());
+  for (auto [begin, end] : used) {
+    if (!spans.empty() && begin <= spans.back().source + spans.back().size) {
+      auto &last{spans.back()};
+      const auto grown{std::max(last.size, end - last.source)};
+      bufferSize += grown - last.size;
+      last.size = grown;
+      continue;
+    }
+    spans.push_back(Span{begin, end - begin, bufferSize});
+    bufferSize += end - begin;
+  }
+
+  auto moved{[&](GLintptr source) {
+    auto span{std::upper_bound(spans.begin(), spans.end(),
+                               static_cast<std::size_t>(source),
+                               [](std::size_t s, const Span &span) {
+                                 return s < span.source;
+                               }) -
+              1};
+    return static_cast<GLintptr>(span->offset + (source - span->source));
+  }};
+  for (auto &p : primitives) {
+    if (!p.direct)
+      continue;
+    for (auto &a : p.attributes)
+      if (a.components)
+        a.offset = moved(a.offset);
+    p.indexOffset = moved(p.indexOffset);
+  }
+}
+
+// Resolves and bounds-checks an accessor against its buffer view and the
+// binary chunk.
+auto GlbFile::accessor(long index, Accessor &out) const -> bool {
+  const auto &a{json["accessors"][index]};
+  if (a.isNull() || !a["sparse"].isNull())
+    return false; // sparse accessors are not supported
+  const auto &view{json["bufferViews"][a["bufferView"].integer()]};
+  if (view.isNull() || view["buffer"].integer(0) != 0)
+    return false;
+  const long count{a["count"].integer(0)};
+  const long viewOffset{view["byteOffset"].integer(0)};
+  const long viewLength{view["byteLength"].integer(0)};
+  const long accessorOffset{a["byteOffset"].integer(0)};
+  const long stride{view["byteStride"].integer(0)};
+  if (count <= 0 || viewOffset < 0 || viewLength <= 0 || accessorOffset < 0 ||
+      stride < 0)
+    return false;
+  out.type = a["componentType"].integer(0);
+  out.components = componentCount(a["type"].string);
+  out.count = count;
+  out.normalized = a["normalized"].boolean;
+  const std::size_t elementSize{componentSize(out.type) * out.components};
+  out.stride = stride ? stride : elementSize;
+  // Subtractions only, so huge values can't wrap around past the checks
+  const auto length{static_cast<std::size_t>(viewLength)};
+  const auto start{static_cast<std::size_t>(accessorOffset)};
+  if (!elementSize || out.stride < elementSize ||
+      static_cast<std::size_t>(viewOffset) > binSize ||
+      length > binSize - viewOffset || start > length ||
+      elementSize > length - start ||
+      out.count > (length - start - elementSize) / out.stride + 1)
+    return false;
+  out.offset = viewOffset + accessorOffset;
+  if (out.offset % componentSize(out.type))
+    return false; // misaligned components
+  out.data = binData + out.offset;
+
+  const auto &min{a["min"]}, &max{a["max"]};
+  out.hasBounds = min.size() >= 3 && max.size() >= 3;
+  for (int c = 0; out.hasBounds && c < 3; c++) {
+    out.min[c] = min[c].number;
+    out.max[c] = max[c].number;
+  }
+  return true;
+}
+
+auto GlbFile::readFloats(const Accessor &a, std::size_t i, float *out) const
+    -> void {
+  const auto *p{a.data + i * a.stride};
+  for (int c = 0; c < a.components; c++) {
+    switch (a.type) {
+    case GL_FLOAT:
+      std::memcpy(out + c, p + 4 * c, 4);
+      break;
+    case GL_UNSIGNED_BYTE:
+      out[c] = p[c] / (a.normalized ? 255.0f : 1.0f);
+      break;
+    case GL_UNSIGNED_SHORT: {
+      std::uint16_t v;
+      std::memcpy(&v, p + 2 * c, 2);
+      out[c] = v / (a.normalized ? 65535.0f : 1.0f);
+      break;
+    }
+    case GL_BYTE:
+      out[c] = a.normalized ? std::max(static_cast<std::int8_t>(p[c]) / 127.0f,
+                                       -1.0f)
+                            : static_cast<std::int8_t>(p[c]);
+      break;
+    case GL_SHORT: {
+      std::int16_t v;
+      std::memcpy(&v, p + 2 * c, 2);
+      out[c] = a.normalized ? std::max(v / 32767.0f, -1.0f) : v;
+      break;
+    }
+    default:
+      out[c] = 0.0f;
+    }
+  }
+}
+
+auto GlbFile::readIndex(const Accessor &a, std::size_t i) const -> uint {
+  const auto *p{a.data + i * a.stride};
+  if (a.type == GL_UNSIGNED_BYTE)
+    return *p;
+  if (a.type == GL_UNSIGNED_SHORT) {
+    std::uint16_t v;
+    std::memcpy(&v, p, 2);
+    return v;
+  }
+  std::uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+// Validates the primitive and decides whether it can be drawn straight from
+// the binary chunk: triangles, float positions and normals, float or
+// normalized integer UVs, 4-byte aligned strides and unsigned indices.
+auto GlbFile::loadPrimitive(const JsonValue &primitive, Primitive &out,
+                            std::array<long, 4> &accessors) const -> bool {
+  if (primitive["mode"].integer(4) != 4 /* TRIANGLES */)
+    return false;
+  const auto &attributes{primitive["attributes"]};
+  accessors = {attributes["POSITION"].integer(), attributes["NORMAL"].integer(),
+               attributes["TEXCOORD_0"].integer(),
+               primitive["indices"].integer()};
+
+  Accessor position, normal, uv, index;
+  if (!accessor(accessors[0], position) || position.components != 3)
+    return false;
+  const bool hasNormal{accessor(accessors[1], normal) &&
+                       normal.count == position.count &&
+                       normal.components == 3};
+  const bool hasUV{accessor(accessors[2], uv) && uv.count == position.count &&
+                   uv.components == 2};
+  const bool hasIndex{accessor(accessors[3], index) &&
+                      index.components == 1 &&
+                      (index.type == GL_UNSIGNED_BYTE ||
+                       index.type == GL_UNSIGNED_SHORT ||
+                       index.type == GL_UNSIGNED_INT)};
+  if (accessors[3] >= 0 && !hasIndex)
+    return false;
+  // Both the GPU and repack()'s consumers index the vertices unchecked
+  for (std::size_t n = 0; hasIndex && n < index.count; n++)
+    if (readIndex(index, n) >= position.count)
+      return false;
+  if (!hasNormal)
+    accessors[1] = -1;
+  if (!hasUV)
+    accessors[2] = -1;
+
+  auto direct{[](const Accessor &a, bool floatOnly) {
+    return a.stride % 4 == 0 && a.stride <= 255 &&
+           (a.type == GL_FLOAT || (!floatOnly && a.normalized));
+  }};
+  out.direct = direct(position, true) && hasNormal && direct(normal, true) &&
+               (!hasUV || direct(uv, false)) && hasIndex &&
+               index.stride == componentSize(index.type);
+  if (out.direct) {
+    auto attribute{[](const Accessor &a) {
+      return Attribute{a.components, a.type,
+                       static_cast<GLboolean>(a.normalized),
+                       static_cast<GLsizei>(a.stride),
+                       static_cast<GLintptr>(a.offset)};
+    }};
+    out.attributes = {attribute(position), attribute(normal),
+                      hasUV ? attribute(uv) : Attribute{}};
+    out.indexType = index.type;
+    out.indexOffset = index.offset;
+    out.indexCount = index.count;
+  }
+
+  if (position.hasBounds) {
+    out.boundsMin = position.min;
+    out.boundsMax = position.max;
+  } else { // optional in practice, scan the mapped positions
+    constexpr float inf{std::numeric_limits<float>::infinity()};
+    out.boundsMin = glm::vec3{inf};
+    out.boundsMax = glm::vec3{-inf};
+    for (std::size_t i = 0; i < position.count; i++) {
+      glm::vec3 v;
+      readFloats(position, i, &v.x);
+      out.boundsMin = glm::min(out.boundsMin, v);
+      out.boundsMax = glm::max(out.boundsMax, v);
+    }
+  }
+
+  const auto &material{json["materials"][primitive["material"].integer()]};
+  const auto &texture{json["textures"][material["pbrMetallicRoughness"]
+                                              ["baseColorTexture"]["index"]
+                                                  .integer()]};
+  auto image{texture["source"].integer()};
+  out.image = image >= 0 && static_cast<std::size_t>(image) <
+                                json["images"].size()
+                  ? image
+                  : -1;
+  return true;
+}
+
+auto GlbFile::repack(std::size_t i) -> void {
+  auto &p{primitives[i]};
+  if (p.direct)
+    return;
+  const auto &ids{primitiveAccessors[i]};
+  Accessor position, normal, uv, index;
+  accessor(ids[0], position);
+  const bool hasNormal{ids[1] >= 0 && accessor(ids[1], normal)};
+  const bool hasUV{ids[2] >= 0 && accessor(ids[2], uv)};
+  p.vertices.resize(position.count);
+  for (std::size_t v = 0; v < position.count; v++) {
+    auto &out{p.vertices[v]};
+    readFloats(position, v, &out.position.x);
+    out.normal = glm::vec3{0.0f};
+    if (hasNormal)
+      readFloats(normal, v, &out.normal.x);
+    out.texCoords = glm::vec2{0.0f};
+    if (hasUV)
+      readFloats(uv, v, &out.texCoords.x);
+  }
+  if (ids[3] >= 0 && accessor(ids[3], index)) {
+    p.indices.resize(index.count);
+    for (std::size_t n = 0; n < index.count; n++)
+      p.indices[n] = readIndex(index, n);
+  } else { // non-indexed triangles
+    p.indices.resize(position.count);
+    for (std::size_t n = 0; n < position.count; n++)
+      p.indices[n] = n;
+  }
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "gl_ext.hh"
+#include "gpu_registry.hh"
+#include "model.hh"
+#include "shader.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Many instances of one model, culled and submitted entirely by the GPU
+// (GL 4.3, see gl_ext.hh).
+//
+// Every mesh's vertices and indices are merged into one VBO/EBO pair, so a
+// single glMultiDrawElementsIndirect can draw all of them. An object is one
+// (mesh, instance) pair; cull.comp tests each object's world-space AABB
+// against up to MAX_VIEWS view-projections in a single dispatch and, per
+// view, appends the visible instance indices behind their mesh's draw
+// command, bumping its instanceCount. Commands are reset from a template
+// copy every frame.
+//
+// The visible indices feed vertex attribute 3 with a divisor of 1, and each
+// command's baseInstance points at its own run of them, so the vertex
+// shader (indirect.vert) reads `objectId` and fetches the model matrix from
+// the instance SSBO at binding 0. No per-draw state remains, hence every
+// instance shares the first mesh's material.
+class IndirectBatch {
+public:
+  static constexpr uint MAX_VIEWS = 4;
+  static constexpr uint WORKGROUP = 64; // local_size_x in cull.comp
+
+  // `model` must be resident and keep its CPU-side vertices.
+  IndirectBatch(const Model &model, const std::vector<glm::mat4> &instances,
+                uint viewCount);
+  IndirectBatch(const IndirectBatch &) = delete;
+  IndirectBatch &operator=(const IndirectBatch &) = delete;
+
+  auto destory() -> void;
+
+  // Culls every object against viewProjections[v] for each view v, with
+  // `cullShader` (cull.comp). Call once per frame, before the draws.
+  auto cull(const Shader &cullShader,
+            const std::vector<glm::mat4> &viewProjections) -> void;
+  // One glMultiDrawElementsIndirect over view `view`'s commands, with the
+  // caller's indirect.vert program bound.
+  auto draw(uint view, GLenum drawMode = GL_TRIANGLES) const -> void;
+
+  auto objectCount() const -> std::size_t { return meshCount * instanceCount; }
+  auto instances() const -> std::size_t { return instanceCount; }
+  // Sum of instanceCount over view `view`'s commands. Reads the GPU result
+  // back, so it stalls; for logs and benchmarks only.
+  auto visibleObjects(uint view) const -> std::size_t;
+
+  // The test cull.comp runs: true when all corners of the AABB [lo, hi]
+  // transformed by `mvp` lie outside the same clip plane. For CPU paths
+  // that want to cull the same objects.
+  static auto outsideFrustum(const glm::mat4 &mvp, const glm::vec3 &lo,
+                             const glm::vec3 &hi) -> bool;
+
+private:
+  uint views;
+  std::size_t meshCount{0}, instanceCount{0};
+  std::size_t indexTotal{0};
+  VertexArrayHandle VAO;
+  BufferHandle VBO, EBO;
+  BufferHandle instanceBuffer; // mat4 per instance
+  BufferHandle boundsBuffer;   // vec4 min, max per mesh, object space
+  BufferHandle commandTemplate, commandBuffer; // views * meshCount commands
+  BufferHandle visibleBuffer;  // views * objectCount() instance indices
+};
+
+IndirectBatch::IndirectBatch(const Model &model,
+                             const std::vector<glm::mat4> &instances,
+                             uint viewCount)
+    : views{std::min(viewCount, MAX_VIEWS)}, instanceCount{instances.size()} {
+  std::vector<Vertex> vertices;
+  std::vector<uint> indices;
+  std::vector<glm::vec4> bounds;
+  std::vector<GLExt::DrawElementsIndirectCommand> commands;
+  for (auto &m : model.meshes) {
+    if (m.vertices.empty()) {
+      std::cerr << "ERROR::IndirectBatch::IndirectBatch -> skipping a mesh "
+                   "without CPU-side vertices."
+                << std::endl;
+      continue;
+    }
+    commands.push_back(GLExt::DrawElementsIndirectCommand{
+        static_cast<GLuint>(m.indices.size()), 0,
+        static_cast<GLuint>(indices.size()),
+        static_cast<GLint>(vertices.size()), 0});
+    vertices.insert(vertices.end(), m.vertices.begin(), m.vertices.end());
+    indices.insert(indices.end(), m.indices.begin(), m.indices.end());
+    bounds.push_back(glm::vec4(m.boundsMin, 1.0f));
+    bounds.push_back(glm::vec4(m.boundsMax, 1.0f));
+  }
+  meshCount = commands.size();
+  indexTotal = indices.size();
+  // view v, mesh m: its visible instances start at (v * meshes + m) * instances
+  std::vector<GLExt::DrawElementsIndirectCommand> perView;
+  for (uint v = 0; v < views; v++)
+    for (std::size_t m = 0; m < meshCount; m++) {
+      auto c{commands[m]};
+      c.baseInstance = (v * meshCount + m) * instanceCount;
+      perView.push_back(c);
+    }
+
+  auto buffer{[](GLenum target, std::size_t bytes, const void *data,
+                 GLenum usage) {
+    auto h{DefaultGpuRegistry.create<GpuKind::Buffer>(bytes)};
+    glBindBuffer(target, h.name());
+    glBufferData(target, bytes, data, usage);
+    return h;
+  }};
+  GLint boundVAO;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &boundVAO);
+  VAO = DefaultGpuRegistry.create<GpuKind::VertexArray>();
+  glBindVertexArray(VAO.name());
+  VBO = buffer(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
+               vertices.data(), GL_STATIC_DRAW);
+  for (uint i = 0; i < 3; i++)
+    glEnableVertexAttribArray(i);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, position)));
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, normal)));
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, texCoords)));
+  EBO = buffer(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint),
+               indices.data(), GL_STATIC_DRAW);
+  // 3: objectId, one per instance, offset by each command's baseInstance
+  visibleBuffer = buffer(GL_ARRAY_BUFFER,
+                         std::max<std::size_t>(1, views * objectCount()) *
+                             sizeof(GLuint),
+                         nullptr, GL_DYNAMIC_COPY);
+  glEnableVertexAttribArray(3);
+  glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), nullptr);
+  glVertexAttribDivisor(3, 1);
+  glBindVertexArray(boundVAO);
+
+  instanceBuffer = buffer(GL_SHADER_STORAGE_BUFFER,
+                          instances.size() * sizeof(glm::mat4),
+                          instances.data(), GL_STATIC_DRAW);
+  boundsBuffer = buffer(GL_SHADER_STORAGE_BUFFER,
+                        bounds.size() * sizeof(glm::vec4), bounds.data(),
+                        GL_STATIC_DRAW);
+  const std::size_t commandBytes{perView.size() *
+                                 sizeof(GLExt::DrawElementsIndirectCommand)};
+  commandTemplate = buffer(GL_COPY_READ_BUFFER, commandBytes, perView.data(),
+                           GL_STATIC_DRAW);
+  commandBuffer = buffer(GL_DRAW_INDIRECT_BUFFER, commandBytes, nullptr,
+                         GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  std::clog << "LOG::IndirectBatch::\"Batch Built\": " << meshCount
+            << " meshes x " << instanceCount << " instances, "
+            << views << " views, "
+            << (vertices.size() * sizeof(Vertex) +
+                indexTotal * sizeof(uint)) / 1024
+            << " KiB geometry" << std::endl;
+}
+
+auto IndirectBatch::destory() -> void {
+  DefaultGpuRegistry.release(VAO);
+  DefaultGpuRegistry.release(VBO);
+  DefaultGpuRegistry.release(EBO);
+  DefaultGpuRegistry.release(instanceBuffer);
+  DefaultGpuRegistry.release(boundsBuffer);
+  DefaultGpuRegistry.release(commandTemplate);
+  DefaultGpuRegistry.release(commandBuffer);
+  DefaultGpuRegistry.release(visibleBuffer);
+}
+
+auto IndirectBatch::cull(const Shader &cullShader,
+                         const std::vector<glm::mat4> &viewProjections)
+    -> void {
+  PROFILE_SCOPE("IndirectBatch::cull");
+  PROFILE_GPU_SCOPE("IndirectBatch::cull");
+  if (!objectCount())
+    return;
+  // instanceCount back to 0 everywhere
+  glBindBuffer(GL_COPY_READ_BUFFER, commandTemplate.name());
+  glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer.name());
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                      views * meshCount *
+                          sizeof(GLExt::DrawElementsIndirectCommand));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  const uint n{std::min<uint>(viewProjections.size(), views)};
+  glUseProgram(cullShader.id());
+  glUniformMatrix4fv(cullShader.getUniform("viewProjections"), n, GL_FALSE,
+                     glm::value_ptr(viewProjections.front()));
+  glUniform1ui(cullShader.getUniform("viewCount"), n);
+  glUniform1ui(cullShader.getUniform("meshCount"), meshCount);
+  glUniform1ui(cullShader.getUniform("instanceCount"), instanceCount);
+  DefaultFrameStats.uniformUploads += 4;
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer.name());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, boundsBuffer.name());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer.name());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visibleBuffer.name());
+  GLExt::dispatchCompute((objectCount() + WORKGROUP - 1) / WORKGROUP, 1, 1);
+  GLExt::memoryBarrier(GL_COMMAND_BARRIER_BIT |
+                       GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                       GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+auto IndirectBatch::draw(uint view, GLenum drawMode) const -> void {
+  if (!objectCount() || view >= views)
+    return;
+  // indirect.vert reads the model matrices here
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer.name());
+  glBindVertexArray(VAO.name());
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer.name());
+  GLExt::multiDrawElementsIndirect(
+      drawMode, GL_UNSIGNED_INT,
+      reinterpret_cast<void *>(view * meshCount *
+                               sizeof(GLExt::DrawElementsIndirectCommand)),
+      meshCount, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  DefaultFrameStats.drawCalls++;
+}
+
+auto IndirectBatch::visibleObjects(uint view) const -> std::size_t {
+  if (!objectCount() || view >= views)
+    return 0;
+  std::vector<GLExt::DrawElementsIndirectCommand> commands(meshCount);
+  glBindBuffer(GL_COPY_READ_BUFFER, commandBuffer.name());
+  glGetBufferSubData(GL_COPY_READ_BUFFER,
+                     view * meshCount *
+                         sizeof(GLExt::DrawElementsIndirectCommand),
+                     commands.size() * sizeof(commands.front()),
+                     commands.data());
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  std::size_t visible{0};
+  for (auto &c : commands)
+    visible += c.instanceCount;
+  return visible;
+}
+
+auto IndirectBatch::outsideFrustum(const glm::mat4 &mvp, const glm::vec3 &lo,
+                                   const glm::vec3 &hi) -> bool {
+  std::array<bool, 6> allOut{true, true, true, true, true, true};
+  for (int i = 0; i < 8; i++) {
+    const glm::vec4 c{mvp * glm::vec4(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y,
+                                      i & 4 ? hi.z : lo.z, 1.0f)};
+    for (int axis = 0; axis < 3; axis++) {
+      allOut[2 * axis] = allOut[2 * axis] && c[axis] < -c.w;
+      allOut[2 * axis + 1] = allOut[2 * axis + 1] && c[axis] > c.w;
+    }
+  }
+  return std::any_of(allOut.begin(), allOut.end(), [](bool b) { return b; });
+}
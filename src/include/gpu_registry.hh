@@ -0,0 +1,318 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+enum class GpuKind : std::uint8_t {
+  Buffer,
+  Texture,
+  VertexArray,
+  Framebuffer,
+  Program,
+};
+constexpr std::size_t GPU_KINDS = 5;
+
+// A typed slot index plus the generation it was created with. Handles are
+// plain values: copying one adds no reference (GpuRegistry::retain() does),
+// and once the slot is released every copy resolves to GL name 0.
+template <GpuKind K> struct GpuHandle {
+  std::uint32_t index{0}; // 0 is the null handle
+  std::uint32_t generation{0};
+
+  explicit operator bool() const { return index != 0; }
+  bool operator==(const GpuHandle &o) const {
+    return index == o.index && generation == o.generation;
+  }
+  bool operator!=(const GpuHandle &o) const { return !(*this == o); }
+
+  // GL name through DefaultGpuRegistry, 0 if null or stale.
+  auto name() const -> GLuint;
+};
+
+using BufferHandle = GpuHandle<GpuKind::Buffer>;
+using TextureHandle = GpuHandle<GpuKind::Texture>;
+using VertexArrayHandle = GpuHandle<GpuKind::VertexArray>;
+using FramebufferHandle = GpuHandle<GpuKind::Framebuffer>;
+using ProgramHandle = GpuHandle<GpuKind::Program>;
+
+// Owner of every GL buffer, texture, VAO, FBO and program name.
+//
+// Objects are reference counted: create() hands out the first reference,
+// retain() adds one for every further owner (e.g. a mesh sharing a texture
+// with TextureRepository) and release() drops one. The slot is recycled as
+// soon as the count hits zero, so stale handles fail the generation check,
+// but the GL name is only deleted DELETE_LATENCY frames later, once frames
+// still in flight can no longer reference it.
+//
+// Render thread only, like every other GL call.
+class GpuRegistry {
+public:
+  static constexpr std::uint64_t DELETE_LATENCY = 3; // frames
+
+  struct Totals {
+    std::size_t count{0};
+    std::size_t bytes{0};
+  };
+
+  // glGen*/glCreateProgram, accounted with `bytes` (the caller still
+  // allocates the storage).
+  template <GpuKind K> auto create(std::size_t bytes = 0) -> GpuHandle<K> {
+    return adopt<K>(generate(K), bytes);
+  }
+  // Takes ownership of a name generated elsewhere.
+  template <GpuKind K>
+  auto adopt(GLuint name, std::size_t bytes = 0) -> GpuHandle<K> {
+    auto id{allocate(K, name, bytes)};
+    return GpuHandle<K>{id.index, id.generation};
+  }
+  template <GpuKind K> auto name(GpuHandle<K> h) const -> GLuint {
+    auto *s{find(K, h.index, h.generation)};
+    return s ? s->name : 0;
+  }
+  template <GpuKind K> auto retain(GpuHandle<K> h) -> GpuHandle<K> {
+    if (auto *s{find(K, h.index, h.generation)}) {
+      s->refs++;
+      return h;
+    }
+    if (h)
+      staleAccess(K, "retain");
+    return GpuHandle<K>{};
+  }
+  // Drops one reference and nulls `h`. Null handles are ignored.
+  template <GpuKind K> auto release(GpuHandle<K> &h) -> void {
+    if (h)
+      drop(K, h.index, h.generation);
+    h = GpuHandle<K>{};
+  }
+  // Accounted storage and reference count, 0 if null or stale.
+  template <GpuKind K> auto bytes(GpuHandle<K> h) const -> std::size_t {
+    auto *s{find(K, h.index, h.generation)};
+    return s ? s->bytes : 0;
+  }
+  template <GpuKind K> auto refs(GpuHandle<K> h) const -> std::uint32_t {
+    auto *s{find(K, h.index, h.generation)};
+    return s ? s->refs : 0;
+  }
+  // Storage changed size, e.g. a buffer re-specified with glBufferData.
+  template <GpuKind K> auto setBytes(GpuHandle<K> h, std::size_t bytes) -> void {
+    if (auto *s{find(K, h.index, h.generation)}) {
+      totals_[index(K)].bytes += bytes - s->bytes;
+      s->bytes = bytes;
+    }
+  }
+
+  auto totals(GpuKind kind) const -> const Totals & {
+    return totals_[index(kind)];
+  }
+  auto totalBytes() const -> std::size_t;
+  auto pendingDeletes() const -> std::size_t { return pending.size(); }
+
+  // Deletes the names whose latency has passed. Call once per frame, after
+  // the swap.
+  auto endFrame() -> void;
+  // Deletes everything pending right away and reports objects that were
+  // never released. Call before the context goes away.
+  auto destory() -> void;
+
+  static auto kindName(GpuKind kind) -> const char *;
+  // Mip chain included, for glGenerateMipmap'd textures.
+  static auto mipmappedBytes(std::size_t baseBytes) -> std::size_t {
+    return baseBytes + baseBytes / 3;
+  }
+
+private:
+  struct Slot {
+    GLuint name{0};
+    std::uint32_t generation{0};
+    std::uint32_t refs{0};
+    std::size_t bytes{0};
+  };
+  struct Pending {
+    GpuKind kind;
+    GLuint name;
+    std::uint64_t frame;
+  };
+  struct Id {
+    std::uint32_t index, generation;
+  };
+
+  // Index 0 of each kind is the null slot and never handed out.
+  std::array<std::vector<Slot>, GPU_KINDS> slots{};
+  std::array<std::vector<std::uint32_t>, GPU_KINDS> freeSlots;
+  std::array<Totals, GPU_KINDS> totals_{};
+  std::vector<Pending> pending;
+  std::uint64_t frame{0};
+
+  static constexpr auto index(GpuKind kind) -> std::size_t {
+    return static_cast<std::size_t>(kind);
+  }
+  auto find(GpuKind kind, std::uint32_t i, std::uint32_t generation) const
+      -> const Slot *;
+  auto find(GpuKind kind, std::uint32_t i, std::uint32_t generation)
+      -> Slot *;
+  auto allocate(GpuKind kind, GLuint name, std::size_t bytes) -> Id;
+  auto drop(GpuKind kind, std::uint32_t i, std::uint32_t generation) -> void;
+  static auto staleAccess(GpuKind kind, const char *what) -> void;
+  static auto generate(GpuKind kind) -> GLuint;
+  static auto remove(GpuKind kind, GLuint name) -> void;
+};
+
+auto GpuRegistry::kindName(GpuKind kind) -> const char * {
+  switch (kind) {
+  case GpuKind::Buffer:
+    return "Buffer";
+  case GpuKind::Texture:
+    return "Texture";
+  case GpuKind::VertexArray:
+    return "VertexArray";
+  case GpuKind::Framebuffer:
+    return "Framebuffer";
+  case GpuKind::Program:
+    return "Program";
+  }
+  return "None";
+}
+
+auto GpuRegistry::generate(GpuKind kind) -> GLuint {
+  GLuint name{0};
+  switch (kind) {
+  case GpuKind::Buffer:
+    glGenBuffers(1, &name);
+    break;
+  case GpuKind::Texture:
+    glGenTextures(1, &name);
+    break;
+  case GpuKind::VertexArray:
+    glGenVertexArrays(1, &name);
+    break;
+  case GpuKind::Framebuffer:
+    glGenFramebuffers(1, &name);
+    break;
+  case GpuKind::Program:
+    name = glCreateProgram();
+    break;
+  }
+  return name;
+}
+
+auto GpuRegistry::remove(GpuKind kind, GLuint name) -> void {
+  switch (kind) {
+  case GpuKind::Buffer:
+    glDeleteBuffers(1, &name);
+    break;
+  case GpuKind::Texture:
+    glDeleteTextures(1, &name);
+    break;
+  case GpuKind::VertexArray:
+    glDeleteVertexArrays(1, &name);
+    break;
+  case GpuKind::Framebuffer:
+    glDeleteFramebuffers(1, &name);
+    break;
+  case GpuKind::Program:
+    glDeleteProgram(name);
+    break;
+  }
+}
+
+auto GpuRegistry::find(GpuKind kind, std::uint32_t i,
+                       std::uint32_t generation) const -> const Slot * {
+  auto &s{slots[index(kind)]};
+  if (i == 0 || i >= s.size() || s[i].generation != generation ||
+      s[i].refs == 0)
+    return nullptr;
+  return &s[i];
+}
+
+auto GpuRegistry::find(GpuKind kind, std::uint32_t i, std::uint32_t generation)
+    -> Slot * {
+  return const_cast<Slot *>(
+      static_cast<const GpuRegistry *>(this)->find(kind, i, generation));
+}
+
+auto GpuRegistry::allocate(GpuKind kind, GLuint name, std::size_t bytes)
+    -> Id {
+  auto &s{slots[index(kind)]};
+  auto &free{freeSlots[index(kind)]};
+  if (s.empty())
+    s.emplace_back(); // null slot
+  std::uint32_t i;
+  if (free.empty()) {
+    i = static_cast<std::uint32_t>(s.size());
+    s.emplace_back();
+  } else {
+    i = free.back();
+    free.pop_back();
+  }
+  auto &slot{s[i]};
+  slot.name = name;
+  slot.generation++; // a recycled slot never matches its old handles
+  slot.refs = 1;
+  slot.bytes = bytes;
+  totals_[index(kind)].count++;
+  totals_[index(kind)].bytes += bytes;
+  return Id{i, slot.generation};
+}
+
+auto GpuRegistry::drop(GpuKind kind, std::uint32_t i,
+                       std::uint32_t generation) -> void {
+  auto *slot{find(kind, i, generation)};
+  if (!slot) {
+    staleAccess(kind, "release");
+    return;
+  }
+  if (--slot->refs > 0)
+    return;
+  auto &t{totals_[index(kind)]};
+  t.count--;
+  t.bytes -= slot->bytes;
+  pending.push_back(Pending{kind, slot->name, frame});
+  slot->name = 0;
+  slot->bytes = 0;
+  freeSlots[index(kind)].push_back(i);
+}
+
+auto GpuRegistry::staleAccess(GpuKind kind, const char *what) -> void {
+  std::cerr << "ERROR::GpuRegistry::" << what << " -> stale " << kindName(kind)
+            << " handle." << std::endl;
+}
+
+auto GpuRegistry::totalBytes() const -> std::size_t {
+  std::size_t bytes{0};
+  for (auto &t : totals_)
+    bytes += t.bytes;
+  return bytes;
+}
+
+auto GpuRegistry::endFrame() -> void {
+  frame++;
+  auto due{std::partition(pending.begin(), pending.end(), [&](auto &p) {
+    return frame - p.frame < DELETE_LATENCY;
+  })};
+  for (auto p{due}; p != pending.end(); p++)
+    remove(p->kind, p->name);
+  pending.erase(due, pending.end());
+}
+
+auto GpuRegistry::destory() -> void {
+  for (auto &p : pending)
+    remove(p.kind, p.name);
+  pending.clear();
+  for (std::size_t k = 0; k < GPU_KINDS; k++)
+    if (totals_[k].count)
+      std::clog << "LOG::GpuRegistry::\"Unreleased Objects\": "
+                << totals_[k].count << ' '
+                << kindName(static_cast<GpuKind>(k)) << "s, "
+                << totals_[k].bytes << " bytes" << std::endl;
+}
+
+static GpuRegistry DefaultGpuRegistry;
+
+template <GpuKind K> auto GpuHandle<K>::name() const -> GLuint {
+  return DefaultGpuRegistry.name(*this);
+}
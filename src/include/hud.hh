@@ -0,0 +1,276 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gpu_registry.hh"
+#include "overlay.hh"
+#include "shader.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+
+// Performance HUD: a frame-time graph, per-pass GPU times, the frame's
+// FrameStats counters and GPU memory from DefaultGpuRegistry, drawn over
+// the frame with one QuadBatch draw call.
+//
+// Text uses a built-in 5x7 font (upper case, digits and a little
+// punctuation) baked into a one-row GL_R8 atlas, whose last cell is solid
+// for plain rectangles. Numbers are formatted with snprintf into stack
+// buffers, so a frame's HUD makes no heap allocations.
+class Hud {
+public:
+  struct Pass {
+    const char *name;
+    float ms;
+  };
+
+  static constexpr std::size_t GRAPH_SAMPLES = 120;
+  static constexpr std::size_t MAX_QUADS = 2048;
+
+  Hud();
+  Hud(const Hud &) = delete;
+  Hud &operator=(const Hud &) = delete;
+
+  auto destory() -> void;
+
+  // Call once per frame with the last frame's duration.
+  auto addFrameTime(float ms) -> void;
+  // Builds and draws the HUD for a `width` x `height` framebuffer with
+  // `shader` (hud.vert/hud.frag). `stats` should be captured before the
+  // call: the HUD's own draw isn't counted.
+  auto draw(const Shader &shader, int width, int height,
+            const FrameStats &stats, float cpuMs,
+            std::initializer_list<Pass> passes) -> void;
+
+private:
+  static constexpr int GLYPH_W = 5, GLYPH_H = 7;
+  static constexpr int CELL_W = 6, CELL_H = 8;
+  static constexpr char FIRST = ' ', LAST = '_';
+  static constexpr int CELLS = LAST - FIRST + 2; // glyphs + the solid cell
+  static constexpr float SCALE = 2.0f;           // screen pixels per texel
+
+  QuadBatch batch{MAX_QUADS};
+  TextureHandle font;
+  std::array<float, GRAPH_SAMPLES> frameMs{};
+  std::size_t graphHead{0};
+
+  auto rect(glm::vec2 min, glm::vec2 max, std::uint32_t color) -> void;
+  // Returns the x just past the text.
+  auto text(glm::vec2 at, const char *s, std::uint32_t color) -> float;
+  static auto glyph(char c) -> const std::array<std::uint8_t, GLYPH_H> &;
+};
+
+// Rows top to bottom, bit 4 is the leftmost column.
+auto Hud::glyph(char c) -> const std::array<std::uint8_t, GLYPH_H> & {
+  using G = std::array<std::uint8_t, GLYPH_H>;
+  static const std::array<G, LAST - FIRST + 1> font{{
+      {},                                           // ' '
+      {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04},   // !
+      {}, {}, {},                                   // " # $
+      {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},   // %
+      {}, {},                                       // & '
+      {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},   // (
+      {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},   // )
+      {}, {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}, // * +
+      {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08},   // ,
+      {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00},   // -
+      {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},   // .
+      {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},   // /
+      {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},   // 0
+      {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},   // 1
+      {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},   // 2
+      {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},   // 3
+      {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},   // 4
+      {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},   // 5
+      {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},   // 6
+      {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},   // 7
+      {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},   // 8
+      {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},   // 9
+      {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},   // :
+      {}, {},                                       // ; <
+      {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00},   // =
+      {}, {}, {},                                   // > ? @
+      {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11},   // A
+      {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},   // B
+      {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E},   // C
+      {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},   // D
+      {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F},   // E
+      {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},   // F
+      {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F},   // G
+      {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},   // H
+      {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},   // I
+      {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},   // J
+      {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},   // K
+      {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},   // L
+      {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11},   // M
+      {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},   // N
+      {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},   // O
+      {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},   // P
+      {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D},   // Q
+      {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},   // R
+      {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E},   // S
+      {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},   // T
+      {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},   // U
+      {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},   // V
+      {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A},   // W
+      {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},   // X
+      {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04},   // Y
+      {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},   // Z
+      {}, {}, {}, {},                               // [ \ ] ^
+      {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F},   // _
+  }};
+  if (c >= 'a' && c <= 'z')
+    c -= 'a' - 'A';
+  if (c < FIRST || c > LAST)
+    c = FIRST;
+  return font[c - FIRST];
+}
+
+Hud::Hud() {
+  constexpr int width{CELLS * CELL_W};
+  std::array<std::uint8_t, width * CELL_H> pixels{};
+  for (int c = 0; c < CELLS - 1; c++) {
+    auto &g{glyph(FIRST + c)};
+    for (int y = 0; y < GLYPH_H; y++)
+      for (int x = 0; x < GLYPH_W; x++)
+        if (g[y] & (0x10 >> x))
+          pixels[y * width + c * CELL_W + x] = 255;
+  }
+  for (int y = 0; y < CELL_H; y++) // solid cell
+    for (int x = 0; x < CELL_W; x++)
+      pixels[y * width + (CELLS - 1) * CELL_W + x] = 255;
+
+  font = DefaultGpuRegistry.create<GpuKind::Texture>(pixels.size());
+  glBindTexture(GL_TEXTURE_2D, font.name());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, CELL_H, 0, GL_RED,
+               GL_UNSIGNED_BYTE, pixels.data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+auto Hud::destory() -> void {
+  batch.destory();
+  DefaultGpuRegistry.release(font);
+}
+
+auto Hud::addFrameTime(float ms) -> void {
+  frameMs[graphHead] = ms;
+  graphHead = (graphHead + 1) % GRAPH_SAMPLES;
+}
+
+auto Hud::rect(glm::vec2 min, glm::vec2 max, std::uint32_t color) -> void {
+  // the middle of the solid cell, clear of its neighbours under filtering
+  const glm::vec2 uv{(CELLS - 0.5f) / CELLS, 0.5f};
+  batch.add(min, max, uv, uv, color);
+}
+
+auto Hud::text(glm::vec2 at, const char *s, std::uint32_t color) -> float {
+  for (; *s; s++) {
+    char c{*s};
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    if (c < FIRST || c > LAST)
+      c = FIRST;
+    if (c != ' ') {
+      const float u0{static_cast<float>((c - FIRST) * CELL_W) /
+                     (CELLS * CELL_W)};
+      const float u1{u0 + static_cast<float>(GLYPH_W) / (CELLS * CELL_W)};
+      const float v1{static_cast<float>(GLYPH_H) / CELL_H};
+      batch.add(at, at + SCALE * glm::vec2(GLYPH_W, GLYPH_H),
+                glm::vec2(u0, 0.0f), glm::vec2(u1, v1), color);
+    }
+    at.x += SCALE * CELL_W;
+  }
+  return at.x;
+}
+
+auto Hud::draw(const Shader &shader, int width, int height,
+               const FrameStats &stats, float cpuMs,
+               std::initializer_list<Pass> passes) -> void {
+  constexpr std::uint32_t WHITE{0xFFFFFFFF}, GREY{0xFFB0B0B0},
+      BACKGROUND{0xB0000000}, GREEN{0xFF40D040}, YELLOW{0xFF30D0E0},
+      RED{0xFF4040E0};
+  constexpr float TARGET_MS{1000.0f / 60.0f};
+  constexpr float LINE{SCALE * CELL_H + 4.0f};
+  constexpr float GRAPH_H{48.0f}, BAR_W{2.0f};
+  const float panelW{GRAPH_SAMPLES * BAR_W + 16.0f};
+  const float panelH{GRAPH_H + LINE * (5 + passes.size()) + 20.0f};
+
+  batch.clear();
+  char line[96];
+  glm::vec2 at{16.0f, 16.0f};
+  rect(glm::vec2(8.0f), glm::vec2(8.0f) + glm::vec2(panelW, panelH),
+       BACKGROUND);
+
+  const float last{frameMs[(graphHead + GRAPH_SAMPLES - 1) % GRAPH_SAMPLES]};
+  std::snprintf(line, sizeof line, "FRAME %5.2f MS  CPU %5.2f MS", last,
+                cpuMs);
+  text(at, line, WHITE);
+  at.y += LINE;
+
+  // Frame-time graph, oldest sample on the left, 2x the target at the top
+  const float graphBottom{at.y + GRAPH_H};
+  for (std::size_t i = 0; i < GRAPH_SAMPLES; i++) {
+    const float ms{frameMs[(graphHead + i) % GRAPH_SAMPLES]};
+    const float h{std::min(ms / (2.0f * TARGET_MS), 1.0f) * GRAPH_H};
+    const float x{at.x + i * BAR_W};
+    rect(glm::vec2(x, graphBottom - h), glm::vec2(x + BAR_W, graphBottom),
+         ms <= TARGET_MS ? GREEN : ms <= 2.0f * TARGET_MS ? YELLOW : RED);
+  }
+  rect(glm::vec2(at.x, graphBottom - GRAPH_H / 2.0f - 0.5f),
+       glm::vec2(at.x + GRAPH_SAMPLES * BAR_W,
+                 graphBottom - GRAPH_H / 2.0f + 0.5f),
+       GREY); // the target
+  at.y = graphBottom + 8.0f;
+
+  for (auto &pass : passes) {
+    std::snprintf(line, sizeof line, "%-8s %6.3f MS GPU", pass.name, pass.ms);
+    text(at, line, WHITE);
+    at.y += LINE;
+  }
+  std::snprintf(line, sizeof line, "DRAWS %u  TRIS %u", stats.drawCalls,
+                stats.triangles);
+  text(at, line, WHITE);
+  at.y += LINE;
+  std::snprintf(line, sizeof line, "TEX BINDS %u  UNIFORMS %u",
+                stats.textureBinds, stats.uniformUploads);
+  text(at, line, WHITE);
+  at.y += LINE;
+  constexpr float MIB{1024.0f * 1024.0f};
+  std::snprintf(
+      line, sizeof line, "GPU MEM TEX %.1f MIB  BUF %.1f MIB",
+      DefaultGpuRegistry.totals(GpuKind::Texture).bytes / MIB,
+      DefaultGpuRegistry.totals(GpuKind::Buffer).bytes / MIB);
+  text(at, line, WHITE);
+
+  GLboolean depthTest{glIsEnabled(GL_DEPTH_TEST)};
+  GLboolean cullFace{glIsEnabled(GL_CULL_FACE)};
+  GLboolean blend{glIsEnabled(GL_BLEND)};
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glUseProgram(shader.id());
+  glUniform2f(shader.getUniform("screenSize"), width, height);
+  glUniform1i(shader.getUniform("font"), 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, font.name());
+  batch.draw();
+  if (depthTest)
+    glEnable(GL_DEPTH_TEST);
+  if (cullFace)
+    glEnable(GL_CULL_FACE);
+  if (!blend)
+    glDisable(GL_BLEND);
+}
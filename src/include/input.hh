@@ -0,0 +1,322 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+namespace fs = std::filesystem;
+
+// Keys the render loop reacts to; one bit each in InputFrame::keys.
+enum class Key : std::uint8_t { W, A, S, D, Space, C, Q, M, P, H, Count };
+
+// Everything a frame reads from the user: how far to step the simulation,
+// which keys are held and how far the cursor moved since the last frame.
+struct InputFrame {
+  float deltaTime{0.0f}; // seconds
+  std::uint32_t keys{0};
+  float cursorDx{0.0f}, cursorDy{0.0f};
+
+  auto down(Key k) const -> bool {
+    return keys & (1u << static_cast<uint>(k));
+  }
+};
+
+// The single source of input for the render loop.
+//
+// Mode::Live reads GLFW callbacks. Mode::Record does the same and, from
+// start() on, also appends every key and cursor event, with its time since
+// start(), plus one record per frame with the frame's delta to a binary
+// file. Mode::Replay
+// ignores the user and plays such a file back on a fixed timestep: each
+// frame advances a simulated clock by FIXED_STEP and applies the events
+// stamped up to it. Replays therefore produce the same camera path on
+// every run and every machine, however fast the frames render.
+//
+// File layout (little-endian): "SMIN", u32 version, then tagged records
+//   Frame  u8 0, f32 delta
+//   Key    u8 1, f32 time, u8 Key, u8 pressed
+//   Cursor u8 2, f32 time, f32 x, f32 y
+class Input {
+public:
+  enum class Mode { Live, Record, Replay };
+
+  static constexpr float FIXED_STEP = 1.0f / 60.0f;
+  static constexpr std::uint32_t VERSION = 1;
+
+  // Installs the GLFW key and cursor callbacks on `window` (nullptr for a
+  // windowless replay). `file` is written in Record, read in Replay.
+  Input(GLFWwindow *window, Mode mode = Mode::Live, const fs::path &file = {});
+  Input(const Input &) = delete;
+  Input &operator=(const Input &) = delete;
+  ~Input();
+
+  auto mode() const -> Mode { return mode_; }
+  // `measuredDelta` is the wall-clock time of the last frame; replay
+  // ignores it and steps by FIXED_STEP.
+  auto beginFrame(float measuredDelta) -> InputFrame;
+  // Record: starts the recording at zero, on the frame a replay starts on
+  // too (main: the first with every asset resident), so nothing from the
+  // loading period is played back at once. Keys held and the cursor
+  // position carry over as events at time 0.
+  auto start() -> void;
+  // Replay only: every recorded frame has been played back.
+  auto finished() const -> bool;
+  // Replay only: number of FIXED_STEP frames the recording spans.
+  auto replayFrames() const -> std::size_t;
+
+private:
+  enum Tag : std::uint8_t { FrameTag, KeyTag, CursorTag };
+
+  Mode mode_;
+  bool recording{false}; // Record, once started
+  double startTime{0.0};
+  std::uint32_t keys{0};
+  bool haveCursor{false};
+  float cursorX{0.0f}, cursorY{0.0f};
+  float cursorDx{0.0f}, cursorDy{0.0f};
+
+  // Record: pending bytes, flushed in large writes. Replay: the whole file.
+  std::vector<char> buffer;
+  std::ofstream out;
+  // Replay state
+  std::size_t readPos{0};
+  float recordedTime{0.0f}, replayTime{0.0f};
+
+  static auto keyOf(int glfwKey) -> int;
+  auto now() const -> float;
+  auto onKey(std::uint8_t key, bool pressed, float time) -> void;
+  auto onCursor(float x, float y, float time) -> void;
+  auto flush() -> void;
+  template <typename T> auto put(const T &value) -> void;
+  template <typename T> auto get(T &value) -> bool;
+  auto loadRecording(const fs::path &file) -> bool;
+};
+
+Input::Input(GLFWwindow *window, Mode mode, const fs::path &file)
+    : mode_{mode}, startTime{glfwGetTime()} {
+  if (mode_ == Mode::Record) {
+    out.open(file, std::ios::binary);
+    if (!out) {
+      std::cerr << "ERROR::Input::Input -> cannot write " << file
+                << ", input is not recorded." << std::endl;
+      mode_ = Mode::Live;
+    } else {
+      buffer.insert(buffer.end(), {'S', 'M', 'I', 'N'});
+      put(VERSION);
+    }
+  } else if (mode_ == Mode::Replay && !loadRecording(file)) {
+    std::cerr << "ERROR::Input::Input -> cannot replay " << file << '.'
+              << std::endl;
+    buffer.clear();
+  }
+  if (!window || mode_ == Mode::Replay)
+    return;
+  glfwSetWindowUserPointer(window, this);
+  glfwSetKeyCallback(window, [](GLFWwindow *w, int key, int, int action, int) {
+    if (action == GLFW_REPEAT)
+      return;
+    auto *input{static_cast<Input *>(glfwGetWindowUserPointer(w))};
+    if (auto k{keyOf(key)}; k >= 0)
+      input->onKey(k, action == GLFW_PRESS, input->now());
+  });
+  glfwSetCursorPosCallback(window, [](GLFWwindow *w, double x, double y) {
+    auto *input{static_cast<Input *>(glfwGetWindowUserPointer(w))};
+    input->onCursor(x, y, input->now());
+  });
+}
+
+Input::~Input() {
+  if (mode_ == Mode::Record)
+    flush();
+}
+
+auto Input::now() const -> float { return glfwGetTime() - startTime; }
+
+auto Input::keyOf(int glfwKey) -> int {
+  constexpr std::array<int, static_cast<std::size_t>(Key::Count)> keys{
+      GLFW_KEY_W, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_SPACE,
+      GLFW_KEY_C, GLFW_KEY_Q, GLFW_KEY_M, GLFW_KEY_P, GLFW_KEY_H};
+  for (std::size_t i = 0; i < keys.size(); i++)
+    if (keys[i] == glfwKey)
+      return i;
+  return -1;
+}
+
+template <typename T> auto Input::put(const T &value) -> void {
+  auto *bytes{reinterpret_cast<const char *>(&value)};
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T> auto Input::get(T &value) -> bool {
+  if (readPos + sizeof(T) > buffer.size())
+    return false;
+  std::memcpy(&value, buffer.data() + readPos, sizeof(T));
+  readPos += sizeof(T);
+  return true;
+}
+
+auto Input::flush() -> void {
+  out.write(buffer.data(), buffer.size());
+  out.flush();
+  buffer.clear();
+}
+
+// Live and Record callbacks. Replay calls them with the recorded values.
+auto Input::onKey(std::uint8_t key, bool pressed, float time) -> void {
+  if (key >= static_cast<std::uint8_t>(Key::Count))
+    return;
+  if (pressed)
+    keys |= 1u << key;
+  else
+    keys &= ~(1u << key);
+  if (recording) {
+    put(KeyTag);
+    put(time);
+    put(key);
+    put(static_cast<std::uint8_t>(pressed));
+  }
+}
+
+auto Input::onCursor(float x, float y, float time) -> void {
+  // The first position only sets the reference point
+  if (haveCursor) {
+    cursorDx += x - cursorX;
+    cursorDy += cursorY - y; // y grows downwards on screen
+  }
+  haveCursor = true;
+  cursorX = x;
+  cursorY = y;
+  if (recording) {
+    put(CursorTag);
+    put(time);
+    put(x);
+    put(y);
+  }
+}
+
+auto Input::beginFrame(float measuredDelta) -> InputFrame {
+  if (recording) {
+    put(FrameTag);
+    put(measuredDelta);
+    if (buffer.size() >= 64 * 1024)
+      flush();
+  }
+  if (mode_ == Mode::Replay) {
+    measuredDelta = FIXED_STEP;
+    replayTime += FIXED_STEP;
+    // Apply every event up to the new simulated time. Frame records only
+    // matter for the recording's length, which loadRecording() summed up.
+    while (readPos < buffer.size()) {
+      const auto start{readPos};
+      std::uint8_t tag;
+      float time;
+      get(tag);
+      if (tag == FrameTag) {
+        get(time); // the frame's delta
+        continue;
+      }
+      if (!get(time) || time > replayTime) {
+        readPos = start;
+        break;
+      }
+      if (tag == KeyTag) {
+        std::uint8_t key, pressed;
+        get(key);
+        get(pressed);
+        onKey(key, pressed, time);
+      } else {
+        float x, y;
+        get(x);
+        get(y);
+        onCursor(x, y, time);
+      }
+    }
+  }
+  InputFrame frame{measuredDelta, keys, cursorDx, cursorDy};
+  cursorDx = cursorDy = 0.0f;
+  return frame;
+}
+
+auto Input::start() -> void {
+  startTime = glfwGetTime();
+  if (mode_ != Mode::Record || recording)
+    return;
+  recording = true;
+  for (std::uint8_t k = 0; k < static_cast<std::uint8_t>(Key::Count); k++)
+    if (keys & (1u << k)) {
+      put(KeyTag);
+      put(0.0f);
+      put(k);
+      put(std::uint8_t{1});
+    }
+  if (haveCursor) { // the reference point for the first replayed delta
+    put(CursorTag);
+    put(0.0f);
+    put(cursorX);
+    put(cursorY);
+  }
+}
+
+auto Input::finished() const -> bool {
+  return mode_ == Mode::Replay && replayTime >= recordedTime;
+}
+
+auto Input::replayFrames() const -> std::size_t {
+  return static_cast<std::size_t>(recordedTime / FIXED_STEP);
+}
+
+// Reads the file and checks that its records are well formed, so beginFrame()
+// can walk them without further checks.
+auto Input::loadRecording(const fs::path &file) -> bool {
+  std::ifstream in(file, std::ios::binary);
+  if (!in)
+    return false;
+  buffer.assign(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+  char magic[4];
+  std::uint32_t version;
+  if (!get(magic) || std::memcmp(magic, "SMIN", 4) || !get(version) ||
+      version != VERSION)
+    return false;
+
+  const auto first{readPos};
+  std::size_t frames{0}, events{0};
+  bool truncated{false};
+  while (readPos < buffer.size()) {
+    const auto start{readPos};
+    std::uint8_t tag;
+    float value;
+    get(tag);
+    bool ok{get(value)};
+    if (tag == FrameTag) {
+      recordedTime += value;
+      frames++;
+    } else if (tag == KeyTag) {
+      std::uint16_t keyPressed;
+      ok = ok && get(keyPressed);
+      events++;
+    } else if (tag == CursorTag) {
+      float xy[2];
+      ok = ok && get(xy);
+      events++;
+    } else {
+      ok = false;
+    }
+    if (!ok) { // keep what was complete, e.g. after a crash mid-write
+      buffer.resize(start);
+      truncated = true;
+      break;
+    }
+  }
+  readPos = first;
+  std::clog << "LOG::Input::\"Loading Recording Successful\": " << file
+            << ", " << frames << " frames, " << events << " events, "
+            << recordedTime << " s" << (truncated ? " (truncated)" : "")
+            << std::endl;
+  return true;
+}
@@ -6,10 +6,13 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <shader.hh>
+#include "gpu_registry.hh"
+#include "profiler.hh"
+#include "uniform_ring.hh"
 
+#include <algorithm>
 #include <string>
 #include <iostream>
-#include <functional>
 
 class Light {
 public:
@@ -19,11 +22,13 @@ public:
   glm::mat4 depthModelMatrix;
   // glm::mat4 depthMVP;
 
-  GLuint depthMapFBO;
-  GLuint depthTexture;
+  FramebufferHandle depthMapFBO;
+  TextureHandle depthTexture;
 
+  // Size of the depth texture, the upper bound for resolution().
   static constexpr int SHADOW_HEIGHT = 1024;
   static constexpr int SHADOW_WIDTH  = 1024;
+  static constexpr int MIN_SHADOW_SIZE = 64;
 
   // lightInvDir <- glm::vec3(0.5f,2,2)
   Light():
@@ -44,8 +49,8 @@ public:
     }
 
     auto destory() -> void {
-      glDeleteTextures(1, &depthMapFBO);
-      glDeleteFramebuffers(1, &depthMapFBO);
+      DefaultGpuRegistry.release(depthTexture);
+      DefaultGpuRegistry.release(depthMapFBO);
     }
 
   // auto calcDepthMVP() -> glm::mat4 const {
@@ -53,38 +58,56 @@ public:
   // }
 
   auto bindDepthMap() -> void {
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO.name());
   }
 
-  auto render(Shader &shaderRenderToDepthMap,
-              std::function<void()> subrenderToDepthMap) {
-    using namespace std::string_literals;
+  // Contents of the shared `Light` uniform block. The light sits at the eye
+  // of depthViewMatrix.
+  auto block() const -> LightBlock {
+    return LightBlock{depthProjectionMatrix * depthViewMatrix, depthViewMatrix,
+                      depthProjectionMatrix, glm::inverse(depthViewMatrix)[3],
+                      glm::vec4(static_cast<float>(resolution_) / SHADOW_WIDTH,
+                                static_cast<float>(resolution_) / SHADOW_HEIGHT,
+                                0.0f, 0.0f)};
+  }
+
+  // The shadow pass renders into the bottom-left resolution() x resolution()
+  // texels of the depth texture; block() tells the shaders how much of it to
+  // sample. Lowering it trades shadow detail for fill rate without
+  // reallocating anything.
+  auto setResolution(int size) -> void {
+    resolution_ = std::clamp(size, MIN_SHADOW_SIZE,
+                             std::min(SHADOW_WIDTH, SHADOW_HEIGHT));
+  }
+  auto resolution() const -> int { return resolution_; }
+
+  // The light matrices come from the `Light` uniform block, which the caller
+  // has bound for this frame. Any callable: a std::function here would
+  // allocate for every capturing lambda, every frame.
+  template <typename DrawCasters>
+  auto render(DrawCasters &&subrenderToDepthMap) {
+    PROFILE_SCOPE("Light::render");
+    PROFILE_GPU_SCOPE("Light::render");
     GLint viewport[4];
 
     // Render to depth map from light's point of view
     glGetIntegerv(GL_VIEWPORT, viewport);
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);    // set viewport proportions
+    glViewport(0, 0, resolution_, resolution_);    // set viewport proportions
     glClear(GL_DEPTH_BUFFER_BIT);
 
-    auto light_space_matrix_uniform_location{shaderRenderToDepthMap.getUniform("lightSpaceMatrix"s)};
-    glUniformMatrix4fv(light_space_matrix_uniform_location,
-                       1, GL_FALSE, glm::value_ptr(depthViewMatrix));
-    auto model_matrix_uniform_location{shaderRenderToDepthMap.getUniform("lightProjection"s)};
-    glUniformMatrix4fv(model_matrix_uniform_location,
-                       1, GL_FALSE, glm::value_ptr(depthProjectionMatrix));
-
     subrenderToDepthMap();
     glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
   }
 
   auto setupDepthTexture() -> bool {
-    glGenFramebuffers(1, &depthMapFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+    depthMapFBO = DefaultGpuRegistry.create<GpuKind::Framebuffer>();
+    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO.name());
 
     // Depth texutre is slower than depth buffer, but you can
     // sample it later in fragment shader.
-    glGenTextures(1, &depthTexture);
-    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    depthTexture = DefaultGpuRegistry.create<GpuKind::Texture>(
+        SHADOW_WIDTH * SHADOW_HEIGHT * sizeof(GLushort));
+    glBindTexture(GL_TEXTURE_2D, depthTexture.name());
     glTexImage2D(GL_TEXTURE_2D,
                  0,                    // mipmap level
                  GL_DEPTH_COMPONENT16, // internal format
@@ -102,7 +125,7 @@ public:
     glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor.data());
     glFramebufferTexture(GL_FRAMEBUFFER,
                          GL_DEPTH_ATTACHMENT, // attachment
-                         depthTexture,        // texture
+                         depthTexture.name(), // texture
                          0);                  // mipmap level
     glDrawBuffer(GL_NONE); // Don't draw to any color buffer.
     glReadBuffer(GL_NONE);
@@ -113,4 +136,6 @@ public:
     return true;
   }
 
+private:
+  int resolution_{std::min(SHADOW_WIDTH, SHADOW_HEIGHT)};
 };
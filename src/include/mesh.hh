@@ -4,17 +4,26 @@
 
 // #include <glad/glad.h>
 
+#include "gpu_registry.hh"
+#include "meshlet.hh"
 #include "texture.hh"
 #include "vertex.hh"
 
 #include "shader.hh"
+#include "profiler.hh"
+#include "stats.hh"
+#include "upload_budget.hh"
 
 #include <glad/glad.h>
 
+#include <algorithm>
+#include <array>
+#include <cstdio>
 #include <filesystem>
 #include <iostream>
 #include <vector>
 #include <string>
+#include <utility>
 namespace fs = std::filesystem;
 
 class Mesh {
@@ -22,11 +31,62 @@ public:
   std::vector<Vertex> vertices;
   std::vector<uint> indices;
 std::vector<Texture> textures;
+  // Object-space AABB of `vertices`
+  glm::vec3 boundsMin{0.0f}, boundsMax{0.0f};
+  // Set by OcclusionCuller; the camera passes skip culled meshes, the shadow
+  // pass still draws them.
+  bool culled{false};
+  // Built with the CPU-side data at load; empty for External meshes.
+  std::vector<Meshlet> meshlets;
+  // Set by MeshletCuller: while `active`, draw() submits only these index
+  // ranges, with one glMultiDrawElements, instead of the whole mesh.
+  struct DrawRanges {
+    bool active{false};
+    std::vector<GLsizei> counts;
+    std::vector<const void *> offsets;
+    uint triangles{0};
+  };
+  DrawRanges ranges;
+  // Skeletal binding, parallel to `vertices`, and the bones it indexes: the
+  // node each follows and its inverse bind matrix. Empty for static meshes;
+  // GpuSkinning poses the others.
+  struct Bone {
+    std::string name;
+    glm::mat4 offset;
+  };
+  std::vector<VertexSkin> skin;
+  std::vector<Bone> bones;
+
+  // Tag: keep the data CPU-side and let uploadSlice() create the GL objects.
+  struct Deferred {};
+
+  // Vertex data already resident in a buffer shared with other meshes (e.g.
+  // a GLB binary chunk uploaded as is), read in whatever layout it has.
+  struct Attribute {
+    GLint components{0}; // 0: the attribute is missing
+    GLenum type{GL_FLOAT};
+    GLboolean normalized{GL_FALSE};
+    GLsizei stride{0};
+    GLintptr offset{0};
+  };
+  struct External {
+    BufferHandle buffer; // a reference the mesh takes over
+    std::array<Attribute, 3> attributes; // position, normal, texCoords
+    GLenum indexType{GL_UNSIGNED_INT};
+    GLintptr indexOffset{0};
+    GLsizei indexCount{0};
+    glm::vec3 boundsMin{0.0f}, boundsMax{0.0f};
+    // A reference the mesh takes over; null: the indices live in `buffer`
+    BufferHandle indexBuffer{};
+  };
 
   Mesh(const std::vector<Vertex> &vertices, const std::vector<uint> &indices,
        const std::vector<Texture> &textures);
   Mesh(std::vector<Vertex> &vertices, std::vector<uint> &idices,
        std::vector<Texture> &textures);
+  Mesh(std::vector<Vertex> &&vertices, std::vector<uint> &&indices, Deferred);
+  // No CPU-side copy: `vertices` and `indices` stay empty.
+  explicit Mesh(const External &external);
 
   // COPY
   Mesh(const Mesh& other) = delete;
@@ -36,59 +96,153 @@ std::vector<Texture> textures;
   Mesh(Mesh&& other) noexcept { *this = std::move(other); }
   Mesh& operator=(Mesh&& other);
 
-  auto draw(GLenum drawMode) -> void;
+  auto draw(GLenum drawMode) const -> void;
   auto bindVAO() const -> void;
   auto bindTextures(const Shader &shader, uint offsetTexture) -> void;
+  auto bindLayers(GLint diffuseLayerLocation, GLint specularLayerLocation) const -> void;
+  auto layerOf(Texture::Type type) const -> const Texture *;
   auto bindDraw(const Shader& shader, uint offsetTexture, GLenum drawMode) -> void;
 
+  auto uploadSlice(UploadBudget &budget) -> bool;
+  auto uploaded() const -> bool;
+  // What the CPU-side copies kept after upload take.
+  auto cpuBytes() const -> std::size_t {
+    return vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint) +
+           meshlets.size() * sizeof(Meshlet) + skin.size() * sizeof(VertexSkin);
+  }
+  // The mesh's own buffers, for vertex arrays built over them elsewhere
+  // (GpuSkinning); retain them to keep a reference.
+  auto vertexBuffer() const -> BufferHandle { return VBO; }
+  auto indexBuffer() const -> BufferHandle { return EBO; }
+
   auto destory() -> void;
 
 private:
-  uint VAO, VBO, EBO;
-  auto setupMesh() -> void;
+  VertexArrayHandle VAO;
+  BufferHandle VBO, EBO;
+  std::size_t uploadedBytes{0};
+  GLenum indexType{GL_UNSIGNED_INT};
+  GLintptr indexOffset{0};
+  GLsizei indexCount{0};
+  auto setupMesh(bool withData = true) -> void;
+  auto computeBounds() -> void;
 };
 
 Mesh::Mesh(const std::vector<Vertex> &vertices,
            const std::vector<uint> &indices,
            const std::vector<Texture> &textures)
-    : vertices{vertices}, indices{indices}, textures{textures} {
+    : vertices{vertices}, indices{indices}, textures{textures},
+      indexCount{static_cast<GLsizei>(this->indices.size())} {
+  computeBounds();
+  meshlets = buildMeshlets(this->vertices, this->indices);
   setupMesh();
 }
 Mesh::Mesh(std::vector<Vertex> &vertices, std::vector<uint> &indices,
            std::vector<Texture> &textures)
-    : vertices{vertices}, indices{indices}, textures{textures} {
+    : vertices{vertices}, indices{indices}, textures{textures},
+      indexCount{static_cast<GLsizei>(this->indices.size())} {
+  computeBounds();
+  meshlets = buildMeshlets(this->vertices, this->indices);
   setupMesh();
 }
 
+Mesh::Mesh(std::vector<Vertex> &&vertices, std::vector<uint> &&indices,
+           Deferred)
+    : vertices{std::move(vertices)}, indices{std::move(indices)},
+      indexCount{static_cast<GLsizei>(this->indices.size())} {
+  computeBounds();
+  meshlets = buildMeshlets(this->vertices, this->indices);
+}
+
+// Without an index buffer of its own, the buffer serves as both vertex and
+// index buffer; the mesh holds its reference in VBO and leaves EBO null.
+Mesh::Mesh(const External &external)
+    : boundsMin{external.boundsMin}, boundsMax{external.boundsMax},
+      VBO{external.buffer}, EBO{external.indexBuffer},
+      indexType{external.indexType},
+      indexOffset{external.indexOffset}, indexCount{external.indexCount} {
+  GLint boundVAO;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &boundVAO);
+  VAO = DefaultGpuRegistry.create<GpuKind::VertexArray>();
+  glBindVertexArray(VAO.name());
+  glBindBuffer(GL_ARRAY_BUFFER, VBO.name());
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO ? EBO.name() : VBO.name());
+  for (uint i = 0; i < external.attributes.size(); i++) {
+    auto &a{external.attributes[i]};
+    if (!a.components) {
+      glDisableVertexAttribArray(i); // reads the current value, (0, 0, 0, 1)
+      continue;
+    }
+    glEnableVertexAttribArray(i);
+    glVertexAttribPointer(i, a.components, a.type, a.normalized, a.stride,
+                          reinterpret_cast<void *>(a.offset));
+  }
+  glBindVertexArray(boundVAO);
+}
+
 Mesh& Mesh::operator=(Mesh&& other){
   if (this != &other) {
+    // drop what this mesh held, or its registry entries would leak
+    for (auto &t : textures)
+      t.destory();
+    DefaultGpuRegistry.release(VAO);
+    DefaultGpuRegistry.release(EBO);
+    DefaultGpuRegistry.release(VBO);
     vertices = std::move(other.vertices);
     indices = std::move(other.indices);
     textures = std::move(other.textures);
-    VAO = other.VAO;
-    VBO = other.VBO;
-    EBO = other.EBO;
+    boundsMin = other.boundsMin;
+    boundsMax = other.boundsMax;
+    culled = other.culled;
+    meshlets = std::move(other.meshlets);
+    ranges = std::move(other.ranges);
+    skin = std::move(other.skin);
+    bones = std::move(other.bones);
+    // the handles move, so destory() on the husk releases nothing
+    VAO = std::exchange(other.VAO, {});
+    VBO = std::exchange(other.VBO, {});
+    EBO = std::exchange(other.EBO, {});
+    uploadedBytes = std::exchange(other.uploadedBytes, 0);
+    indexType = other.indexType;
+    indexOffset = other.indexOffset;
+    indexCount = other.indexCount;
   }
   return *this;
 }
 
-auto Mesh::setupMesh() -> void {
+auto Mesh::computeBounds() -> void {
+  if (vertices.empty())
+    return;
+  boundsMin = boundsMax = vertices.front().position;
+  for (auto &v : vertices) {
+    boundsMin = glm::min(boundsMin, v.position);
+    boundsMax = glm::max(boundsMax, v.position);
+  }
+}
+
+// withData == false only allocates the buffers; uploadSlice() fills them.
+auto Mesh::setupMesh(bool withData) -> void {
   constexpr auto sizeofVertices{sizeof(decltype(vertices)::value_type)};
   constexpr auto sizeofIndecies{sizeof(decltype(indices)::value_type)};
 
-  glGenVertexArrays(1, &VAO);
-  glGenBuffers(1, &VBO);
-  glGenBuffers(1, &EBO);
+  VAO = DefaultGpuRegistry.create<GpuKind::VertexArray>();
+  VBO = DefaultGpuRegistry.create<GpuKind::Buffer>(vertices.size() *
+                                                    sizeofVertices);
+  EBO = DefaultGpuRegistry.create<GpuKind::Buffer>(indices.size() *
+                                                    sizeofIndecies);
 
-  glBindVertexArray(VAO);
+  glBindVertexArray(VAO.name());
 
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
+  glBindBuffer(GL_ARRAY_BUFFER, VBO.name());
   glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeofVertices,
-               vertices.data(), GL_STATIC_DRAW);
+               withData ? vertices.data() : nullptr, GL_STATIC_DRAW);
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.name());
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeofIndecies,
-               indices.data(), GL_STATIC_DRAW);
+               withData ? indices.data() : nullptr, GL_STATIC_DRAW);
+  if (withData)
+    uploadedBytes = vertices.size() * sizeofVertices +
+                    indices.size() * sizeofIndecies;
 
   // 0: vertex positions
   // 1: vertex normal
@@ -105,52 +259,117 @@ auto Mesh::setupMesh() -> void {
   // glBindVertexArray(0);
 }
 
+// Streams the vertex then index data in UploadBudget::CHUNK pieces through
+// GL_COPY_WRITE_BUFFER, so whatever VAO the caller has bound is left intact.
+// Returns true once the mesh is fully resident and drawable.
+auto Mesh::uploadSlice(UploadBudget &budget) -> bool {
+  const std::size_t vertexBytes{vertices.size() * sizeof(Vertex)};
+  const std::size_t totalBytes{vertexBytes + indices.size() * sizeof(uint)};
+  if (!VAO) {
+    GLint boundVAO;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &boundVAO);
+    setupMesh(false);
+    glBindVertexArray(boundVAO);
+  }
+  while (uploadedBytes < totalBytes && !budget.exhausted()) {
+    const bool vertexPart{uploadedBytes < vertexBytes};
+    auto n{budget.take((vertexPart ? vertexBytes : totalBytes) - uploadedBytes)};
+    if (vertexPart) {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, VBO.name());
+      glBufferSubData(GL_COPY_WRITE_BUFFER, uploadedBytes, n,
+                      reinterpret_cast<const char *>(vertices.data()) +
+                          uploadedBytes);
+    } else {
+      auto offset{uploadedBytes - vertexBytes};
+      glBindBuffer(GL_COPY_WRITE_BUFFER, EBO.name());
+      glBufferSubData(GL_COPY_WRITE_BUFFER, offset, n,
+                      reinterpret_cast<const char *>(indices.data()) + offset);
+    }
+    uploadedBytes += n;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return uploaded();
+}
+
+auto Mesh::uploaded() const -> bool {
+  return static_cast<bool>(VAO) && uploadedBytes == vertices.size() * sizeof(Vertex) +
+                                     indices.size() * sizeof(uint);
+}
+
 auto Mesh::bindVAO() const -> void {
-  glBindVertexArray(VAO);
+  glBindVertexArray(VAO.name());
 }
 
 auto Mesh::bindTextures(const Shader &shader, uint offsetTexture = 0) -> void{
-  using namespace std::string_literals;
+  PROFILE_SCOPE("Mesh::bindTextures");
 
+  // Sampler names are formatted on the stack: this runs per mesh per pass
   uint diffuseN{1}, specularN{1}, normalN{1};
   for (uint i = offsetTexture; i < textures.size() + offsetTexture; i++) {
     glActiveTexture(GL_TEXTURE0 + i);
     uint idx = i - offsetTexture;
 
-    std::string name;
+    char name[48];
     switch (textures[idx].type) {
     case Texture::Type::Diffuse:
-      name = "texture_diffuse" + std::to_string(diffuseN++);
-      // std::clog <<name;
+      std::snprintf(name, sizeof name, "material.texture_diffuse%u",
+                    diffuseN++);
       break;
     case Texture::Type::Specular:
-      // static bool flg{false};
-      // if (!flg) {
-      //   std::clog << "spec unit: " << i << std::endl;
-      //   flg = true;
-      // }
-      name = "texture_specular" + std::to_string(specularN++);
-      // std::clog <<name;
+      std::snprintf(name, sizeof name, "material.texture_specular%u",
+                    specularN++);
       break;
     case Texture::Type::Normal:
-      name = "texture_normal" + std::to_string(normalN++);
-      // std::clog <<name;
+      std::snprintf(name, sizeof name, "material.texture_normal%u",
+                    normalN++);
       break;
-      // case
     default:
-      name = "INVALID";
+      std::snprintf(name, sizeof name, "material.INVALID");
       std::clog << "INVALIND NAME FOR TEXTURE: " << shader.id() << ':' << idx
                 << ", TYPE: " << textures[idx].type << std::endl;
     }
-    auto samplerLocation{glGetUniformLocation(shader.id(), ("material."s + name).c_str())};
-    // std::clog << "--> " << "material." + name << ": " << samplerLocation << std::endl;
+    auto samplerLocation{shader.getUniform(name)};
     glUniform1i(samplerLocation, i);
-    glBindTexture(GL_TEXTURE_2D, textures[idx].id);
+    glBindTexture(GL_TEXTURE_2D, textures[idx].id());
+    DefaultFrameStats.uniformUploads++;
+    DefaultFrameStats.textureBinds++;
   }
   glActiveTexture(GL_TEXTURE0);
 }
-auto Mesh::draw(GLenum drawMode=GL_TRIANGLES) -> void {
-  glDrawElements(drawMode, indices.size(), GL_UNSIGNED_INT, 0);
+
+// First packed texture of the given type, nullptr if the mesh has none.
+auto Mesh::layerOf(Texture::Type type) const -> const Texture * {
+  for (auto &t : textures)
+    if (t.type == type && t.layer >= 0)
+      return &t;
+  return nullptr;
+}
+
+// Texture-array counterpart of bindTextures: the pages are bound once per
+// model, so a mesh only selects its layers (-1 means "no such map").
+auto Mesh::bindLayers(GLint diffuseLayerLocation,
+                      GLint specularLayerLocation) const -> void {
+  auto *diffuse{layerOf(Texture::Type::Diffuse)};
+  auto *specular{layerOf(Texture::Type::Specular)};
+  glUniform1i(diffuseLayerLocation, diffuse ? diffuse->layer : -1);
+  glUniform1i(specularLayerLocation, specular ? specular->layer : -1);
+  DefaultFrameStats.uniformUploads += 2;
+}
+
+auto Mesh::draw(GLenum drawMode=GL_TRIANGLES) const -> void {
+  if (ranges.active) {
+    if (ranges.counts.empty())
+      return;
+    glMultiDrawElements(drawMode, ranges.counts.data(), indexType,
+                        ranges.offsets.data(), ranges.counts.size());
+    DefaultFrameStats.drawCalls++;
+    DefaultFrameStats.triangles += ranges.triangles;
+    return;
+  }
+  glDrawElements(drawMode, indexCount, indexType,
+                 reinterpret_cast<void *>(indexOffset));
+  DefaultFrameStats.drawCalls++;
+  DefaultFrameStats.triangles += indexCount / 3;
 }
 
 auto Mesh::bindDraw(const Shader& shader, uint offsetTexture = 0, GLenum drawMode=GL_TRIANGLES) -> void {
@@ -164,7 +383,7 @@ auto Mesh::destory() -> void {
     t.destory();
   for (auto &v : vertices)
     v.destory();
-  glDeleteBuffers(1, &VAO);
-  glDeleteBuffers(1, &EBO);
-  glDeleteBuffers(1, &VBO);
+  DefaultGpuRegistry.release(VAO);
+  DefaultGpuRegistry.release(EBO);
+  DefaultGpuRegistry.release(VBO);
 }
\ No newline at end of file
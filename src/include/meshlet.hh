@@ -0,0 +1,116 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "vertex.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// A run of consecutive triangles of a mesh's index buffer, small enough to
+// be culled on its own. Bounds are in object space.
+struct Meshlet {
+  uint firstIndex{0};
+  uint indexCount{0};
+  glm::vec3 center{0.0f}; // bounding sphere
+  float radius{0.0f};
+  // Normal cone: every face normal is within acos(sqrt(1 - cutoff^2)) of
+  // `coneAxis`. A cutoff of 1 marks a cone too wide to ever reject.
+  glm::vec3 coneAxis{0.0f, 0.0f, 1.0f};
+  float coneCutoff{1.0f};
+};
+
+constexpr std::size_t MESHLET_MAX_TRIANGLES = 124;
+constexpr std::size_t MESHLET_MAX_VERTICES = 64;
+
+// Splits `indices` (a triangle list) into meshlets without reordering it,
+// so a meshlet stays an index range of the buffer already uploaded.
+// Importers emit triangles in a spatially coherent order, which a greedy
+// pass turns into compact clusters: a meshlet closes when it reaches
+// MESHLET_MAX_TRIANGLES triangles or MESHLET_MAX_VERTICES distinct vertices,
+// or when a triangle turns more than 75 degrees away from the meshlet's
+// average normal, which would widen its cone past any use.
+inline auto buildMeshlets(const std::vector<Vertex> &vertices,
+                          const std::vector<uint> &indices)
+    -> std::vector<Meshlet> {
+  constexpr float SPLIT_COS{0.26f};
+  constexpr std::size_t MIN_TRIANGLES{16}; // before a normal split
+  std::vector<Meshlet> meshlets;
+  if (vertices.empty() || indices.size() < 3)
+    return meshlets;
+  meshlets.reserve(indices.size() / 3 / (MESHLET_MAX_TRIANGLES / 2) + 1);
+
+  auto faceNormal{[&](std::size_t t) {
+    const auto &a{vertices[indices[t]].position};
+    const auto &b{vertices[indices[t + 1]].position};
+    const auto &c{vertices[indices[t + 2]].position};
+    const glm::vec3 n{glm::cross(b - a, c - a)};
+    const float length{glm::length(n)};
+    return length > 0.0f ? n / length : glm::vec3(0.0f);
+  }};
+
+  // Bounds and cone of indices [first, last)
+  auto finish{[&](std::size_t first, std::size_t last) {
+    Meshlet m;
+    m.firstIndex = first;
+    m.indexCount = last - first;
+    glm::vec3 lo{vertices[indices[first]].position}, hi{lo};
+    for (auto i = first; i < last; i++) {
+      lo = glm::min(lo, vertices[indices[i]].position);
+      hi = glm::max(hi, vertices[indices[i]].position);
+    }
+    m.center = (lo + hi) * 0.5f;
+    for (auto i = first; i < last; i++)
+      m.radius = std::max(
+          m.radius, glm::length(vertices[indices[i]].position - m.center));
+
+    glm::vec3 sum{0.0f};
+    for (auto t = first; t < last; t += 3)
+      sum += faceNormal(t);
+    if (const float length{glm::length(sum)}; length > 0.0f) {
+      m.coneAxis = sum / length;
+      float minDot{1.0f};
+      for (auto t = first; t < last; t += 3) {
+        const glm::vec3 n{faceNormal(t)};
+        if (n != glm::vec3(0.0f)) // degenerate triangles face nowhere
+          minDot = std::min(minDot, glm::dot(m.coneAxis, n));
+      }
+      if (minDot > 0.0f)
+        m.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+    meshlets.push_back(m);
+  }};
+
+  std::vector<uint> used; // distinct vertices of the open meshlet
+  used.reserve(MESHLET_MAX_VERTICES);
+  glm::vec3 normalSum{0.0f};
+  std::size_t first{0};
+  const std::size_t end{indices.size() / 3 * 3};
+  for (std::size_t t = 0; t < end; t += 3) {
+    std::size_t added{0};
+    for (std::size_t k = 0; k < 3; k++)
+      if (std::find(used.begin(), used.end(), indices[t + k]) == used.end())
+        added++;
+    const std::size_t triangles{(t - first) / 3};
+    const glm::vec3 n{faceNormal(t)};
+    const bool turns{triangles >= MIN_TRIANGLES &&
+                     glm::dot(n, normalSum) <
+                         SPLIT_COS * glm::length(normalSum)};
+    if (triangles == MESHLET_MAX_TRIANGLES ||
+        used.size() + added > MESHLET_MAX_VERTICES || turns) {
+      finish(first, t);
+      first = t;
+      used.clear();
+      normalSum = glm::vec3(0.0f);
+    }
+    for (std::size_t k = 0; k < 3; k++)
+      if (std::find(used.begin(), used.end(), indices[t + k]) == used.end())
+        used.push_back(indices[t + k]);
+    normalSum += n;
+  }
+  if (first < end)
+    finish(first, end);
+  return meshlets;
+}
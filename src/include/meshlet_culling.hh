@@ -0,0 +1,174 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "meshlet.hh"
+#include "model.hh"
+#include "profiler.hh"
+
+#include <array>
+#include <chrono>
+#include <cmath>
+
+// Per-pass meshlet culling on the CPU: each meshlet of a model is tested
+// against the pass's frustum and, through its normal cone, against the face
+// the pass culls anyway. Survivors become the Mesh::ranges the next draws
+// submit; adjacent survivors merge into one range.
+//
+//   culler.beginFrame();
+//   culler.cull(MeshletCuller::Pass::Shadow, nanosuit, model, lightView);
+//   ... shadow draws ...
+//   MeshletCuller::reset(nanosuit); // before passes that aren't culled
+//
+// The shadow pass renders back faces (front faces are culled against peter
+// panning), so it rejects meshlets that face the light entirely, while the
+// camera pass rejects those facing away from the eye.
+class MeshletCuller {
+public:
+  enum class Pass { Shadow, Camera, Count };
+
+  struct View {
+    glm::mat4 viewProjection{1.0f};
+    // Perspective views test the cone against the eye, orthographic ones
+    // against the (constant) direction they look in.
+    bool orthographic{false};
+    glm::vec3 eye{0.0f};
+    glm::vec3 direction{0.0f, 0.0f, -1.0f};
+    GLenum culledFace{GL_BACK};
+
+    static auto perspective(const glm::mat4 &viewProjection,
+                            const glm::vec3 &eye, GLenum culledFace = GL_BACK)
+        -> View {
+      return View{viewProjection, false, eye, glm::vec3(0.0f, 0.0f, -1.0f),
+                  culledFace};
+    }
+    // `view` is an orthographic view matrix, e.g. Light::depthViewMatrix.
+    static auto directional(const glm::mat4 &viewProjection,
+                            const glm::mat4 &view, GLenum culledFace = GL_BACK)
+        -> View {
+      return View{viewProjection, true, glm::vec3(0.0f),
+                  -glm::vec3(glm::inverse(view)[2]), culledFace};
+    }
+  };
+
+  struct Stats {
+    uint meshlets{0};
+    uint facing{0};    // rejected by the normal cone
+    uint outside{0};   // rejected by the frustum
+    uint triangles{0}; // of the tested meshes
+    uint culledTriangles{0};
+    uint ranges{0};    // index ranges submitted
+    float cullMs{0.0f};
+
+    auto culledFraction() const -> float {
+      return triangles ? static_cast<float>(culledTriangles) / triangles
+                       : 0.0f;
+    }
+  };
+
+  auto beginFrame() -> void { stats_ = {}; }
+  // Sets Mesh::ranges on every mesh of `model` that has meshlets.
+  auto cull(Pass pass, Model &model, const glm::mat4 &modelMatrix,
+            const View &view) -> void;
+  // Back to whole-mesh draws.
+  static auto reset(Model &model) -> void;
+
+  auto stats(Pass pass) const -> const Stats & {
+    return stats_[static_cast<std::size_t>(pass)];
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+  std::array<Stats, static_cast<std::size_t>(Pass::Count)> stats_;
+};
+
+auto MeshletCuller::cull(Pass pass, Model &model, const glm::mat4 &modelMatrix,
+                         const View &view) -> void {
+  PROFILE_SCOPE("MeshletCuller::cull");
+  auto start{Clock::now()};
+  auto &stats{stats_[static_cast<std::size_t>(pass)]};
+
+  // Object-space frustum planes (Gribb & Hartmann), normalized so the
+  // sphere test works in object units
+  const glm::mat4 mvp{view.viewProjection * modelMatrix};
+  std::array<glm::vec4, 6> planes;
+  for (int i = 0; i < 3; i++) {
+    planes[2 * i] = glm::vec4(mvp[0][3] + mvp[0][i], mvp[1][3] + mvp[1][i],
+                              mvp[2][3] + mvp[2][i], mvp[3][3] + mvp[3][i]);
+    planes[2 * i + 1] =
+        glm::vec4(mvp[0][3] - mvp[0][i], mvp[1][3] - mvp[1][i],
+                  mvp[2][3] - mvp[2][i], mvp[3][3] - mvp[3][i]);
+  }
+  for (auto &p : planes)
+    p /= glm::length(glm::vec3(p));
+
+  // The cone test rejects faces pointing away from the viewer; when the
+  // pass culls front faces, flipping the axis rejects those instead.
+  const float flip{view.culledFace == GL_FRONT ? -1.0f : 1.0f};
+  const glm::mat4 toObject{glm::inverse(modelMatrix)};
+  const glm::vec3 eye{toObject * glm::vec4(view.eye, 1.0f)};
+  const glm::vec3 direction{
+      glm::normalize(glm::vec3(toObject * glm::vec4(view.direction, 0.0f)))};
+
+  for (auto &mesh : model.meshes) {
+    auto &ranges{mesh.ranges};
+    ranges.active = !mesh.meshlets.empty();
+    if (!ranges.active)
+      continue;
+    // Sized once; later frames reuse the capacity
+    ranges.counts.reserve(mesh.meshlets.size());
+    ranges.offsets.reserve(mesh.meshlets.size());
+    ranges.counts.clear();
+    ranges.offsets.clear();
+    ranges.triangles = 0;
+    uint rangeEnd{0}; // index one past the last range, for merging
+    for (auto &m : mesh.meshlets) {
+      stats.meshlets++;
+      stats.triangles += m.indexCount / 3;
+
+      bool inside{true};
+      for (auto &p : planes)
+        if (glm::dot(glm::vec3(p), m.center) + p.w < -m.radius) {
+          inside = false;
+          break;
+        }
+      if (!inside) {
+        stats.outside++;
+        stats.culledTriangles += m.indexCount / 3;
+        continue;
+      }
+      const glm::vec3 axis{flip * m.coneAxis};
+      const bool facing{
+          view.orthographic
+              ? glm::dot(direction, axis) > m.coneCutoff
+              : glm::dot(m.center - eye, axis) >=
+                    m.coneCutoff * glm::length(m.center - eye) + m.radius};
+      if (facing) {
+        stats.facing++;
+        stats.culledTriangles += m.indexCount / 3;
+        continue;
+      }
+
+      if (!ranges.counts.empty() && rangeEnd == m.firstIndex)
+        ranges.counts.back() += m.indexCount;
+      else {
+        ranges.counts.push_back(m.indexCount);
+        // meshlets only exist for meshes with their own u32 index buffer
+        ranges.offsets.push_back(
+            reinterpret_cast<const void *>(m.firstIndex * sizeof(uint)));
+      }
+      rangeEnd = m.firstIndex + m.indexCount;
+      ranges.triangles += m.indexCount / 3;
+    }
+    stats.ranges += ranges.counts.size();
+  }
+  stats.cullMs +=
+      std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+auto MeshletCuller::reset(Model &model) -> void {
+  for (auto &mesh : model.meshes)
+    mesh.ranges.active = false;
+}
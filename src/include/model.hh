@@ -4,21 +4,46 @@
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+#include "animation.hh"
+#include "glb.hh"
 #include "mesh.hh"
 #include "shader.hh"
 #include "texture.hh"
 #include "vertex.hh"
 #include "utils.hh"
 #include "texture_repo.hh"
+#include "profiler.hh"
+#include "thread_pool.hh"
+#include "upload_budget.hh"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 namespace fs = std::filesystem;
 
 class Model {
 public:
+  // Tag: import and decode on a background thread, then stream the GL uploads
+  // through pumpUploads() from the render thread.
+  struct Async {};
+  // Tag: load .glb files through Assimp too instead of the native loader.
+  struct ViaAssimp {};
+
   Model(const fs::path &file) { loadModel(file); }
+  Model(const fs::path &file, Async);
+  Model(const fs::path &file, ViaAssimp) : viaAssimp{true} { loadModel(file); }
+  // Meshes built elsewhere and already resident (GpuSkinning's characters).
+  explicit Model(std::vector<Mesh> &&meshes);
+  ~Model();
   // COPY
   Model(const Model& other) = delete;
   Model& operator=(const Model& other) = delete;
@@ -28,48 +53,357 @@ public:
 
   auto destory() -> void;
 
+  // Render thread only. Uploads staged textures and meshes until `budget` is
+  // spent; a mesh joins `meshes` (and becomes drawable) once it is complete.
+  // Returns true when the whole model is resident.
+  auto pumpUploads(UploadBudget &budget) -> bool;
+  auto ready() const -> bool;
+  // The loader thread is still importing: destory() would wait for it.
+  auto importing() const -> bool {
+    return loader.joinable() && !imported.load(std::memory_order_acquire);
+  }
+  // Once ready(): what the meshes keep CPU-side, and their GL buffers and
+  // textures, each shared object counted once. Textures shared with other
+  // models count in each of them.
+  auto cpuBytes() const -> std::size_t;
+  auto gpuBytes() const -> std::size_t;
+
   auto draw(Shader &shader, uint offsetTexture, GLenum drawMode) -> void;
   auto drawWithoutVAOBinding(Shader &shader, uint offsetTexture, GLenum drawMode) -> void;
   auto drawWihtoutTextureBinding(GLenum drawMode) -> void ;
+  auto drawLayered(Shader &shader, uint offsetTexture, GLenum drawMode) -> void;
+  // Binds one mesh's material as draw() would, for draws that don't go
+  // through the mesh itself (IndirectBatch).
+  auto bindMaterial(Shader &shader, std::size_t mesh, uint offsetTexture)
+      -> void;
 
   // protected:
   std::vector<Mesh> meshes;
   fs::path directory;
+  // Node hierarchy and clips, for models with bones or animations (Assimp
+  // imports only)
+  std::unique_ptr<Skeleton> skeleton;
 
   auto loadModel(const fs::path &file) -> void;
-  auto processNode(aiNode *node, const aiScene *scene) -> void;
-  auto processMesh(aiMesh *mesh, const aiScene *scene) -> Mesh;
-  auto loadMaterialTextures(aiMaterial *mat, aiTextureType type) -> std::vector<Texture>;
+  auto importModel(const fs::path &file) -> void;
+  auto importGLB(const fs::path &file) -> bool;
+  auto processNode(aiNode *node, const aiScene *scene,
+                   std::vector<const aiMesh *> &sources) -> void;
+  static auto processMesh(const aiMesh *mesh) -> Mesh;
+  auto loadMaterialTextures(aiMaterial *mat, aiTextureType type) -> void;
+
+private:
+  // CPU-side result of importModel(), consumed by pumpUploads().
+  struct StagedTexture {
+    Texture::Type type;
+    std::string path;
+  };
+  struct StagedMesh {
+    Mesh mesh;
+    std::vector<StagedTexture> textures;
+  };
+  std::vector<StagedMesh> stagedMeshes;
+  std::vector<StagedImage> stagedImages;
+  std::size_t nextImage{0}, nextMesh{0};
+  // Uploaded textures, held until every mesh has attached its own
+  // references so the repository can't evict them in between
+  std::vector<TextureHandle> heldTextures;
+  auto releaseHeldTextures() -> void;
+
+  // Native GLB path: the file stays mapped until its binary chunk has been
+  // uploaded to glbBuffer, which every direct primitive's mesh then shares.
+  bool viaAssimp{false};
+  std::unique_ptr<GlbFile> glb;
+  BufferHandle glbBuffer{};
+  std::size_t glbUploaded{0};
+  auto pumpGLB(UploadBudget &budget) -> bool;
+  auto glbImageName(int image) const -> std::string;
+  auto attachTextures(Mesh &mesh, const std::vector<StagedTexture> &textures)
+      -> void;
+
+  std::thread loader;
+  std::atomic<bool> imported{false};
 };
- 
+
+Model::Model(const fs::path &file, Async) {
+  loader = std::thread{[this, file] { importModel(file); }};
+}
+
+Model::Model(std::vector<Mesh> &&meshes) : meshes{std::move(meshes)} {
+  imported.store(true, std::memory_order_release);
+}
+
+Model::~Model() {
+  if (loader.joinable())
+    loader.join();
+}
+
 Model& Model::operator=(Model&& other){
   if (this != &other) {
+    destory(); // joins this model's own import first
+    if (other.loader.joinable()) // never move a half-written staging area
+      other.loader.join();
     meshes = std::move(other.meshes);
     directory = std::move(other.directory);
+    skeleton = std::move(other.skeleton);
+    stagedMeshes = std::move(other.stagedMeshes);
+    stagedImages = std::move(other.stagedImages);
+    heldTextures = std::move(other.heldTextures);
+    nextImage = other.nextImage;
+    nextMesh = other.nextMesh;
+    viaAssimp = other.viaAssimp;
+    glb = std::move(other.glb);
+    glbBuffer = std::exchange(other.glbBuffer, {});
+    glbUploaded = other.glbUploaded;
+    imported.store(other.imported.load());
   }
   return *this;
 }
 
 auto Model::destory() -> void {
+  if (loader.joinable())
+    loader.join();
   for (auto &m: meshes)
     m.destory();
+  for (std::size_t i = nextMesh; i < stagedMeshes.size(); i++)
+    stagedMeshes[i].mesh.destory();
+  for (std::size_t i = nextImage; i < stagedImages.size(); i++) {
+    stbi_image_free(stagedImages[i].data);
+    DefaultGpuRegistry.release(stagedImages[i].texture);
+  }
+  stagedMeshes.clear();
+  stagedImages.clear();
+  releaseHeldTextures();
+  DefaultGpuRegistry.release(glbBuffer);
+  glb.reset();
+}
+
+auto Model::ready() const -> bool {
+  return imported.load(std::memory_order_acquire) &&
+         nextImage == stagedImages.size() && nextMesh == stagedMeshes.size() &&
+         !glb;
+}
+
+auto Model::cpuBytes() const -> std::size_t {
+  std::size_t bytes{0};
+  for (auto &m : meshes)
+    bytes += m.cpuBytes();
+  return bytes;
+}
+
+auto Model::gpuBytes() const -> std::size_t {
+  // GLB meshes share one buffer, and meshes their textures
+  std::vector<std::uint32_t> buffers, textures;
+  std::size_t bytes{0};
+  auto once{[&](std::vector<std::uint32_t> &seen, std::uint32_t index) {
+    if (!index || std::find(seen.begin(), seen.end(), index) != seen.end())
+      return false;
+    seen.push_back(index);
+    return true;
+  }};
+  for (auto &m : meshes) {
+    for (auto buffer : {m.vertexBuffer(), m.indexBuffer()})
+      if (once(buffers, buffer.index))
+        bytes += DefaultGpuRegistry.bytes(buffer);
+    for (auto &t : m.textures)
+      if (once(textures, t.handle.index))
+        bytes += DefaultGpuRegistry.bytes(t.handle);
+  }
+  return bytes;
+}
+
+auto Model::pumpUploads(UploadBudget &budget) -> bool {
+  if (!imported.load(std::memory_order_acquire))
+    return false;
+  PROFILE_SCOPE("Model::pumpUploads");
+  // Textures first: a mesh resolves its texture slots when it is published.
+  for (; nextImage < stagedImages.size(); nextImage++) {
+    if (!DefaultTexRepo.upload(stagedImages[nextImage], budget))
+      return false;
+    heldTextures.push_back(DefaultTexRepo.retain(stagedImages[nextImage].path));
+  }
+  if (glb && !pumpGLB(budget))
+    return false;
+  for (; nextMesh < stagedMeshes.size(); nextMesh++) {
+    auto &staged{stagedMeshes[nextMesh]};
+    if (!staged.mesh.uploadSlice(budget))
+      return false;
+    attachTextures(staged.mesh, staged.textures);
+    meshes.push_back(std::move(staged.mesh));
+  }
+  if (!stagedMeshes.empty()) {
+    stagedMeshes.clear();
+    stagedImages.clear();
+    nextMesh = nextImage = 0;
+  }
+  releaseHeldTextures();
+  return true;
 }
 
+auto Model::releaseHeldTextures() -> void {
+  for (auto &t : heldTextures)
+    DefaultGpuRegistry.release(t);
+  heldTextures.clear();
+}
+
+auto Model::attachTextures(Mesh &mesh,
+                           const std::vector<StagedTexture> &textures) -> void {
+  for (auto &t : textures) {
+    auto slot{DefaultTexRepo.getSlot(t.path)};
+    mesh.textures.push_back(Texture{DefaultGpuRegistry.retain(slot.texture),
+                                    t.type, slot.page, slot.layer});
+  }
+}
+
+auto Model::glbImageName(int image) const -> std::string {
+  return directory.string() + "#image" + std::to_string(image);
+}
+
+// Copies the spans of the mapped binary chunk that direct primitives read
+// into one GL buffer, UploadBudget::CHUNK at a time and without repacking,
+// then publishes a mesh per direct primitive reading its attributes and
+// indices at their offsets in that buffer.
+auto Model::pumpGLB(UploadBudget &budget) -> bool {
+  PROFILE_SCOPE("Model::pumpGLB");
+  const auto data{glb->bin().first};
+  const auto size{glb->bufferSize};
+  const bool direct{std::any_of(glb->primitives.begin(), glb->primitives.end(),
+                                [](auto &p) { return p.direct; })};
+  if (direct) {
+    if (!glbBuffer) {
+      glbBuffer = DefaultGpuRegistry.create<GpuKind::Buffer>(size);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, glbBuffer.name());
+      glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, glbBuffer.name());
+    while (glbUploaded < size && !budget.exhausted()) {
+      // the span holding the next byte of the buffer
+      auto &span{*(std::upper_bound(glb->spans.begin(), glb->spans.end(),
+                                    glbUploaded,
+                                    [](std::size_t at, const auto &s) {
+                                      return at < s.offset;
+                                    }) -
+                   1)};
+      auto n{budget.take(span.offset + span.size - glbUploaded)};
+      glBufferSubData(GL_COPY_WRITE_BUFFER, glbUploaded, n,
+                      data + span.source + (glbUploaded - span.offset));
+      glbUploaded += n;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if (glbUploaded < size)
+      return false;
+  }
+
+  for (auto &p : glb->primitives) {
+    if (!p.direct)
+      continue;
+    Mesh::External external{DefaultGpuRegistry.retain(glbBuffer), {},
+                            p.indexType, p.indexOffset, p.indexCount,
+                            p.boundsMin, p.boundsMax};
+    for (std::size_t i = 0; i < external.attributes.size(); i++) {
+      auto &a{p.attributes[i]};
+      external.attributes[i] = Mesh::Attribute{a.components, a.type,
+                                               a.normalized, a.stride, a.offset};
+    }
+    Mesh mesh{external};
+    if (p.image >= 0)
+      attachTextures(mesh, {StagedTexture{Texture::Type::Diffuse,
+                                          glbImageName(p.image)}});
+    meshes.push_back(std::move(mesh));
+  }
+  DefaultGpuRegistry.release(glbBuffer); // the meshes hold their own
+  glbUploaded = 0;
+  glb.reset(); // unmaps the file
+  return true;
+}
 
 auto Model::draw(Shader &shader, uint offsetTexture = 0, GLenum drawMode=GL_TRIANGLES) -> void {
+  PROFILE_SCOPE("Model::draw");
+  PROFILE_GPU_SCOPE("Model::draw");
+  if (DefaultTexRepo.mode() == TextureRepository::Mode::Array) {
+    drawLayered(shader, offsetTexture, drawMode);
+    return;
+  }
   for (uint i = 0; i < meshes.size(); i++)
-    meshes[i].bindDraw(shader, offsetTexture, drawMode);
+    if (!meshes[i].culled)
+      meshes[i].bindDraw(shader, offsetTexture, drawMode);
 }
 
+// Texture-array path: the diffuse page goes to unit `offsetTexture`, the
+// specular page to the next one. Pages are only rebound when a mesh's page
+// differs from the one already bound, so a model whose maps share a size and
+// format is drawn with a single set of bindings.
+auto Model::drawLayered(Shader &shader, uint offsetTexture = 0, GLenum drawMode=GL_TRIANGLES) -> void {
+  glUniform1i(shader.getUniform("material.diffuse_page"), offsetTexture);
+  glUniform1i(shader.getUniform("material.specular_page"), offsetTexture + 1);
+  auto diffuseLayerLocation{shader.getUniform("material.diffuse_layer")};
+  auto specularLayerLocation{shader.getUniform("material.specular_layer")};
+  DefaultFrameStats.uniformUploads += 2;
+
+  std::array<GLuint, 2> boundPage{0, 0}; // diffuse, specular
+  auto bindPage{[&](uint slot, const Texture *t) {
+    if (!t)
+      return;
+    auto id{DefaultTexRepo.pageId(t->page)};
+    if (id == boundPage[slot])
+      return;
+    glActiveTexture(GL_TEXTURE0 + offsetTexture + slot);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+    boundPage[slot] = id;
+    DefaultFrameStats.textureBinds++;
+  }};
+
+  for (auto &m : meshes) {
+    if (m.culled)
+      continue;
+    bindPage(0, m.layerOf(Texture::Type::Diffuse));
+    bindPage(1, m.layerOf(Texture::Type::Specular));
+    m.bindVAO();
+    m.bindLayers(diffuseLayerLocation, specularLayerLocation);
+    m.draw(drawMode);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+auto Model::bindMaterial(Shader &shader, std::size_t mesh, uint offsetTexture = 0)
+    -> void {
+  if (mesh >= meshes.size())
+    return;
+  auto &m{meshes[mesh]};
+  if (DefaultTexRepo.mode() != TextureRepository::Mode::Array) {
+    m.bindTextures(shader, offsetTexture);
+    return;
+  }
+  glUniform1i(shader.getUniform("material.diffuse_page"), offsetTexture);
+  glUniform1i(shader.getUniform("material.specular_page"), offsetTexture + 1);
+  DefaultFrameStats.uniformUploads += 2;
+  uint slot{0};
+  for (auto *t : {m.layerOf(Texture::Type::Diffuse),
+                  m.layerOf(Texture::Type::Specular)}) {
+    if (t) {
+      glActiveTexture(GL_TEXTURE0 + offsetTexture + slot);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, DefaultTexRepo.pageId(t->page));
+      DefaultFrameStats.textureBinds++;
+    }
+    slot++;
+  }
+  glActiveTexture(GL_TEXTURE0);
+  m.bindLayers(shader.getUniform("material.diffuse_layer"),
+               shader.getUniform("material.specular_layer"));
+}
 
 auto Model::drawWithoutVAOBinding(Shader &shader, uint offsetTexture = 0, GLenum drawMode=GL_TRIANGLES) -> void {
   for (uint i = 0; i < meshes.size(); i++) {
     auto &m{meshes[i]};
+    if (m.culled)
+      continue;
     m.bindTextures(shader, offsetTexture);
     m.draw(drawMode);
   }
 }
 
+// Ignores Mesh::culled: used by the shadow pass, where meshes hidden from the
+// camera still cast shadows.
 auto Model::drawWihtoutTextureBinding(GLenum drawMode=GL_TRIANGLES) -> void {
   for (uint i = 0; i < meshes.size(); i++){
     auto& m{meshes[i]};
@@ -79,97 +413,226 @@ auto Model::drawWihtoutTextureBinding(GLenum drawMode=GL_TRIANGLES) -> void {
 }
 
 auto Model::loadModel(const fs::path &file) -> void {
+  PROFILE_SCOPE("Model::loadModel");
+  importModel(file);
+  auto budget{UploadBudget::unlimited()};
+  pumpUploads(budget);
+}
+
+// Assimp import, vertex conversion and texture decode. Touches no GL state,
+// so it can run on the loader thread. The node walk only records meshes and
+// material paths; converting the meshes and decoding the images then runs
+// on a thread pool, one task per mesh or image.
+auto Model::importModel(const fs::path &file) -> void {
+  PROFILE_SCOPE("Model::importModel");
+  if (!viaAssimp && file.extension() == ".glb" && importGLB(file))
+    return;
   Assimp::Importer importer;
   const aiScene *scene{importer.ReadFile(
       file.c_str(), aiProcess_Triangulate | aiProcess_GenNormals |
                                 // aiProcessPreset_TargetRealtime_Fast|
-                        aiProcess_FlipUVs | aiProcess_OptimizeGraph)};
+                        aiProcess_FlipUVs | aiProcess_OptimizeGraph |
+                        aiProcess_LimitBoneWeights)};
   if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
       !scene->mRootNode) {
     std::cerr << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
+    imported.store(true, std::memory_order_release);
     return;
   }
   directory = file.root_path() / file.relative_path(); //
-  processNode(scene->mRootNode, scene);
-  std::clog << "LOG::Model::\"Loading Model Successful\": "
-            << file << std::endl;
+  skeleton = Skeleton::fromAssimp(scene);
+  std::vector<const aiMesh *> sources;
+  processNode(scene->mRootNode, scene, sources);
+
+  std::vector<std::string> paths;
+  std::unordered_set<std::string> seen;
+  for (auto &m : stagedMeshes)
+    for (auto &t : m.textures)
+      if (seen.insert(t.path).second)
+        paths.push_back(t.path);
+  stagedImages.resize(paths.size());
+
+  auto start{std::chrono::steady_clock::now()};
+  {
+    ThreadPool pool;
+    // Biggest first, so one large mesh doesn't finish alone at the end
+    std::vector<std::size_t> order(sources.size());
+    for (std::size_t i = 0; i < order.size(); i++)
+      order[i] = i;
+    std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+      return sources[a]->mNumVertices > sources[b]->mNumVertices;
+    });
+    for (auto i : order)
+      pool.submit([this, &sources, i] {
+        stagedMeshes[i].mesh = processMesh(sources[i]);
+      });
+    for (std::size_t i = 0; i < paths.size(); i++)
+      pool.submit([this, &paths, i] {
+        stagedImages[i] = StagedImage::decode(paths[i]);
+      });
+    pool.wait();
+  }
+  std::chrono::duration<float, std::milli> convert{
+      std::chrono::steady_clock::now() - start};
+  imported.store(true, std::memory_order_release);
+  std::clog << "LOG::Model::\"Loading Model Successful\": " << file << ", "
+            << sources.size() << " meshes and " << paths.size()
+            << " images converted in " << convert.count() << " ms";
+  if (skeleton)
+    std::clog << ", " << skeleton->nodes.size() << " nodes and "
+              << skeleton->clips.size() << " animations";
+  std::clog << std::endl;
+}
+
+// Native counterpart of the Assimp import for binary glTF: maps the file,
+// validates it and stages only what can't be used in place. Embedded images
+// are decoded straight from the mapping and primitives the renderer can't
+// read directly are repacked, both on a thread pool. Returns false, and
+// leaves the Assimp path to try, if the file isn't usable.
+auto Model::importGLB(const fs::path &file) -> bool {
+  PROFILE_SCOPE("Model::importGLB");
+  auto start{std::chrono::steady_clock::now()};
+  glb = GlbFile::open(file);
+  if (!glb)
+    return false;
+  directory = file.root_path() / file.relative_path();
+
+  std::vector<std::size_t> repacked;
+  for (std::size_t i = 0; i < glb->primitives.size(); i++)
+    if (!glb->primitives[i].direct)
+      repacked.push_back(i);
+  stagedImages.resize(glb->images.size());
+  {
+    ThreadPool pool;
+    for (auto i : repacked)
+      pool.submit([this, i] { glb->repack(i); });
+    for (std::size_t i = 0; i < glb->images.size(); i++)
+      pool.submit([this, i] {
+        auto &image{glb->images[i]};
+        stagedImages[i] =
+            StagedImage::decodeMemory(glbImageName(i), image.data, image.size);
+      });
+    pool.wait();
+  }
+  for (auto i : repacked) {
+    auto &p{glb->primitives[i]};
+    StagedMesh staged{Mesh{std::move(p.vertices), std::move(p.indices),
+                           Mesh::Deferred{}},
+                      {}};
+    if (p.image >= 0)
+      staged.textures.push_back(
+          StagedTexture{Texture::Type::Diffuse, glbImageName(p.image)});
+    stagedMeshes.push_back(std::move(staged));
+  }
+  std::chrono::duration<float, std::milli> elapsed{
+      std::chrono::steady_clock::now() - start};
+  imported.store(true, std::memory_order_release);
+  std::clog << "LOG::Model::\"Loading GLB Successful\": " << file << ", "
+            << glb->primitives.size() - repacked.size() << " direct and "
+            << repacked.size() << " repacked primitives, "
+            << glb->images.size() << " images in " << elapsed.count() << " ms"
+            << std::endl;
+  return true;
 }
 
-auto Model::processNode(aiNode *node, const aiScene *scene) -> void {
+// Serial part of the import: one staging slot per mesh, in traversal order,
+// with its texture paths. processMesh() fills the slots afterwards.
+auto Model::processNode(aiNode *node, const aiScene *scene,
+                        std::vector<const aiMesh *> &sources) -> void {
   // process meshes
   for (uint i = 0; i < node->mNumMeshes; i++) {
     aiMesh *mesh{scene->mMeshes[node->mMeshes[i]]};
-    meshes.push_back(processMesh(mesh, scene));
+    stagedMeshes.push_back(StagedMesh{Mesh{{}, {}, Mesh::Deferred{}}, {}});
+    sources.push_back(mesh);
+    if (mesh->mMaterialIndex != 0) {
+      auto *material{scene->mMaterials[mesh->mMaterialIndex]};
+      loadMaterialTextures(material, aiTextureType_DIFFUSE);
+      loadMaterialTextures(material, aiTextureType_SPECULAR);
+    }
   }
   // procss my children
   for (uint i = 0; i < node->mNumChildren; i++)
-    processNode(node->mChildren[i], scene);
+    processNode(node->mChildren[i], scene, sources);
 }
 
-auto Model::processMesh(aiMesh *mesh, const aiScene *scene) -> Mesh {
-  std::vector<Vertex> vertices(mesh->mNumVertices);
-  std::vector<uint> indices;
-  std::vector<Texture> textures;
-
-  for (uint i = 0; i < mesh->mNumVertices; i++) {
+// Pure conversion, safe to run on any thread. Both buffers are sized up
+// front; attributes are copied as raw floats, which the compiler turns into
+// wide moves, instead of building a glm vector per element.
+auto Model::processMesh(const aiMesh *mesh) -> Mesh {
+  const std::size_t n{mesh->mNumVertices};
+  std::vector<Vertex> vertices(n);
+  static_assert(sizeof(aiVector3D) == 3 * sizeof(float),
+                "aiVector3D must be three packed floats");
+  const auto *positions{reinterpret_cast<const float *>(mesh->mVertices)};
+  const auto *normals{reinterpret_cast<const float *>(mesh->mNormals)};
+  // I'll use only the first texture
+  const auto *uvs{reinterpret_cast<const float *>(mesh->mTextureCoords[0])};
+  for (std::size_t i = 0; i < n; i++) {
     auto &u{vertices[i]};
-    auto &v{mesh->mVertices[i]};
-    auto &n{mesh->mNormals[i]};
+    std::memcpy(&u.position.x, positions + 3 * i, 3 * sizeof(float));
+    if (normals)
+      std::memcpy(&u.normal.x, normals + 3 * i, 3 * sizeof(float));
+    else
+      u.normal = glm::vec3{0.0f};
+    if (uvs) // uvs are 3D in Assimp, keep x and y
+      std::memcpy(&u.texCoords.x, uvs + 3 * i, 2 * sizeof(float));
+    else
+      u.texCoords = glm::vec2{0.0f};
+  }
 
-    u.position = glm::vec3{v.x, v.y, v.z};
-    u.normal = glm::vec3{n.x, n.y, n.z};
+  std::size_t indexCount{0};
+  for (uint i = 0; i < mesh->mNumFaces; i++)
+    indexCount += mesh->mFaces[i].mNumIndices;
+  std::vector<uint> indices(indexCount);
+  auto *out{indices.data()};
+  for (uint i = 0; i < mesh->mNumFaces; i++) {
+    auto &face{mesh->mFaces[i]};
+    std::memcpy(out, face.mIndices, face.mNumIndices * sizeof(uint));
+    out += face.mNumIndices;
+  }
+  Mesh result{std::move(vertices), std::move(indices), Mesh::Deferred{}};
 
-    // I'll use only the first texture
-    if (mesh->mTextureCoords[0]) { // does mesh have any tex coords
-      auto &t{mesh->mTextureCoords[0][i]};
-      u.texCoords = glm::vec2{t.x, t.y};
-    } else
-      u.texCoords = glm::vec2{0, 0};
+  // aiProcess_LimitBoneWeights leaves at most four weights per vertex; the
+  // lightest is still replaced should a file carry more.
+  if (mesh->mNumBones) {
+    result.skin.resize(n);
+    for (uint b = 0; b < mesh->mNumBones; b++) {
+      auto *bone{mesh->mBones[b]};
+      result.bones.push_back(Mesh::Bone{bone->mName.C_Str(),
+                                        Skeleton::toGlm(bone->mOffsetMatrix)});
+      for (uint w = 0; w < bone->mNumWeights; w++) {
+        auto &skin{result.skin[bone->mWeights[w].mVertexId]};
+        float *weights{&skin.weights.x};
+        const auto slot{std::min_element(weights, weights + 4) - weights};
+        if (weights[slot] < bone->mWeights[w].mWeight) {
+          weights[slot] = bone->mWeights[w].mWeight;
+          skin.joints[slot] = static_cast<std::uint16_t>(b);
+        }
+      }
+    }
+    for (auto &skin : result.skin) {
+      const float sum{skin.weights.x + skin.weights.y + skin.weights.z +
+                      skin.weights.w};
+      if (sum > 0.0f)
+        skin.weights = skin.weights / sum;
+    }
   }
-  for (uint i = 0; i < mesh->mNumFaces; i++) { // HACK: bad allocations
-    auto &face{mesh->mFaces[i]};
-    for (uint j = 0; j < face.mNumIndices; j++)
-      indices.push_back(face.mIndices[j]);
-  }
-  if (mesh->mMaterialIndex != 0) {
-    auto *material{scene->mMaterials[mesh->mMaterialIndex]};
-    std::vector<Texture> diffuseMaps{
-        loadMaterialTextures(material, aiTextureType_DIFFUSE)};
-    textures.insert(end(textures), begin(diffuseMaps), end(diffuseMaps));
-    std::vector<Texture> specularMaps{
-        loadMaterialTextures(material, aiTextureType_SPECULAR)};
-    textures.insert(end(textures), begin(specularMaps), end(specularMaps));
-  }
-  // std::clog << "Vertices: " << vertices.size() << std::endl
-            // << "Indices: " << indices.size() << std::endl
-            // << "Textures: " << textures.size() << std::endl;
-
-  // for (std::size_t i = 0; i < 200; i++) {
-  //   auto &x = vertices[i];
-  //   std::clog << "(" << x.position.x << ", " << x.position.y << ", "
-  //             << x.position.z << ")" << std::endl;
-  // }
-  // for (std::size_t i = 0; i < 200; i++) {
-  //   auto &x = indices[i];
-  //   std::clog << x << ", ";
-  // }
-  // std::clog << std::endl;
-  return Mesh{vertices, indices, textures}; // Copy-Ellison
+  return result;
 }
 
+// Records the material's texture paths on the mesh being staged; decoding
+// happens once per path at the end of importModel().
 auto Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type)
-  -> std::vector<Texture> {
+  -> void {
   auto n{mat->GetTextureCount(type)};
-  std::vector<Texture> texes;
-  texes.resize(n);
+  auto &texes{stagedMeshes.back().textures};
 
   // std::clog << "[Model::loadMaterialTextures]Texture Count: " << n << std::endl;
   for (uint i = 0; i < n; i++) {
     aiString str;
-    auto &t{texes[i]};
+    StagedTexture t;
     mat->GetTexture(type, i, &str);
-    auto path = fs::path(directory).parent_path() / fs::path(str.C_Str());
-    t.id = DefaultTexRepo.get(path);
+    t.path = fs::path(directory).parent_path() / fs::path(str.C_Str());
     switch (type) {
     case aiTextureType_SPECULAR:
       t.type = Texture::Type::Specular;
@@ -183,6 +646,6 @@ auto Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type)
     default:
       t.type = Texture::Type::None;
     }
+    texes.push_back(std::move(t));
   }
-  return texes;
 }
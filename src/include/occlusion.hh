@@ -0,0 +1,194 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "cpu_rasterizer.hh"
+#include "model.hh"
+#include "profiler.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+// Software hierarchical-Z occlusion culling for the camera pass.
+//
+// Each frame, large occluders are rasterized at low resolution with the
+// CpuDepthRasterizer, a max-depth pyramid is built on top of the result, and
+// every mesh of the tested models gets its Mesh::culled flag set when its
+// screen-space bounds lie behind the pyramid:
+//
+//   culler.beginFrame(camera.prespective_matrix * camera.view_matrix);
+//   culler.addOccluder(cube, cube_model_matrix);
+//   culler.buildHiZ();
+//   culler.cull(nanosuit, nanosuit_model_matrix);
+class OcclusionCuller {
+public:
+  struct Stats {
+    uint tested{0};
+    uint occluded{0};  // behind the occluders
+    uint offscreen{0}; // bounds outside the viewport
+    std::size_t occluderTriangles{0};
+    float rasterMs{0.0f}; // addOccluder() + buildHiZ()
+    float testMs{0.0f};   // cull()
+
+    auto culled() const -> uint { return occluded + offscreen; }
+    auto costMs() const -> float { return rasterMs + testMs; }
+  };
+
+  OcclusionCuller(int width = 256, int height = 128,
+                  uint threads = std::thread::hardware_concurrency());
+
+  auto beginFrame(const glm::mat4 &viewProjection) -> void;
+  auto addOccluder(const Model &model, const glm::mat4 &modelMatrix) -> void;
+  auto buildHiZ() -> void;
+  // Sets Mesh::culled on every mesh of `model`; returns the number culled.
+  auto cull(Model &model, const glm::mat4 &modelMatrix) -> uint;
+  // Clears Mesh::culled, e.g. when culling gets switched off.
+  static auto reset(Model &model) -> void;
+
+  auto stats() const -> const Stats & { return stats_; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  CpuDepthRasterizer rasterizer;
+  glm::mat4 viewProjection{1.0f};
+  // levels[0] is the rasterized depth, each next level keeps the farthest
+  // depth of a 2x2 block of the previous one.
+  std::vector<std::vector<float>> levels;
+  std::vector<std::pair<int, int>> levelSizes;
+  Stats stats_;
+
+  auto visible(const Mesh &mesh, const glm::mat4 &mvp) -> bool;
+  static auto msSince(Clock::time_point start) -> float;
+};
+
+OcclusionCuller::OcclusionCuller(int width, int height, uint threads)
+    : rasterizer{width, height, threads} {
+  for (int w = width, h = height;; w = (w + 1) / 2, h = (h + 1) / 2) {
+    levelSizes.emplace_back(w, h);
+    levels.emplace_back(static_cast<std::size_t>(w) * h, 1.0f);
+    if (w == 1 && h == 1)
+      break;
+  }
+}
+
+auto OcclusionCuller::msSince(Clock::time_point start) -> float {
+  return std::chrono::duration<float, std::milli>(Clock::now() - start)
+      .count();
+}
+
+auto OcclusionCuller::beginFrame(const glm::mat4 &vp) -> void {
+  viewProjection = vp;
+  stats_ = Stats{};
+  rasterizer.clear();
+}
+
+// Occluders only need to be closed, front-facing geometry; back faces are
+// culled to halve the fill cost.
+auto OcclusionCuller::addOccluder(const Model &model,
+                                  const glm::mat4 &modelMatrix) -> void {
+  PROFILE_SCOPE("OcclusionCuller::addOccluder");
+  auto start{Clock::now()};
+  for (auto &m : model.meshes)
+    rasterizer.submit(m.vertices, m.indices, viewProjection * modelMatrix,
+                      CpuDepthRasterizer::Cull::Back);
+  stats_.rasterMs += msSince(start);
+}
+
+auto OcclusionCuller::buildHiZ() -> void {
+  PROFILE_SCOPE("OcclusionCuller::buildHiZ");
+  auto start{Clock::now()};
+  rasterizer.rasterize();
+  stats_.occluderTriangles = rasterizer.trianglesBinned;
+  levels[0] = rasterizer.depth();
+  for (std::size_t l = 1; l < levels.size(); l++) {
+    auto [pw, ph] = levelSizes[l - 1];
+    auto [w, h] = levelSizes[l];
+    auto &src{levels[l - 1]};
+    auto &dst{levels[l]};
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++) {
+        // odd sizes: the last column/row folds onto itself
+        const int x0{2 * x}, x1{std::min(2 * x + 1, pw - 1)};
+        const int y0{2 * y}, y1{std::min(2 * y + 1, ph - 1)};
+        dst[y * w + x] = std::max({src[y0 * pw + x0], src[y0 * pw + x1],
+                                   src[y1 * pw + x0], src[y1 * pw + x1]});
+      }
+  }
+  stats_.rasterMs += msSince(start);
+}
+
+// Projects the mesh's AABB, picks the pyramid level where its screen rect
+// spans at most 2x2 texels and compares the box's nearest depth against the
+// farthest occluder depth under it.
+auto OcclusionCuller::visible(const Mesh &mesh, const glm::mat4 &mvp) -> bool {
+  const auto &lo{mesh.boundsMin};
+  const auto &hi{mesh.boundsMax};
+  constexpr float inf{std::numeric_limits<float>::infinity()};
+  glm::vec2 rectMin{inf}, rectMax{-inf};
+  float nearest{inf};
+  for (int c = 0; c < 8; c++) {
+    glm::vec4 clip{mvp * glm::vec4(c & 1 ? hi.x : lo.x, c & 2 ? hi.y : lo.y,
+                                   c & 4 ? hi.z : lo.z, 1.0f)};
+    if (clip.w <= 1e-5f)
+      return true; // crosses the camera plane
+    glm::vec3 ndc{clip.x / clip.w, clip.y / clip.w, clip.z / clip.w};
+    rectMin = glm::min(rectMin, glm::vec2(ndc.x, ndc.y));
+    rectMax = glm::max(rectMax, glm::vec2(ndc.x, ndc.y));
+    nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+  }
+  if (rectMax.x < -1.0f || rectMin.x > 1.0f || rectMax.y < -1.0f ||
+      rectMin.y > 1.0f || nearest > 1.0f) {
+    stats_.offscreen++;
+    return false;
+  }
+  if (nearest < 0.0f)
+    return true; // in front of the near plane's depth, nothing can hide it
+
+  const auto [w, h] = levelSizes[0];
+  auto toPixel{[](float ndc, int size) {
+    return std::clamp(static_cast<int>((ndc * 0.5f + 0.5f) * size), 0,
+                      size - 1);
+  }};
+  int x0{toPixel(rectMin.x, w)}, x1{toPixel(rectMax.x, w)};
+  int y0{toPixel(rectMin.y, h)}, y1{toPixel(rectMax.y, h)};
+  std::size_t level{0};
+  while (level + 1 < levels.size() && (x1 - x0 > 1 || y1 - y0 > 1)) {
+    x0 /= 2, x1 /= 2, y0 /= 2, y1 /= 2;
+    level++;
+  }
+  const auto &hiz{levels[level]};
+  const int lw{levelSizes[level].first};
+  float farthest{0.0f};
+  for (int y = y0; y <= y1; y++)
+    for (int x = x0; x <= x1; x++)
+      farthest = std::max(farthest, hiz[y * lw + x]);
+  if (nearest > farthest) {
+    stats_.occluded++;
+    return false;
+  }
+  return true;
+}
+
+auto OcclusionCuller::cull(Model &model, const glm::mat4 &modelMatrix)
+    -> uint {
+  PROFILE_SCOPE("OcclusionCuller::cull");
+  auto start{Clock::now()};
+  const glm::mat4 mvp{viewProjection * modelMatrix};
+  uint culled{0};
+  for (auto &m : model.meshes) {
+    stats_.tested++;
+    m.culled = !visible(m, mvp);
+    culled += m.culled;
+  }
+  stats_.testMs += msSince(start);
+  return culled;
+}
+
+auto OcclusionCuller::reset(Model &model) -> void {
+  for (auto &m : model.meshes)
+    m.culled = false;
+}
@@ -4,21 +4,28 @@
 
 #include <glm/glm.hpp>
 
+#include "gpu_registry.hh"
+
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
 
 class Overlay {
   using v2 = glm::vec2;
   using Quad = std::array<v2, 4>;
 
 public:
-  GLuint VAO;
+  VertexArrayHandle VAO;
 
   Overlay(float);
   Overlay(Quad, float);
-  Overlay(Overlay &&) = default;
-  Overlay(const Overlay &) = default;
-  Overlay &operator=(Overlay &&) = default;
-  Overlay &operator=(const Overlay &) = default;
+  // Owns GL objects: movable, not copyable
+  Overlay(Overlay &&other) noexcept { *this = std::move(other); }
+  Overlay(const Overlay &) = delete;
+  Overlay &operator=(Overlay &&other) noexcept;
+  Overlay &operator=(const Overlay &) = delete;
   ~Overlay();
 
   auto destory() -> void;
@@ -28,7 +35,7 @@ public:
 private:
   Quad overlay_quad_vertices;
   Quad overlay_quad_uvs;
-  GLuint VBO_uv, VBO_pos;
+  BufferHandle VBO_uv, VBO_pos;
 
   auto setup(float) -> void;
 
@@ -51,24 +58,37 @@ Overlay::Overlay(Quad overlay_quad_vertices, float aspect_ratio)
 
 Overlay::~Overlay() {}
 
+Overlay &Overlay::operator=(Overlay &&other) noexcept {
+  if (this != &other) {
+    overlay_quad_vertices = other.overlay_quad_vertices;
+    overlay_quad_uvs = other.overlay_quad_uvs;
+    VAO = std::exchange(other.VAO, {});
+    VBO_uv = std::exchange(other.VBO_uv, {});
+    VBO_pos = std::exchange(other.VBO_pos, {});
+  }
+  return *this;
+}
+
 auto Overlay::setup(float aspect_ratio) -> void {
   for (auto &pos : overlay_quad_vertices)
     if (pos.y != -1.0f)
       pos.y /= aspect_ratio;
 
-  glGenVertexArrays(1, &VAO);
-  glBindVertexArray(VAO);
+  VAO = DefaultGpuRegistry.create<GpuKind::VertexArray>();
+  glBindVertexArray(VAO.name());
 
-  glGenBuffers(1, &VBO_uv);
-  glGenBuffers(1, &VBO_pos);
+  VBO_uv = DefaultGpuRegistry.create<GpuKind::Buffer>(
+      sizeof(v2) * overlay_quad_uvs.size());
+  VBO_pos = DefaultGpuRegistry.create<GpuKind::Buffer>(
+      sizeof(v2) * overlay_quad_vertices.size());
 
-  glBindBuffer(GL_ARRAY_BUFFER, VBO_pos);
+  glBindBuffer(GL_ARRAY_BUFFER, VBO_pos.name());
   glBufferData(GL_ARRAY_BUFFER, sizeof(v2) * overlay_quad_vertices.size(),
                overlay_quad_vertices.data(), GL_STATIC_DRAW);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
 
-  glBindBuffer(GL_ARRAY_BUFFER, VBO_uv);
+  glBindBuffer(GL_ARRAY_BUFFER, VBO_uv.name());
   glBufferData(GL_ARRAY_BUFFER, sizeof(v2) * overlay_quad_uvs.size(),
                overlay_quad_uvs.data(), GL_STATIC_DRAW);
   glEnableVertexAttribArray(1);
@@ -76,10 +96,111 @@ auto Overlay::setup(float aspect_ratio) -> void {
 }
 
 auto Overlay::destory() -> void {
-  glDeleteVertexArrays(1, &VAO);
-  glDeleteBuffers(1, &VBO_pos);
-  glDeleteBuffers(1, &VBO_uv);
+  DefaultGpuRegistry.release(VAO);
+  DefaultGpuRegistry.release(VBO_pos);
+  DefaultGpuRegistry.release(VBO_uv);
 }
 auto Overlay::draw() -> void {
   glDrawArrays(GL_TRIANGLE_STRIP, 0, overlay_quad_vertices.size());
 }
+
+// Screen-space quads in pixel coordinates (origin top-left), collected on
+// the CPU and drawn with a single glDrawElements. Vertex storage is sized
+// for `maxQuads` up front and the index buffer never changes, so filling a
+// frame's batch allocates nothing; quads past the capacity are dropped.
+//
+// Each quad samples `uvMin..uvMax` of whatever texture the caller binds and
+// is tinted by an RGBA8 color (0xAABBGGRR, i.e. bytes R, G, B, A in memory).
+class QuadBatch {
+public:
+  struct Vertex {
+    glm::vec2 position;
+    glm::vec2 uv;
+    std::uint32_t color;
+  };
+
+  explicit QuadBatch(std::size_t maxQuads);
+  QuadBatch(const QuadBatch &) = delete;
+  QuadBatch &operator=(const QuadBatch &) = delete;
+
+  auto destory() -> void;
+
+  auto clear() -> void { vertices.clear(); }
+  auto add(glm::vec2 min, glm::vec2 max, glm::vec2 uvMin, glm::vec2 uvMax,
+           std::uint32_t color) -> bool;
+  auto quads() const -> std::size_t { return vertices.size() / 4; }
+  // Uploads the batch and draws it, with the caller's program bound.
+  auto draw() -> void;
+
+private:
+  std::size_t maxQuads;
+  std::vector<Vertex> vertices; // capacity 4 * maxQuads, never exceeded
+  VertexArrayHandle VAO;
+  BufferHandle VBO, EBO;
+};
+
+QuadBatch::QuadBatch(std::size_t maxQuads) : maxQuads{maxQuads} {
+  vertices.reserve(4 * maxQuads);
+  std::vector<GLuint> indices;
+  indices.reserve(6 * maxQuads);
+  for (GLuint q = 0; q < maxQuads; q++)
+    for (GLuint i : {0u, 1u, 2u, 2u, 1u, 3u})
+      indices.push_back(4 * q + i);
+
+  GLint boundVAO;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &boundVAO);
+  VAO = DefaultGpuRegistry.create<GpuKind::VertexArray>();
+  glBindVertexArray(VAO.name());
+  VBO = DefaultGpuRegistry.create<GpuKind::Buffer>(4 * maxQuads *
+                                                   sizeof(Vertex));
+  glBindBuffer(GL_ARRAY_BUFFER, VBO.name());
+  glBufferData(GL_ARRAY_BUFFER, 4 * maxQuads * sizeof(Vertex), nullptr,
+               GL_STREAM_DRAW);
+  EBO = DefaultGpuRegistry.create<GpuKind::Buffer>(indices.size() *
+                                                   sizeof(GLuint));
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO.name());
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
+               indices.data(), GL_STATIC_DRAW);
+  // 0: pixel position, 1: uv, 2: color
+  for (uint i = 0; i < 3; i++)
+    glEnableVertexAttribArray(i);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, position)));
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, uv)));
+  glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex),
+                        reinterpret_cast<void *>(offsetof(Vertex, color)));
+  glBindVertexArray(boundVAO);
+}
+
+auto QuadBatch::destory() -> void {
+  DefaultGpuRegistry.release(VAO);
+  DefaultGpuRegistry.release(VBO);
+  DefaultGpuRegistry.release(EBO);
+}
+
+auto QuadBatch::add(glm::vec2 min, glm::vec2 max, glm::vec2 uvMin,
+                    glm::vec2 uvMax, std::uint32_t color) -> bool {
+  if (quads() >= maxQuads)
+    return false;
+  vertices.push_back(Vertex{min, uvMin, color});
+  vertices.push_back(Vertex{glm::vec2(max.x, min.y),
+                            glm::vec2(uvMax.x, uvMin.y), color});
+  vertices.push_back(Vertex{glm::vec2(min.x, max.y),
+                            glm::vec2(uvMin.x, uvMax.y), color});
+  vertices.push_back(Vertex{max, uvMax, color});
+  return true;
+}
+
+auto QuadBatch::draw() -> void {
+  if (vertices.empty())
+    return;
+  glBindVertexArray(VAO.name());
+  glBindBuffer(GL_ARRAY_BUFFER, VBO.name());
+  // orphan, so the driver never waits for last frame's draw
+  glBufferData(GL_ARRAY_BUFFER, 4 * maxQuads * sizeof(Vertex), nullptr,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(Vertex),
+                  vertices.data());
+  glDrawElements(GL_TRIANGLES, 6 * quads(), GL_UNSIGNED_INT, nullptr);
+}
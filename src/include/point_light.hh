@@ -0,0 +1,280 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "gpu_registry.hh"
+#include "model.hh"
+#include "profiler.hh"
+#include "shader.hh"
+#include "stats.hh"
+#include "uniform_ring.hh"
+
+#include <array>
+#include <iostream>
+#include <vector>
+
+// Omnidirectional shadows: a depth cubemap storing distance-to-light / far.
+//
+// Pass::Layered renders every caster once. point.geom routes each triangle
+// only to the faces whose frusta it touches (gl_Layer), and the CPU first
+// narrows that down per mesh with a face mask from its bounds. Pass::SixPass
+// is the naive reference: six framebuffer passes, each drawing every mesh.
+// The two passes need the matching programs (point.vert + point.geom, or
+// point_face.vert), both with point.frag.
+class PointLight {
+public:
+  enum class Pass { Layered, SixPass };
+
+  // A model drawn into the cubemap, with its Object block already pushed
+  // into the frame's UniformRing.
+  struct Caster {
+    const Model *model;
+    glm::mat4 modelMatrix;
+    GLintptr objectBlock;
+  };
+
+  struct PassStats {
+    uint draws{0};
+    uint meshes{0};        // caster meshes, drawn or culled from every face
+    uint faceRoutes{0};    // sum over meshes of the faces they are drawn to
+    float gpuMs{0.0f};     // latest GL_TIME_ELAPSED result for this pass
+  };
+
+  static constexpr int SHADOW_SIZE = 512;
+
+  glm::vec3 position;
+  float nearPlane, farPlane;
+
+  TextureHandle depthCubemap;
+  FramebufferHandle layeredFBO, faceFBO;
+
+  PointLight(const glm::vec3 &position = glm::vec3(1.0f, 2.0f, 1.0f),
+             float nearPlane = 0.1f, float farPlane = 25.0f);
+
+  auto destory() -> void;
+
+  auto faceMatrix(int face) const -> glm::mat4;
+  auto block() const -> PointLightBlock;
+  // Bit f is set when the mesh's bounds, under `modelMatrix`, intersect the
+  // frustum of cubemap face f.
+  auto faceMask(const Mesh &mesh, const glm::mat4 &modelMatrix) const -> uint;
+
+  // The `PointLight` uniform block must be bound for this frame.
+  auto render(const Shader &shader, const std::vector<Caster> &casters,
+              const UniformRing &uniforms, Pass pass) -> void;
+
+  auto stats(Pass pass) const -> const PassStats & {
+    return passes[static_cast<int>(pass)].stats;
+  }
+
+private:
+  struct PassState {
+    PassStats stats;
+    GLuint timer{0};
+    bool timerPending{false};
+  };
+  std::array<PassState, 2> passes;
+
+  auto setupDepthCubemap() -> bool;
+  auto renderLayered(const Shader &shader, const std::vector<Caster> &casters,
+                     const UniformRing &uniforms, PassStats &stats) -> void;
+  auto renderSixPass(const Shader &shader, const std::vector<Caster> &casters,
+                     const UniformRing &uniforms, PassStats &stats) -> void;
+};
+
+PointLight::PointLight(const glm::vec3 &position, float nearPlane,
+                       float farPlane)
+    : position{position}, nearPlane{nearPlane}, farPlane{farPlane} {
+  if (!setupDepthCubemap())
+    std::cerr << "ERROR::PointLight::setupDepthCubemap -> returned false."
+              << std::endl;
+  for (auto &p : passes)
+    glGenQueries(1, &p.timer);
+}
+
+auto PointLight::destory() -> void {
+  for (auto &p : passes)
+    glDeleteQueries(1, &p.timer);
+  DefaultGpuRegistry.release(depthCubemap);
+  DefaultGpuRegistry.release(layeredFBO);
+  DefaultGpuRegistry.release(faceFBO);
+}
+
+auto PointLight::setupDepthCubemap() -> bool {
+  // D24 is stored as 4 bytes per texel
+  depthCubemap = DefaultGpuRegistry.create<GpuKind::Texture>(
+      6 * SHADOW_SIZE * SHADOW_SIZE * 4);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap.name());
+  for (GLenum face = 0; face < 6; face++)
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0,
+                 GL_DEPTH_COMPONENT24, SHADOW_SIZE, SHADOW_SIZE, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+  bool complete{true};
+  // Whole cubemap attached: gl_Layer picks the face
+  layeredFBO = DefaultGpuRegistry.create<GpuKind::Framebuffer>();
+  glBindFramebuffer(GL_FRAMEBUFFER, layeredFBO.name());
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                       depthCubemap.name(), 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  complete = complete &&
+             glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  // One face at a time, re-attached by renderSixPass()
+  faceFBO = DefaultGpuRegistry.create<GpuKind::Framebuffer>();
+  glBindFramebuffer(GL_FRAMEBUFFER, faceFBO.name());
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                         GL_TEXTURE_CUBE_MAP_POSITIVE_X, depthCubemap.name(),
+                         0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  complete = complete &&
+             glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return complete;
+}
+
+auto PointLight::faceMatrix(int face) const -> glm::mat4 {
+  static const std::array<std::pair<glm::vec3, glm::vec3>, 6> axes{{
+      {glm::vec3(1, 0, 0), glm::vec3(0, -1, 0)},
+      {glm::vec3(-1, 0, 0), glm::vec3(0, -1, 0)},
+      {glm::vec3(0, 1, 0), glm::vec3(0, 0, 1)},
+      {glm::vec3(0, -1, 0), glm::vec3(0, 0, -1)},
+      {glm::vec3(0, 0, 1), glm::vec3(0, -1, 0)},
+      {glm::vec3(0, 0, -1), glm::vec3(0, -1, 0)},
+  }};
+  const auto &[forward, up] = axes[face];
+  return glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane) *
+         glm::lookAt(position, position + forward, up);
+}
+
+auto PointLight::block() const -> PointLightBlock {
+  PointLightBlock b;
+  for (int f = 0; f < 6; f++)
+    b.faceMatrices[f] = faceMatrix(f);
+  b.position = glm::vec4(position, 1.0f);
+  b.range = glm::vec4(nearPlane, farPlane, 0.0f, 0.0f);
+  return b;
+}
+
+auto PointLight::faceMask(const Mesh &mesh, const glm::mat4 &modelMatrix) const
+    -> uint {
+  const auto &lo{mesh.boundsMin};
+  const auto &hi{mesh.boundsMax};
+  uint mask{0};
+  for (int f = 0; f < 6; f++) {
+    const glm::mat4 mvp{faceMatrix(f) * modelMatrix};
+    // outcodes: a box is outside when all 8 corners fail the same plane
+    uint allOutside{0x3f};
+    for (int c = 0; c < 8 && allOutside; c++) {
+      glm::vec4 v{mvp * glm::vec4(c & 1 ? hi.x : lo.x, c & 2 ? hi.y : lo.y,
+                                  c & 4 ? hi.z : lo.z, 1.0f)};
+      uint outside{0};
+      outside |= (v.x < -v.w) << 0 | (v.x > v.w) << 1;
+      outside |= (v.y < -v.w) << 2 | (v.y > v.w) << 3;
+      outside |= (v.z < -v.w) << 4 | (v.z > v.w) << 5;
+      allOutside &= outside;
+    }
+    if (!allOutside)
+      mask |= 1u << f;
+  }
+  return mask;
+}
+
+auto PointLight::render(const Shader &shader,
+                        const std::vector<Caster> &casters,
+                        const UniformRing &uniforms, Pass pass) -> void {
+  PROFILE_SCOPE("PointLight::render");
+  PROFILE_GPU_SCOPE("PointLight::render");
+  auto &state{passes[static_cast<int>(pass)]};
+  // Read last frame's timer without stalling; skip timing while it's pending.
+  if (state.timerPending) {
+    GLint available{GL_FALSE};
+    glGetQueryObjectiv(state.timer, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      GLuint64 ns;
+      glGetQueryObjectui64v(state.timer, GL_QUERY_RESULT, &ns);
+      state.stats.gpuMs = ns * 1e-6f;
+      state.timerPending = false;
+    }
+  }
+  const bool timing{!state.timerPending};
+  if (timing)
+    glBeginQuery(GL_TIME_ELAPSED, state.timer);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glViewport(0, 0, SHADOW_SIZE, SHADOW_SIZE);
+  glUseProgram(shader.id());
+  auto gpuMs{state.stats.gpuMs};
+  state.stats = PassStats{};
+  state.stats.gpuMs = gpuMs;
+  if (pass == Pass::Layered)
+    renderLayered(shader, casters, uniforms, state.stats);
+  else
+    renderSixPass(shader, casters, uniforms, state.stats);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+  if (timing) {
+    glEndQuery(GL_TIME_ELAPSED);
+    state.timerPending = true;
+  }
+}
+
+auto PointLight::renderLayered(const Shader &shader,
+                               const std::vector<Caster> &casters,
+                               const UniformRing &uniforms, PassStats &stats)
+    -> void {
+  auto maskLocation{shader.getUniform("faceMask")};
+  glBindFramebuffer(GL_FRAMEBUFFER, layeredFBO.name());
+  glClear(GL_DEPTH_BUFFER_BIT);
+  for (auto &c : casters) {
+    uniforms.bind<ObjectBlock>(BlockBinding::Object, c.objectBlock);
+    stats.meshes += c.model->meshes.size();
+    for (auto &m : c.model->meshes) {
+      auto mask{faceMask(m, c.modelMatrix)};
+      if (!mask)
+        continue;
+      glUniform1i(maskLocation, mask);
+      m.bindVAO();
+      m.draw();
+      stats.draws++;
+      for (; mask; mask &= mask - 1)
+        stats.faceRoutes++;
+    }
+  }
+}
+
+auto PointLight::renderSixPass(const Shader &shader,
+                               const std::vector<Caster> &casters,
+                               const UniformRing &uniforms, PassStats &stats)
+    -> void {
+  auto faceLocation{shader.getUniform("face")};
+  glBindFramebuffer(GL_FRAMEBUFFER, faceFBO.name());
+  const GLuint cubemap{depthCubemap.name()};
+  for (GLenum f = 0; f < 6; f++) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                           GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, cubemap, 0);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glUniform1i(faceLocation, f);
+    for (auto &c : casters) {
+      uniforms.bind<ObjectBlock>(BlockBinding::Object, c.objectBlock);
+      for (auto &m : c.model->meshes) {
+        m.bindVAO();
+        m.draw();
+        stats.draws++;
+        stats.faceRoutes++;
+      }
+    }
+  }
+  for (auto &c : casters)
+    stats.meshes += c.model->meshes.size();
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+// Scoped CPU/GPU profiler with Chrome trace export.
+//
+// Build with -DSHADOW_PROFILE (cmake -DSHADOW_PROFILE=ON) to enable it;
+// otherwise every PROFILE_* macro expands to nothing and this header declares
+// no code at all.
+//
+//   PROFILE_SCOPE("Model::draw");      // CPU zone until end of scope
+//   PROFILE_GPU_SCOPE("Model::draw");  // GL_TIMESTAMP pair, render thread only
+//   PROFILE_FRAME();                   // once per frame: harvest GPU results
+//   PROFILE_EXPORT("trace.json");      // about:tracing / Perfetto JSON
+//
+// Zone names must be string literals; they are stored by pointer. With
+// SHADOW_ALLOC_TRACKING, PROFILE_SCOPE also opens an allocation zone
+// (alloc_tracker.hh), whether or not SHADOW_PROFILE is on.
+
+#include "alloc_tracker.hh"
+
+#ifdef SHADOW_PROFILE
+
+#include <glad/glad.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+namespace fs = std::filesystem;
+
+struct PendingGpuZone {
+  const char *name;
+  GLuint begin, end;
+  bool closed;
+};
+
+class Profiler {
+public:
+  struct Event {
+    const char *name;
+    std::uint32_t tid;  // GPU_TID for GPU zones
+    std::int64_t start; // ns on the steady_clock timeline
+    std::int64_t duration;
+  };
+
+  class CpuZone {
+  public:
+    CpuZone(const char *name);
+    ~CpuZone();
+
+  private:
+    const char *name;
+    std::int64_t start;
+  };
+
+  class GpuZone {
+  public:
+    GpuZone(const char *name);
+    ~GpuZone();
+
+  private:
+    PendingGpuZone *pending; // std::deque keeps it in place while open
+  };
+
+  static constexpr std::uint32_t GPU_TID = 0;
+
+  auto frame() -> void;
+  auto writeChromeTrace(const fs::path &path) -> bool;
+  auto destory() -> void;
+
+  static auto now() -> std::int64_t;
+  static auto threadId() -> std::uint32_t;
+
+private:
+  std::mutex eventsMutex;
+  std::vector<Event> events;
+
+  // Render thread only
+  std::deque<PendingGpuZone> pendingGpu;
+  std::vector<GLuint> freeQueries;
+  std::int64_t gpuToCpuOffset{0};
+  bool gpuClockSynced{false};
+  std::int64_t frameStart{-1};
+
+  auto record(const Event &e) -> void;
+  auto acquireQuery() -> GLuint;
+  auto collectGpu() -> void;
+};
+
+static Profiler DefaultProfiler;
+
+auto Profiler::now() -> std::int64_t {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+auto Profiler::threadId() -> std::uint32_t {
+  static std::atomic<std::uint32_t> next{1};
+  thread_local std::uint32_t id{next++};
+  return id;
+}
+
+auto Profiler::record(const Event &e) -> void {
+  std::lock_guard<std::mutex> lock{eventsMutex};
+  events.push_back(e);
+}
+
+Profiler::CpuZone::CpuZone(const char *name) : name{name}, start{now()} {}
+
+Profiler::CpuZone::~CpuZone() {
+  DefaultProfiler.record(Event{name, threadId(), start, now() - start});
+}
+
+auto Profiler::acquireQuery() -> GLuint {
+  if (freeQueries.empty()) {
+    std::array<GLuint, 16> q;
+    glGenQueries(q.size(), q.data());
+    freeQueries.insert(end(freeQueries), begin(q), end(q));
+  }
+  auto q{freeQueries.back()};
+  freeQueries.pop_back();
+  return q;
+}
+
+Profiler::GpuZone::GpuZone(const char *name) {
+  auto &p{DefaultProfiler};
+  if (!p.gpuClockSynced) {
+    GLint64 gpuNow;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    p.gpuToCpuOffset = now() - gpuNow;
+    p.gpuClockSynced = true;
+  }
+  PendingGpuZone z{name, p.acquireQuery(), p.acquireQuery(), false};
+  glQueryCounter(z.begin, GL_TIMESTAMP);
+  pending = &p.pendingGpu.emplace_back(z);
+}
+
+Profiler::GpuZone::~GpuZone() {
+  glQueryCounter(pending->end, GL_TIMESTAMP);
+  pending->closed = true;
+}
+
+// Harvests finished timestamp pairs in submission order and stops at the
+// first one the GPU has not reached yet, so this never stalls the pipeline.
+auto Profiler::collectGpu() -> void {
+  while (!pendingGpu.empty()) {
+    auto &z{pendingGpu.front()};
+    if (!z.closed)
+      break;
+    GLint available{GL_FALSE};
+    glGetQueryObjectiv(z.end, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      break;
+    GLuint64 t0, t1;
+    glGetQueryObjectui64v(z.begin, GL_QUERY_RESULT, &t0);
+    glGetQueryObjectui64v(z.end, GL_QUERY_RESULT, &t1);
+    record(Event{z.name, GPU_TID, static_cast<std::int64_t>(t0) + gpuToCpuOffset,
+                 static_cast<std::int64_t>(t1 - t0)});
+    freeQueries.push_back(z.begin);
+    freeQueries.push_back(z.end);
+    pendingGpu.pop_front();
+  }
+}
+
+auto Profiler::frame() -> void {
+  auto t{now()};
+  if (frameStart >= 0)
+    record(Event{"frame", threadId(), frameStart, t - frameStart});
+  frameStart = t;
+  collectGpu();
+}
+
+auto Profiler::writeChromeTrace(const fs::path &path) -> bool {
+  std::ofstream out{path};
+  if (!out) {
+    std::cerr << "ERROR::Profiler::writeChromeTrace -> cannot open " << path
+              << std::endl;
+    return false;
+  }
+  std::lock_guard<std::mutex> lock{eventsMutex};
+  out << "{\"traceEvents\":[\n"
+      << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << GPU_TID
+      << ",\"args\":{\"name\":\"GPU\"}}";
+  for (auto &e : events)
+    out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\""
+        << (e.tid == GPU_TID ? "gpu" : "cpu")
+        << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.tid
+        << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << e.duration / 1000.0
+        << '}';
+  out << "\n]}\n";
+  std::clog << "LOG::Profiler::\"Writing Trace Successful\": " << path << " ("
+            << events.size() << " events)" << std::endl;
+  return true;
+}
+
+auto Profiler::destory() -> void {
+  collectGpu();
+  for (auto &z : pendingGpu) {
+    freeQueries.push_back(z.begin);
+    freeQueries.push_back(z.end);
+  }
+  pendingGpu.clear();
+  glDeleteQueries(freeQueries.size(), freeQueries.data());
+  freeQueries.clear();
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name)                                                    \
+  Profiler::CpuZone PROFILE_CONCAT(profile_zone_, __LINE__){name};             \
+  ALLOC_ZONE(name)
+#define PROFILE_GPU_SCOPE(name)                                                \
+  Profiler::GpuZone PROFILE_CONCAT(profile_gpu_zone_, __LINE__) { name }
+#define PROFILE_FRAME() DefaultProfiler.frame()
+#define PROFILE_EXPORT(path) DefaultProfiler.writeChromeTrace(path)
+#define PROFILE_DESTORY() DefaultProfiler.destory()
+
+#else
+
+#define PROFILE_SCOPE(name) ALLOC_ZONE(name)
+#define PROFILE_GPU_SCOPE(name)
+#define PROFILE_FRAME() static_cast<void>(0)
+#define PROFILE_EXPORT(path) static_cast<void>(path)
+#define PROFILE_DESTORY() static_cast<void>(0)
+
+#endif
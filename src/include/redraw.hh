@@ -0,0 +1,20 @@
+#pragma once
+
+// Scene-wide dirty flag for on-demand rendering (--on-demand). Anything that
+// changes what the next frame shows -- camera movement, transform or light
+// changes, finished uploads, a resized or exposed window -- requests a
+// redraw; the render loop consumes the request once per frame and, while
+// none is pending, waits for events instead of drawing.
+struct Redraw {
+  bool requested{true}; // the first frame always draws
+
+  auto request() -> void { requested = true; }
+  // Whether a frame is due. Clears the request.
+  auto consume() -> bool {
+    const bool due{requested};
+    requested = false;
+    return due;
+  }
+};
+
+static Redraw DefaultRedraw;
@@ -1,14 +1,301 @@
 #pragma once
-#include <unordered_map>
-// #include <optional>
 
-#include "texture.hh"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
+#include "glb.hh"
 
-class Scene{
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+namespace fs = std::filesystem;
+
+// What the viewer loads at startup: models, the instances drawing them,
+// lights and the camera, read from a JSON file.
+//
+//   {
+//     "models": [{"name": "nanosuit", "path": "res/nanosuit/nanosuit.obj"}],
+//     "instances": [{"model": "nanosuit", "position": [0, 0, 0],
+//                    "rotation": [0, 90, 0], "scale": 1, "occluder": false,
+//                    "animation": {"clip": 0, "blendClip": 1, "blend": 0.5,
+//                                  "speed": 1, "time": 0}}],
+//     "directional": {"position": [0.5, 2, 2], "target": [0, 0, 0],
+//                     "extent": 10},
+//     "lights": [{"position": [1, 2, 0], "radius": 3, "color": [1, 1, 1]}],
+//     "camera": {"position": [0, 1.5, 2], "yaw": -90, "pitch": -18,
+//                "fov": 60,
+//                "path": [{"time": 0, "position": [0, 2, 4],
+//                          "target": [0, 1, 0]}]}
+//   }
+//
+// Rotations are XYZ Euler angles in degrees, applied after the scale.
+// "animation" only matters for models with animations (GpuSkinning): clip
+// indices, blendClip -1 for none, and a start time in seconds.
+// Everything but "models" and "instances" is optional. Relative model paths
+// resolve against the base directory given to load(). Strings are read as
+// is (glb.hh's JsonValue doesn't unescape), so paths use forward slashes.
+class Scene {
 public:
-  std::unordered_map<std::string, Texture> loadedTextures;
+  struct ModelEntry {
+    std::string name;
+    fs::path path;
+  };
+  struct Instance {
+    std::size_t model; // index into `models`
+    glm::vec3 position{0.0f};
+    glm::vec3 rotation{0.0f}; // degrees
+    float scale{1.0f};
+    // Drawn into OcclusionCuller's depth buffer instead of being tested
+    bool occluder{false};
+    struct Animation {
+      long clip{0};
+      long blendClip{-1};
+      float blend{0.0f};
+      float speed{1.0f};
+      float time{0.0f};
+    };
+    Animation animation{};
+
+    auto transform() const -> glm::mat4;
+  };
+  // Unshadowed point light, shaded through the light clusters
+  struct PointLightEntry {
+    glm::vec3 position{0.0f};
+    float radius{1.0f};
+    glm::vec3 color{1.0f};
+  };
+  struct Directional {
+    glm::vec3 position{0.5f, 2.0f, 2.0f};
+    glm::vec3 target{0.0f};
+    // Half the width of the square the shadow map covers around `target`
+    float extent{10.0f};
+  };
+  struct Keyframe {
+    float time{0.0f}; // seconds, increasing
+    glm::vec3 position{0.0f};
+    glm::vec3 target{0.0f};
+  };
+  struct Camera {
+    glm::vec3 position{0.0f, 1.5f, 2.0f};
+    float yaw{-90.0f}, pitch{-18.0f}, fov{60.0f}; // degrees
+    std::vector<Keyframe> path;
+  };
 
+  std::vector<ModelEntry> models;
+  std::vector<Instance> instances;
+  Directional directional;
+  std::vector<PointLightEntry> lights;
+  Camera camera;
 
+  // nullptr, with the reason logged, if the file is missing or malformed.
+  static auto load(const fs::path &file, const fs::path &base)
+      -> std::unique_ptr<Scene>;
+  auto write(const fs::path &file) const -> bool;
 
+  // Index of the model called `name`, -1 if there is none.
+  auto findModel(const std::string &name) const -> long;
+  // Length of the camera path in seconds, 0 without one.
+  auto pathDuration() const -> float;
+  // Camera position and target at `time` along the path, linearly
+  // interpolated and clamped to its ends.
+  auto samplePath(float time) const -> Keyframe;
 };
+
+auto Scene::Instance::transform() const -> glm::mat4 {
+  glm::mat4 m{glm::translate(glm::mat4(1.0f), position)};
+  m = glm::rotate(m, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+  m = glm::rotate(m, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+  m = glm::rotate(m, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+  return glm::scale(m, glm::vec3(scale));
+}
+
+auto Scene::load(const fs::path &file, const fs::path &base)
+    -> std::unique_ptr<Scene> {
+  auto fail{[&](const char *why) {
+    std::cerr << "ERROR::Scene::load -> " << file << ": " << why << '.'
+              << std::endl;
+    return nullptr;
+  }};
+  MappedFile mapping{file};
+  if (!mapping)
+    return fail("cannot open the file");
+  JsonValue root;
+  if (!JsonValue::parse({reinterpret_cast<const char *>(mapping.data()),
+                         mapping.size()},
+                        root) ||
+      root.type != JsonValue::Type::Object)
+    return fail("malformed JSON");
+
+  auto number{[](const JsonValue &v, float fallback) {
+    return v.type == JsonValue::Type::Number ? static_cast<float>(v.number)
+                                             : fallback;
+  }};
+  auto vec3{[&](const JsonValue &v, glm::vec3 fallback) {
+    if (v.type != JsonValue::Type::Array || v.size() != 3)
+      return fallback;
+    return glm::vec3(number(v[0], fallback.x), number(v[1], fallback.y),
+                     number(v[2], fallback.z));
+  }};
+
+  auto scene{std::make_unique<Scene>()};
+  for (auto &m : root["models"].items) {
+    if (m["name"].type != JsonValue::Type::String ||
+        m["path"].type != JsonValue::Type::String)
+      return fail("every model needs a name and a path");
+    fs::path path{std::string{m["path"].string}};
+    scene->models.push_back(ModelEntry{std::string{m["name"].string},
+                                       path.is_absolute() ? path
+                                                          : base / path});
+  }
+  for (auto &i : root["instances"].items) {
+    const long model{scene->findModel(std::string{i["model"].string})};
+    if (model < 0)
+      return fail("an instance names an unknown model");
+    Instance instance{static_cast<std::size_t>(model)};
+    instance.position = vec3(i["position"], instance.position);
+    instance.rotation = vec3(i["rotation"], instance.rotation);
+    instance.scale = number(i["scale"], instance.scale);
+    instance.occluder = i["occluder"].boolean;
+    auto &a{i["animation"]};
+    auto &animation{instance.animation};
+    animation.clip = static_cast<long>(number(a["clip"], animation.clip));
+    animation.blendClip =
+        static_cast<long>(number(a["blendClip"], animation.blendClip));
+    animation.blend = number(a["blend"], animation.blend);
+    animation.speed = number(a["speed"], animation.speed);
+    animation.time = number(a["time"], animation.time);
+    scene->instances.push_back(instance);
+  }
+  if (scene->instances.empty())
+    return fail("no instances");
+
+  auto &d{root["directional"]};
+  auto &directional{scene->directional};
+  directional.position = vec3(d["position"], directional.position);
+  directional.target = vec3(d["target"], directional.target);
+  directional.extent = number(d["extent"], directional.extent);
+  for (auto &l : root["lights"].items) {
+    PointLightEntry light;
+    light.position = vec3(l["position"], light.position);
+    light.radius = number(l["radius"], light.radius);
+    light.color = vec3(l["color"], light.color);
+    scene->lights.push_back(light);
+  }
+
+  auto &c{root["camera"]};
+  auto &camera{scene->camera};
+  camera.position = vec3(c["position"], camera.position);
+  camera.yaw = number(c["yaw"], camera.yaw);
+  camera.pitch = number(c["pitch"], camera.pitch);
+  camera.fov = number(c["fov"], camera.fov);
+  for (auto &k : c["path"].items) {
+    Keyframe key;
+    key.time = number(k["time"], key.time);
+    key.position = vec3(k["position"], key.position);
+    key.target = vec3(k["target"], key.target);
+    if (!camera.path.empty() && key.time <= camera.path.back().time)
+      return fail("camera path times must increase");
+    camera.path.push_back(key);
+  }
+
+  std::clog << "LOG::Scene::\"Loading Scene Successful\": " << file << ", "
+            << scene->models.size() << " models, " << scene->instances.size()
+            << " instances, " << scene->lights.size() << " lights, "
+            << camera.path.size() << " camera keyframes" << std::endl;
+  return scene;
+}
+
+auto Scene::write(const fs::path &file) const -> bool {
+  std::ofstream out{file};
+  if (!out) {
+    std::cerr << "ERROR::Scene::write -> cannot write " << file << '.'
+              << std::endl;
+    return false;
+  }
+  auto vec3{[&](const glm::vec3 &v) {
+    out << '[' << v.x << ", " << v.y << ", " << v.z << ']';
+  }};
+  out << "{\n  \"models\": [";
+  for (std::size_t i = 0; i < models.size(); i++)
+    out << (i ? ",\n    " : "\n    ") << "{\"name\": \"" << models[i].name
+        << "\", \"path\": \"" << models[i].path.generic_string() << "\"}";
+  out << "\n  ],\n  \"instances\": [";
+  for (std::size_t i = 0; i < instances.size(); i++) {
+    auto &instance{instances[i]};
+    out << (i ? ",\n    " : "\n    ") << "{\"model\": \""
+        << models[instance.model].name << "\", \"position\": ";
+    vec3(instance.position);
+    out << ", \"rotation\": ";
+    vec3(instance.rotation);
+    out << ", \"scale\": " << instance.scale;
+    if (instance.occluder)
+      out << ", \"occluder\": true";
+    auto &a{instance.animation};
+    if (a.clip != 0 || a.blendClip != -1 || a.speed != 1.0f || a.time != 0.0f)
+      out << ", \"animation\": {\"clip\": " << a.clip
+          << ", \"blendClip\": " << a.blendClip << ", \"blend\": " << a.blend
+          << ", \"speed\": " << a.speed << ", \"time\": " << a.time << '}';
+    out << '}';
+  }
+  out << "\n  ],\n  \"directional\": {\"position\": ";
+  vec3(directional.position);
+  out << ", \"target\": ";
+  vec3(directional.target);
+  out << ", \"extent\": " << directional.extent << "},\n  \"lights\": [";
+  for (std::size_t i = 0; i < lights.size(); i++) {
+    out << (i ? ",\n    " : "\n    ") << "{\"position\": ";
+    vec3(lights[i].position);
+    out << ", \"radius\": " << lights[i].radius << ", \"color\": ";
+    vec3(lights[i].color);
+    out << '}';
+  }
+  out << (lights.empty() ? "" : "\n  ") << "],\n  \"camera\": {\"position\": ";
+  vec3(camera.position);
+  out << ", \"yaw\": " << camera.yaw << ", \"pitch\": " << camera.pitch
+      << ", \"fov\": " << camera.fov << ",\n    \"path\": [";
+  for (std::size_t i = 0; i < camera.path.size(); i++) {
+    auto &key{camera.path[i]};
+    out << (i ? ",\n      " : "\n      ") << "{\"time\": " << key.time
+        << ", \"position\": ";
+    vec3(key.position);
+    out << ", \"target\": ";
+    vec3(key.target);
+    out << '}';
+  }
+  out << (camera.path.empty() ? "" : "\n    ") << "]}\n}\n";
+  return static_cast<bool>(out);
+}
+
+auto Scene::findModel(const std::string &name) const -> long {
+  for (std::size_t i = 0; i < models.size(); i++)
+    if (models[i].name == name)
+      return i;
+  return -1;
+}
+
+auto Scene::pathDuration() const -> float {
+  return camera.path.empty() ? 0.0f : camera.path.back().time;
+}
+
+auto Scene::samplePath(float time) const -> Keyframe {
+  auto &path{camera.path};
+  if (path.empty())
+    return Keyframe{time, camera.position, camera.position};
+  if (time <= path.front().time)
+    return path.front();
+  if (time >= path.back().time)
+    return path.back();
+  auto next{std::upper_bound(
+      path.begin(), path.end(), time,
+      [](float t, const Keyframe &k) { return t < k.time; })};
+  auto &b{*next};
+  auto &a{*(next - 1)};
+  const float t{(time - a.time) / (b.time - a.time)};
+  return Keyframe{time, glm::mix(a.position, b.position, t),
+                  glm::mix(a.target, b.target, t)};
+}
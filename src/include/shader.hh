@@ -3,6 +3,7 @@
 
 #include <glad/glad.h>
 
+#include <array>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -10,18 +11,31 @@
 #include <vector>
 namespace fs = std::filesystem;
 
+#include "gpu_registry.hh"
+#include "profiler.hh"
 #include "utils.hh"
 
+// Fixed uniform-block binding points shared by every program. link() wires
+// any block with a matching name; UniformRing binds buffer ranges to them.
+enum class BlockBinding : GLuint {
+  Camera = 0,
+  Light = 1,
+  Object = 2,
+  PointLight = 3,
+  ShadowAtlas = 4,
+};
+
 class Shader {
 private:
   static auto ReadFile(const fs::path &path, std::string &content) -> void;
   static auto CompileShader(unsigned int shader) -> bool;
+  auto bindUniformBlocks() -> void;
 
   // No copy constructor
   Shader(const Shader &) = delete;
   Shader &operator=(const Shader &) = delete;
 
-  GLuint program_;
+  ProgramHandle program_;
   std::vector<GLuint> createdShaders;
 
 public:
@@ -31,27 +45,38 @@ public:
 
   auto destory() -> void;
 
-  auto attach(const fs::path &shaderPath, GLenum shaderType) -> Shader &;
+  auto attach(const fs::path &shaderPath, GLenum shaderType,
+              const std::vector<std::string> &defines) -> Shader &;
+  // Outputs captured by transform feedback, interleaved in this order into
+  // one buffer. Takes effect at link().
+  auto captureVaryings(const std::vector<const char *> &varyings) -> Shader &;
   auto link() -> void;
   auto id() const -> GLuint;
+  // The const char * overload is the one for per-frame lookups: a literal
+  // converted to std::string may allocate.
+  auto getUniform(const char *name) const -> GLint;
   auto getUniform(const std::string &name) const -> GLint;
 };
 
-Shader::Shader() { program_ = glCreateProgram();}
+Shader::Shader() { program_ = DefaultGpuRegistry.create<GpuKind::Program>(); }
 
 auto Shader::destory() -> void {
-    glDeleteProgram(program_);
+    DefaultGpuRegistry.release(program_);
 }
 
 Shader& Shader::operator=(Shader &&other) {
-    program_ = other.program_;
-    other.program_ = 0;
-    if (other.program_ != 0)
-      glDeleteProgram(other.program_);
+    if (this != &other) {
+      DefaultGpuRegistry.release(program_);
+      program_ = other.program_;
+      other.program_ = ProgramHandle{};
+    }
     return *this;
   }
 
-auto Shader::attach(const fs::path &shaderPath, GLenum shaderType) -> Shader & {
+// `defines` are injected as `#define`s right after the `#version` line, so
+// one source file can be compiled into several variants.
+auto Shader::attach(const fs::path &shaderPath, GLenum shaderType,
+                    const std::vector<std::string> &defines = {}) -> Shader & {
   std::string shdr_src;
   try {
     ReadFile(shaderPath, shdr_src);
@@ -61,6 +86,15 @@ auto Shader::attach(const fs::path &shaderPath, GLenum shaderType) -> Shader & {
               << e.what() << std::endl;
     shdr_src = "";
   }
+  if (!defines.empty()) {
+    std::string header;
+    for (auto &d : defines)
+      header += "#define " + d + '\n';
+    auto version_end{shdr_src.find('\n')};
+    shdr_src.insert(version_end == std::string::npos ? shdr_src.size()
+                                                     : version_end + 1,
+                    header);
+  }
 
   GLuint shdr{glCreateShader(shaderType)};
   const GLchar *source = shdr_src.data();
@@ -72,11 +106,19 @@ auto Shader::attach(const fs::path &shaderPath, GLenum shaderType) -> Shader & {
               << shaderPath << std::endl;
 
   createdShaders.push_back(shdr);
-  glAttachShader(program_, shdr);
+  glAttachShader(program_.name(), shdr);
+  return *this;
+}
+
+auto Shader::captureVaryings(const std::vector<const char *> &varyings)
+    -> Shader & {
+  glTransformFeedbackVaryings(program_.name(), varyings.size(),
+                              varyings.data(), GL_INTERLEAVED_ATTRIBS);
   return *this;
 }
 
 auto Shader::link() -> void {
+  PROFILE_SCOPE("Shader::link");
   /* code below return 0 insted of name of attached shaders */
   // GLint shaderCount;
   // glGetProgramiv(program_, GL_ATTACHED_SHADERS, &shaderCount);
@@ -84,41 +126,63 @@ auto Shader::link() -> void {
   // std::vector<GLuint> shaders(shaderCount);
   // glGetAttachedShaders(program_, 0, nullptr, shaders.data());
 
-  glLinkProgram(program_);
+  const GLuint program{program_.name()};
+  glLinkProgram(program);
 
   for (std::size_t i = 0; i < createdShaders.size(); i++) {
     // glDetachShader(program_, shaders[i]);
     // glDeleteShader(shaders[i]);
-    glDetachShader(program_, createdShaders[i]);
+    glDetachShader(program, createdShaders[i]);
     glDeleteShader(createdShaders[i]);
   }
   createdShaders.clear();
 
   GLint isLinked = 0;
-  glGetProgramiv(program_, GL_LINK_STATUS, &isLinked);
+  glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
   if (isLinked == GL_FALSE) {
     GLint maxLength = 0;
-    glGetProgramiv(program_, GL_INFO_LOG_LENGTH, &maxLength);
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &maxLength);
 
     // The maxLength includes the NULL character
     std::vector<GLchar> log(static_cast<std::size_t>(maxLength));
-    glGetProgramInfoLog(program_, maxLength, &maxLength, log.data());
+    glGetProgramInfoLog(program, maxLength, &maxLength, log.data());
     std::cerr << "Shader:: failed to link shader program" << std::endl;
     std::copy(begin(log), end(log),
               std::ostream_iterator<GLchar>{std::cerr, ""});
 
-    glDeleteProgram(program_); // Don't leak the program.
+    DefaultGpuRegistry.release(program_); // Don't leak the program.
   } else {
+    bindUniformBlocks();
     std::clog << "LOG::Shader::\"Linking Shader Program Successful\""
               << std::endl;
   }
   // Program is linked successfully.
 }
 
-auto Shader::id() const -> GLuint { return program_; }
+auto Shader::id() const -> GLuint { return program_.name(); }
+
+auto Shader::bindUniformBlocks() -> void {
+  constexpr std::array<std::pair<const char *, BlockBinding>, 5> blocks{{
+      {"Camera", BlockBinding::Camera},
+      {"Light", BlockBinding::Light},
+      {"Object", BlockBinding::Object},
+      {"PointLight", BlockBinding::PointLight},
+      {"ShadowAtlas", BlockBinding::ShadowAtlas},
+  }};
+  const GLuint program{program_.name()};
+  for (auto [name, binding] : blocks) {
+    auto index{glGetUniformBlockIndex(program, name)};
+    if (index != GL_INVALID_INDEX)
+      glUniformBlockBinding(program, index, static_cast<GLuint>(binding));
+  }
+}
+
+auto Shader::getUniform(const char *name) const -> GLint {
+  return glGetUniformLocation(program_.name(), name);
+}
 
 auto Shader::getUniform(const std::string &name) const -> GLint {
-  return glGetUniformLocation(program_, name.c_str());
+  return getUniform(name.c_str());
 }
 
 auto Shader::CompileShader(GLuint shader) -> bool {
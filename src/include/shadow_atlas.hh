@@ -0,0 +1,390 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "gpu_registry.hh"
+#include "profiler.hh"
+#include "shader.hh"
+#include "uniform_ring.hh"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+// A shadowed spot light living in a ShadowAtlas tile.
+struct AtlasLight {
+  glm::vec3 position;
+  glm::vec3 target{0.0f};
+  glm::vec3 color{1.0f};
+  float fov{glm::radians(60.0f)};
+  float range{15.0f};
+
+  auto view() const -> glm::mat4 {
+    auto dir{glm::normalize(target - position)};
+    auto up{std::abs(dir.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0)};
+    return glm::lookAt(position, target, up);
+  }
+  auto projection() const -> glm::mat4 {
+    return glm::perspective(fov, 1.0f, 0.1f, range);
+  }
+  // Same block the directional Light uses, so shadow.vert renders tiles too.
+  auto block() const -> LightBlock {
+    return LightBlock{projection() * view(), view(), projection(),
+                      glm::vec4(position, 1.0f)};
+  }
+};
+
+// One depth texture shared by many lights. Tiles are power-of-two squares
+// handed out by a quadtree (buddy) allocator and sized by each light's
+// screen importance; lights are rendered into their tile with one FBO bind
+// and a viewport per tile, and only `budget` of them are refreshed a frame:
+//
+//   atlas.assign(camera.cameraPos, camera.fov);   // resize tiles
+//   atlas.schedule(budget, uniforms);             // before uniforms.flush()
+//   auto atlas_block{uniforms.push(atlas.block())};
+//   uniforms.flush();
+//   atlas.render(uniforms, draw_casters);         // shadow program bound
+class ShadowAtlas {
+public:
+  struct Tile {
+    int x{0}, y{0}, size{0}; // size == 0: no tile
+  };
+
+  struct Stats {
+    uint lights{0};
+    uint shadowed{0}; // lights whose tile holds a rendered map
+    uint updated{0};  // tiles rendered this frame
+    float occupancy{0.0f};
+  };
+
+  ShadowAtlas(int size = 4096, int minTile = 128, int maxTile = 1024);
+  ShadowAtlas(const ShadowAtlas &) = delete;
+  ShadowAtlas &operator=(const ShadowAtlas &) = delete;
+
+  auto destory() -> void;
+
+  auto add(const AtlasLight &light) -> uint;
+  auto light(uint i) -> AtlasLight & { return entries[i].light; }
+  auto lightCount() const -> std::size_t { return entries.size(); }
+
+  // Resizes tiles to the lights' current screen importance. Important lights
+  // are placed first; a light that no longer fits gets a smaller tile.
+  auto assign(const glm::vec3 &cameraPos, float fovY) -> void;
+  // Picks up to `budget` lights to refresh this frame (never-rendered tiles
+  // first, then by staleness x importance) and pushes their Light blocks.
+  auto schedule(uint budget, UniformRing &uniforms) -> void;
+  // Renders the scheduled tiles with the caller's program, calling
+  // drawCasters(light) with that light's `Light` block bound.
+  template <typename DrawCasters>
+  auto render(const UniformRing &uniforms, DrawCasters &&drawCasters)
+      -> void;
+
+  auto block() const -> ShadowAtlasBlock;
+  auto stats() const -> Stats;
+
+  // Fraction of the screen height covered by the light's range sphere.
+  static auto screenImportance(const AtlasLight &light,
+                               const glm::vec3 &cameraPos, float fovY)
+      -> float;
+
+  const int size, minTile, maxTile;
+  FramebufferHandle FBO;
+  TextureHandle depthTexture;
+
+private:
+  struct Entry {
+    AtlasLight light;
+    Tile tile;
+    int requested{0}; // tile size asked for; `tile` may be smaller if full
+    float importance{0.0f};
+    std::uint64_t lastRendered{0};
+    bool rendered{false}; // tile contents are valid
+    GLintptr lightBlock{0};
+    // What the tile was rendered from; the light may have moved since
+    glm::mat4 renderedMatrix{1.0f};
+    glm::vec3 renderedPosition{0.0f};
+  };
+
+  std::vector<Entry> entries;
+  std::vector<uint> order, scheduled; // reused every frame
+  // freeTiles[level] holds free tiles of size `size >> level`
+  std::vector<std::vector<Tile>> freeTiles;
+  std::uint64_t frame{0};
+
+  auto levelOf(int tileSize) const -> int;
+  auto allocate(int tileSize) -> Tile;
+  auto release(Tile tile) -> void;
+  auto upgrade(Entry &e) -> void;
+  auto wantedSize(float importance) const -> int;
+  auto setupAtlas() -> bool;
+};
+
+ShadowAtlas::ShadowAtlas(int size, int minTile, int maxTile)
+    : size{size}, minTile{minTile}, maxTile{std::min(maxTile, size)} {
+  freeTiles.resize(levelOf(minTile) + 1);
+  freeTiles[0].push_back(Tile{0, 0, size});
+  if (!setupAtlas())
+    std::cerr << "ERROR::ShadowAtlas::setupAtlas -> returned false."
+              << std::endl;
+}
+
+auto ShadowAtlas::setupAtlas() -> bool {
+  depthTexture = DefaultGpuRegistry.create<GpuKind::Texture>(
+      static_cast<std::size_t>(size) * size * sizeof(GLushort));
+  glBindTexture(GL_TEXTURE_2D, depthTexture.name());
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, size, size, 0,
+               GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  FBO = DefaultGpuRegistry.create<GpuKind::Framebuffer>();
+  glBindFramebuffer(GL_FRAMEBUFFER, FBO.name());
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                       depthTexture.name(), 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  bool complete{glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                GL_FRAMEBUFFER_COMPLETE};
+  // Start with the whole atlas at the far plane
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return complete;
+}
+
+auto ShadowAtlas::destory() -> void {
+  DefaultGpuRegistry.release(depthTexture);
+  DefaultGpuRegistry.release(FBO);
+}
+
+auto ShadowAtlas::add(const AtlasLight &light) -> uint {
+  if (entries.size() == MAX_ATLAS_LIGHTS) {
+    std::cerr << "ERROR::ShadowAtlas::add -> more than " << MAX_ATLAS_LIGHTS
+              << " lights." << std::endl;
+    return entries.size() - 1;
+  }
+  entries.push_back(Entry{light, Tile{}});
+  return entries.size() - 1;
+}
+
+auto ShadowAtlas::levelOf(int tileSize) const -> int {
+  int level{0};
+  for (int s = size; s > tileSize; s /= 2)
+    level++;
+  return level;
+}
+
+// Takes the smallest free tile that is at least `tileSize` and splits it
+// down, returning the siblings to the free lists.
+auto ShadowAtlas::allocate(int tileSize) -> Tile {
+  const int level{levelOf(tileSize)};
+  int l{level};
+  while (l >= 0 && freeTiles[l].empty())
+    l--;
+  if (l < 0)
+    return Tile{};
+  Tile t{freeTiles[l].back()};
+  freeTiles[l].pop_back();
+  for (; l < level; l++) {
+    const int half{t.size / 2};
+    freeTiles[l + 1].push_back(Tile{t.x + half, t.y, half});
+    freeTiles[l + 1].push_back(Tile{t.x, t.y + half, half});
+    freeTiles[l + 1].push_back(Tile{t.x + half, t.y + half, half});
+    t.size = half;
+  }
+  return t;
+}
+
+// Frees the tile and merges it with its three buddies while they are free.
+auto ShadowAtlas::release(Tile tile) -> void {
+  if (!tile.size)
+    return;
+  for (int level{levelOf(tile.size)}; level > 0; level--) {
+    const int parentSize{tile.size * 2};
+    const int px{tile.x / parentSize * parentSize};
+    const int py{tile.y / parentSize * parentSize};
+    auto &free{freeTiles[level]};
+    std::array<decltype(free.begin()), 3> buddies;
+    int found{0};
+    for (int i = 0; i < 4; i++) {
+      const int bx{px + (i & 1) * tile.size}, by{py + (i >> 1) * tile.size};
+      if (bx == tile.x && by == tile.y)
+        continue;
+      auto it{std::find_if(begin(free), end(free), [&](const Tile &t) {
+        return t.x == bx && t.y == by;
+      })};
+      if (it == end(free))
+        break;
+      buddies[found++] = it;
+    }
+    if (found < 3) {
+      free.push_back(tile);
+      return;
+    }
+    std::sort(begin(buddies), end(buddies), std::greater<>{});
+    for (auto it : buddies) // back to front keeps the other iterators valid
+      free.erase(it);
+    tile = Tile{px, py, parentSize};
+  }
+  freeTiles[0].push_back(tile);
+}
+
+auto ShadowAtlas::screenImportance(const AtlasLight &light,
+                                   const glm::vec3 &cameraPos, float fovY)
+    -> float {
+  const float distance{
+      std::max(glm::length(light.position - cameraPos), 1e-3f)};
+  return std::clamp(light.range / (distance * std::tan(fovY * 0.5f)), 0.0f,
+                    1.0f);
+}
+
+// Half the screen covered gets maxTile; the size halves with the coverage.
+auto ShadowAtlas::wantedSize(float importance) const -> int {
+  int s{maxTile};
+  while (s > minTile && importance * 2.0f * maxTile < s)
+    s /= 2;
+  return s;
+}
+
+auto ShadowAtlas::assign(const glm::vec3 &cameraPos, float fovY) -> void {
+  PROFILE_SCOPE("ShadowAtlas::assign");
+  order.clear();
+  for (uint i = 0; i < entries.size(); i++) {
+    entries[i].importance =
+        screenImportance(entries[i].light, cameraPos, fovY);
+    order.push_back(i);
+  }
+  std::sort(begin(order), end(order), [&](uint a, uint b) {
+    return entries[a].importance > entries[b].importance;
+  });
+  for (auto i : order) {
+    auto &e{entries[i]};
+    // grow eagerly, shrink only with a 1.5x margin so a camera hovering at
+    // a threshold doesn't reallocate every frame; a light left without a
+    // tile tries again every frame in case others have freed space
+    const int grow{wantedSize(e.importance)};
+    const int shrink{wantedSize(e.importance * 1.5f)};
+    if (e.tile.size && grow <= e.requested && shrink >= e.requested) {
+      if (e.tile.size < e.requested) // got less than it asked for: retry
+        upgrade(e);
+      continue;
+    }
+    const int wanted{e.requested && grow <= e.requested ? shrink : grow};
+    e.requested = wanted;
+    release(e.tile);
+    e.tile = Tile{};
+    for (int s = wanted; s >= minTile && !e.tile.size; s /= 2)
+      e.tile = allocate(s);
+    e.rendered = false;
+  }
+}
+
+// A light that had to settle for a smaller tile while the atlas was full
+// takes the largest one up to its request that fits now. Its old tile is
+// released first so it can merge with free buddies; if nothing larger fits
+// it gets one of the old size back, which keeps its place unless that tile
+// merged away, and only a moved tile needs rendering again.
+auto ShadowAtlas::upgrade(Entry &e) -> void {
+  const Tile old{e.tile};
+  release(old);
+  e.tile = Tile{};
+  for (int s = e.requested; s > old.size && !e.tile.size; s /= 2)
+    e.tile = allocate(s);
+  if (!e.tile.size)
+    e.tile = allocate(old.size);
+  if (e.tile.x != old.x || e.tile.y != old.y || e.tile.size != old.size)
+    e.rendered = false;
+}
+
+auto ShadowAtlas::schedule(uint budget, UniformRing &uniforms) -> void {
+  frame++;
+  order.clear();
+  for (uint i = 0; i < entries.size(); i++)
+    if (entries[i].tile.size)
+      order.push_back(i);
+  auto priority{[&](uint i) {
+    auto &e{entries[i]};
+    return e.rendered ? (frame - e.lastRendered) * e.importance
+                      : std::numeric_limits<float>::infinity();
+  }};
+  const auto count{std::min<std::size_t>(budget, order.size())};
+  std::partial_sort(begin(order), begin(order) + count, end(order),
+                    [&](uint a, uint b) { return priority(a) > priority(b); });
+  scheduled.assign(begin(order), begin(order) + count);
+  for (auto i : scheduled) {
+    auto &e{entries[i]};
+    const auto lightBlock{e.light.block()};
+    e.lightBlock = uniforms.push(lightBlock);
+    e.renderedMatrix = lightBlock.lightSpaceMatrix;
+    e.renderedPosition = e.light.position;
+    e.rendered = true; // rendered by render() before anything samples it
+    e.lastRendered = frame;
+  }
+}
+
+template <typename DrawCasters>
+auto ShadowAtlas::render(const UniformRing &uniforms,
+                         DrawCasters &&drawCasters) -> void {
+  PROFILE_SCOPE("ShadowAtlas::render");
+  PROFILE_GPU_SCOPE("ShadowAtlas::render");
+  if (scheduled.empty())
+    return;
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, FBO.name());
+  glEnable(GL_SCISSOR_TEST); // glClear only the tile
+  for (auto i : scheduled) {
+    auto &e{entries[i]};
+    glViewport(e.tile.x, e.tile.y, e.tile.size, e.tile.size);
+    glScissor(e.tile.x, e.tile.y, e.tile.size, e.tile.size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    uniforms.bind<LightBlock>(BlockBinding::Light, e.lightBlock);
+    drawCasters(i);
+  }
+  glDisable(GL_SCISSOR_TEST);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+auto ShadowAtlas::block() const -> ShadowAtlasBlock {
+  ShadowAtlasBlock b{};
+  const float inv{1.0f / size};
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    auto &e{entries[i]};
+    // A tile is sampled with the matrix it was rendered with, not the
+    // light's current one, or stale tiles would swim
+    const bool shadowed{e.rendered && e.tile.size};
+    b.lightSpaceMatrices[i] = shadowed
+                                  ? e.renderedMatrix
+                                  : e.light.projection() * e.light.view();
+    b.rects[i] = shadowed ? glm::vec4(e.tile.x * inv, e.tile.y * inv,
+                                      e.tile.size * inv, e.tile.size * inv)
+                          : glm::vec4(0.0f);
+    b.positions[i] = glm::vec4(shadowed ? e.renderedPosition : e.light.position,
+                               e.light.range);
+    b.colors[i] = glm::vec4(e.light.color, 1.0f);
+  }
+  b.count = glm::ivec4(static_cast<int>(entries.size()), 0, 0, 0);
+  return b;
+}
+
+auto ShadowAtlas::stats() const -> Stats {
+  Stats s;
+  float area{0.0f};
+  for (auto &e : entries) {
+    s.lights++;
+    s.shadowed += e.rendered && e.tile.size;
+    area += static_cast<float>(e.tile.size) * e.tile.size;
+  }
+  s.updated = scheduled.size();
+  s.occupancy = area / (static_cast<float>(size) * size);
+  return s;
+}
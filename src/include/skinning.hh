@@ -0,0 +1,326 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "animation.hh"
+#include "gpu_registry.hh"
+#include "model.hh"
+#include "profiler.hh"
+#include "shader.hh"
+#include "thread_pool.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Skeletal animation of every character drawing one skinned Model.
+//
+//   GpuSkinning skinning{model, characters};
+//   skinning.animate(dt);      // CPU: sample, blend, palettes; upload
+//   skinning.skin(program);    // GPU: skin.vert with transform feedback
+//   ... every pass draws skinning.model(c) for character c ...
+//
+// animate() samples and blends the clips of each character and builds its
+// bone palette on the thread pool, a contiguous group of characters per
+// worker. skin() then deforms each mesh once for all characters -- one
+// instanced transform feedback draw per mesh -- into a single vertex buffer
+// in Vertex layout, per mesh and within it per character. A character is
+// drawn through its own Model, whose meshes read its part of that buffer
+// with the source meshes' indices and textures, so the shadow, point light
+// and scene passes (shadow.vert, texshad.vert) draw it like any other model
+// and a character is skinned once a frame however many passes draw it.
+//
+// Its meshes have no CPU-side vertices or meshlets, so the CPU rasterizer,
+// occlusion culler and meshlet culler leave them alone.
+class GpuSkinning {
+public:
+  struct Character {
+    std::size_t clip{0};
+    long blendClip{-1}; // -1: `clip` alone
+    float blend{0.0f};  // weight of blendClip
+    float speed{1.0f};
+    float time{0.0f}; // seconds into the clips
+  };
+
+  struct Stats {
+    std::size_t characters{0};
+    std::size_t vertices{0}; // skinned per frame, over every character
+    float animateMs{0.0f};   // CPU, sampling to palettes
+    float uploadMs{0.0f};
+  };
+
+  // `source` must be resident and have a Skeleton with at least one clip.
+  GpuSkinning(Model &source, const std::vector<Character> &characters,
+              uint threads = std::thread::hardware_concurrency());
+  GpuSkinning(const GpuSkinning &) = delete;
+  GpuSkinning &operator=(const GpuSkinning &) = delete;
+
+  auto destory() -> void;
+
+  // Advances every character by `seconds` and uploads the new palettes.
+  auto animate(float seconds) -> void;
+  // `program` is skin.vert linked with captureVaryings(VARYINGS).
+  auto skin(const Shader &program) -> void;
+
+  auto characterCount() const -> std::size_t { return characters.size(); }
+  auto model(std::size_t character) -> Model & { return *models[character]; }
+  auto stats() const -> const Stats & { return stats_; }
+
+  static inline const std::vector<const char *> VARYINGS{
+      "skinnedPos", "skinnedNormal", "skinnedTexCoords"};
+
+private:
+  using Clock = std::chrono::steady_clock;
+  static constexpr GLuint PALETTE_UNIT = 0;
+
+  struct Scratch {
+    Pose pose, blended;
+    std::vector<glm::mat4> nodes;
+  };
+
+  Model &source;
+  const Skeleton &skeleton;
+  std::vector<Character> characters;
+  ThreadPool pool;
+  std::vector<Scratch> scratch; // per parallelFor chunk
+  Pose bindPose;
+
+  // Per source mesh: the node each bone follows (-1: none), where its bones
+  // start in a character's palette and its region of the output buffer
+  std::vector<std::vector<int>> boneNodes;
+  std::vector<std::size_t> paletteStart;
+  std::vector<GLintptr> outputStart; // bytes
+  std::size_t paletteSize{0};        // matrices per character
+  std::vector<glm::mat4> palettes;   // character after character
+
+  BufferHandle paletteBuffer, output;
+  TextureHandle paletteTexture; // view of paletteBuffer
+  std::vector<BufferHandle> skinBuffers;
+  std::vector<VertexArrayHandle> sourceArrays;
+  std::vector<std::unique_ptr<Model>> models;
+  Stats stats_;
+};
+
+GpuSkinning::GpuSkinning(Model &source,
+                         const std::vector<Character> &characters,
+                         uint threads)
+    : source{source}, skeleton{*source.skeleton}, characters{characters},
+      pool{threads}, scratch(pool.size()), bindPose{skeleton.bindPose()} {
+  const std::size_t count{characters.size()};
+  std::size_t vertices{0};
+  for (auto &mesh : source.meshes) {
+    std::vector<int> nodes;
+    for (auto &bone : mesh.bones)
+      nodes.push_back(skeleton.find(bone.name));
+    boneNodes.push_back(std::move(nodes));
+    paletteStart.push_back(paletteSize);
+    paletteSize += mesh.bones.size();
+    outputStart.push_back(vertices * sizeof(Vertex));
+    vertices += mesh.vertices.size() * count;
+  }
+  paletteSize = std::max<std::size_t>(paletteSize, 1);
+  palettes.resize(paletteSize * count, glm::mat4(1.0f));
+  stats_.characters = count;
+  stats_.vertices = vertices;
+
+  paletteBuffer = DefaultGpuRegistry.create<GpuKind::Buffer>();
+  paletteTexture = DefaultGpuRegistry.create<GpuKind::Texture>();
+  glBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer.name());
+  glBindTexture(GL_TEXTURE_BUFFER, paletteTexture.name());
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, paletteBuffer.name());
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  const std::size_t outputBytes{std::max<std::size_t>(
+      vertices * sizeof(Vertex), sizeof(Vertex))};
+  output = DefaultGpuRegistry.create<GpuKind::Buffer>(outputBytes);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, output.name());
+  glBufferData(GL_COPY_WRITE_BUFFER, outputBytes, nullptr, GL_DYNAMIC_COPY);
+
+  // Transform feedback sources: the mesh's own vertices (0-2) plus its skin
+  // (3: joints, 4: weights)
+  GLint boundVAO;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &boundVAO);
+  for (auto &mesh : source.meshes) {
+    std::vector<VertexSkin> skin{mesh.skin};
+    skin.resize(mesh.vertices.size()); // unweighted: bind pose
+    auto buffer{DefaultGpuRegistry.create<GpuKind::Buffer>(
+        skin.size() * sizeof(VertexSkin))};
+    auto vao{DefaultGpuRegistry.create<GpuKind::VertexArray>()};
+    glBindVertexArray(vao.name());
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer().name());
+    for (uint i = 0; i < 5; i++)
+      glEnableVertexAttribArray(i);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          reinterpret_cast<void *>(offsetof(Vertex, position)));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          reinterpret_cast<void *>(offsetof(Vertex, normal)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          reinterpret_cast<void *>(offsetof(Vertex, texCoords)));
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.name());
+    glBufferData(GL_ARRAY_BUFFER, skin.size() * sizeof(VertexSkin),
+                 skin.data(), GL_STATIC_DRAW);
+    glVertexAttribIPointer(3, 4, GL_UNSIGNED_SHORT, sizeof(VertexSkin),
+                           reinterpret_cast<void *>(offsetof(VertexSkin, joints)));
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(VertexSkin),
+                          reinterpret_cast<void *>(offsetof(VertexSkin, weights)));
+    skinBuffers.push_back(buffer);
+    sourceArrays.push_back(vao);
+  }
+
+  // A pose reaches past the bind pose's box, so every character mesh gets
+  // the whole model's box grown by half its size on each side
+  glm::vec3 lo{0.0f}, hi{0.0f};
+  for (std::size_t m = 0; m < source.meshes.size(); m++) {
+    auto &mesh{source.meshes[m]};
+    lo = m ? glm::min(lo, mesh.boundsMin) : mesh.boundsMin;
+    hi = m ? glm::max(hi, mesh.boundsMax) : mesh.boundsMax;
+  }
+  const glm::vec3 margin{(hi - lo) * 0.5f};
+  for (std::size_t c = 0; c < count; c++) {
+    std::vector<Mesh> meshes;
+    for (std::size_t m = 0; m < source.meshes.size(); m++) {
+      auto &mesh{source.meshes[m]};
+      const GLintptr base{outputStart[m] +
+                          static_cast<GLintptr>(c * mesh.vertices.size() *
+                                                sizeof(Vertex))};
+      Mesh::External external{
+          DefaultGpuRegistry.retain(output),
+          {Mesh::Attribute{3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                           base + static_cast<GLintptr>(
+                                      offsetof(Vertex, position))},
+           Mesh::Attribute{3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                           base + static_cast<GLintptr>(
+                                      offsetof(Vertex, normal))},
+           Mesh::Attribute{2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                           base + static_cast<GLintptr>(
+                                      offsetof(Vertex, texCoords))}},
+          GL_UNSIGNED_INT,
+          0,
+          static_cast<GLsizei>(mesh.indices.size()),
+          lo - margin,
+          hi + margin,
+          DefaultGpuRegistry.retain(mesh.indexBuffer())};
+      Mesh posed{external};
+      for (auto &t : mesh.textures)
+        posed.textures.push_back(Texture{DefaultGpuRegistry.retain(t.handle),
+                                         t.type, t.page, t.layer});
+      meshes.push_back(std::move(posed));
+    }
+    models.push_back(std::make_unique<Model>(std::move(meshes)));
+  }
+  glBindVertexArray(boundVAO);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  std::clog << "LOG::GpuSkinning::\"Characters Created\": " << count
+            << " characters of " << source.meshes.size() << " meshes, "
+            << skeleton.nodes.size() << " nodes, " << paletteSize
+            << " bones each, " << vertices << " vertices ("
+            << outputBytes / (1024 * 1024) << " MiB) skinned per frame on "
+            << pool.size() << " threads" << std::endl;
+}
+
+auto GpuSkinning::destory() -> void {
+  for (auto &m : models)
+    m->destory();
+  models.clear();
+  for (auto &b : skinBuffers)
+    DefaultGpuRegistry.release(b);
+  for (auto &a : sourceArrays)
+    DefaultGpuRegistry.release(a);
+  skinBuffers.clear();
+  sourceArrays.clear();
+  DefaultGpuRegistry.release(paletteTexture);
+  DefaultGpuRegistry.release(paletteBuffer);
+  DefaultGpuRegistry.release(output);
+}
+
+auto GpuSkinning::animate(float seconds) -> void {
+  PROFILE_SCOPE("GpuSkinning::animate");
+  auto start{Clock::now()};
+  auto &clips{skeleton.clips};
+  pool.parallelFor(characters.size(), [&](std::size_t begin, std::size_t end,
+                                          uint chunk) {
+    auto &s{scratch[chunk]};
+    for (std::size_t c = begin; c < end; c++) {
+      auto &character{characters[c]};
+      character.time += seconds * character.speed;
+      s.pose = bindPose;
+      clips[character.clip % clips.size()].sample(character.time, s.pose);
+      if (character.blendClip >= 0 &&
+          static_cast<std::size_t>(character.blendClip) < clips.size()) {
+        s.blended = bindPose;
+        clips[character.blendClip].sample(character.time, s.blended);
+        Skeleton::blend(s.pose, s.blended, character.blend);
+      }
+      skeleton.modelSpace(s.pose, s.nodes);
+      auto *palette{palettes.data() + c * paletteSize};
+      for (std::size_t m = 0; m < boneNodes.size(); m++) {
+        auto &bones{source.meshes[m].bones};
+        for (std::size_t b = 0; b < bones.size(); b++) {
+          const int node{boneNodes[m][b]};
+          palette[paletteStart[m] + b] =
+              node < 0 ? glm::mat4(1.0f)
+                       : JointTransform::multiply(
+                             JointTransform::multiply(skeleton.rootInverse,
+                                                      s.nodes[node]),
+                             bones[b].offset);
+        }
+      }
+    }
+  });
+  auto animated{Clock::now()};
+  stats_.animateMs =
+      std::chrono::duration<float, std::milli>(animated - start).count();
+
+  // Orphaned, so the GPU can keep reading last frame's palettes
+  const std::size_t bytes{palettes.size() * sizeof(glm::mat4)};
+  glBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer.name());
+  glBufferData(GL_TEXTURE_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, palettes.data());
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  DefaultGpuRegistry.setBytes(paletteBuffer, bytes);
+  stats_.uploadMs =
+      std::chrono::duration<float, std::milli>(Clock::now() - animated)
+          .count();
+}
+
+auto GpuSkinning::skin(const Shader &program) -> void {
+  PROFILE_SCOPE("GpuSkinning::skin");
+  PROFILE_GPU_SCOPE("GpuSkinning::skin");
+  if (characters.empty())
+    return;
+  GLint boundVAO;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &boundVAO);
+  glUseProgram(program.id());
+  glActiveTexture(GL_TEXTURE0 + PALETTE_UNIT);
+  glBindTexture(GL_TEXTURE_BUFFER, paletteTexture.name());
+  glUniform1i(program.getUniform("palettes"), PALETTE_UNIT);
+  glUniform1i(program.getUniform("paletteStride"), paletteSize);
+  const GLint offsetLocation{program.getUniform("paletteOffset")};
+
+  glEnable(GL_RASTERIZER_DISCARD);
+  for (std::size_t m = 0; m < source.meshes.size(); m++) {
+    const auto n{source.meshes[m].vertices.size()};
+    if (!n)
+      continue;
+    glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, output.name(),
+                      outputStart[m], n * characters.size() * sizeof(Vertex));
+    glBindVertexArray(sourceArrays[m].name());
+    glUniform1i(offsetLocation, paletteStart[m]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArraysInstanced(GL_POINTS, 0, n, characters.size());
+    glEndTransformFeedback();
+    DefaultFrameStats.drawCalls++;
+  }
+  glDisable(GL_RASTERIZER_DISCARD);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindVertexArray(boundVAO);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <sys/types.h>
+
+// Per-frame GL call counters. Bumped by Mesh/Model and reset by the render
+// loop once per frame.
+struct FrameStats {
+  uint drawCalls{0};
+  uint triangles{0};
+  uint textureBinds{0};
+  uint uniformUploads{0};
+
+  auto reset() -> void { *this = FrameStats{}; }
+};
+
+static FrameStats DefaultFrameStats;
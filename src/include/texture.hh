@@ -2,6 +2,7 @@
 
 #include <glad/glad.h>
 
+#include "gpu_registry.hh"
 #include "utils.hh"
 
 #include <string>
@@ -17,10 +18,16 @@ public:
     None,
   };
 
-  auto destory() -> void { glDeleteTextures(1, &id); }
+  // Drops this texture's reference; TextureRepository holds its own.
+  auto destory() -> void { DefaultGpuRegistry.release(handle); }
+  auto id() const -> GLuint { return handle.name(); }
 
-  GLuint id;
+  TextureHandle handle;
   Type type;
+  // Only meaningful in TextureRepository::Mode::Array: which array page the
+  // texture was packed into and its layer there (-1 if not packed).
+  uint page{0};
+  GLint layer{-1};
 
   static auto typeName(const Type t) -> std::string {
     switch (t) {
@@ -2,75 +2,383 @@
 
 #include <glad/glad.h>
 
+#include "profiler.hh"
 #include "texture.hh"
+#include "upload_budget.hh"
 
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
+#include <iostream>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 namespace fs = std::filesystem;
 
+// An image decoded off the render thread, waiting for its GL upload.
+struct StagedImage {
+  std::string path;
+  stbi_uc *data{nullptr};
+  int width{0}, height{0}, nrComponents{0};
+  // Texture2D mode upload progress
+  TextureHandle texture{};
+  int rowsUploaded{0};
+  std::size_t mipBytesTaken{0}; // of the mip chain, charged before mipmapping
+
+  static auto decode(const std::string &path) -> StagedImage {
+    auto [data, w, h, nrComponents] = Utils::loadImageFromFile(fs::path(path));
+    return StagedImage{path, data, w, h, nrComponents};
+  }
+  // An encoded image already in memory, e.g. embedded in a mapped GLB; `path`
+  // only names it in the repository.
+  static auto decodeMemory(const std::string &path, const std::uint8_t *bytes,
+                           std::size_t size) -> StagedImage {
+    int w{0}, h{0}, nrComponents{0};
+    auto *data{bytes ? stbi_load_from_memory(bytes, static_cast<int>(size), &w,
+                                             &h, &nrComponents, 0)
+                     : nullptr};
+    return StagedImage{path, data, w, h, nrComponents};
+  }
+};
+
 class TextureRepository {
 public:
-  auto insert(std::pair<std::string, GLuint> i) -> bool;
-  auto get(const std::string &p) -> GLuint;
+  // Texture2D: one GL_TEXTURE_2D per file (default).
+  // Array: same-size, same-format files share GL_TEXTURE_2D_ARRAY pages, so a
+  //        whole model can be drawn with one set of texture bindings.
+  enum class Mode { Texture2D, Array };
+
+  // A slot's texture reference belongs to the repository; users retain()
+  // their own.
+  struct Slot {
+    TextureHandle texture; // GL_TEXTURE_2D, null in Array mode
+    uint page;   // Array mode only
+    GLint layer; // Array mode only, -1 if the file failed to load
+  };
+
+  auto setMode(Mode m) -> void { mode_ = m; }
+  auto mode() const -> Mode { return mode_; }
+
+  auto insert(std::pair<std::string, TextureHandle> i) -> bool;
+  auto get(const std::string &p) -> TextureHandle;
+  auto getSlot(const std::string &p) -> Slot;
+  // Uploads (part of) a pre-decoded image within `budget`; returns true once
+  // the image is registered under its path and its pixels were released.
+  auto upload(StagedImage &img, UploadBudget &budget) -> bool;
+  // A new reference to the texture loaded under `p`, or null if there is
+  // none; never loads. Keeps it from evictUnused() until released.
+  auto retain(const std::string &p) -> TextureHandle;
+
+  // Uploads staged layers into their GL_TEXTURE_2D_ARRAY pages, a band of
+  // rows at a time within `budget`, and mipmaps each page once it is full
+  // and the budget has covered its mip chain too;
+  // returns true once every page is packed. Call every frame once all
+  // models are loaded; a page is sealed as soon as it starts packing and
+  // later files open new pages.
+  auto pack(UploadBudget &budget) -> bool;
+  auto pageId(uint page) const -> GLuint { return pages[page].texture.name(); }
+  auto pageCount() const -> std::size_t { return pages.size(); }
+
+  // Texture2D mode: releases and forgets the textures nobody but the
+  // repository references any more, i.e. whose models were unloaded.
+  // Models still uploading retain() theirs until their meshes attach them.
+  // Returns how many. Array pages are never given back.
+  auto evictUnused() -> std::size_t;
+
+  // Releases the repository's references and forgets every path. Textures
+  // still held by meshes stay alive until those release them too.
+  auto destory() -> void;
+
 private:
-  std::unordered_map<std::string, GLuint> LoadedTextures;
+  struct Page {
+    int width, height;
+    GLenum format;
+    std::vector<stbi_uc *> staged; // decoded pixels, freed by pack()
+    GLsizei layers{0};
+    TextureHandle texture{};       // set once packing starts (sealed)
+    GLsizei packedLayers{0};
+    int rowsPacked{0};             // of layer `packedLayers`
+    std::size_t mipBytesTaken{0};  // of the mip chain, charged before mipmapping
+  };
 
-  static auto loadTexture(const fs::path&) -> GLuint;
+  Mode mode_{Mode::Texture2D};
+  std::unordered_map<std::string, Slot> LoadedTextures;
+  std::vector<Page> pages;
+
+  // GL 3.3 guarantees at least 256 layers per array texture.
+  static constexpr GLsizei MAX_LAYERS_PER_PAGE = 256;
+
+  static auto formatOf(int nrComponents) -> GLenum;
+  static auto componentsOf(GLenum format) -> std::size_t;
+  static auto loadTexture(const fs::path&) -> TextureHandle;
+  auto stageTexture(const fs::path &) -> Slot;
+  auto stageDecoded(const std::string &path, stbi_uc *data, int w, int h,
+                    int nrComponents) -> Slot;
+  static auto setTextureParameters() -> void;
+  static auto takeMipBytes(std::size_t baseBytes, std::size_t &taken,
+                           UploadBudget &budget) -> bool;
 };
 
-auto TextureRepository::insert(std::pair<std::string, GLuint> i) -> bool {
-  return LoadedTextures.insert(i).second;
+auto TextureRepository::insert(std::pair<std::string, TextureHandle> i)
+    -> bool {
+  return LoadedTextures.insert({i.first, Slot{i.second, 0, -1}}).second;
 }
 
 // TODO: use std::optional reference
 auto TextureRepository::get(const std::string &p)
-    -> GLuint { // TODO
+    -> TextureHandle { // TODO
+  return getSlot(p).texture;
+}
+
+auto TextureRepository::getSlot(const std::string &p) -> Slot {
   auto search{LoadedTextures.find(p)};
-  const bool found = search != std::end(LoadedTextures);
-  GLuint tex;
-  if (!found) {
-    tex = loadTexture(fs::path(p));
-    this->insert({p, tex});
-  } else {
-    tex = search->second;
+  if (search != std::end(LoadedTextures))
+    return search->second;
+
+  Slot slot{};
+  if (mode_ == Mode::Array)
+    slot = stageTexture(fs::path(p));
+  else
+    slot = Slot{loadTexture(fs::path(p)), 0, -1};
+  LoadedTextures.insert({p, slot});
+  return slot;
+}
+
+auto TextureRepository::formatOf(int nrComponents) -> GLenum {
+  if (nrComponents == 1)
+    return GL_RED;
+  else if (nrComponents == 3)
+    return GL_RGB;
+  else if (nrComponents == 4)
+    return GL_RGBA;
+  return GLenum{};
+}
+
+auto TextureRepository::componentsOf(GLenum format) -> std::size_t {
+  return format == GL_RED ? 1 : format == GL_RGB ? 3 : 4;
+}
+
+auto TextureRepository::destory() -> void {
+  for (auto &[path, slot] : LoadedTextures)
+    DefaultGpuRegistry.release(slot.texture);
+  LoadedTextures.clear();
+  for (auto &pg : pages) {
+    for (auto *data : pg.staged)
+      stbi_image_free(data);
+    DefaultGpuRegistry.release(pg.texture);
+  }
+  pages.clear();
+}
+
+auto TextureRepository::retain(const std::string &p) -> TextureHandle {
+  auto search{LoadedTextures.find(p)};
+  return search != std::end(LoadedTextures)
+             ? DefaultGpuRegistry.retain(search->second.texture)
+             : TextureHandle{};
+}
+
+auto TextureRepository::evictUnused() -> std::size_t {
+  std::size_t evicted{0};
+  for (auto it{LoadedTextures.begin()}; it != LoadedTextures.end();) {
+    auto &texture{it->second.texture};
+    if (texture && DefaultGpuRegistry.refs(texture) == 1) {
+      DefaultGpuRegistry.release(texture);
+      it = LoadedTextures.erase(it);
+      evicted++;
+    } else
+      it++;
   }
-  return tex;
+  return evicted;
 }
 
-auto TextureRepository::loadTexture(const fs::path &path) -> GLuint {
-  GLuint textureID;
-  glGenTextures(1, &textureID);
+auto TextureRepository::loadTexture(const fs::path &path) -> TextureHandle {
+  PROFILE_SCOPE("TextureRepository::loadTexture");
   auto [data, w, h, nrComponents] =
       Utils::loadImageFromFile(path); // fix data_tmp
   // stbi_uc_UniquePtr data { std::move(data_tmp) };
 
   if (data) {
-    GLenum format{};
-    if (nrComponents == 1)
-      format = GL_RED;
-    else if (nrComponents == 3)
-      format = GL_RGB;
-    else if (nrComponents == 4)
-      format = GL_RGBA;
-
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    GLenum format{formatOf(nrComponents)};
+    auto texture{DefaultGpuRegistry.create<GpuKind::Texture>(
+        GpuRegistry::mipmappedBytes(static_cast<std::size_t>(w) * h *
+                                    nrComponents))};
+
+    glBindTexture(GL_TEXTURE_2D, texture.name());
     glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE,
                  data);
     // data.get());
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                    GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glGenerateMipmap(GL_TEXTURE_2D); // synchronous path: no budget to charge
+    setTextureParameters();
     std::clog << "LOG::Model::Utils::\"Loading Texture Successful\": " << path
               << std::endl;
     stbi_image_free(data);
-    return textureID;
+    return texture;
   }
   std::cerr << "TEXTURE::LOAD::FAILED TO LOAD AT " << path << std::endl;
-  glDeleteTextures(1, &textureID); // don't leak texture
-  return -1;
+  return TextureHandle{};
+}
+
+auto TextureRepository::setTextureParameters() -> void {
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// glGenerateMipmap writes the whole chain below level 0 in one call, so its
+// bytes are taken from the budget like uploaded rows, across frames if need
+// be; returns true once all of them are paid for and the chain may be built.
+auto TextureRepository::takeMipBytes(std::size_t baseBytes, std::size_t &taken,
+                                     UploadBudget &budget) -> bool {
+  const auto mipBytes{GpuRegistry::mipmappedBytes(baseBytes) - baseBytes};
+  while (taken < mipBytes && !budget.exhausted())
+    taken += budget.take(mipBytes - taken);
+  return taken >= mipBytes;
+}
+
+auto TextureRepository::upload(StagedImage &img, UploadBudget &budget) -> bool {
+  PROFILE_SCOPE("TextureRepository::upload");
+  auto search{LoadedTextures.find(img.path)};
+  if (!img.texture && search != std::end(LoadedTextures)) {
+    stbi_image_free(img.data); // another model got there first
+    img.data = nullptr;
+    return true;
+  }
+  if (!img.data) {
+    std::cerr << "TEXTURE::LOAD::FAILED TO LOAD AT " << img.path << std::endl;
+    LoadedTextures.insert({img.path, Slot{TextureHandle{}, 0, -1}});
+    return true;
+  }
+  if (mode_ == Mode::Array) {
+    LoadedTextures.insert({img.path, stageDecoded(img.path, img.data, img.width,
+                                                  img.height, img.nrComponents)});
+    img.data = nullptr; // owned by the page now
+    return true;
+  }
+
+  // Texture2D: allocate storage once, then fill it a band of rows at a time.
+  GLenum format{formatOf(img.nrComponents)};
+  if (!img.texture) {
+    img.texture = DefaultGpuRegistry.create<GpuKind::Texture>(
+        GpuRegistry::mipmappedBytes(static_cast<std::size_t>(img.width) *
+                                    img.height * img.nrComponents));
+    glBindTexture(GL_TEXTURE_2D, img.texture.name());
+    glTexImage2D(GL_TEXTURE_2D, 0, format, img.width, img.height, 0, format,
+                 GL_UNSIGNED_BYTE, nullptr);
+    setTextureParameters();
+  } else {
+    glBindTexture(GL_TEXTURE_2D, img.texture.name());
+  }
+  const std::size_t rowBytes{static_cast<std::size_t>(img.width) *
+                             img.nrComponents};
+  while (img.rowsUploaded < img.height && !budget.exhausted()) {
+    auto rows{static_cast<int>(budget.take(UploadBudget::CHUNK) / rowBytes)};
+    rows = std::clamp(rows, 1, img.height - img.rowsUploaded);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, img.rowsUploaded, img.width, rows,
+                    format, GL_UNSIGNED_BYTE,
+                    img.data + img.rowsUploaded * rowBytes);
+    img.rowsUploaded += rows;
+  }
+  if (img.rowsUploaded < img.height ||
+      !takeMipBytes(rowBytes * img.height, img.mipBytesTaken, budget))
+    return false;
+
+  glGenerateMipmap(GL_TEXTURE_2D);
+  stbi_image_free(img.data);
+  img.data = nullptr;
+  if (!LoadedTextures.insert({img.path, Slot{img.texture, 0, -1}}).second)
+    DefaultGpuRegistry.release(img.texture); // raced with another model
+  img.texture = TextureHandle{}; // the repository owns it now
+  std::clog << "LOG::TextureRepository::\"Uploading Texture Successful\": "
+            << img.path << std::endl;
+  return true;
+}
+
+// Decodes the file and reserves a layer in an open page with matching size
+// and format. No GL calls happen until pack().
+auto TextureRepository::stageTexture(const fs::path &path) -> Slot {
+  auto [data, w, h, nrComponents] = Utils::loadImageFromFile(path);
+  if (!data) {
+    std::cerr << "TEXTURE::LOAD::FAILED TO LOAD AT " << path << std::endl;
+    return Slot{TextureHandle{}, 0, -1};
+  }
+  return stageDecoded(path, data, w, h, nrComponents);
+}
+
+auto TextureRepository::stageDecoded(const std::string &path, stbi_uc *data,
+                                     int w, int h, int nrComponents) -> Slot {
+  GLenum format{formatOf(nrComponents)};
+
+  uint page = 0;
+  for (; page < pages.size(); page++) {
+    auto &pg{pages[page]};
+    if (!pg.texture && pg.width == w && pg.height == h && pg.format == format &&
+        pg.layers < MAX_LAYERS_PER_PAGE)
+      break;
+  }
+  if (page == pages.size())
+    pages.push_back(Page{w, h, format, {}});
+
+  auto &pg{pages[page]};
+  pg.staged.push_back(data);
+  GLint layer{pg.layers++};
+  std::clog << "LOG::TextureRepository::\"Staging Texture Layer\": " << path
+            << " -> page " << page << ", layer " << layer << std::endl;
+  return Slot{TextureHandle{}, page, layer};
+}
+
+auto TextureRepository::pack(UploadBudget &budget) -> bool {
+  PROFILE_SCOPE("TextureRepository::pack");
+  for (auto &pg : pages) {
+    if (pg.staged.empty())
+      continue; // packed
+    if (!pg.texture) {
+      pg.texture = DefaultGpuRegistry.create<GpuKind::Texture>(
+          GpuRegistry::mipmappedBytes(static_cast<std::size_t>(pg.width) *
+                                      pg.height * pg.layers *
+                                      componentsOf(pg.format)));
+      glBindTexture(GL_TEXTURE_2D_ARRAY, pg.texture.name());
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, pg.format, pg.width, pg.height,
+                   pg.layers, 0, pg.format, GL_UNSIGNED_BYTE, nullptr);
+    } else {
+      glBindTexture(GL_TEXTURE_2D_ARRAY, pg.texture.name());
+    }
+    const std::size_t rowBytes{static_cast<std::size_t>(pg.width) *
+                               componentsOf(pg.format)};
+    while (pg.packedLayers < pg.layers && !budget.exhausted()) {
+      auto rows{static_cast<int>(budget.take(UploadBudget::CHUNK) / rowBytes)};
+      rows = std::clamp(rows, 1, pg.height - pg.rowsPacked);
+      auto &data{pg.staged[pg.packedLayers]};
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, pg.rowsPacked,
+                      pg.packedLayers, pg.width, rows, 1, pg.format,
+                      GL_UNSIGNED_BYTE, data + pg.rowsPacked * rowBytes);
+      pg.rowsPacked += rows;
+      if (pg.rowsPacked == pg.height) {
+        stbi_image_free(data);
+        data = nullptr;
+        pg.packedLayers++;
+        pg.rowsPacked = 0;
+      }
+    }
+    if (pg.packedLayers < pg.layers ||
+        !takeMipBytes(rowBytes * pg.height * pg.layers, pg.mipBytesTaken,
+                      budget)) {
+      glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+      return false;
+    }
+    pg.staged.clear();
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    std::clog << "LOG::TextureRepository::\"Packing Texture Array Successful\": "
+              << pg.width << 'x' << pg.height << 'x' << pg.layers << std::endl;
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  return true;
 }
 
 static TextureRepository DefaultTexRepo;
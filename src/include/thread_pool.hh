@@ -0,0 +1,134 @@
+#pragma once
+
+#include "alloc_tracker.hh"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+// Fixed set of worker threads fed from one FIFO queue. submit() is fire and
+// forget; parallelFor() splits a range across the workers and blocks until
+// every piece ran. Once warm, neither allocates: the queue keeps its
+// capacity and parallelFor's tasks fit in std::function's inline storage.
+class ThreadPool {
+public:
+  ThreadPool(uint threads = std::thread::hardware_concurrency());
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  auto size() const -> uint { return workers.size(); }
+
+  auto submit(std::function<void()> task) -> void;
+  // Blocks until the queue is drained and every worker is idle.
+  auto wait() -> void;
+  // Calls fn(begin, end, chunk) for at most size() contiguous chunks of
+  // [0, n). `chunk` is unique per call, so it can index per-worker scratch.
+  template <typename Fn> auto parallelFor(std::size_t n, Fn &&fn) -> void;
+
+private:
+  std::vector<std::thread> workers;
+  // FIFO from `head`; cleared (capacity kept) whenever it drains
+  std::vector<std::function<void()>> tasks;
+  std::size_t head{0};
+  std::mutex mutex;
+  std::condition_variable wake, idle;
+  uint busy{0};
+  bool stopping{false};
+
+  auto work() -> void;
+};
+
+ThreadPool::ThreadPool(uint threads) {
+  threads = std::max(1u, threads);
+  for (uint i = 0; i < threads; i++)
+    workers.emplace_back([this] { work(); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &w : workers)
+    w.join();
+}
+
+auto ThreadPool::work() -> void {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      wake.wait(lock, [this] { return stopping || head < tasks.size(); });
+      if (head == tasks.size())
+        return; // stopping
+      task = std::move(tasks[head++]);
+      if (head == tasks.size()) {
+        tasks.clear();
+        head = 0;
+      }
+      busy++;
+    }
+    task();
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      busy--;
+    }
+    idle.notify_all();
+  }
+}
+
+auto ThreadPool::submit(std::function<void()> task) -> void {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    tasks.push_back(std::move(task));
+  }
+  wake.notify_one();
+}
+
+auto ThreadPool::wait() -> void {
+  std::unique_lock<std::mutex> lock{mutex};
+  idle.wait(lock, [this] { return head == tasks.size() && busy == 0; });
+}
+
+template <typename Fn>
+auto ThreadPool::parallelFor(std::size_t n, Fn &&fn) -> void {
+  const auto chunks{static_cast<uint>(std::min<std::size_t>(size(), n))};
+  if (chunks <= 1) {
+    if (n)
+      fn(std::size_t{0}, n, 0u);
+    return;
+  }
+  // Shared by the chunks, which capture only its address and their index:
+  // small enough for std::function to store without allocating
+  struct Batch {
+    Fn &fn;
+    std::size_t n;
+    uint chunks, remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+#ifdef SHADOW_ALLOC_TRACKING
+    // The chunks allocate on the caller's behalf, counted or not
+    AllocTracker::Context caller{AllocTracker::context()};
+#endif
+  } batch{fn, n, chunks, chunks, {}, {}};
+  for (uint c = 0; c < chunks; c++) {
+    submit([b = &batch, c] {
+#ifdef SHADOW_ALLOC_TRACKING
+      AllocTracker::Track track{b->caller};
+#endif
+      b->fn(b->n * c / b->chunks, b->n * (c + 1) / b->chunks, c);
+      std::lock_guard<std::mutex> lock{b->mutex};
+      if (--b->remaining == 0)
+        b->done.notify_one();
+    });
+  }
+  std::unique_lock<std::mutex> lock{batch.mutex};
+  batch.done.wait(lock, [&] { return batch.remaining == 0; });
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gpu_registry.hh"
+#include "shader.hh"
+#include "stats.hh"
+
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// std140 mirrors of the uniform blocks declared in the shaders. Only mat4 and
+// vec4 members, so the C++ layout matches std140 without padding.
+struct CameraBlock {
+  glm::mat4 prespective;
+  glm::mat4 view;
+  glm::vec4 viewPos;
+};
+
+struct LightBlock {
+  glm::mat4 lightSpaceMatrix; // lightProjection * lightView
+  glm::mat4 lightView;
+  glm::mat4 lightProjection;
+  glm::vec4 lightPos;
+  // xy: fraction of the depth texture the shadow pass rendered to
+  glm::vec4 shadowScale{1.0f};
+};
+
+struct ObjectBlock {
+  glm::mat4 model;
+};
+
+struct PointLightBlock {
+  std::array<glm::mat4, 6> faceMatrices; // cubemap face order, +X first
+  glm::vec4 position;
+  glm::vec4 range; // x: near, y: far
+};
+
+// MAX_ATLAS_LIGHTS must match the define in texshad.frag.
+constexpr std::size_t MAX_ATLAS_LIGHTS = 64;
+struct ShadowAtlasBlock {
+  std::array<glm::mat4, MAX_ATLAS_LIGHTS> lightSpaceMatrices;
+  std::array<glm::vec4, MAX_ATLAS_LIGHTS> rects;     // atlas uv; z == 0: none
+  std::array<glm::vec4, MAX_ATLAS_LIGHTS> positions; // w: range
+  std::array<glm::vec4, MAX_ATLAS_LIGHTS> colors;
+  glm::ivec4 count;                                  // x: lights in use
+};
+
+// One GL_UNIFORM_BUFFER split into FRAMES regions. A frame push()es every
+// block into a CPU staging copy, flush()es it into its region with a single
+// memcpy and then binds blocks by offset. endFrame() fences the region and
+// beginFrame() only reuses it once that fence has signalled.
+//
+// GL 3.3 has no persistent mapping, so the region is mapped unsynchronized
+// for the one memcpy instead; the fences make that safe.
+class UniformRing {
+public:
+  static constexpr std::size_t FRAMES = 3;
+
+  UniformRing(std::size_t bytesPerFrame = 256 * 1024);
+  UniformRing(const UniformRing &) = delete;
+  UniformRing &operator=(const UniformRing &) = delete;
+
+  auto destory() -> void;
+
+  auto beginFrame() -> void;
+  template <typename Block> auto push(const Block &block) -> GLintptr;
+  auto flush() -> void;
+  template <typename Block>
+  auto bind(BlockBinding binding, GLintptr offset) const -> void;
+  auto endFrame() -> void;
+
+private:
+  BufferHandle UBO;
+  std::size_t regionSize;
+  GLint alignment{256};
+  std::size_t region{0};
+  std::array<GLsync, FRAMES> fences{};
+  std::vector<char> staging;
+  std::size_t stagingUsed{0};
+
+  auto regionOffset() const -> GLintptr { return region * regionSize; }
+};
+
+UniformRing::UniformRing(std::size_t bytesPerFrame)
+    : regionSize{bytesPerFrame}, staging(bytesPerFrame) {
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  regionSize = (regionSize + alignment - 1) / alignment * alignment;
+  UBO = DefaultGpuRegistry.create<GpuKind::Buffer>(regionSize * FRAMES);
+  glBindBuffer(GL_UNIFORM_BUFFER, UBO.name());
+  glBufferData(GL_UNIFORM_BUFFER, regionSize * FRAMES, nullptr,
+               GL_STREAM_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+auto UniformRing::destory() -> void {
+  for (auto &f : fences)
+    if (f)
+      glDeleteSync(f);
+  DefaultGpuRegistry.release(UBO);
+}
+
+auto UniformRing::beginFrame() -> void {
+  region = (region + 1) % FRAMES;
+  if (auto &fence{fences[region]}; fence) {
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000) ==
+           GL_TIMEOUT_EXPIRED)
+      ;
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+  stagingUsed = 0;
+}
+
+// Returns the block's offset inside the UBO, to be passed to bind().
+template <typename Block>
+auto UniformRing::push(const Block &block) -> GLintptr {
+  auto offset{(stagingUsed + alignment - 1) / alignment * alignment};
+  if (offset + sizeof(Block) > staging.size()) {
+    std::cerr << "ERROR::UniformRing::push -> frame region full ("
+              << regionSize << " bytes)." << std::endl;
+    return regionOffset();
+  }
+  std::memcpy(staging.data() + offset, &block, sizeof(Block));
+  stagingUsed = offset + sizeof(Block);
+  return regionOffset() + offset;
+}
+
+auto UniformRing::flush() -> void {
+  if (!stagingUsed)
+    return;
+  glBindBuffer(GL_UNIFORM_BUFFER, UBO.name());
+  auto *dst{glMapBufferRange(GL_UNIFORM_BUFFER, regionOffset(), stagingUsed,
+                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                 GL_MAP_UNSYNCHRONIZED_BIT)};
+  if (dst) {
+    std::memcpy(dst, staging.data(), stagingUsed);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  DefaultFrameStats.uniformUploads++;
+}
+
+template <typename Block>
+auto UniformRing::bind(BlockBinding binding, GLintptr offset) const -> void {
+  glBindBufferRange(GL_UNIFORM_BUFFER, static_cast<GLuint>(binding),
+                    UBO.name(), offset, sizeof(Block));
+}
+
+auto UniformRing::endFrame() -> void {
+  fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
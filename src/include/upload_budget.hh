@@ -0,0 +1,34 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+
+// How much GL upload work the render thread may do in one frame. Uploaders
+// take() bytes in chunks and stop as soon as exhausted() turns true, so one
+// frame never spends much more than `time` or `bytes` on asset streaming.
+struct UploadBudget {
+  using Clock = std::chrono::steady_clock;
+
+  std::size_t bytes;
+  Clock::duration time;
+  Clock::time_point start{Clock::now()};
+
+  // Largest single glBufferSubData/glTexSubImage2D issued by an uploader.
+  static constexpr std::size_t CHUNK = 256 * 1024;
+
+  static auto unlimited() -> UploadBudget {
+    return UploadBudget{std::numeric_limits<std::size_t>::max(),
+                        Clock::duration::max()};
+  }
+
+  auto exhausted() const -> bool {
+    return bytes == 0 || Clock::now() - start >= time;
+  }
+  auto take(std::size_t want) -> std::size_t {
+    auto n{std::min({want, bytes, CHUNK})};
+    bytes -= n;
+    return n;
+  }
+};
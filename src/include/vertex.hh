@@ -2,6 +2,9 @@
 
 #include <glm/glm.hpp>
 
+#include <array>
+#include <cstdint>
+
 class Vertex {
 public:
   glm::vec3 position;
@@ -10,3 +13,11 @@ public:
 
   auto destory() const -> void {}
 };
+
+// A Vertex's binding to its mesh's bones: up to four of them, with weights
+// summing to 1 (unused slots weigh 0).
+class VertexSkin {
+public:
+  std::array<std::uint16_t, 4> joints{0, 0, 0, 0};
+  glm::vec4 weights{0.0f};
+};
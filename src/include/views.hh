@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "camera.hh"
+#include "dynamic_resolution.hh"
+#include "stats.hh"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// One camera of a split-screen frame (--views), drawn into its own part of
+// the window. Work that doesn't depend on the camera -- the shadow maps,
+// culling against the light volumes, per-object uniform uploads -- runs
+// once per frame and every view reuses it; a View owns only what differs
+// per camera, and its costs are measured apart from the shared ones.
+// Camera-dependent work that needs big scratch state -- the occlusion Hi-Z
+// and the light clusters -- is not owned per view: main keeps one
+// OcclusionCuller and one LightClusters and rebuilds them for each view
+// before drawing it, so their stats describe the last view drawn.
+struct View {
+  static constexpr uint MAX_VIEWS = 4;
+
+  explicit View(const FPSCamera &camera) : camera{camera} {}
+
+  FPSCamera camera;
+  // Lower-left corner and size, as fractions of the window
+  glm::vec2 origin{0.0f}, extent{1.0f};
+  GLintptr cameraBlock{0}; // this frame's CameraBlock in the UniformRing
+  std::unique_ptr<GpuPassTimer> timer{std::make_unique<GpuPassTimer>()};
+  // The view's own CPU time and GL work, last frame
+  float cpuMs{0.0f};
+  FrameStats stats;
+
+  // Pixel rectangle (x, y, width, height) of the view in a `width` x
+  // `height` target.
+  auto viewport(int width, int height) const -> glm::ivec4 {
+    const int x{static_cast<int>(std::lround(origin.x * width))};
+    const int y{static_cast<int>(std::lround(origin.y * height))};
+    return glm::ivec4(
+        x, y,
+        std::max(1, static_cast<int>(std::lround((origin.x + extent.x) * width)) - x),
+        std::max(1, static_cast<int>(std::lround((origin.y + extent.y) * height)) - y));
+  }
+
+  // Tiles the window with `count` views: one fills it, two sit side by
+  // side, three and four share a 2x2 grid filled row by row from the top.
+  static auto split(uint count, std::vector<View> &views) -> void {
+    const uint columns{count > 1 ? 2u : 1u};
+    const uint rows{(count + columns - 1) / columns};
+    for (uint i = 0; i < count && i < views.size(); i++) {
+      views[i].extent = glm::vec2(1.0f / columns, 1.0f / rows);
+      views[i].origin = glm::vec2((i % columns) * views[i].extent.x,
+                                  1.0f - (i / columns + 1) * views[i].extent.y);
+    }
+  }
+};
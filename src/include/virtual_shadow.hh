@@ -0,0 +1,581 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gpu_registry.hh"
+#include "profiler.hh"
+#include "shader.hh"
+#include "uniform_ring.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// A directional shadow map of virtualSize^2 texels that only exists where
+// the camera looks (--virtual-shadows).
+//
+// The light's ortho view is cut into pages of pageSize^2 texels, with a
+// coarser copy of the page grid per level: level 0 has virtualSize /
+// pageSize pages a side, each level halves that, and the last level is a
+// single page over the whole view. A low-resolution camera depth pre-pass
+// is read back asynchronously; every sample is projected into light space
+// and requests the page of the level whose texels match its screen
+// footprint. Requested pages get a slot in one physical depth texture (the
+// pool), least recently requested pages are evicted when it's full, and the
+// page table -- one RGBA8UI texel per page and level, a mip chain --
+// tells texshad.frag where each resident page lives. The shader takes the
+// finest resident page covering the fragment, so a page that isn't
+// rendered yet falls back to a coarser one.
+//
+// Rendered pages stay valid until the light moves or invalidate() reports
+// a caster change under them; only new or invalidated pages are drawn,
+// at most `budget` a frame, coarse levels first.
+//
+//   vsm.setLight(directional_light.block());
+//   vsm.schedule(camera, budget, uniforms); // before uniforms.flush()
+//   vsm.render(uniforms, draw_casters);     // shadow program bound
+//   vsm.renderPrepass(uniforms, draw_casters);
+//   vsm.bind(scene_shader, poolUnit, tableUnit);
+class VirtualShadowMap {
+public:
+  struct Camera {
+    glm::mat4 viewProjection{1.0f};
+    glm::mat4 view{1.0f};
+    glm::mat4 projection{1.0f};
+    glm::vec3 position{0.0f};
+    float fovY{glm::radians(45.0f)};
+    int screenHeight{720};
+  };
+
+  struct Stats {
+    uint requested{0}; // pages asked for by the latest pre-pass
+    uint resident{0};
+    uint rendered{0};  // this frame
+    uint evicted{0};   // this frame
+    uint missing{0};   // requested but without a slot, pool full
+    float analyzeMs{0.0f};
+    std::size_t poolBytes{0}, tableBytes{0};
+    std::size_t uniformBytes{0}; // a plain virtualSize^2 D16 map
+  };
+
+  VirtualShadowMap(int virtualSize = 16384, int pageSize = 128,
+                   int poolSize = 4096, int prepassWidth = 320,
+                   int prepassHeight = 180);
+  VirtualShadowMap(const VirtualShadowMap &) = delete;
+  VirtualShadowMap &operator=(const VirtualShadowMap &) = delete;
+
+  auto destory() -> void;
+
+  // Directional light whose view is virtualized; a changed matrix
+  // invalidates every page.
+  auto setLight(const LightBlock &light) -> void;
+  // Casters inside the world AABB [lo, hi] moved: re-render their pages.
+  auto invalidate(const glm::vec3 &lo, const glm::vec3 &hi) -> void;
+  auto invalidate() -> void;
+
+  // Reads back finished pre-passes, allocates the pages they request,
+  // picks up to `budget` pages to render and pushes their Light blocks and
+  // the pre-pass block for `camera`.
+  auto schedule(const Camera &camera, uint budget, UniformRing &uniforms)
+      -> void;
+  // Renders the scheduled pages, calling drawCasters(pageLightSpace) with
+  // that page's `Light` block bound. The caller leaves face culling alone.
+  template <typename DrawCasters>
+  auto render(const UniformRing &uniforms, DrawCasters &&drawCasters)
+      -> void;
+  // Camera depth at low resolution for the next schedule(), read back
+  // without stalling; same callback contract as render().
+  template <typename DrawCasters>
+  auto renderPrepass(const UniformRing &uniforms, DrawCasters &&drawCasters)
+      -> void;
+  // Pool and page table on the given units of the bound program.
+  auto bind(const Shader &shader, GLuint poolUnit, GLuint tableUnit) const
+      -> void;
+
+  // Pre-passes still in flight, or requested pages the budget left for
+  // later frames: the map keeps changing without the camera moving.
+  auto settling() const -> bool;
+
+  // For texshad.frag's VIRTUAL_SHADOWS variant
+  auto defines() const -> std::vector<std::string>;
+  auto stats() const -> const Stats & { return stats_; }
+
+  const int virtualSize, pageSize, poolSize;
+  const int prepassWidth, prepassHeight;
+  FramebufferHandle poolFBO;
+  TextureHandle poolTexture;
+
+private:
+  using Clock = std::chrono::steady_clock;
+  static constexpr std::size_t READBACKS = 3;
+  // A still camera re-runs the pre-pass this often (frames), for receivers
+  // that moved into its view
+  static constexpr std::uint64_t PREPASS_INTERVAL = 30;
+
+  struct Page {
+    int slot{-1}; // physical page, -1: not resident
+    bool rendered{false};
+    std::uint64_t lastRequested{0};
+  };
+  struct Readback {
+    BufferHandle PBO;
+    GLsync fence{nullptr};
+    Camera camera;
+  };
+
+  int levels{0}, poolPages{0};
+  std::vector<int> levelOffset; // first page of each level in `pages`
+  std::vector<Page> pages;
+  std::vector<int> freeSlots;
+  std::vector<int> requested, scheduled, candidates; // reused every frame
+  std::vector<std::array<std::uint8_t, 4>> table; // CPU mirror, all levels
+  std::vector<bool> tableDirty;                   // per level
+  std::vector<GLintptr> pageBlocks;
+  std::vector<float> depth; // mapped pre-pass, reused
+
+  LightBlock light{};
+  bool haveLight{false};
+  std::uint64_t frame{0};
+  std::uint64_t analyzed{0}; // frame of the pre-pass `requested` came from
+  Stats stats_;
+
+  FramebufferHandle prepassFBO;
+  TextureHandle prepassDepth;
+  std::array<Readback, READBACKS> readbacks;
+  std::size_t nextReadback{0};
+  Camera prepassCamera;
+  GLintptr prepassBlock{0};
+  bool prepassDue{true};
+  std::uint64_t lastPrepass{0};
+  bool budgetFull{false};
+  TextureHandle tableTexture;
+
+  auto pagesAt(int level) const -> int { return (virtualSize / pageSize) >> level; }
+  auto levelOf(int page) const -> int;
+  auto pageMatrix(int page) const -> glm::mat4;
+  auto setTable(int page) -> void;
+  auto analyze(const Readback &r) -> void;
+  auto request(int level, glm::vec2 uv) -> void;
+  auto evictOne() -> int;
+  auto setup() -> bool;
+};
+
+VirtualShadowMap::VirtualShadowMap(int virtualSize, int pageSize, int poolSize,
+                                   int prepassWidth, int prepassHeight)
+    : virtualSize{virtualSize}, pageSize{pageSize}, poolSize{poolSize},
+      prepassWidth{prepassWidth}, prepassHeight{prepassHeight} {
+  for (int n = virtualSize / pageSize; n >= 1; n /= 2) {
+    levelOffset.push_back(pages.size());
+    pages.resize(pages.size() + static_cast<std::size_t>(n) * n);
+    levels++;
+  }
+  table.resize(pages.size());
+  tableDirty.assign(levels, true);
+  poolPages = poolSize / pageSize;
+  for (int s = poolPages * poolPages - 1; s >= 0; s--)
+    freeSlots.push_back(s);
+  depth.resize(static_cast<std::size_t>(prepassWidth) * prepassHeight);
+
+  stats_.poolBytes = static_cast<std::size_t>(poolSize) * poolSize *
+                     sizeof(GLushort);
+  stats_.tableBytes = table.size() * sizeof(table[0]);
+  stats_.uniformBytes = static_cast<std::size_t>(virtualSize) * virtualSize *
+                        sizeof(GLushort);
+  if (!setup())
+    std::cerr << "ERROR::VirtualShadowMap::setup -> returned false."
+              << std::endl;
+}
+
+auto VirtualShadowMap::setup() -> bool {
+  poolTexture = DefaultGpuRegistry.create<GpuKind::Texture>(stats_.poolBytes);
+  glBindTexture(GL_TEXTURE_2D, poolTexture.name());
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, poolSize, poolSize, 0,
+               GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  poolFBO = DefaultGpuRegistry.create<GpuKind::Framebuffer>();
+  glBindFramebuffer(GL_FRAMEBUFFER, poolFBO.name());
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                       poolTexture.name(), 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  bool complete{glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                GL_FRAMEBUFFER_COMPLETE};
+
+  // Page table: level L of the mip chain holds level L's pages
+  tableTexture = DefaultGpuRegistry.create<GpuKind::Texture>(stats_.tableBytes);
+  glBindTexture(GL_TEXTURE_2D, tableTexture.name());
+  for (int l = 0; l < levels; l++)
+    glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8UI, pagesAt(l), pagesAt(l), 0,
+                 GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+  const std::size_t texels{static_cast<std::size_t>(prepassWidth) *
+                           prepassHeight};
+  prepassDepth =
+      DefaultGpuRegistry.create<GpuKind::Texture>(texels * sizeof(float));
+  glBindTexture(GL_TEXTURE_2D, prepassDepth.name());
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, prepassWidth,
+               prepassHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  prepassFBO = DefaultGpuRegistry.create<GpuKind::Framebuffer>();
+  glBindFramebuffer(GL_FRAMEBUFFER, prepassFBO.name());
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                       prepassDepth.name(), 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                             GL_FRAMEBUFFER_COMPLETE;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  for (auto &r : readbacks) {
+    r.PBO = DefaultGpuRegistry.create<GpuKind::Buffer>(texels * sizeof(float));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.PBO.name());
+    glBufferData(GL_PIXEL_PACK_BUFFER, texels * sizeof(float), nullptr,
+                 GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  return complete;
+}
+
+auto VirtualShadowMap::destory() -> void {
+  for (auto &r : readbacks) {
+    if (r.fence)
+      glDeleteSync(r.fence);
+    r.fence = nullptr;
+    DefaultGpuRegistry.release(r.PBO);
+  }
+  DefaultGpuRegistry.release(prepassDepth);
+  DefaultGpuRegistry.release(prepassFBO);
+  DefaultGpuRegistry.release(tableTexture);
+  DefaultGpuRegistry.release(poolTexture);
+  DefaultGpuRegistry.release(poolFBO);
+}
+
+auto VirtualShadowMap::levelOf(int page) const -> int {
+  int l{levels - 1};
+  while (levelOffset[l] > page)
+    l--;
+  return l;
+}
+
+// The light's projection cropped to the page: the page's NDC square is
+// scaled and shifted onto [-1, 1]^2, depth untouched.
+auto VirtualShadowMap::pageMatrix(int page) const -> glm::mat4 {
+  const int level{levelOf(page)};
+  const int n{pagesAt(level)};
+  const int local{page - levelOffset[level]};
+  const int px{local % n}, py{local / n};
+  glm::mat4 crop{1.0f};
+  crop[0][0] = crop[1][1] = static_cast<float>(n);
+  crop[3][0] = n - 1.0f - 2.0f * px;
+  crop[3][1] = n - 1.0f - 2.0f * py;
+  return crop;
+}
+
+auto VirtualShadowMap::setTable(int page) -> void {
+  auto &p{pages[page]};
+  const bool valid{p.slot >= 0 && p.rendered};
+  table[page] = {static_cast<std::uint8_t>(valid ? p.slot % poolPages : 0),
+                 static_cast<std::uint8_t>(valid ? p.slot / poolPages : 0),
+                 static_cast<std::uint8_t>(valid), 0};
+  tableDirty[levelOf(page)] = true;
+}
+
+auto VirtualShadowMap::setLight(const LightBlock &block) -> void {
+  if (haveLight &&
+      std::memcmp(&block.lightSpaceMatrix, &light.lightSpaceMatrix,
+                  sizeof(glm::mat4)) == 0)
+    return;
+  light = block;
+  haveLight = true;
+  invalidate();
+}
+
+auto VirtualShadowMap::invalidate() -> void {
+  for (std::size_t i = 0; i < pages.size(); i++)
+    if (pages[i].rendered) {
+      pages[i].rendered = false;
+      setTable(i);
+    }
+}
+
+auto VirtualShadowMap::invalidate(const glm::vec3 &lo, const glm::vec3 &hi)
+    -> void {
+  // Light-space rectangle of the box's corners, in [0, 1] uv
+  glm::vec2 uvLo{1.0f}, uvHi{0.0f};
+  for (int c = 0; c < 8; c++) {
+    const glm::vec3 corner{c & 1 ? hi.x : lo.x, c & 2 ? hi.y : lo.y,
+                           c & 4 ? hi.z : lo.z};
+    const glm::vec2 uv{glm::vec2(light.lightSpaceMatrix *
+                                 glm::vec4(corner, 1.0f)) *
+                           0.5f +
+                       0.5f};
+    uvLo = glm::min(uvLo, uv);
+    uvHi = glm::max(uvHi, uv);
+  }
+  uvLo = glm::clamp(uvLo, 0.0f, 1.0f);
+  uvHi = glm::clamp(uvHi, 0.0f, 1.0f);
+  for (int l = 0; l < levels; l++) {
+    const int n{pagesAt(l)};
+    for (int y = std::min(n - 1, static_cast<int>(uvLo.y * n));
+         y <= std::min(n - 1, static_cast<int>(uvHi.y * n)); y++)
+      for (int x = std::min(n - 1, static_cast<int>(uvLo.x * n));
+           x <= std::min(n - 1, static_cast<int>(uvHi.x * n)); x++) {
+        const int page{levelOffset[l] + y * n + x};
+        if (pages[page].rendered) {
+          pages[page].rendered = false;
+          setTable(page);
+        }
+      }
+  }
+}
+
+auto VirtualShadowMap::request(int level, glm::vec2 uv) -> void {
+  const int n{pagesAt(level)};
+  const int x{std::min(n - 1, static_cast<int>(uv.x * n))};
+  const int y{std::min(n - 1, static_cast<int>(uv.y * n))};
+  const int page{levelOffset[level] + y * n + x};
+  if (pages[page].lastRequested == frame)
+    return;
+  pages[page].lastRequested = frame;
+  requested.push_back(page);
+}
+
+// Every pre-pass sample asks for the level whose texels are no larger than
+// the screen pixel it covers.
+auto VirtualShadowMap::analyze(const Readback &r) -> void {
+  PROFILE_SCOPE("VirtualShadowMap::analyze");
+  auto start{Clock::now()};
+  requested.clear();
+  analyzed = frame;
+  request(levels - 1, glm::vec2(0.5f)); // the fallback page, always
+  const glm::mat4 toWorld{glm::inverse(r.camera.viewProjection)};
+  const float pixelAngle{2.0f * std::tan(r.camera.fovY * 0.5f) /
+                         r.camera.screenHeight};
+  // World size of a level-0 texel; the ortho projection is 2 / width
+  const float texel0{2.0f / (light.lightProjection[0][0] * virtualSize)};
+  for (int y = 0; y < prepassHeight; y++)
+    for (int x = 0; x < prepassWidth; x++) {
+      const float d{depth[static_cast<std::size_t>(y) * prepassWidth + x]};
+      if (d >= 1.0f)
+        continue; // sky
+      glm::vec4 world{toWorld * glm::vec4((x + 0.5f) / prepassWidth * 2.0f -
+                                              1.0f,
+                                          (y + 0.5f) / prepassHeight * 2.0f -
+                                              1.0f,
+                                          d * 2.0f - 1.0f, 1.0f)};
+      world /= world.w;
+      const glm::vec4 lightSpace{light.lightSpaceMatrix * world};
+      const glm::vec2 uv{glm::vec2(lightSpace) * 0.5f + 0.5f};
+      if (uv.x < 0.0f || uv.y < 0.0f || uv.x >= 1.0f || uv.y >= 1.0f)
+        continue;
+      const float footprint{
+          glm::length(glm::vec3(world) - r.camera.position) * pixelAngle};
+      const int level{std::clamp(
+          static_cast<int>(std::floor(std::log2(footprint / texel0))), 0,
+          levels - 1)};
+      request(level, uv);
+    }
+  stats_.requested = requested.size();
+  stats_.analyzeMs =
+      std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+// Frees the slot of the least recently requested page that the latest
+// pre-pass didn't ask for; -1 if every resident page is wanted.
+auto VirtualShadowMap::evictOne() -> int {
+  if (candidates.empty())
+    return -1;
+  const int page{candidates.back()};
+  candidates.pop_back();
+  const int slot{pages[page].slot};
+  pages[page].slot = -1;
+  pages[page].rendered = false;
+  setTable(page);
+  stats_.evicted++;
+  return slot;
+}
+
+auto VirtualShadowMap::schedule(const Camera &camera, uint budget,
+                                UniformRing &uniforms) -> void {
+  PROFILE_SCOPE("VirtualShadowMap::schedule");
+  frame++;
+  stats_.rendered = stats_.evicted = stats_.missing = 0;
+
+  // Newest finished pre-pass; older ones are superseded
+  for (std::size_t i = 1; i <= READBACKS; i++) {
+    auto &r{readbacks[(nextReadback + READBACKS - i) % READBACKS]};
+    if (!r.fence)
+      continue;
+    const GLenum status{glClientWaitSync(r.fence, 0, 0)};
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      continue;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.PBO.name());
+    if (auto *src{glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                   depth.size() * sizeof(float),
+                                   GL_MAP_READ_BIT)}) {
+      std::memcpy(depth.data(), src, depth.size() * sizeof(float));
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      analyze(r);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    for (auto &older : readbacks) // this one and everything before it
+      if (older.fence && &older != &r &&
+          glClientWaitSync(older.fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+        glDeleteSync(older.fence);
+        older.fence = nullptr;
+      }
+    glDeleteSync(r.fence);
+    r.fence = nullptr;
+    break;
+  }
+
+  // Coarse levels first, so fallbacks exist before details
+  std::sort(begin(requested), end(requested), std::greater<>{});
+  candidates.clear();
+  for (std::size_t i = 0; i < pages.size(); i++)
+    if (pages[i].slot >= 0 && pages[i].lastRequested < analyzed)
+      candidates.push_back(i);
+  std::sort(begin(candidates), end(candidates), [&](int a, int b) {
+    return pages[a].lastRequested > pages[b].lastRequested;
+  });
+  scheduled.clear();
+  for (auto page : requested) {
+    auto &p{pages[page]};
+    if (p.slot < 0) {
+      if (!freeSlots.empty()) {
+        p.slot = freeSlots.back();
+        freeSlots.pop_back();
+      } else if ((p.slot = evictOne()) < 0) {
+        stats_.missing++;
+        continue;
+      }
+    }
+    if (!p.rendered && scheduled.size() < budget)
+      scheduled.push_back(page);
+  }
+
+  pageBlocks.clear();
+  for (auto page : scheduled) {
+    const glm::mat4 crop{pageMatrix(page)};
+    pageBlocks.push_back(uniforms.push(LightBlock{
+        crop * light.lightSpaceMatrix, light.lightView,
+        crop * light.lightProjection, light.lightPos, glm::vec4(1.0f)}));
+    pages[page].rendered = true; // drawn by render() before anything samples
+    setTable(page);
+  }
+  stats_.rendered = scheduled.size();
+  budgetFull = scheduled.size() == budget;
+  stats_.resident = poolPages * poolPages - freeSlots.size();
+
+  prepassDue = frame - lastPrepass >= PREPASS_INTERVAL ||
+               std::memcmp(&camera.viewProjection,
+                           &prepassCamera.viewProjection,
+                           sizeof(glm::mat4)) != 0;
+  prepassCamera = camera;
+  prepassBlock = uniforms.push(LightBlock{
+      camera.viewProjection, camera.view, camera.projection,
+      glm::vec4(camera.position, 1.0f), glm::vec4(1.0f)});
+
+  glBindTexture(GL_TEXTURE_2D, tableTexture.name());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  for (int l = 0; l < levels; l++)
+    if (tableDirty[l]) {
+      glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, pagesAt(l), pagesAt(l),
+                      GL_RGBA_INTEGER, GL_UNSIGNED_BYTE,
+                      table.data() + levelOffset[l]);
+      tableDirty[l] = false;
+    }
+}
+
+template <typename DrawCasters>
+auto VirtualShadowMap::render(const UniformRing &uniforms,
+                              DrawCasters &&drawCasters) -> void {
+  PROFILE_SCOPE("VirtualShadowMap::render");
+  PROFILE_GPU_SCOPE("VirtualShadowMap::render");
+  if (scheduled.empty())
+    return;
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, poolFBO.name());
+  glEnable(GL_SCISSOR_TEST); // glClear only the page
+  glCullFace(GL_FRONT);      // peter panning
+  for (std::size_t i = 0; i < scheduled.size(); i++) {
+    const int slot{pages[scheduled[i]].slot};
+    const int x{slot % poolPages * pageSize}, y{slot / poolPages * pageSize};
+    glViewport(x, y, pageSize, pageSize);
+    glScissor(x, y, pageSize, pageSize);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    uniforms.bind<LightBlock>(BlockBinding::Light, pageBlocks[i]);
+    drawCasters(pageMatrix(scheduled[i]) * light.lightSpaceMatrix);
+  }
+  glCullFace(GL_BACK);
+  glDisable(GL_SCISSOR_TEST);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+template <typename DrawCasters>
+auto VirtualShadowMap::renderPrepass(const UniformRing &uniforms,
+                                     DrawCasters &&drawCasters) -> void {
+  PROFILE_SCOPE("VirtualShadowMap::renderPrepass");
+  auto &r{readbacks[nextReadback]};
+  // skipped while the ring is full of unread pre-passes
+  if (!prepassDue || r.fence)
+    return;
+  lastPrepass = frame;
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, prepassFBO.name());
+  glViewport(0, 0, prepassWidth, prepassHeight);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  uniforms.bind<LightBlock>(BlockBinding::Light, prepassBlock);
+  drawCasters(prepassCamera.viewProjection);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, r.PBO.name());
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, prepassWidth, prepassHeight, GL_DEPTH_COMPONENT,
+               GL_FLOAT, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  r.camera = prepassCamera;
+  nextReadback = (nextReadback + 1) % READBACKS;
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+auto VirtualShadowMap::settling() const -> bool {
+  return budgetFull ||
+         std::any_of(begin(readbacks), end(readbacks),
+                     [](const Readback &r) { return r.fence != nullptr; });
+}
+
+auto VirtualShadowMap::bind(const Shader &shader, GLuint poolUnit,
+                            GLuint tableUnit) const -> void {
+  glActiveTexture(GL_TEXTURE0 + poolUnit);
+  glBindTexture(GL_TEXTURE_2D, poolTexture.name());
+  glUniform1i(shader.getUniform("shadowPool"), poolUnit);
+  glActiveTexture(GL_TEXTURE0 + tableUnit);
+  glBindTexture(GL_TEXTURE_2D, tableTexture.name());
+  glUniform1i(shader.getUniform("shadowPageTable"), tableUnit);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+auto VirtualShadowMap::defines() const -> std::vector<std::string> {
+  return {"VIRTUAL_SHADOWS", "VSM_PAGES " + std::to_string(pagesAt(0)),
+          "VSM_LEVELS " + std::to_string(levels),
+          "VSM_POOL_PAGES " + std::to_string(poolPages)};
+}
@@ -0,0 +1,416 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "model.hh"
+#include "profiler.hh"
+#include "scene.hh"
+#include "texture_repo.hh"
+#include "upload_budget.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// Streams a scene too large to keep resident. Instances are binned by
+// position into square cells on the ground plane (x/z). Cells within
+// `loadRadius` of the camera, or of where it will be `prefetchSeconds` from
+// now at its current velocity, are wanted: their models import on
+// background threads (Model::Async) and upload within the frame's
+// UploadBudget, nearest cell first. A cell is resident, and its instances
+// drawable, once every model it draws is.
+//
+// Cells that stop being wanted stay cached until the resident models go
+// over the CPU or GPU budget; then the farthest are evicted until they fit.
+// Models are shared between cells and unload with the last cell drawing
+// them, their textures (TextureRepository::evictUnused) with the last model.
+//
+// Render thread only.
+class WorldPartition {
+public:
+  struct Config {
+    float cellSize{32.0f};
+    float loadRadius{64.0f};
+    float prefetchSeconds{2.0f};
+    // CPU-side mesh copies and GL buffers and textures of resident models
+    std::size_t cpuBudget{512u << 20};
+    std::size_t gpuBudget{1024u << 20};
+    // Each import runs a thread pool of its own
+    uint maxImports{2};
+  };
+  struct Stats {
+    std::size_t cells{0}; // holding instances
+    std::size_t wantedCells{0}, residentCells{0}, loadingCells{0};
+    std::size_t residentModels{0}, loadingModels{0};
+    std::size_t cpuBytes{0}, gpuBytes{0};
+    std::size_t peakCpuBytes{0}, peakGpuBytes{0};
+    std::size_t loads{0}, evictions{0}; // cells, since the start
+    // The wanted cells alone don't fit the budgets
+    bool overBudget{false};
+  };
+  // World AABB of a cell's instances
+  struct Bounds {
+    glm::vec3 lo, hi;
+  };
+
+  WorldPartition(const Scene &scene, const Config &config);
+  WorldPartition(const WorldPartition &) = delete;
+  WorldPartition &operator=(const WorldPartition &) = delete;
+
+  // Once per frame, with the camera's position and velocity (units per
+  // second). Returns true when drawable() or model() changed.
+  auto update(const glm::vec3 &position, const glm::vec3 &velocity,
+              UploadBudget &budget) -> bool;
+  // Every wanted cell is resident.
+  auto settled() const -> bool;
+  // Scene model `m` if it is resident, nullptr otherwise.
+  auto model(std::size_t m) const -> Model *;
+  // Instances of the resident cells, grouped by model.
+  auto drawable() const -> const std::vector<std::size_t> & {
+    return drawable_;
+  }
+  // Cells that became resident or were evicted by the last update(), for
+  // caches of what was drawn, e.g. rendered shadow pages.
+  auto changedBounds() const -> const std::vector<Bounds> & {
+    return changedBounds_;
+  }
+  auto stats() const -> const Stats & { return stats_; }
+  auto destory() -> void;
+
+private:
+  struct Cell {
+    enum class State { Unloaded, Loading, Resident };
+    std::vector<std::size_t> instances;
+    std::vector<std::size_t> models; // distinct, indices into scene.models
+    State state{State::Unloaded};
+    std::uint64_t wantedFrame{0};
+    float distance{0.0f}; // from the camera, as of the last update
+    Bounds bounds{};      // Resident only
+  };
+  struct ModelSlot {
+    std::unique_ptr<Model> model;
+    uint users{0}; // loading or resident cells drawing it
+    bool counted{false}; // its bytes are in stats_
+    std::size_t cpuBytes{0}, gpuBytes{0};
+  };
+
+  const Scene &scene;
+  Config config;
+  glm::vec2 origin{0.0f}; // corner of cell (0, 0)
+  int columns{0}, rows{0};
+  std::vector<Cell> cells;
+  std::vector<ModelSlot> slots;
+  std::uint64_t frame{0};
+
+  // Reused every frame
+  std::vector<std::size_t> wanted;
+  std::vector<std::size_t> cached;  // cells loading or resident
+  std::vector<std::size_t> queued;  // models to import, nearest first
+  std::vector<std::size_t> loading; // models importing or uploading
+  std::vector<std::size_t> drawable_;
+  std::vector<Bounds> changedBounds_;
+  // A resident cell came or went, or a counted model was unloaded
+  bool changed{false};
+  bool texturesDirty{false};
+  Stats stats_;
+
+  auto markWanted(const glm::vec2 &center) -> void;
+  auto distanceTo(std::size_t cell, const glm::vec2 &point) const -> float;
+  auto activate(std::size_t cell) -> void;
+  auto deactivate(std::size_t cell) -> void;
+  auto unload(std::size_t model) -> void;
+  auto boundsOf(const Cell &cell) const -> Bounds;
+  auto rebuildDrawable() -> void;
+};
+
+WorldPartition::WorldPartition(const Scene &scene, const Config &config)
+    : scene{scene}, config{config}, slots(scene.models.size()) {
+  if (scene.instances.empty()) { // no cells: nothing is ever wanted
+    std::clog << "LOG::WorldPartition::\"Partitioned Scene\": no instances"
+              << std::endl;
+    return;
+  }
+  glm::vec2 lo{std::numeric_limits<float>::max()}, hi{-lo};
+  for (auto &instance : scene.instances) {
+    const glm::vec2 p{instance.position.x, instance.position.z};
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+  origin = glm::floor(lo / config.cellSize) * config.cellSize;
+  columns = static_cast<int>((hi.x - origin.x) / config.cellSize) + 1;
+  rows = static_cast<int>((hi.y - origin.y) / config.cellSize) + 1;
+  cells.resize(static_cast<std::size_t>(columns) * rows);
+
+  for (std::size_t i = 0; i < scene.instances.size(); i++) {
+    auto &instance{scene.instances[i]};
+    const auto x{static_cast<int>((instance.position.x - origin.x) /
+                                  config.cellSize)};
+    const auto z{static_cast<int>((instance.position.z - origin.y) /
+                                  config.cellSize)};
+    auto &cell{
+        cells[std::min(z, rows - 1) * columns + std::min(x, columns - 1)]};
+    cell.instances.push_back(i);
+    if (std::find(cell.models.begin(), cell.models.end(), instance.model) ==
+        cell.models.end())
+      cell.models.push_back(instance.model);
+  }
+  for (auto &cell : cells)
+    stats_.cells += !cell.instances.empty();
+  std::clog << "LOG::WorldPartition::\"Partitioned Scene\": "
+            << scene.instances.size() << " instances into " << stats_.cells
+            << " of " << columns << 'x' << rows << " cells of "
+            << config.cellSize << " units, load radius " << config.loadRadius
+            << ", budgets CPU " << (config.cpuBudget >> 20) << " MiB, GPU "
+            << (config.gpuBudget >> 20) << " MiB" << std::endl;
+}
+
+auto WorldPartition::distanceTo(std::size_t cell, const glm::vec2 &point) const
+    -> float {
+  const glm::vec2 lo{origin + config.cellSize *
+                                  glm::vec2(cell % columns, cell / columns)};
+  return glm::distance(point, glm::clamp(point, lo, lo + config.cellSize));
+}
+
+auto WorldPartition::markWanted(const glm::vec2 &center) -> void {
+  const glm::ivec2 lo{glm::floor((center - config.loadRadius - origin) /
+                                 config.cellSize)};
+  const glm::ivec2 hi{glm::floor((center + config.loadRadius - origin) /
+                                 config.cellSize)};
+  for (int z = std::max(lo.y, 0); z <= std::min(hi.y, rows - 1); z++)
+    for (int x = std::max(lo.x, 0); x <= std::min(hi.x, columns - 1); x++) {
+      const std::size_t i{static_cast<std::size_t>(z) * columns + x};
+      auto &cell{cells[i]};
+      if (cell.instances.empty() || cell.wantedFrame == frame ||
+          distanceTo(i, center) > config.loadRadius)
+        continue;
+      cell.wantedFrame = frame;
+      wanted.push_back(i);
+    }
+}
+
+auto WorldPartition::activate(std::size_t cell) -> void {
+  auto &c{cells[cell]};
+  c.state = Cell::State::Loading;
+  cached.push_back(cell);
+  for (auto m : c.models)
+    if (slots[m].users++ == 0 && !slots[m].model)
+      queued.push_back(m);
+}
+
+auto WorldPartition::deactivate(std::size_t cell) -> void {
+  auto &c{cells[cell]};
+  if (c.state == Cell::State::Resident)
+    changedBounds_.push_back(c.bounds);
+  c.state = Cell::State::Unloaded;
+  cached.erase(std::find(cached.begin(), cached.end(), cell));
+  for (auto m : c.models)
+    // Models mid-import are left to the sweep: destory() would wait on them
+    if (--slots[m].users == 0 && slots[m].model &&
+        !slots[m].model->importing())
+      unload(m);
+}
+
+auto WorldPartition::unload(std::size_t model) -> void {
+  auto &slot{slots[model]};
+  if (slot.counted) {
+    stats_.cpuBytes -= slot.cpuBytes;
+    stats_.gpuBytes -= slot.gpuBytes;
+    slot.counted = false;
+    changed = true;
+  }
+  slot.model->destory();
+  slot.model.reset();
+  if (auto it{std::find(loading.begin(), loading.end(), model)};
+      it != loading.end())
+    loading.erase(it);
+  texturesDirty = true;
+}
+
+auto WorldPartition::update(const glm::vec3 &position,
+                            const glm::vec3 &velocity, UploadBudget &budget)
+    -> bool {
+  PROFILE_SCOPE("WorldPartition::update");
+  frame++;
+  changed = false;
+  changedBounds_.clear();
+  const glm::vec2 here{position.x, position.z};
+  const glm::vec2 ahead{here + config.prefetchSeconds *
+                                   glm::vec2(velocity.x, velocity.z)};
+  wanted.clear();
+  markWanted(here);
+  markWanted(ahead);
+  for (auto i : wanted)
+    cells[i].distance = std::min(distanceTo(i, here), distanceTo(i, ahead));
+  std::sort(wanted.begin(), wanted.end(), [&](auto a, auto b) {
+    return cells[a].distance < cells[b].distance;
+  });
+  for (auto i : wanted)
+    if (cells[i].state == Cell::State::Unloaded)
+      activate(i);
+
+  // Cells that left the wanted set before finishing aren't worth finishing
+  for (std::size_t k = cached.size(); k-- > 0;) {
+    const auto i{cached[k]};
+    if (cells[i].wantedFrame != frame) {
+      cells[i].distance = distanceTo(i, here);
+      if (cells[i].state == Cell::State::Loading)
+        deactivate(i);
+    }
+  }
+  // Unused models whose import finished since
+  for (std::size_t k = loading.size(); k-- > 0;) {
+    const auto m{loading[k]};
+    if (!slots[m].users && !slots[m].model->importing())
+      unload(m);
+  }
+
+  auto running{static_cast<uint>(
+      std::count_if(loading.begin(), loading.end(),
+                    [&](auto m) { return slots[m].model->importing(); }))};
+  auto next{queued.begin()};
+  for (; next != queued.end() && running < config.maxImports; next++) {
+    auto &slot{slots[*next]};
+    if (!slot.users || slot.model) // dropped, or queued twice
+      continue;
+    slot.model =
+        std::make_unique<Model>(scene.models[*next].path, Model::Async{});
+    loading.push_back(*next);
+    running++;
+  }
+  queued.erase(queued.begin(), next);
+
+  // Nearest first, as they were started
+  for (std::size_t k = 0; k < loading.size() && !budget.exhausted();) {
+    auto &slot{slots[loading[k]]};
+    if (!slot.model->pumpUploads(budget)) {
+      k++;
+      continue;
+    }
+    slot.cpuBytes = slot.model->cpuBytes();
+    slot.gpuBytes = slot.model->gpuBytes();
+    slot.counted = true;
+    stats_.cpuBytes += slot.cpuBytes;
+    stats_.gpuBytes += slot.gpuBytes;
+    loading.erase(loading.begin() + k);
+  }
+  // Counted, not just ready(): model() hands out counted models only, and a
+  // failed or empty import is ready() before the pump above gets to it
+  for (auto i : cached) {
+    auto &cell{cells[i]};
+    if (cell.state != Cell::State::Loading ||
+        !std::all_of(cell.models.begin(), cell.models.end(),
+                     [&](auto m) { return slots[m].counted; }))
+      continue;
+    cell.state = Cell::State::Resident;
+    cell.bounds = boundsOf(cell);
+    changedBounds_.push_back(cell.bounds);
+    stats_.loads++;
+    changed = true;
+  }
+  stats_.peakCpuBytes = std::max(stats_.peakCpuBytes, stats_.cpuBytes);
+  stats_.peakGpuBytes = std::max(stats_.peakGpuBytes, stats_.gpuBytes);
+
+  // Farthest unwanted cell first, until the resident models fit
+  while (stats_.cpuBytes > config.cpuBudget ||
+         stats_.gpuBytes > config.gpuBudget) {
+    auto victim{cached.end()};
+    for (auto it{cached.begin()}; it != cached.end(); it++)
+      if (cells[*it].wantedFrame != frame &&
+          (victim == cached.end() ||
+           cells[*it].distance > cells[*victim].distance))
+        victim = it;
+    if (victim == cached.end())
+      break;
+    changed = changed || cells[*victim].state == Cell::State::Resident;
+    deactivate(*victim);
+    stats_.evictions++;
+  }
+  if (texturesDirty) {
+    DefaultTexRepo.evictUnused();
+    texturesDirty = false;
+  }
+  const bool overBudget{stats_.cpuBytes > config.cpuBudget ||
+                        stats_.gpuBytes > config.gpuBudget};
+  if (overBudget && !stats_.overBudget)
+    std::cerr << "ERROR::WorldPartition::update -> the cells around the "
+                 "camera alone need CPU "
+              << (stats_.cpuBytes >> 20) << " MiB, GPU "
+              << (stats_.gpuBytes >> 20) << " MiB; over budget." << std::endl;
+  stats_.overBudget = overBudget;
+
+  stats_.wantedCells = wanted.size();
+  stats_.residentCells = stats_.loadingCells = 0;
+  for (auto i : cached)
+    (cells[i].state == Cell::State::Resident ? stats_.residentCells
+                                              : stats_.loadingCells)++;
+  stats_.loadingModels = loading.size();
+  stats_.residentModels = 0;
+  for (auto &slot : slots)
+    stats_.residentModels += slot.counted;
+  if (changed)
+    rebuildDrawable();
+  return changed;
+}
+
+// Every mesh's bounds, transformed by each instance; the cell's models must
+// be resident.
+auto WorldPartition::boundsOf(const Cell &cell) const -> Bounds {
+  Bounds b{glm::vec3{std::numeric_limits<float>::max()},
+           glm::vec3{-std::numeric_limits<float>::max()}};
+  for (auto i : cell.instances) {
+    auto &instance{scene.instances[i]};
+    const auto transform{instance.transform()};
+    for (auto &mesh : slots[instance.model].model->meshes)
+      for (int c = 0; c < 8; c++) {
+        const glm::vec3 corner{
+            transform * glm::vec4(c & 1 ? mesh.boundsMax.x : mesh.boundsMin.x,
+                                  c & 2 ? mesh.boundsMax.y : mesh.boundsMin.y,
+                                  c & 4 ? mesh.boundsMax.z : mesh.boundsMin.z,
+                                  1.0f)};
+        b.lo = glm::min(b.lo, corner);
+        b.hi = glm::max(b.hi, corner);
+      }
+  }
+  return b;
+}
+
+auto WorldPartition::rebuildDrawable() -> void {
+  drawable_.clear();
+  for (auto i : cached)
+    if (cells[i].state == Cell::State::Resident)
+      drawable_.insert(drawable_.end(), cells[i].instances.begin(),
+                       cells[i].instances.end());
+  std::sort(drawable_.begin(), drawable_.end(), [&](auto a, auto b) {
+    const auto ma{scene.instances[a].model}, mb{scene.instances[b].model};
+    return ma != mb ? ma < mb : a < b;
+  });
+}
+
+auto WorldPartition::settled() const -> bool {
+  return std::all_of(wanted.begin(), wanted.end(), [&](auto i) {
+    return cells[i].state == Cell::State::Resident;
+  });
+}
+
+auto WorldPartition::model(std::size_t m) const -> Model * {
+  auto &slot{slots[m]};
+  return slot.model && slot.counted ? slot.model.get() : nullptr;
+}
+
+auto WorldPartition::destory() -> void {
+  for (auto &slot : slots)
+    if (slot.model) {
+      slot.model->destory();
+      slot.model.reset();
+      slot.counted = false;
+    }
+  cached.clear();
+  queued.clear();
+  loading.clear();
+  drawable_.clear();
+  for (auto &cell : cells)
+    cell.state = Cell::State::Unloaded;
+}
@@ -2,28 +2,238 @@
 #include <glad/glad.h>
 
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "camera.hh" 
+#include "clustered.hh"
+#include "cpu_rasterizer.hh"
+#include "dynamic_resolution.hh"
+#include "gl_ext.hh"
+#include "gpu_culling.hh"
+#include "gpu_registry.hh"
+#include "hud.hh"
+#include "input.hh"
 #include "utils.hh"
 #include "light.hh"
+#include "meshlet_culling.hh"
 #include "model.hh"
+#include "occlusion.hh"
 #include "shader.hh"
 #include "overlay.hh"
+#include "point_light.hh"
+#include "profiler.hh"
+#include "redraw.hh"
+#include "scene.hh"
+#include "shadow_atlas.hh"
+#include "skinning.hh"
+#include "stats.hh"
+#include "uniform_ring.hh"
+#include "views.hh"
+#include "virtual_shadow.hh"
+#include "world_partition.hh"
 
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <filesystem>
+#include <fstream>
+#include <limits>
 #include <memory>
+#include <random>
 #include <thread>
+#include <unistd.h>
 namespace fs = std::filesystem;
 
-std::function<void(GLFWwindow*, double, double)> g_callback_mouse;
-
-int main()
+int main(int argc, char **argv)
 {
-  using namespace std::string_literals;
+
+  // --scene <file>:   load models, instances, lights and the camera from a
+  //                    scene file instead of scenes/default.json
+  // --benchmark:       fly the scene's camera path once on a fixed timestep,
+  //                    then print load time, memory and frame times and exit
+  // --texture-arrays: pack material textures into GL_TEXTURE_2D_ARRAY pages
+  // --trace <file>:    write a Chrome trace on exit (SHADOW_PROFILE builds)
+  // --cpu-shadows:     rasterize the shadow map on the CPU (CpuDepthRasterizer)
+  // --virtual-shadows: a 16k^2 virtual directional shadow map whose pages
+  //                    are allocated where the camera sees receivers
+  // --occlusion:       cull meshes hidden behind the scene's occluders (Hi-Z)
+  // --point-shadows:   add a point light with cubemap shadows; P switches
+  //                    between the layered pass and the six-pass reference
+  // --shadow-atlas <n>: n orbiting spot lights sharing one ShadowAtlas
+  // --lights <n>:      n unshadowed point lights, clustered forward shading
+  // --record <file>:   save key/cursor input and frame deltas to <file>
+  // --replay <file>:   drive the camera from a recording on a fixed timestep,
+  //                    then print frame time statistics and exit
+  // --headless:        with --replay, render to a hidden window, unpaced
+  // --dynamic-resolution: scale the scene target and the shadow map to keep
+  //                    the GPU time of both passes within the frame budget
+  // --dynres-log <file>: with --dynamic-resolution, write the per-frame
+  //                    timings and resolutions to <file> as CSV
+  // --gpu-culling <n>: n small cubes culled by a compute shader and drawn
+  //                    with one indirect multi-draw per pass (GL 4.3)
+  // --meshlets:       cull the instances' meshlets per pass by frustum and
+  //                    normal cone, drawing the survivors as index ranges
+  // --hud:             start with the performance HUD shown; H toggles it
+  // --views <n>:       split the window between n cameras (up to 4) that
+  //                    share one shadow pass; only the first follows input
+  // --on-demand:       draw only when something changed, waiting for events
+  //                    in between instead of rendering at 60 Hz
+  // --stream:          load and unload the scene's models by grid cell around
+  //                    the camera instead of keeping them all resident;
+  //                    animated models draw in their bind pose
+  // --stream-budget <cpu>,<gpu>: with --stream, MiB the resident models may
+  //                    take before cached cells are evicted (512,1024)
+  // --alloc-report:    log the heap allocations of a frame, by zone and call
+  //                    site, once per second (SHADOW_ALLOC_TRACKING builds)
+  // --alloc-assert <n>: abort with that report if a drawn frame allocates,
+  //                    from the n-th one after every asset became resident
+  bool use_texture_arrays = false;
+  bool use_cpu_shadows = false;
+  bool use_virtual_shadows = false;
+  bool use_occlusion_culling = false;
+  bool use_meshlet_culling = false;
+  bool use_point_shadows = false;
+  uint atlas_light_count = 0;
+  uint cluster_light_count = 0;
+  uint gpu_culled_count = 0;
+  bool headless = false;
+  bool use_dynamic_resolution = false;
+  bool show_hud = false;
+  bool on_demand = false;
+  bool use_streaming = false;
+  WorldPartition::Config stream_config;
+  bool alloc_report = false;
+  long alloc_assert_frame = -1;
+  uint view_count = 1;
+  bool benchmarking = false;
+  auto input_mode{Input::Mode::Live};
+  fs::path trace_path, input_path, dynres_log_path, scene_path;
+  for (int i = 1; i < argc; i++) {
+    if (!std::strcmp(argv[i], "--texture-arrays"))
+      use_texture_arrays = true;
+    else if (!std::strcmp(argv[i], "--cpu-shadows"))
+      use_cpu_shadows = true;
+    else if (!std::strcmp(argv[i], "--virtual-shadows"))
+      use_virtual_shadows = true;
+    else if (!std::strcmp(argv[i], "--occlusion"))
+      use_occlusion_culling = true;
+    else if (!std::strcmp(argv[i], "--meshlets"))
+      use_meshlet_culling = true;
+    else if (!std::strcmp(argv[i], "--point-shadows"))
+      use_point_shadows = true;
+    else if (!std::strcmp(argv[i], "--shadow-atlas") && i + 1 < argc)
+      atlas_light_count = std::min<uint>(std::atoi(argv[++i]), MAX_ATLAS_LIGHTS);
+    else if (!std::strcmp(argv[i], "--lights") && i + 1 < argc)
+      cluster_light_count = std::min<uint>(std::atoi(argv[++i]), 1024);
+    else if (!std::strcmp(argv[i], "--record") && i + 1 < argc) {
+      input_mode = Input::Mode::Record;
+      input_path = argv[++i];
+    } else if (!std::strcmp(argv[i], "--replay") && i + 1 < argc) {
+      input_mode = Input::Mode::Replay;
+      input_path = argv[++i];
+    } else if (!std::strcmp(argv[i], "--headless"))
+      headless = true;
+    else if (!std::strcmp(argv[i], "--dynamic-resolution"))
+      use_dynamic_resolution = true;
+    else if (!std::strcmp(argv[i], "--dynres-log") && i + 1 < argc)
+      dynres_log_path = argv[++i];
+    else if (!std::strcmp(argv[i], "--gpu-culling") && i + 1 < argc)
+      gpu_culled_count = std::atoi(argv[++i]);
+    else if (!std::strcmp(argv[i], "--scene") && i + 1 < argc)
+      scene_path = argv[++i];
+    else if (!std::strcmp(argv[i], "--benchmark"))
+      benchmarking = true;
+    else if (!std::strcmp(argv[i], "--hud"))
+      show_hud = true;
+    else if (!std::strcmp(argv[i], "--views") && i + 1 < argc)
+      view_count = std::clamp<uint>(std::atoi(argv[++i]), 1, View::MAX_VIEWS);
+    else if (!std::strcmp(argv[i], "--on-demand"))
+      on_demand = true;
+    else if (!std::strcmp(argv[i], "--stream"))
+      use_streaming = true;
+    else if (!std::strcmp(argv[i], "--stream-budget") && i + 1 < argc) {
+      std::size_t cpu_mib{0}, gpu_mib{0};
+      if (std::sscanf(argv[++i], "%zu,%zu", &cpu_mib, &gpu_mib) == 2) {
+        stream_config.cpuBudget = cpu_mib << 20;
+        stream_config.gpuBudget = gpu_mib << 20;
+      }
+    } else if (!std::strcmp(argv[i], "--alloc-report"))
+      alloc_report = true;
+    else if (!std::strcmp(argv[i], "--alloc-assert") && i + 1 < argc)
+      alloc_assert_frame = std::max(0, std::atoi(argv[++i]));
+    else if (!std::strcmp(argv[i], "--trace") && i + 1 < argc)
+      trace_path = argv[++i];
+  }
+#ifndef SHADOW_ALLOC_TRACKING
+  if (alloc_report || alloc_assert_frame >= 0) {
+    std::cerr << "ERROR::main -> --alloc-report and --alloc-assert need a "
+                 "build with SHADOW_ALLOC_TRACKING."
+              << std::endl;
+    alloc_report = false;
+    alloc_assert_frame = -1;
+  }
+#endif
+  const bool replaying{input_mode == Input::Mode::Replay};
+  const auto base_path{fs::current_path() / "../../"};
+  const auto load_start{std::chrono::steady_clock::now()};
+  auto scene{Scene::load(
+      scene_path.empty() ? base_path / "scenes/default.json" : scene_path,
+      base_path)};
+  if (!scene)
+    throw std::runtime_error{"scene load failed"};
+  benchmarking = benchmarking && !replaying;
+  if (benchmarking && scene->camera.path.empty()) {
+    std::cerr << "ERROR::main -> --benchmark needs a scene with a camera "
+                 "path."
+              << std::endl;
+    benchmarking = false;
+  }
+  // The GPU-culled grid instances the scene's cube
+  const long batch_model{scene->findModel("cube")};
+  if (gpu_culled_count && batch_model < 0) {
+    std::cerr << "ERROR::main -> --gpu-culling needs a model named \"cube\""
+                 " in the scene."
+              << std::endl;
+    gpu_culled_count = 0;
+  }
+  // One GPU cull dispatch tests every view plus the directional light
+  if (gpu_culled_count && view_count >= IndirectBatch::MAX_VIEWS) {
+    std::cerr << "ERROR::main -> --gpu-culling supports at most "
+              << IndirectBatch::MAX_VIEWS - 1 << " views." << std::endl;
+    view_count = IndirectBatch::MAX_VIEWS - 1;
+  }
+  if (use_virtual_shadows && use_cpu_shadows) {
+    std::cerr << "ERROR::main -> --virtual-shadows and --cpu-shadows both "
+                 "replace the shadow pass; using --cpu-shadows."
+              << std::endl;
+    use_virtual_shadows = false;
+  }
+  // Array pages can't give layers back, and the GPU-culled grid needs its
+  // cube resident for good
+  if (use_streaming && use_texture_arrays) {
+    std::cerr << "ERROR::main -> --stream can't unload array pages; using "
+                 "2D textures."
+              << std::endl;
+    use_texture_arrays = false;
+  }
+  if (use_streaming && gpu_culled_count) {
+    std::cerr << "ERROR::main -> --gpu-culling doesn't work with --stream."
+              << std::endl;
+    gpu_culled_count = 0;
+  }
+  // Recordings and benchmarks need a frame every step
+  if (on_demand && (input_mode != Input::Mode::Live || benchmarking)) {
+    std::cerr << "ERROR::main -> --on-demand only works with live input."
+              << std::endl;
+    on_demand = false;
+  }
+  // nobody could steer a hidden window
+  headless = headless && (replaying || benchmarking);
 
   constexpr int window_height{1366}, window_width{768};
   // std::setlocale(LC_ALL, "POSIX");
@@ -33,6 +243,8 @@ int main()
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  if (headless)
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
   Utils::GLFWwindowUniquePtr window{
       glfwCreateWindow(window_height, window_width, "Shadow Mapping Example OpenGL", nullptr, nullptr)};
   glfwMakeContextCurrent(window.get());
@@ -40,58 +252,306 @@ int main()
     throw std::runtime_error{"glfw window create failed"};
   if (!gladLoadGLLoader(GLADloadproc(glfwGetProcAddress)))
     throw std::runtime_error{"GLAD init failed"};
+  if (gpu_culled_count && !GLExt::load(GLADloadproc(glfwGetProcAddress)))
+    gpu_culled_count = 0;
 
   // Adjust viewport upon window resize
   glfwSetFramebufferSizeCallback(
-      window.get(), [](auto, int w, int h) { glViewport(0, 0, w, h); });
+      window.get(), [](auto, int w, int h) {
+        glViewport(0, 0, w, h);
+        DefaultRedraw.request();
+      });
+  // Uncovered or restored windows need their contents again
+  glfwSetWindowRefreshCallback(window.get(),
+                               [](auto) { DefaultRedraw.request(); });
   glfwSetScrollCallback(window.get(), [](auto, auto, auto) {});
 
+  if (headless)
+    glfwSwapInterval(0);
   // Grab cursor
-  glfwSetInputMode(window.get(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+  if (!replaying)
+    glfwSetInputMode(window.get(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+  Input input{window.get(), input_mode, input_path};
 
-  const auto base_path{fs::current_path() / "../../"};
-  Shader shader_nanosuit, shader_shadowmap, shader_depthmap_overlay;
+  Shader shader_nanosuit, shader_shadowmap, shader_depthmap_overlay, shader_hud;
+  Shader shader_point_layered, shader_point_faces;
   shader_shadowmap
       .attach(base_path / "shader/shadow_mapping/shadow.vert", GL_VERTEX_SHADER)
       .attach(base_path / "shader/shadow_mapping/shadow.frag",
               GL_FRAGMENT_SHADER)
       .link();
+  // Built before the scene shader, which compiles its page table lookup in
+  std::unique_ptr<VirtualShadowMap> virtual_shadows;
+  if (use_virtual_shadows)
+    virtual_shadows = std::make_unique<VirtualShadowMap>();
+  std::vector<std::string> scene_defines;
+  if (virtual_shadows)
+    for (auto &d : virtual_shadows->defines())
+      scene_defines.push_back(d);
+  if (use_texture_arrays)
+    scene_defines.push_back("TEXTURE_ARRAYS");
+  if (atlas_light_count)
+    scene_defines.push_back("SHADOW_ATLAS");
+  if (cluster_light_count || !scene->lights.empty())
+    scene_defines.push_back("CLUSTERED");
+  if (use_point_shadows) {
+    scene_defines.push_back("POINT_SHADOWS");
+    shader_point_layered
+        .attach(base_path / "shader/shadow_mapping/point/point.vert",
+                GL_VERTEX_SHADER)
+        .attach(base_path / "shader/shadow_mapping/point/point.geom",
+                GL_GEOMETRY_SHADER)
+        .attach(base_path / "shader/shadow_mapping/point/point.frag",
+                GL_FRAGMENT_SHADER)
+        .link();
+    shader_point_faces
+        .attach(base_path / "shader/shadow_mapping/point/point_face.vert",
+                GL_VERTEX_SHADER)
+        .attach(base_path / "shader/shadow_mapping/point/point.frag",
+                GL_FRAGMENT_SHADER)
+        .link();
+  }
   shader_nanosuit
       .attach(base_path /
                   "shader/shadow_mapping/texturewithshadow/texshad.vert",
               GL_VERTEX_SHADER)
       .attach(base_path /
                   "shader/shadow_mapping/texturewithshadow/texshad.frag",
-              GL_FRAGMENT_SHADER)
+              GL_FRAGMENT_SHADER, scene_defines)
       .link();
+  Shader shader_cull, shader_indirect, shader_indirect_depth;
+  if (gpu_culled_count) {
+    shader_cull
+        .attach(base_path / "shader/gpu_culling/cull.comp", GL_COMPUTE_SHADER)
+        .link();
+    shader_indirect_depth
+        .attach(base_path / "shader/gpu_culling/indirect.vert",
+                GL_VERTEX_SHADER, {"DEPTH_ONLY"})
+        .attach(base_path / "shader/shadow_mapping/shadow.frag",
+                GL_FRAGMENT_SHADER)
+        .link();
+    // Only the directional shadow, virtual if enabled: the other lights'
+    // samplers aren't set up for this program
+    std::vector<std::string> indirect_defines;
+    if (virtual_shadows)
+      indirect_defines = virtual_shadows->defines();
+    if (use_texture_arrays)
+      indirect_defines.push_back("TEXTURE_ARRAYS");
+    shader_indirect
+        .attach(base_path / "shader/gpu_culling/indirect.vert",
+                GL_VERTEX_SHADER)
+        .attach(base_path /
+                    "shader/shadow_mapping/texturewithshadow/texshad.frag",
+                GL_FRAGMENT_SHADER, indirect_defines)
+        .link();
+  }
   shader_depthmap_overlay
       .attach(base_path / "shader/shadow_mapping/renderdepthmap/depth.vert", GL_VERTEX_SHADER)
       .attach(base_path / "shader/shadow_mapping/renderdepthmap/depth.frag", GL_FRAGMENT_SHADER)
       .link();
+  shader_hud
+      .attach(base_path / "shader/hud/hud.vert", GL_VERTEX_SHADER)
+      .attach(base_path / "shader/hud/hud.frag", GL_FRAGMENT_SHADER)
+      .link();
+  Shader shader_skinning;
+  shader_skinning
+      .attach(base_path / "shader/skinning/skin.vert", GL_VERTEX_SHADER)
+      .captureVaryings(GpuSkinning::VARYINGS)
+      .link();
 
-  Model nanosuit{base_path / "res/nanosuit/nanosuit.obj"};
-  Model cube{base_path / "res/cube/cube.obj"};
-
-  Light directional_light;
-
-  FPSCamera camera{
-      glm::vec3(0, 1.5, 2), // cam_pos
-      glm::vec3(0, 1, 0),   // cam_up
-      window_height / static_cast<float>(window_width),  // aspect-ratio
-      -90.0f,              // yaw
-      -18.0f,              // pitch
-      glm::radians(60.0f), // FOV
-  };
-  g_callback_mouse = [&camera](GLFWwindow *w, double x, double y) {   /* Mouse Support */
-    camera.mouseCallback(w, x, y);
-  }; // HACK
-  glfwSetCursorPosCallback(window.get(), [](GLFWwindow *w, double x, double y) {
-    g_callback_mouse(w, x, y);
+  if (use_texture_arrays)
+    DefaultTexRepo.setMode(TextureRepository::Mode::Array);
+  // Models import on background threads and stream their GL uploads in
+  // from the render loop, so the window is responsive from the first frame.
+  // Streamed, they come and go with the cells around the camera instead.
+  std::vector<std::unique_ptr<Model>> models;
+  std::unique_ptr<WorldPartition> world;
+  if (use_streaming)
+    world = std::make_unique<WorldPartition>(*scene, stream_config);
+  else
+    for (auto &entry : scene->models)
+      models.push_back(std::make_unique<Model>(entry.path, Model::Async{}));
+  // Instances grouped by model, so material state changes once per model.
+  // Every pass draws these; streamed, only the resident cells' instances.
+  std::vector<std::size_t> draw_order(world ? 0 : scene->instances.size());
+  for (std::size_t i = 0; i < draw_order.size(); i++)
+    draw_order[i] = i;
+  std::stable_sort(draw_order.begin(), draw_order.end(), [&](auto a, auto b) {
+    return scene->instances[a].model < scene->instances[b].model;
   });
+  std::vector<glm::mat4> instance_transforms;
+  for (auto &instance : scene->instances)
+    instance_transforms.push_back(instance.transform());
+  // Filled each frame with the instances' ObjectBlock offsets
+  std::vector<GLintptr> instance_blocks(scene->instances.size());
+  std::vector<PointLight::Caster> point_casters;
+  point_casters.reserve(scene->instances.size());
+  bool assets_ready = false;
+  // What each instance draws: its scene model, or for a model with
+  // animations the character GpuSkinning poses for it, once it's resident
+  std::vector<Model *> instance_models;
+  for (auto &instance : scene->instances)
+    instance_models.push_back(world ? nullptr
+                                    : models[instance.model].get());
+  // Camera velocity for the partition's prefetch
+  glm::vec3 last_camera_position{scene->camera.position};
+  auto world_report_time{std::chrono::steady_clock::now()};
+  std::vector<std::unique_ptr<GpuSkinning>> skinnings;
+  std::vector<std::size_t> character_instances;
+  std::unique_ptr<GpuPassTimer> skin_timer;
+  auto skin_report_time{std::chrono::steady_clock::now()};
+
+  const auto &sun{scene->directional};
+  Light directional_light{
+      glm::ortho<float>(-sun.extent, sun.extent, -sun.extent, sun.extent,
+                        -sun.extent, 2.0f * sun.extent),
+      glm::lookAt(sun.position, sun.target, glm::vec3(0, 1, 0)),
+      glm::mat4{1.0f}};
+  std::unique_ptr<CpuDepthRasterizer> cpu_shadow_rasterizer;
+  if (use_cpu_shadows)
+    cpu_shadow_rasterizer = std::make_unique<CpuDepthRasterizer>(
+        Light::SHADOW_WIDTH, Light::SHADOW_HEIGHT);
+  bool cpu_shadows_validated = false;
+  constexpr uint VSM_PAGES_PER_FRAME = 16;
+  constexpr GLuint VSM_POOL_UNIT = 13, VSM_TABLE_UNIT = 14;
+  std::unique_ptr<GpuPassTimer> vsm_timer;
+  if (virtual_shadows) {
+    vsm_timer = std::make_unique<GpuPassTimer>();
+    auto &stats{virtual_shadows->stats()};
+    std::clog << "LOG::main::\"Virtual Shadows\": "
+              << virtual_shadows->virtualSize << "^2 virtual, "
+              << virtual_shadows->pageSize << "^2 pages, pool "
+              << stats.poolBytes / (1024 * 1024) << " MiB + page table "
+              << stats.tableBytes / 1024 << " KiB instead of "
+              << stats.uniformBytes / (1024 * 1024) << " MiB for a uniform map"
+              << std::endl;
+  }
+  auto vsm_report_time{std::chrono::steady_clock::now()};
+  // One Hi-Z, rebuilt for each view (--views) right before it's drawn
+  std::unique_ptr<OcclusionCuller> occlusion_culler;
+  if (use_occlusion_culling)
+    occlusion_culler = std::make_unique<OcclusionCuller>();
+  auto occlusion_report_time{std::chrono::steady_clock::now()};
+  std::unique_ptr<MeshletCuller> meshlet_culler;
+  if (use_meshlet_culling)
+    meshlet_culler = std::make_unique<MeshletCuller>();
+  auto meshlet_report_time{std::chrono::steady_clock::now()};
+  std::unique_ptr<PointLight> point_light;
+  if (use_point_shadows)
+    point_light = std::make_unique<PointLight>();
+  auto point_pass{PointLight::Pass::Layered};
+  bool point_pass_key_down = false;
+  auto point_report_time{std::chrono::steady_clock::now()};
+  constexpr GLuint POINT_SHADOW_UNIT = 8; // clear of the model's texture units
+  std::unique_ptr<ShadowAtlas> shadow_atlas;
+  if (atlas_light_count) {
+    shadow_atlas = std::make_unique<ShadowAtlas>();
+    const std::array<glm::vec3, 6> palette{
+        glm::vec3(0.8f, 0.3f, 0.3f), glm::vec3(0.3f, 0.8f, 0.3f),
+        glm::vec3(0.3f, 0.3f, 0.8f), glm::vec3(0.8f, 0.8f, 0.3f),
+        glm::vec3(0.8f, 0.3f, 0.8f), glm::vec3(0.3f, 0.8f, 0.8f)};
+    for (uint i = 0; i < atlas_light_count; i++) {
+      AtlasLight light;
+      light.position = glm::vec3(0.0f, 3.0f, 4.0f); // placed every frame
+      light.target = glm::vec3(0.0f, 0.8f, 0.0f);
+      light.color = palette[i % palette.size()];
+      shadow_atlas->add(light);
+    }
+    std::clog << "LOG::main::\"Shadow Atlas\": " << atlas_light_count
+              << " lights in one " << shadow_atlas->size << "^2 D16 atlas ("
+              << shadow_atlas->size * shadow_atlas->size * 2 / (1024 * 1024)
+              << " MiB)" << std::endl;
+  }
+  constexpr uint ATLAS_UPDATES_PER_FRAME = 4;
+  constexpr GLuint SHADOW_ATLAS_UNIT = 9;
+  auto atlas_report_time{std::chrono::steady_clock::now()};
+  // Like the Hi-Z, one cluster grid rebuilt and re-uploaded for each view
+  std::unique_ptr<LightClusters> light_clusters;
+  std::vector<ClusterLight> cluster_lights;
+  for (auto &light : scene->lights)
+    cluster_lights.push_back(
+        ClusterLight{light.position, light.radius, light.color});
+  if (cluster_light_count || !cluster_lights.empty()) {
+    light_clusters = std::make_unique<LightClusters>();
+    std::mt19937 rng{42}; // same scene every run
+    std::uniform_real_distribution<float> unit{0.0f, 1.0f};
+    for (uint i = 0; i < cluster_light_count; i++)
+      cluster_lights.push_back(ClusterLight{
+          glm::vec3(8.0f * unit(rng) - 4.0f, 3.0f * unit(rng),
+                    8.0f * unit(rng) - 4.0f),
+          1.5f + 1.5f * unit(rng),
+          glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.6f});
+  }
+  constexpr GLuint CLUSTER_UNIT = 10; // grid, indices, lights: 10..12
+  auto clusters_report_time{std::chrono::steady_clock::now()};
+  // The CPU shadow rasterizer always fills the whole map, so only the scene
+  // scale is adjusted with --cpu-shadows.
+  std::unique_ptr<DynamicResolution> dynamic_resolution;
+  std::unique_ptr<ScaledTarget> scene_target;
+  // The pass timers also feed the HUD, which can be toggled at any time
+  auto shadow_timer{std::make_unique<GpuPassTimer>()};
+  if (use_dynamic_resolution) {
+    DynamicResolution::Config config;
+    config.maxShadow = std::min(Light::SHADOW_WIDTH, Light::SHADOW_HEIGHT);
+    if (use_cpu_shadows || virtual_shadows)
+      config.minShadow = config.maxShadow;
+    dynamic_resolution = std::make_unique<DynamicResolution>(config);
+    if (!dynres_log_path.empty())
+      dynamic_resolution->openLog(dynres_log_path);
+    scene_target = std::make_unique<ScaledTarget>();
+  }
+  auto dynres_report_time{std::chrono::steady_clock::now()};
+  // Built once the cube is resident; views: the cameras, then the
+  // directional light
+  std::unique_ptr<IndirectBatch> indirect_batch;
+  std::unique_ptr<GpuPassTimer> cull_timer;
+  if (gpu_culled_count)
+    cull_timer = std::make_unique<GpuPassTimer>();
+  auto cull_report_time{std::chrono::steady_clock::now()};
+
+  std::vector<View> views;
+  views.reserve(view_count);
+  for (uint v = 0; v < view_count; v++)
+    views.push_back(View{FPSCamera{
+        scene->camera.position, // cam_pos
+        glm::vec3(0, 1, 0),     // cam_up
+        1.0f,                   // aspect-ratio, set by the split below
+        scene->camera.yaw,                  // yaw
+        scene->camera.pitch,                // pitch
+        glm::radians(scene->camera.fov),    // FOV
+    }});
+  View::split(view_count, views);
+  for (auto &view : views) {
+    view.camera.aspect_ratio = window_height * view.extent.x /
+                               (window_width * view.extent.y);
+    view.camera.updatePrespectiveMatrix();
+  }
+  // The other views circle the sun's target at the scene camera's distance
+  // and height, looking at it
+  for (uint v = 1; v < view_count; v++) {
+    const auto &center{scene->directional.target};
+    const glm::vec3 offset{scene->camera.position - center};
+    const float angle{glm::radians(360.0f) * v / view_count};
+    const float c{std::cos(angle)}, s{std::sin(angle)};
+    views[v].camera.place(
+        center + glm::vec3(c * offset.x - s * offset.z, offset.y,
+                           s * offset.x + c * offset.z),
+        center);
+  }
+  auto &camera{views.front().camera}; // the one input steers
   camera.movementSpeed *= 10;
+  auto views_report_time{std::chrono::steady_clock::now()};
+  std::vector<glm::mat4> cull_view_projections; // reused every frame
+  cull_view_projections.reserve(view_count + 1);
 
-  Overlay depthmap{camera.aspect_ratio};
+  // One ObjectBlock per instance, plus the light blocks
+  UniformRing uniforms{std::max<std::size_t>(
+      256 * 1024, scene->instances.size() * 256 + 64 * 1024)};
+
+  Overlay depthmap{window_height / static_cast<float>(window_width)};
   bool should_render_depthmap_overlay = true;
+  Hud hud;
+  bool hud_key_down = false;
 
   //*OpenGL features */
   glEnable(GL_CULL_FACE);
@@ -102,94 +562,894 @@ int main()
   auto delta_time{current_frame - last_frame};
   constexpr int TARGET_FPS = 60;
   constexpr float OPTIMAL_TIME{1e9 / TARGET_FPS};
+  // Per-frame asset streaming budget
+  constexpr std::size_t UPLOAD_BYTES_PER_FRAME = 8 * 1024 * 1024;
+  constexpr auto UPLOAD_TIME_PER_FRAME{std::chrono::milliseconds(2)};
+  bool frame_stats_logged = false;
+  float load_ms = 0.0f;
+  // Animation clock: advanced by the input's delta, so replays repeat it too
+  float scene_time = 0.0f;
+  // On-demand rendering: idle waits wake at least this often to report
+  constexpr double IDLE_WAIT_SECONDS = 0.5;
+  auto idle_report_time{std::chrono::steady_clock::now()};
+  std::clock_t idle_report_cpu{std::clock()};
+  uint drawn_frames = 0, idle_wakeups = 0;
+  // Benchmark clock along the camera path, on the replay's fixed timestep
+  float path_time = 0.0f;
+  std::vector<float> measured_frame_ms;
+#ifdef SHADOW_ALLOC_TRACKING
+  // Drawn frames since every asset became resident
+  long ready_frames = 0;
+  auto alloc_report_time{std::chrono::steady_clock::now()};
+#endif
+  measured_frame_ms.reserve(
+      benchmarking ? static_cast<std::size_t>(scene->pathDuration() /
+                                              Input::FIXED_STEP) + 1
+                   : input.replayFrames());
+  // Frames count the render thread's allocations, not the loaders'
+  ALLOC_TRACK_THREAD();
   do {
-    if (glfwGetKey(window.get(), GLFW_KEY_Q) == GLFW_PRESS)
+    ALLOC_FRAME();
+    PROFILE_FRAME();
+    DefaultFrameStats.reset();
+    auto frame_start{std::chrono::steady_clock::now()};
+    // A replay starts on the first frame with every asset resident, so each
+    // run measures the same frames.
+    InputFrame input_frame;
+    if (!replaying || assets_ready)
+      input_frame = input.beginFrame(delta_time.count() * 1e-9);
+    scene_time += input_frame.deltaTime;
+    if (input_frame.down(Key::Q))
       glfwSetWindowShouldClose(window.get(), true);
-    if (glfwGetKey(window.get(), GLFW_KEY_M) == GLFW_PRESS)
+    if (input_frame.down(Key::M)) {
         should_render_depthmap_overlay ^= 1;
+        DefaultRedraw.request();
+    }
+    bool point_pass_key{input_frame.down(Key::P)};
+    if (point_pass_key && !point_pass_key_down) {
+      point_pass = point_pass == PointLight::Pass::Layered
+                       ? PointLight::Pass::SixPass
+                       : PointLight::Pass::Layered;
+      DefaultRedraw.request();
+    }
+    point_pass_key_down = point_pass_key;
+    bool hud_key{input_frame.down(Key::H)};
+    if (hud_key && !hud_key_down) {
+      show_hud ^= 1;
+      DefaultRedraw.request();
+    }
+    hud_key_down = hud_key;
 
-    camera.renderloopUpdateView(window, delta_time.count() * 1e-9);
+    if (benchmarking) {
+      auto key{scene->samplePath(path_time)};
+      camera.place(key.position, key.target);
+      if (assets_ready)
+        path_time += Input::FIXED_STEP;
+    } else
+      camera.renderloopUpdateView(input_frame);
+
+    UploadBudget upload_budget{UPLOAD_BYTES_PER_FRAME, UPLOAD_TIME_PER_FRAME};
+    if (world) {
+      const float step{benchmarking ? Input::FIXED_STEP
+                                    : input_frame.deltaTime};
+      const glm::vec3 velocity{
+          step > 0.0f ? (camera.cameraPos - last_camera_position) / step
+                      : glm::vec3(0.0f)};
+      last_camera_position = camera.cameraPos;
+      if (world->update(camera.cameraPos, velocity, upload_budget)) {
+        draw_order = world->drawable();
+        for (std::size_t i = 0; i < scene->instances.size(); i++)
+          instance_models[i] = world->model(scene->instances[i].model);
+        // Casters that streamed in or out: their pages render again
+        if (virtual_shadows)
+          for (auto &bounds : world->changedBounds())
+            virtual_shadows->invalidate(bounds.lo, bounds.hi);
+        DefaultRedraw.request();
+      }
+      if (!world->settled())
+        DefaultRedraw.request(); // keep streaming while idle on demand
+      if (auto now{std::chrono::steady_clock::now()};
+          now - world_report_time >= std::chrono::seconds(1)) {
+        auto &stats{world->stats()};
+        std::clog << "LOG::main::\"World Partition\": "
+                  << stats.residentCells << '/' << stats.wantedCells
+                  << " wanted cells resident (" << stats.loadingCells
+                  << " loading), " << stats.residentModels << " models ("
+                  << stats.loadingModels << " loading), CPU "
+                  << (stats.cpuBytes >> 20) << " MiB, GPU "
+                  << (stats.gpuBytes >> 20) << " MiB, " << stats.loads
+                  << " loads, " << stats.evictions << " evictions"
+                  << std::endl;
+        world_report_time = now;
+      }
+    }
+    if (!assets_ready) {
+      DefaultRedraw.request(); // streamed meshes and textures pop in
+      // Streamed, the cells around the starting camera
+      assets_ready = !world || world->settled();
+      for (auto &model : models)
+        assets_ready = model->pumpUploads(upload_budget) && assets_ready;
+      // Array pages need every layer staged first
+      if (assets_ready && use_texture_arrays)
+        assets_ready = DefaultTexRepo.pack(upload_budget);
+      frame_stats_logged = !assets_ready; // log the first complete frame
+      if (assets_ready) {
+        input.start(); // recordings start where replays do
+        load_ms = std::chrono::duration<float, std::milli>(
+                      std::chrono::steady_clock::now() - load_start)
+                      .count();
+        std::clog << "LOG::main::\"Scene Resident\": "
+                  << (world ? draw_order.size() : scene->instances.size())
+                  << " instances of "
+                  << (world ? world->stats().residentModels : models.size())
+                  << " models in " << load_ms << " ms" << std::endl;
+        // Every instance of an animated model becomes a character
+        for (std::size_t m = 0; m < models.size(); m++) {
+          auto &skeleton{models[m]->skeleton};
+          if (!skeleton || skeleton->clips.empty())
+            continue;
+          std::vector<GpuSkinning::Character> characters;
+          std::vector<std::size_t> owners;
+          for (std::size_t i = 0; i < scene->instances.size(); i++) {
+            auto &instance{scene->instances[i]};
+            if (instance.model != m)
+              continue;
+            auto &a{instance.animation};
+            characters.push_back(GpuSkinning::Character{
+                static_cast<std::size_t>(std::max(0L, a.clip)), a.blendClip,
+                a.blend, a.speed, a.time});
+            owners.push_back(i);
+          }
+          if (characters.empty())
+            continue;
+          skinnings.push_back(
+              std::make_unique<GpuSkinning>(*models[m], characters));
+          for (std::size_t c = 0; c < owners.size(); c++) {
+            instance_models[owners[c]] = &skinnings.back()->model(c);
+            character_instances.push_back(owners[c]);
+          }
+        }
+        if (!skinnings.empty())
+          skin_timer = std::make_unique<GpuPassTimer>();
+      }
+      if (assets_ready && gpu_culled_count) {
+        // A square grid of small cubes behind the origin
+        const uint side{static_cast<uint>(
+            std::ceil(std::sqrt(static_cast<float>(gpu_culled_count))))};
+        std::vector<glm::mat4> instances;
+        instances.reserve(gpu_culled_count);
+        for (uint i = 0; i < gpu_culled_count; i++) {
+          const glm::vec3 position{0.5f * (i % side) - 0.25f * side, 0.1f,
+                                   -1.0f - 0.5f * (i / side)};
+          instances.push_back(
+              glm::scale(glm::translate(glm::mat4(1.0f), position),
+                         glm::vec3(0.1f)));
+        }
+        indirect_batch = std::make_unique<IndirectBatch>(
+            *models[batch_model], instances, view_count + 1);
+      }
+    }
+
+    // Atlas lights orbit the scene, so their tiles keep going stale
+    if (shadow_atlas) {
+      const auto t{scene_time};
+      for (uint i = 0; i < shadow_atlas->lightCount(); i++) {
+        const float angle{0.3f * t + glm::radians(360.0f) * i /
+                                         shadow_atlas->lightCount()};
+        const float radius{3.0f + i % 3};
+        shadow_atlas->light(i).position = glm::vec3(
+            radius * std::cos(angle), 2.5f + i % 2, radius * std::sin(angle));
+      }
+      shadow_atlas->assign(camera.cameraPos, camera.fov);
+      DefaultRedraw.request();
+    }
+
+    // On demand, a frame in which nothing changed isn't drawn: the window
+    // keeps its last image while the loop sleeps in glfwWaitEventsTimeout
+    if (on_demand) {
+      if (auto now{std::chrono::steady_clock::now()};
+          now - idle_report_time >= std::chrono::seconds(1)) {
+        const float wall{
+            std::chrono::duration<float>(now - idle_report_time).count()};
+        const float cpu{static_cast<float>(std::clock() - idle_report_cpu) /
+                        CLOCKS_PER_SEC};
+        std::clog << "LOG::main::\"On-Demand Rendering\": " << drawn_frames
+                  << " frames drawn, " << idle_wakeups
+                  << " idle wakeups, CPU " << 100.0f * cpu / wall
+                  << "% of a core" << std::endl;
+        idle_report_time = now;
+        idle_report_cpu = std::clock();
+        drawn_frames = idle_wakeups = 0;
+      }
+      if (!DefaultRedraw.consume()) {
+        idle_wakeups++;
+        glfwWaitEventsTimeout(IDLE_WAIT_SECONDS);
+        // The wait isn't frame time: the next frame steps the camera by
+        // the last drawn frame's delta instead of the whole idle stretch
+        last_frame = std::chrono::high_resolution_clock::now();
+        continue;
+      }
+      drawn_frames++;
+    }
+
+    // Everything up to the views is shared by all of them
+    const auto shared_start{std::chrono::steady_clock::now()};
+    if (indirect_batch) {
+      cull_timer->begin();
+      cull_view_projections.clear();
+      for (auto &view : views)
+        cull_view_projections.push_back(view.camera.prespective_matrix *
+                                        view.camera.view_matrix);
+      cull_view_projections.push_back(
+          directional_light.block().lightSpaceMatrix);
+      indirect_batch->cull(shader_cull, cull_view_projections);
+      cull_timer->end();
+      if (auto now{std::chrono::steady_clock::now()};
+          now - cull_report_time >= std::chrono::seconds(1)) {
+        std::clog << "LOG::main::\"GPU Culling\": "
+                  << indirect_batch->objectCount() << " objects, "
+                  << indirect_batch->visibleObjects(0) << " visible, "
+                  << indirect_batch->visibleObjects(view_count)
+                  << " shadow casters, cull " << cull_timer->ms() << " ms"
+                  << std::endl;
+        cull_report_time = now;
+      }
+    }
 
     /* BEGIN RENDER */
+    int framebuffer_width, framebuffer_height;
+    glfwGetFramebufferSize(window.get(), &framebuffer_width,
+                           &framebuffer_height);
+    // Sizes chosen from earlier frames' timings; the Light block carries
+    // the shadow map scale, so set it before pushing the block.
+    if (dynamic_resolution)
+      directional_light.setResolution(dynamic_resolution->shadowSize());
+    // 0. Characters: posed on the CPU, then skinned once for every pass
+    // below to draw
+    if (!skinnings.empty()) {
+      const float step{benchmarking ? Input::FIXED_STEP
+                                    : input_frame.deltaTime};
+      float animate_ms{0.0f};
+      skin_timer->begin();
+      for (auto &skinning : skinnings) {
+        skinning->animate(step);
+        skinning->skin(shader_skinning);
+        animate_ms += skinning->stats().animateMs;
+      }
+      skin_timer->end();
+      // Moving casters: the virtual pages under them render again
+      if (virtual_shadows)
+        for (auto i : character_instances) {
+          auto &mesh{instance_models[i]->meshes.front()};
+          glm::vec3 lo{std::numeric_limits<float>::max()};
+          glm::vec3 hi{-std::numeric_limits<float>::max()};
+          for (int c = 0; c < 8; c++) {
+            const glm::vec3 corner{instance_transforms[i] *
+                                   glm::vec4(c & 1 ? mesh.boundsMax.x
+                                                   : mesh.boundsMin.x,
+                                             c & 2 ? mesh.boundsMax.y
+                                                   : mesh.boundsMin.y,
+                                             c & 4 ? mesh.boundsMax.z
+                                                   : mesh.boundsMin.z,
+                                             1.0f)};
+            lo = glm::min(lo, corner);
+            hi = glm::max(hi, corner);
+          }
+          virtual_shadows->invalidate(lo, hi);
+        }
+      DefaultRedraw.request();
+      if (auto now{std::chrono::steady_clock::now()};
+          now - skin_report_time >= std::chrono::seconds(1)) {
+        std::size_t vertices{0};
+        for (auto &skinning : skinnings)
+          vertices += skinning->stats().vertices;
+        std::clog << "LOG::main::\"Skinning\": " << character_instances.size()
+                  << " characters, " << vertices
+                  << " vertices skinned once for every pass, animate "
+                  << animate_ms << " ms, GPU " << skin_timer->ms() << " ms"
+                  << std::endl;
+        skin_report_time = now;
+      }
+    }
+    // 0. Per-frame uniform blocks: one memcpy into the ring, bound by offset
+    uniforms.beginFrame();
+    for (auto &view : views)
+      view.cameraBlock = uniforms.push(CameraBlock{
+          view.camera.prespective_matrix, view.camera.view_matrix,
+          glm::vec4(view.camera.cameraPos, 1.0f)});
+    auto light_block{uniforms.push(directional_light.block())};
+    for (std::size_t i = 0; i < instance_blocks.size(); i++)
+      instance_blocks[i] = uniforms.push(ObjectBlock{instance_transforms[i]});
+    GLintptr point_light_block{0};
+    if (use_point_shadows)
+      point_light_block = uniforms.push(point_light->block());
+    GLintptr shadow_atlas_block{0};
+    if (shadow_atlas) {
+      shadow_atlas->schedule(ATLAS_UPDATES_PER_FRAME, uniforms);
+      shadow_atlas_block = uniforms.push(shadow_atlas->block());
+    }
+    // Pages are requested by the first view's receivers
+    if (virtual_shadows) {
+      virtual_shadows->setLight(directional_light.block());
+      virtual_shadows->schedule(
+          VirtualShadowMap::Camera{
+              camera.prespective_matrix * camera.view_matrix,
+              camera.view_matrix, camera.prespective_matrix, camera.cameraPos,
+              camera.fov,
+              std::max(1, static_cast<int>(framebuffer_height *
+                                           views.front().extent.y))},
+          VSM_PAGES_PER_FRAME, uniforms);
+      if (virtual_shadows->settling())
+        DefaultRedraw.request();
+    }
+    uniforms.flush();
+    uniforms.bind<LightBlock>(BlockBinding::Light, light_block);
+    if (use_point_shadows)
+      uniforms.bind<PointLightBlock>(BlockBinding::PointLight,
+                                     point_light_block);
+    if (shadow_atlas)
+      uniforms.bind<ShadowAtlasBlock>(BlockBinding::ShadowAtlas,
+                                      shadow_atlas_block);
+
     // 1. Render to depth map from light's point of view
     glEnable(GL_DEPTH_TEST);
-    glBindFramebuffer(GL_FRAMEBUFFER, directional_light.depthMapFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, directional_light.depthMapFBO.name());
     glUseProgram(shader_shadowmap.id());
-    auto render_depthmap_lambda{[&nanosuit] {
+    if (meshlet_culler)
+      meshlet_culler->beginFrame();
+    auto render_depthmap_lambda{[&] {
       glCullFace(GL_FRONT); // peter panning
     //   glClear(GL_DEPTH_BUFFER_BIT);  // linux mesa doesn't need it
-      nanosuit.drawWihtoutTextureBinding();
+      const auto light_view{MeshletCuller::View::directional(
+          directional_light.block().lightSpaceMatrix,
+          directional_light.depthViewMatrix, GL_FRONT)};
+      for (auto i : draw_order) {
+        auto &model{*instance_models[i]};
+        uniforms.bind<ObjectBlock>(BlockBinding::Object, instance_blocks[i]);
+        if (meshlet_culler)
+          meshlet_culler->cull(MeshletCuller::Pass::Shadow, model,
+                               instance_transforms[i], light_view);
+        model.drawWihtoutTextureBinding();
+        if (meshlet_culler) // the other shadow passes draw whole meshes
+          MeshletCuller::reset(model);
+      }
+      if (indirect_batch) {
+        glUseProgram(shader_indirect_depth.id());
+        indirect_batch->draw(view_count);
+        glUseProgram(shader_shadowmap.id());
+      }
       glCullFace(GL_BACK);
     }};
-    directional_light.render(shader_shadowmap, render_depthmap_lambda);
+    // Pages and the camera pre-pass: every instance that reaches into the
+    // view, whole (per-page meshlet culling isn't worth its CPU time)
+    auto draw_vsm_casters{[&](const glm::mat4 &view_projection) {
+      for (auto i : draw_order) {
+        auto &model{*instance_models[i]};
+        const glm::mat4 mvp{view_projection * instance_transforms[i]};
+        if (std::all_of(model.meshes.begin(), model.meshes.end(),
+                        [&](const Mesh &m) {
+                          return IndirectBatch::outsideFrustum(
+                              mvp, m.boundsMin, m.boundsMax);
+                        }))
+          continue;
+        uniforms.bind<ObjectBlock>(BlockBinding::Object, instance_blocks[i]);
+        model.drawWihtoutTextureBinding();
+      }
+      if (indirect_batch) {
+        glUseProgram(shader_indirect_depth.id());
+        indirect_batch->draw(view_count);
+        glUseProgram(shader_shadowmap.id());
+      }
+    }};
+    if (virtual_shadows) {
+      vsm_timer->begin();
+      virtual_shadows->render(uniforms, draw_vsm_casters);
+      virtual_shadows->renderPrepass(uniforms, draw_vsm_casters);
+      vsm_timer->end();
+      // both rebind the Light block per page
+      uniforms.bind<LightBlock>(BlockBinding::Light, light_block);
+      if (auto now{std::chrono::steady_clock::now()};
+          now - vsm_report_time >= std::chrono::seconds(1)) {
+        auto &stats{virtual_shadows->stats()};
+        std::clog << "LOG::main::\"Virtual Shadows\": " << stats.requested
+                  << " pages requested, " << stats.resident << " resident ("
+                  << stats.missing << " without a slot), " << stats.rendered
+                  << " rendered and " << stats.evicted
+                  << " evicted this frame, analysis " << stats.analyzeMs
+                  << " ms, GPU " << vsm_timer->ms() << " ms" << std::endl;
+        vsm_report_time = now;
+      }
+    }
+    // With --cpu-shadows the GPU pass only runs once, on the first complete
+    // frame, to validate the CPU depth map against it.
+    else if (!use_cpu_shadows || (assets_ready && !cpu_shadows_validated)) {
+      shadow_timer->begin();
+      directional_light.render(render_depthmap_lambda);
+      shadow_timer->end();
+    }
+    if (use_cpu_shadows) {
+      auto &rasterizer{*cpu_shadow_rasterizer};
+      rasterizer.clear();
+      for (auto i : draw_order)
+        for (auto &m : instance_models[i]->meshes)
+          rasterizer.submit(m.vertices, m.indices,
+                            directional_light.block().lightSpaceMatrix *
+                                instance_transforms[i],
+                            CpuDepthRasterizer::Cull::Front);
+      rasterizer.rasterize();
+      if (assets_ready && !cpu_shadows_validated) {
+        auto [mismatches, max_diff] = rasterizer.compareDepth16(
+            CpuDepthRasterizer::readDepthTexture(
+                directional_light.depthTexture.name(), Light::SHADOW_WIDTH,
+                Light::SHADOW_HEIGHT));
+        std::clog << "LOG::main::\"CPU Shadow Map Validation\": " << mismatches
+                  << " of " << rasterizer.depth().size()
+                  << " texels differ, max D16 difference " << max_diff
+                  << std::endl;
+        cpu_shadows_validated = true;
+      }
+      rasterizer.uploadTo(directional_light.depthTexture.name());
+    }
 
-    // 2. Render scene as normal with shadow mapping using depth map
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    const float shadow_gpu_ms{virtual_shadows   ? vsm_timer->ms()
+                              : use_cpu_shadows ? 0.0f
+                                                : shadow_timer->ms()};
+
+    // 1b. Point light cubemap
+    if (use_point_shadows) {
+      point_casters.clear();
+      for (auto i : draw_order)
+        point_casters.push_back(PointLight::Caster{
+            instance_models[i], instance_transforms[i],
+            instance_blocks[i]});
+      point_light->render(point_pass == PointLight::Pass::Layered
+                              ? shader_point_layered
+                              : shader_point_faces,
+                          point_casters, uniforms, point_pass);
+      if (auto now{std::chrono::steady_clock::now()};
+          now - point_report_time >= std::chrono::seconds(1)) {
+        auto &stats{point_light->stats(point_pass)};
+        std::clog << "LOG::main::\"Point Shadows\" ("
+                  << (point_pass == PointLight::Pass::Layered ? "layered"
+                                                              : "six-pass")
+                  << "): draws " << stats.draws << ", mesh-face routes "
+                  << stats.faceRoutes << " of " << 6 * stats.meshes
+                  << ", GPU " << stats.gpuMs << " ms" << std::endl;
+        point_report_time = now;
+      }
+    }
+
+    // 1c. Stale atlas tiles, one viewport each
+    if (shadow_atlas) {
+      glUseProgram(shader_shadowmap.id());
+      shadow_atlas->render(uniforms, [&](uint) {
+        glCullFace(GL_FRONT);
+        for (auto i : draw_order) {
+          uniforms.bind<ObjectBlock>(BlockBinding::Object, instance_blocks[i]);
+          instance_models[i]->drawWihtoutTextureBinding();
+        }
+        glCullFace(GL_BACK);
+      });
+      // render() rebinds the Light block per tile
+      uniforms.bind<LightBlock>(BlockBinding::Light, light_block);
+      if (auto now{std::chrono::steady_clock::now()};
+          now - atlas_report_time >= std::chrono::seconds(1)) {
+        auto stats{shadow_atlas->stats()};
+        std::clog << "LOG::main::\"Shadow Atlas\": " << stats.shadowed
+                  << " of " << stats.lights << " lights shadowed, "
+                  << stats.updated << " tiles updated this frame, "
+                  << static_cast<int>(stats.occupancy * 100) << "% occupied"
+                  << std::endl;
+        atlas_report_time = now;
+      }
+    }
+
+    // 2. Render scene as normal with shadow mapping using depth map, once
+    // per view into its part of the target
+    const float scene_scale{scene_target ? dynamic_resolution->sceneScale()
+                                         : 1.0f};
+    if (scene_target)
+      scene_target->bind(framebuffer_width, framebuffer_height, scene_scale);
+    else
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glUseProgram(shader_nanosuit.id());
-    glUniformMatrix4fv(shader_nanosuit.getUniform("prespective"), 1,
-                       GL_FALSE, glm::value_ptr(camera.prespective_matrix));
-    glUniformMatrix4fv(shader_nanosuit.getUniform("view"), 1, GL_FALSE,
-                       glm::value_ptr(camera.view_matrix));
-    glUniformMatrix4fv(shader_nanosuit.getUniform("model"), 1, GL_FALSE,
-                       glm::value_ptr(glm::mat4(1.0f)));
-    glUniformMatrix4fv(shader_nanosuit.getUniform("lightSpaceMatrix"s), 1,
-                       GL_FALSE,
-                       glm::value_ptr(directional_light.depthProjectionMatrix *
-                                      directional_light.depthViewMatrix));
-
-    glm::vec4 light_position =
-        directional_light.depthViewMatrix * glm::vec4(1.0f);
-    glUniform3f(shader_nanosuit.getUniform("light_position"s),
-                light_position.x / light_position.w,
-                light_position.y / light_position.w,
-                light_position.z / light_position.w);
-    glUniform3f(shader_nanosuit.getUniform("viewPos"s), camera.cameraPos.x,
-                camera.cameraPos.y, camera.cameraPos.z);
 
     static auto shadowmap_uniform_location =
-        shader_nanosuit.getUniform("shadowMap"s);
+        shader_nanosuit.getUniform("shadowMap");
     glActiveTexture(GL_TEXTURE0); // First tex unit is used for shadowMap texture.
     glUniform1i(shadowmap_uniform_location, 0);
-    glBindTexture(GL_TEXTURE_2D, directional_light.depthTexture);
-
-    // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // wireframe
-    nanosuit.draw(shader_nanosuit, 1u);
-    // glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); // unwireframe
-    
-    glActiveTexture(GL_TEXTURE2); // disable specular map
-    glBindTexture(GL_TEXTURE_2D, 0);
-    cube.draw(shader_nanosuit, 1u);
-    
+    glBindTexture(GL_TEXTURE_2D, directional_light.depthTexture.name());
+    if (use_point_shadows) {
+      static auto point_shadowmap_uniform_location =
+          shader_nanosuit.getUniform("pointShadowMap");
+      glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_UNIT);
+      glUniform1i(point_shadowmap_uniform_location, POINT_SHADOW_UNIT);
+      glBindTexture(GL_TEXTURE_CUBE_MAP, point_light->depthCubemap.name());
+      glActiveTexture(GL_TEXTURE0);
+    }
+    if (shadow_atlas) {
+      static auto shadow_atlas_uniform_location =
+          shader_nanosuit.getUniform("shadowAtlas");
+      glActiveTexture(GL_TEXTURE0 + SHADOW_ATLAS_UNIT);
+      glUniform1i(shadow_atlas_uniform_location, SHADOW_ATLAS_UNIT);
+      glBindTexture(GL_TEXTURE_2D, shadow_atlas->depthTexture.name());
+      glActiveTexture(GL_TEXTURE0);
+    }
+    if (virtual_shadows)
+      virtual_shadows->bind(shader_nanosuit, VSM_POOL_UNIT, VSM_TABLE_UNIT);
+    const float shared_cpu_ms{std::chrono::duration<float, std::milli>(
+                                  std::chrono::steady_clock::now() -
+                                  shared_start)
+                                  .count()};
+
+    float scene_ms{0.0f}; // GPU, summed over the views
+    for (uint v = 0; v < view_count; v++) {
+      auto &view{views[v]};
+      auto &view_camera{view.camera};
+      const auto view_start{std::chrono::steady_clock::now()};
+      const FrameStats stats_before{DefaultFrameStats};
+
+      // Occlusion culling: occluder instances fill the Hi-Z pyramid, the
+      // others are tested right before they're drawn
+      if (use_occlusion_culling && assets_ready) {
+        auto &culler{*occlusion_culler};
+        if (auto now{std::chrono::steady_clock::now()};
+            v == 0 && now - occlusion_report_time >= std::chrono::seconds(1)) {
+          auto &stats{culler.stats()};
+          std::clog << "LOG::main::\"Occlusion Culling\": " << stats.occluded
+                    << " occluded + " << stats.offscreen << " offscreen of "
+                    << stats.tested << " draws, " << stats.occluderTriangles
+                    << " occluder triangles, cost " << stats.rasterMs
+                    << " ms raster + " << stats.testMs << " ms test"
+                    << std::endl;
+          occlusion_report_time = now;
+        }
+        culler.beginFrame(view_camera.prespective_matrix *
+                          view_camera.view_matrix);
+        for (auto i : draw_order)
+          if (scene->instances[i].occluder)
+            culler.addOccluder(*instance_models[i],
+                               instance_transforms[i]);
+        culler.buildHiZ();
+      }
+      if (light_clusters) {
+        light_clusters->build(cluster_lights, view_camera.view_matrix,
+                              view_camera.prespective_matrix);
+        light_clusters->upload();
+        if (auto now{std::chrono::steady_clock::now()};
+            v == 0 && now - clusters_report_time >= std::chrono::seconds(1)) {
+          auto &stats{light_clusters->stats()};
+          std::clog << "LOG::main::\"Clustered Lights\": " << stats.lights
+                    << " lights, " << stats.indices
+                    << " cluster entries, max " << stats.maxPerCluster
+                    << " per cluster, build " << stats.buildMs << " ms"
+                    << std::endl;
+          clusters_report_time = now;
+        }
+      }
+
+      view.timer->begin();
+      const auto viewport{view.viewport(
+          std::max(1, static_cast<int>(
+                          std::lround(framebuffer_width * scene_scale))),
+          std::max(1, static_cast<int>(
+                          std::lround(framebuffer_height * scene_scale))))};
+      glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
+      uniforms.bind<CameraBlock>(BlockBinding::Camera, view.cameraBlock);
+      glUseProgram(shader_nanosuit.id());
+      if (light_clusters) // reads the viewport just set
+        light_clusters->bind(shader_nanosuit, CLUSTER_UNIT);
+
+      // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // wireframe
+      const auto camera_view{MeshletCuller::View::perspective(
+          view_camera.prespective_matrix * view_camera.view_matrix,
+          view_camera.cameraPos)};
+      std::size_t previous_model{scene->models.size()};
+      for (auto i : draw_order) {
+        auto &instance{scene->instances[i]};
+        auto &model{*instance_models[i]};
+        if (instance.model != previous_model) {
+          glActiveTexture(GL_TEXTURE2); // disable specular map
+          glBindTexture(GL_TEXTURE_2D, 0);
+          glActiveTexture(GL_TEXTURE0);
+          previous_model = instance.model;
+        }
+        if (use_occlusion_culling && assets_ready) {
+          if (instance.occluder)
+            OcclusionCuller::reset(model);
+          else
+            occlusion_culler->cull(model, instance_transforms[i]);
+        }
+        if (meshlet_culler)
+          meshlet_culler->cull(MeshletCuller::Pass::Camera, model,
+                               instance_transforms[i], camera_view);
+        uniforms.bind<ObjectBlock>(BlockBinding::Object, instance_blocks[i]);
+        model.draw(shader_nanosuit, 1u);
+        if (meshlet_culler)
+          MeshletCuller::reset(model);
+      }
+      // glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); // unwireframe
+
+      if (indirect_batch) {
+        glUseProgram(shader_indirect.id());
+        static auto indirect_shadowmap_uniform_location =
+            shader_indirect.getUniform("shadowMap");
+        glUniform1i(indirect_shadowmap_uniform_location, 0);
+        if (virtual_shadows)
+          virtual_shadows->bind(shader_indirect, VSM_POOL_UNIT,
+                                VSM_TABLE_UNIT);
+        models[batch_model]->bindMaterial(shader_indirect, 0, 1u);
+        indirect_batch->draw(v);
+      }
+      view.timer->end();
+      scene_ms += view.timer->ms();
+      view.cpuMs = std::chrono::duration<float, std::milli>(
+                       std::chrono::steady_clock::now() - view_start)
+                       .count();
+      view.stats.drawCalls = DefaultFrameStats.drawCalls - stats_before.drawCalls;
+      view.stats.triangles = DefaultFrameStats.triangles - stats_before.triangles;
+    }
+    if (meshlet_culler) {
+      if (auto now{std::chrono::steady_clock::now()};
+          now - meshlet_report_time >= std::chrono::seconds(1)) {
+        std::clog << "LOG::main::\"Meshlet Culling\":";
+        for (auto [pass, name] :
+             {std::pair{MeshletCuller::Pass::Shadow, " shadow "},
+              std::pair{MeshletCuller::Pass::Camera, ", camera "}}) {
+          auto &stats{meshlet_culler->stats(pass)};
+          std::clog << name << stats.culledFraction() * 100.0f << "% of "
+                    << stats.triangles << " triangles culled ("
+                    << stats.facing << " facing + " << stats.outside
+                    << " outside of " << stats.meshlets << " meshlets, "
+                    << stats.ranges << " ranges, " << stats.cullMs << " ms)";
+        }
+        std::clog << std::endl;
+        meshlet_report_time = now;
+      }
+    }
+    if (view_count > 1) {
+      if (auto now{std::chrono::steady_clock::now()};
+          now - views_report_time >= std::chrono::seconds(1)) {
+        std::clog << "LOG::main::\"Views\": shared CPU " << shared_cpu_ms
+                  << " ms, GPU shadow "
+                  << shadow_gpu_ms << " ms";
+        if (point_light)
+          std::clog << " + point " << point_light->stats(point_pass).gpuMs
+                    << " ms";
+        if (cull_timer)
+          std::clog << " + cull " << cull_timer->ms() << " ms";
+        for (uint v = 0; v < view_count; v++)
+          std::clog << "; view " << v << " CPU " << views[v].cpuMs
+                    << " ms, GPU " << views[v].timer->ms() << " ms, "
+                    << views[v].stats.drawCalls << " draws, "
+                    << views[v].stats.triangles << " triangles";
+        std::clog << std::endl;
+        views_report_time = now;
+      }
+    }
+
+    // 2b. Upscale to the window; overlays stay at full resolution
+    if (scene_target)
+      scene_target->blitToDefault();
+    else
+      glViewport(0, 0, framebuffer_width, framebuffer_height);
+    if (dynamic_resolution) {
+      dynamic_resolution->update(virtual_shadows ? 0.0f : shadow_gpu_ms,
+                                 scene_ms);
+      if (auto now{std::chrono::steady_clock::now()};
+          now - dynres_report_time >= std::chrono::seconds(1)) {
+        std::clog << "LOG::main::\"Dynamic Resolution\": scene "
+                  << static_cast<int>(framebuffer_width *
+                                      dynamic_resolution->sceneScale())
+                  << 'x'
+                  << static_cast<int>(framebuffer_height *
+                                      dynamic_resolution->sceneScale())
+                  << " (" << scene_ms << " ms), shadow map "
+                  << directional_light.resolution() << "^2 ("
+                  << shadow_timer->ms() << " ms)" << std::endl;
+        dynres_report_time = now;
+      }
+    }
+
     if (should_render_depthmap_overlay) {
       glUseProgram(shader_depthmap_overlay.id());
       glDisable(GL_DEPTH_TEST);
-      glBindVertexArray(depthmap.VAO);
+      glBindVertexArray(depthmap.VAO.name());
       glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, directional_light.depthTexture);
+      glBindTexture(GL_TEXTURE_2D,
+                    virtual_shadows ? virtual_shadows->poolTexture.name()
+                                    : directional_light.depthTexture.name());
       depthmap.draw();
     }
 
+    hud.addFrameTime(delta_time.count() * 1e-6f);
+    if (show_hud) {
+      // Counted before the HUD adds its own draw
+      const FrameStats hud_stats{DefaultFrameStats};
+      const float cpu_ms{std::chrono::duration<float, std::milli>(
+                             std::chrono::steady_clock::now() - frame_start)
+                             .count()};
+      const float shadow_ms{shadow_gpu_ms};
+      const float point_ms{
+          point_light ? point_light->stats(point_pass).gpuMs : 0.0f};
+      const float cull_ms{cull_timer ? cull_timer->ms() : 0.0f};
+      const float skin_ms{skin_timer ? skin_timer->ms() : 0.0f};
+      hud.draw(shader_hud, framebuffer_width, framebuffer_height, hud_stats,
+               cpu_ms,
+               {{"SKIN", skin_ms},
+                {"SHADOW", shadow_ms},
+                {"POINT", point_ms},
+                {"CULL", cull_ms},
+                {"SCENE", scene_ms}});
+    }
+
+    if (!frame_stats_logged) {
+      std::clog << "LOG::main::\"Frame Stats\" ("
+                << (use_texture_arrays ? "texture arrays" : "texture 2D")
+                << "): draws " << DefaultFrameStats.drawCalls
+                << ", triangles " << DefaultFrameStats.triangles
+                << ", texture binds " << DefaultFrameStats.textureBinds
+                << ", uniform uploads " << DefaultFrameStats.uniformUploads;
+      if (use_occlusion_culling)
+        std::clog << ", occluded draws " << occlusion_culler->stats().culled()
+                  << " (" << occlusion_culler->stats().costMs() << " ms)";
+      std::clog << ", GPU memory";
+      for (auto kind : {GpuKind::Buffer, GpuKind::Texture})
+        std::clog << ' ' << GpuRegistry::kindName(kind) << ' '
+                  << DefaultGpuRegistry.totals(kind).bytes / 1024 << " KiB";
+      std::clog << std::endl;
+      frame_stats_logged = true;
+    }
+
+    uniforms.endFrame();
     glfwSwapBuffers(window.get());
+    DefaultGpuRegistry.endFrame();
     glfwPollEvents();
+    if ((replaying || benchmarking) && assets_ready) {
+      measured_frame_ms.push_back(std::chrono::duration<float, std::milli>(
+                                    std::chrono::steady_clock::now() -
+                                    frame_start)
+                                    .count());
+      if (replaying ? input.finished() : path_time > scene->pathDuration())
+        glfwSetWindowShouldClose(window.get(), true);
+    }
+#ifdef SHADOW_ALLOC_TRACKING
+    if (assets_ready) {
+      if (alloc_assert_frame >= 0 && ready_frames >= alloc_assert_frame &&
+          DefaultAllocTracker.frame().allocations) {
+        std::cerr << "ERROR::main -> frame " << ready_frames
+                  << " after loading allocated (--alloc-assert "
+                  << alloc_assert_frame << ")" << std::endl;
+        DefaultAllocTracker.report(std::cerr);
+        std::abort();
+      }
+      ready_frames++;
+    }
+    if (alloc_report)
+      if (auto now{std::chrono::steady_clock::now()};
+          now - alloc_report_time >= std::chrono::seconds(1)) {
+        DefaultAllocTracker.report(std::clog);
+        alloc_report_time = now;
+      }
+#endif
 
     current_frame = std::chrono::high_resolution_clock::now();
     delta_time = current_frame - last_frame;
     last_frame = current_frame;
 
-    std::this_thread::sleep_for(
-        std::chrono::duration<float, std::nano>(
-            std::max(0.0, OPTIMAL_TIME - delta_time.count() * 1e-9)));
+    if (!headless)
+      std::this_thread::sleep_for(
+          std::chrono::duration<float, std::nano>(
+              std::max(0.0, OPTIMAL_TIME - delta_time.count() * 1e-9)));
   } while (!glfwWindowShouldClose(window.get()));
 
+  if (!measured_frame_ms.empty()) {
+    auto sorted{measured_frame_ms};
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile{[&](float p) {
+      return sorted[static_cast<std::size_t>(p * (sorted.size() - 1))];
+    }};
+    float total{0.0f};
+    for (auto ms : sorted)
+      total += ms;
+    // Hitches: frames taking over twice the median, e.g. a streamed cell
+    // landing at once
+    const auto hitches{sorted.end() -
+                       std::upper_bound(sorted.begin(), sorted.end(),
+                                        2.0f * percentile(0.5f))};
+    std::clog << "LOG::main::\""
+              << (replaying ? "Replay" : "Benchmark") << " Frame Times\": "
+              << sorted.size()
+              << " frames, mean " << total / sorted.size() << " ms, p50 "
+              << percentile(0.5f) << " ms, p95 " << percentile(0.95f)
+              << " ms, p99 " << percentile(0.99f) << " ms, max "
+              << sorted.back() << " ms, " << hitches
+              << " over twice the median" << std::endl;
+  }
+  if (benchmarking) {
+    // Resident set from /proc (pages), 0 where there is none
+    std::size_t pages{0}, resident{0};
+    std::ifstream{"/proc/self/statm"} >> pages >> resident;
+    // and its high-water mark (kB)
+    std::size_t peak_kib{0};
+    {
+      std::ifstream status{"/proc/self/status"};
+      for (std::string line; std::getline(status, line);)
+        if (std::sscanf(line.c_str(), "VmHWM: %zu kB", &peak_kib) == 1)
+          break;
+    }
+    std::clog << "LOG::main::\"Benchmark Scene\": "
+              << scene->instances.size() << " instances, "
+              << scene->models.size() << " models, "
+              << cluster_lights.size() << " point lights, load " << load_ms
+              << " ms, resident "
+              << resident * sysconf(_SC_PAGESIZE) / (1024 * 1024)
+              << " MiB (peak " << peak_kib / 1024 << " MiB), GPU "
+              << DefaultGpuRegistry.totalBytes() / (1024 * 1024) << " MiB"
+              << std::endl;
+    if (world) {
+      auto &stats{world->stats()};
+      std::clog << "LOG::main::\"Benchmark Streaming\": " << stats.cells
+                << " cells, " << stats.loads << " loads, " << stats.evictions
+                << " evictions, peak CPU " << (stats.peakCpuBytes >> 20)
+                << " MiB, peak GPU " << (stats.peakGpuBytes >> 20)
+                << " MiB of the " << (stream_config.cpuBudget >> 20) << '/'
+                << (stream_config.gpuBudget >> 20) << " MiB budgets"
+                << std::endl;
+    }
+  }
+
+  if (dynamic_resolution)
+    dynamic_resolution->closeLog();
+
   /* CLEAN-UP */
+  if (!trace_path.empty())
+    PROFILE_EXPORT(trace_path);
+  PROFILE_DESTORY();
+  uniforms.destory();
   directional_light.destory();
-  cube.destory();
-  nanosuit.destory();
+  if (point_light)
+    point_light->destory();
+  if (shadow_atlas)
+    shadow_atlas->destory();
+  if (light_clusters)
+    light_clusters->destory();
+  if (indirect_batch)
+    indirect_batch->destory();
+  if (cull_timer)
+    cull_timer->destory();
+  if (virtual_shadows) {
+    virtual_shadows->destory();
+    vsm_timer->destory();
+  }
+  if (scene_target)
+    scene_target->destory();
+  shadow_timer->destory();
+  for (auto &view : views)
+    view.timer->destory();
+  hud.destory();
+  for (auto &skinning : skinnings)
+    skinning->destory();
+  if (skin_timer)
+    skin_timer->destory();
+  for (auto &model : models)
+    model->destory();
+  if (world)
+    world->destory();
   depthmap.destory();
   shader_nanosuit.destory();
   shader_shadowmap.destory();
   shader_depthmap_overlay.destory();
+  shader_hud.destory();
+  shader_skinning.destory();
+  shader_point_layered.destory();
+  shader_point_faces.destory();
+  shader_cull.destory();
+  shader_indirect.destory();
+  shader_indirect_depth.destory();
+  DefaultTexRepo.destory();
+  DefaultGpuRegistry.destory();
   glfwTerminate();
   return 0;
 }
@@ -0,0 +1,393 @@
+// shadow_batch: renders stills offscreen from a job list, without the
+// interactive loop.
+//
+//   shadow_batch <jobs> [--out dir] [--size WxH] [--workers n]
+//
+// One job per line, '#' starts a comment:
+//
+//   <model> <eye x y z> <target x y z> <fov deg> <light x y z> <name>
+//
+// Relative model paths are resolved against the jobs file. Every job writes
+// <name>_color.png (the shaded frame) and <name>_depth.png (the light's
+// shadow map) into the output directory.
+//
+// Frames are read back through a ring of PBOs guarded by fences, so the GPU
+// keeps rendering job N while job N - RING + 1 is copied out, and PNG
+// encoding runs on a ThreadPool.
+#include <GLFW/glfw3.h>
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "light.hh"
+#include "model.hh"
+#include "shader.hh"
+#include "thread_pool.hh"
+#include "uniform_ring.hh"
+#include "utils.hh"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Job {
+  fs::path model;
+  glm::vec3 eye, target;
+  float fov;
+  glm::vec3 light;
+  std::string name;
+};
+
+auto readJobs(const fs::path &path) -> std::vector<Job> {
+  std::ifstream in{path};
+  if (!in)
+    throw std::runtime_error{"cannot open jobs file " + path.string()};
+  std::vector<Job> jobs;
+  std::string line;
+  for (int n = 1; std::getline(in, line); n++) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields{line};
+    Job j;
+    std::string model;
+    if (!(fields >> model))
+      continue; // blank or comment
+    if (!(fields >> j.eye.x >> j.eye.y >> j.eye.z >> j.target.x >> j.target.y >>
+          j.target.z >> j.fov >> j.light.x >> j.light.y >> j.light.z >>
+          j.name)) {
+      std::cerr << "ERROR::shadow_batch::readJobs -> " << path << ':' << n
+                << ": malformed job, skipped" << std::endl;
+      continue;
+    }
+    j.model = fs::path{model}.is_absolute() ? fs::path{model}
+                                            : path.parent_path() / model;
+    jobs.push_back(std::move(j));
+  }
+  return jobs;
+}
+
+auto createHiddenContext() -> Utils::GLFWwindowUniquePtr {
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  Utils::GLFWwindowUniquePtr window{
+      glfwCreateWindow(64, 64, "shadow_batch", nullptr, nullptr)};
+  if (!window.get())
+    throw std::runtime_error{"glfw window create failed"};
+  glfwMakeContextCurrent(window.get());
+  if (!gladLoadGLLoader(GLADloadproc(glfwGetProcAddress)))
+    throw std::runtime_error{"GLAD init failed"};
+  return window;
+}
+
+// Color + depth render target for the shaded frame.
+struct Target {
+  GLuint FBO{0}, color{0}, depth{0};
+
+  auto create(int width, int height) -> bool {
+    glGenFramebuffers(1, &FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, color);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+    bool complete{glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+                  GL_FRAMEBUFFER_COMPLETE};
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return complete;
+  }
+
+  auto destory() -> void {
+    glDeleteRenderbuffers(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteFramebuffers(1, &FBO);
+  }
+};
+
+// RING slots of pixel-pack buffers. A slot is refilled only after its fence
+// signalled and its pixels were copied out, so readback never stalls the
+// frame being rendered.
+class Readback {
+public:
+  static constexpr std::size_t RING = 3;
+
+  Readback(int width, int height, ThreadPool &encoders, fs::path outDir)
+      : width{width}, height{height}, encoders{encoders},
+        outDir{std::move(outDir)} {
+    for (auto &s : slots) {
+      glGenBuffers(1, &s.colorPBO);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, s.colorPBO);
+      glBufferData(GL_PIXEL_PACK_BUFFER, colorBytes(), nullptr, GL_STREAM_READ);
+      glGenBuffers(1, &s.depthPBO);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, s.depthPBO);
+      glBufferData(GL_PIXEL_PACK_BUFFER, depthBytes(), nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  // Queues asynchronous copies of the bound read framebuffer and of the
+  // shadow map into the next slot, first retiring whatever the slot held.
+  auto capture(GLuint depthTexture, const std::string &name) -> void {
+    auto &s{slots[next]};
+    next = (next + 1) % RING;
+    retire(s);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.colorPBO);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.depthPBO);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT,
+                  nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s.name = name;
+  }
+
+  // Retires every slot; the encoders may still be running afterwards.
+  auto drain() -> void {
+    for (std::size_t i = 0; i < RING; i++) {
+      retire(slots[next]);
+      next = (next + 1) % RING;
+    }
+  }
+
+  auto destory() -> void {
+    for (auto &s : slots) {
+      glDeleteBuffers(1, &s.colorPBO);
+      glDeleteBuffers(1, &s.depthPBO);
+    }
+  }
+
+private:
+  struct Slot {
+    GLuint colorPBO{0}, depthPBO{0};
+    GLsync fence{nullptr};
+    std::string name;
+  };
+
+  const int width, height;
+  ThreadPool &encoders;
+  const fs::path outDir;
+  std::array<Slot, RING> slots;
+  std::size_t next{0};
+
+  auto colorBytes() const -> std::size_t {
+    return static_cast<std::size_t>(width) * height * 4;
+  }
+  static auto depthBytes() -> std::size_t {
+    return static_cast<std::size_t>(Light::SHADOW_WIDTH) *
+           Light::SHADOW_HEIGHT * sizeof(GLushort);
+  }
+
+  static auto copyOut(GLuint PBO, std::size_t bytes) -> std::vector<char> {
+    std::vector<char> pixels(bytes);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, PBO);
+    if (auto *src{glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes,
+                                   GL_MAP_READ_BIT)}) {
+      std::memcpy(pixels.data(), src, bytes);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    return pixels;
+  }
+
+  auto retire(Slot &s) -> void {
+    if (!s.fence)
+      return;
+    while (glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000) ==
+           GL_TIMEOUT_EXPIRED)
+      ;
+    glDeleteSync(s.fence);
+    s.fence = nullptr;
+    auto color{std::make_shared<std::vector<char>>(
+        copyOut(s.colorPBO, colorBytes()))};
+    auto depth{std::make_shared<std::vector<char>>(
+        copyOut(s.depthPBO, depthBytes()))};
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    encoders.submit([color, depth, w = width, h = height,
+                     base = outDir / s.name] {
+      auto colorPath{base.string() + "_color.png"};
+      if (!stbi_write_png(colorPath.c_str(), w, h, 4, color->data(), w * 4))
+        std::cerr << "ERROR::shadow_batch::encode -> cannot write "
+                  << colorPath << std::endl;
+      // D16 -> 8-bit grey, keeping the high byte
+      std::vector<unsigned char> grey(depth->size() / sizeof(GLushort));
+      auto *d{reinterpret_cast<const GLushort *>(depth->data())};
+      for (std::size_t i = 0; i < grey.size(); i++)
+        grey[i] = d[i] >> 8;
+      auto depthPath{base.string() + "_depth.png"};
+      if (!stbi_write_png(depthPath.c_str(), Light::SHADOW_WIDTH,
+                          Light::SHADOW_HEIGHT, 1, grey.data(),
+                          Light::SHADOW_WIDTH))
+        std::cerr << "ERROR::shadow_batch::encode -> cannot write "
+                  << depthPath << std::endl;
+    });
+  }
+};
+
+auto usage() -> int {
+  std::cerr << "usage: shadow_batch <jobs> [--out dir] [--size WxH] "
+               "[--workers n]"
+            << std::endl;
+  return 1;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2)
+    return usage();
+  fs::path jobs_path{argv[1]}, out_dir{"."};
+  int width{1024}, height{1024};
+  uint workers{std::thread::hardware_concurrency()};
+  for (int i = 2; i < argc; i++) {
+    if (!std::strcmp(argv[i], "--out") && i + 1 < argc)
+      out_dir = argv[++i];
+    else if (!std::strcmp(argv[i], "--size") && i + 1 < argc) {
+      if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2)
+        return usage();
+    } else if (!std::strcmp(argv[i], "--workers") && i + 1 < argc)
+      workers = std::atoi(argv[++i]);
+    else
+      return usage();
+  }
+  auto jobs{readJobs(jobs_path)};
+  fs::create_directories(out_dir);
+
+  const auto base_path{fs::current_path() / "../../"};
+  auto window{createHiddenContext()};
+  std::clog << "LOG::shadow_batch::\"Renderer\": "
+            << glGetString(GL_RENDERER) << std::endl;
+
+  Shader shader_scene, shader_shadowmap;
+  shader_shadowmap
+      .attach(base_path / "shader/shadow_mapping/shadow.vert", GL_VERTEX_SHADER)
+      .attach(base_path / "shader/shadow_mapping/shadow.frag",
+              GL_FRAGMENT_SHADER)
+      .link();
+  shader_scene
+      .attach(base_path /
+                  "shader/shadow_mapping/texturewithshadow/texshad.vert",
+              GL_VERTEX_SHADER)
+      .attach(base_path /
+                  "shader/shadow_mapping/texturewithshadow/texshad.frag",
+              GL_FRAGMENT_SHADER)
+      .link();
+
+  Target target;
+  if (!target.create(width, height)) {
+    std::cerr << "ERROR::shadow_batch::main -> framebuffer incomplete"
+              << std::endl;
+    return 1;
+  }
+  Light light;
+  UniformRing uniforms;
+  int result{0};
+  {
+    ThreadPool encoders{workers};
+    Readback readback{width, height, encoders, out_dir};
+    // Loaded up front, so frames/sec measures rendering and readback only
+    std::map<fs::path, std::unique_ptr<Model>> models;
+    for (auto &job : jobs)
+      if (auto &model{models[job.model]}; !model)
+        model = std::make_unique<Model>(job.model);
+
+    stbi_flip_vertically_on_write(1); // GL rows start at the bottom
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.227451f, 0.227451f, 0.227451f, 1.0f);
+    auto start{std::chrono::steady_clock::now()};
+    for (auto &job : jobs) {
+      auto &model{models[job.model]};
+
+      light.depthViewMatrix =
+          glm::lookAt(job.light, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+      const auto view{glm::lookAt(job.eye, job.target, glm::vec3(0, 1, 0))};
+      const auto prespective{glm::perspective(
+          glm::radians(job.fov), width / static_cast<float>(height), 0.1f,
+          100.0f)};
+
+      uniforms.beginFrame();
+      auto camera_block{uniforms.push(
+          CameraBlock{prespective, view, glm::vec4(job.eye, 1.0f)})};
+      auto light_block{uniforms.push(light.block())};
+      auto object_block{uniforms.push(ObjectBlock{glm::mat4(1.0f)})};
+      uniforms.flush();
+      uniforms.bind<CameraBlock>(BlockBinding::Camera, camera_block);
+      uniforms.bind<LightBlock>(BlockBinding::Light, light_block);
+      uniforms.bind<ObjectBlock>(BlockBinding::Object, object_block);
+
+      // 1. shadow map
+      glViewport(0, 0, width, height);
+      glBindFramebuffer(GL_FRAMEBUFFER, light.depthMapFBO.name());
+      glUseProgram(shader_shadowmap.id());
+      light.render([&] {
+        glCullFace(GL_FRONT); // peter panning
+        model->drawWihtoutTextureBinding();
+        glCullFace(GL_BACK);
+      });
+
+      // 2. shaded frame
+      glBindFramebuffer(GL_FRAMEBUFFER, target.FBO);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      glUseProgram(shader_scene.id());
+      glActiveTexture(GL_TEXTURE0);
+      glUniform1i(shader_scene.getUniform("shadowMap"), 0);
+      glBindTexture(GL_TEXTURE_2D, light.depthTexture.name());
+      model->draw(shader_scene, 1u);
+
+      readback.capture(light.depthTexture.name(), job.name);
+      uniforms.endFrame();
+    }
+    readback.drain();
+    encoders.wait();
+    std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                          start};
+    std::clog << "LOG::shadow_batch::\"Batch Done\": " << jobs.size()
+              << " frames in " << elapsed.count() << " s, "
+              << jobs.size() / elapsed.count() << " frames/sec ("
+              << width << 'x' << height << ", " << encoders.size()
+              << " encoders)" << std::endl;
+    if (jobs.empty())
+      result = 1;
+
+    readback.destory();
+    for (auto &[path, model] : models)
+      model->destory();
+  }
+  uniforms.destory();
+  light.destory();
+  target.destory();
+  shader_scene.destory();
+  shader_shadowmap.destory();
+  DefaultTexRepo.destory();
+  DefaultGpuRegistry.destory();
+  window.reset();
+  glfwTerminate();
+  return result;
+}
@@ -0,0 +1,677 @@
+// shadow_bench: throughput benchmarks for the renderer's CPU-side subsystems.
+//
+//   shadow_bench raster [model] [iterations]
+//       CpuDepthRasterizer triangles/sec against worker thread count, drawing
+//       the model from the default Light into a SHADOW_WIDTH x SHADOW_HEIGHT
+//       depth buffer.
+//
+//   shadow_bench point [model] [iterations]
+//       PointLight cubemap: the single layered pass against the six-pass
+//       reference, in draw calls, CPU ms and GPU ms per frame.
+//
+//   shadow_bench lights [model] [iterations]
+//       Clustered forward shading: frame time against point light count
+//       (1 to 1024), split into LightClusters::build() CPU ms and GPU ms of
+//       the lit scene pass at 1366x768.
+//
+//   shadow_bench cull [model] [iterations]
+//       Many instances of the model (1k to 50k), depth-only at 1366x768:
+//       the CPU loop (frustum test, Object block and draw per mesh) against
+//       IndirectBatch (compute culling, one indirect multi-draw), in CPU
+//       submission ms, GPU ms, frame ms and visible objects per second.
+//       Needs GL 4.3.
+//
+//   shadow_bench glb [file] [iterations]
+//       Load time of a .glb file through the native memory-mapped loader
+//       against Assimp, GL uploads included.
+//
+//   shadow_bench skinning [model] [iterations]
+//       GpuSkinning throughput: 1 to 1024 characters blending two clips,
+//       in CPU ms (sampling, blending and palettes on every thread, then
+//       the upload), GPU ms of the transform feedback pass, and skinned
+//       characters per 60 Hz frame. A model without bones gets a synthetic
+//       chain rig first.
+#include <GLFW/glfw3.h>
+#include <glad/glad.h>
+
+#include "clustered.hh"
+#include "cpu_rasterizer.hh"
+#include "gl_ext.hh"
+#include "gpu_culling.hh"
+#include "light.hh"
+#include "model.hh"
+#include "point_light.hh"
+#include "shader.hh"
+#include "skinning.hh"
+#include "uniform_ring.hh"
+#include "utils.hh"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+namespace fs = std::filesystem;
+
+namespace {
+
+// Models upload to GL, so even CPU benchmarks need a (hidden) context.
+auto createHiddenContext() -> Utils::GLFWwindowUniquePtr {
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  Utils::GLFWwindowUniquePtr window{
+      glfwCreateWindow(64, 64, "shadow_bench", nullptr, nullptr)};
+  if (!window.get())
+    throw std::runtime_error{"glfw window create failed"};
+  glfwMakeContextCurrent(window.get());
+  if (!gladLoadGLLoader(GLADloadproc(glfwGetProcAddress)))
+    throw std::runtime_error{"GLAD init failed"};
+  return window;
+}
+
+auto benchRaster(const fs::path &model_path, int iterations) -> int {
+  Model model{model_path};
+  Light light;
+  const auto mvp{light.block().lightSpaceMatrix};
+  const uint max_threads{std::max(1u, std::thread::hardware_concurrency())};
+  // Powers of two, always finishing on every hardware thread
+  std::vector<uint> thread_counts;
+  for (uint threads = 1; threads < max_threads; threads *= 2)
+    thread_counts.push_back(threads);
+  thread_counts.push_back(max_threads);
+
+  std::cout << "threads  ms/frame  Mtri/s  (" << model_path.filename() << ", "
+            << Light::SHADOW_WIDTH << 'x' << Light::SHADOW_HEIGHT << ", "
+            << iterations << " iterations)" << std::endl;
+  for (auto threads : thread_counts) {
+    CpuDepthRasterizer rasterizer{Light::SHADOW_WIDTH, Light::SHADOW_HEIGHT,
+                                  threads};
+    rasterizer.render(model, mvp, CpuDepthRasterizer::Cull::Front); // warm-up
+    std::size_t triangles{0};
+    auto start{std::chrono::steady_clock::now()};
+    for (int i = 0; i < iterations; i++) {
+      rasterizer.clear();
+      rasterizer.render(model, mvp, CpuDepthRasterizer::Cull::Front);
+      triangles += rasterizer.trianglesSubmitted;
+    }
+    std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                          start};
+    std::cout << std::setw(7) << threads << std::setw(10) << std::fixed
+              << std::setprecision(3) << elapsed.count() * 1e3 / iterations
+              << std::setw(8) << std::setprecision(2)
+              << triangles / elapsed.count() * 1e-6 << std::endl;
+  }
+  model.destory();
+  return 0;
+}
+
+auto benchPoint(const fs::path &base_path, const fs::path &model_path,
+                int iterations) -> int {
+  Shader layered, faces;
+  layered
+      .attach(base_path / "shader/shadow_mapping/point/point.vert",
+              GL_VERTEX_SHADER)
+      .attach(base_path / "shader/shadow_mapping/point/point.geom",
+              GL_GEOMETRY_SHADER)
+      .attach(base_path / "shader/shadow_mapping/point/point.frag",
+              GL_FRAGMENT_SHADER)
+      .link();
+  faces
+      .attach(base_path / "shader/shadow_mapping/point/point_face.vert",
+              GL_VERTEX_SHADER)
+      .attach(base_path / "shader/shadow_mapping/point/point.frag",
+              GL_FRAGMENT_SHADER)
+      .link();
+  Model model{model_path};
+  PointLight light;
+  UniformRing uniforms;
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_CULL_FACE);
+
+  std::cout << "pass      draws  routes  cpu ms  gpu ms  ("
+            << model_path.filename() << ", " << PointLight::SHADOW_SIZE
+            << "^2 x 6, " << iterations << " iterations)" << std::endl;
+  for (auto pass : {PointLight::Pass::Layered, PointLight::Pass::SixPass}) {
+    auto &shader{pass == PointLight::Pass::Layered ? layered : faces};
+    double gpu_ms{0.0};
+    std::chrono::duration<double> elapsed{0};
+    for (int i = -1; i < iterations; i++) { // i == -1: warm-up
+      uniforms.beginFrame();
+      auto object_block{uniforms.push(ObjectBlock{glm::mat4(1.0f)})};
+      auto light_block{uniforms.push(light.block())};
+      uniforms.flush();
+      uniforms.bind<PointLightBlock>(BlockBinding::PointLight, light_block);
+      auto start{std::chrono::steady_clock::now()};
+      light.render(shader, {{&model, glm::mat4(1.0f), object_block}}, uniforms,
+                   pass);
+      glFinish(); // so the next render() reads this frame's timer
+      uniforms.endFrame();
+      if (i >= 0) {
+        elapsed += std::chrono::steady_clock::now() - start;
+        gpu_ms += light.stats(pass).gpuMs; // previous frame's, same work
+      }
+    }
+    auto &stats{light.stats(pass)};
+    std::cout << std::left << std::setw(9)
+              << (pass == PointLight::Pass::Layered ? "layered" : "six-pass")
+              << std::right << std::setw(6) << stats.draws << std::setw(8)
+              << stats.faceRoutes << std::setw(8) << std::fixed
+              << std::setprecision(3) << elapsed.count() * 1e3 / iterations
+              << std::setw(8) << gpu_ms / iterations << std::endl;
+  }
+  uniforms.destory();
+  light.destory();
+  model.destory();
+  layered.destory();
+  faces.destory();
+  return 0;
+}
+
+auto benchLights(const fs::path &base_path, const fs::path &model_path,
+                 int iterations) -> int {
+  constexpr int width{1366}, height{768};
+  Shader shader;
+  shader
+      .attach(base_path /
+                  "shader/shadow_mapping/texturewithshadow/texshad.vert",
+              GL_VERTEX_SHADER)
+      .attach(base_path /
+                  "shader/shadow_mapping/texturewithshadow/texshad.frag",
+              GL_FRAGMENT_SHADER, {"CLUSTERED"})
+      .link();
+  Model model{model_path};
+  Light light;
+  LightClusters clusters;
+  UniformRing uniforms;
+
+  GLuint fbo, color, depth;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glGenRenderbuffers(1, &color);
+  glBindRenderbuffer(GL_RENDERBUFFER, color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color);
+  glGenRenderbuffers(1, &depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, depth);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    std::cerr << "ERROR::benchLights -> framebuffer incomplete." << std::endl;
+  glViewport(0, 0, width, height);
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_CULL_FACE);
+  GLuint timer;
+  glGenQueries(1, &timer);
+
+  const glm::vec3 eye{0.0f, 1.5f, 2.0f};
+  const glm::mat4 view{
+      glm::lookAt(eye, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0, 1, 0))};
+  const glm::mat4 projection{glm::perspective(
+      glm::radians(60.0f), width / static_cast<float>(height),
+      clusters.nearPlane, clusters.farPlane)};
+  std::mt19937 rng{42};
+  std::uniform_real_distribution<float> unit{0.0f, 1.0f};
+  std::vector<ClusterLight> lights;
+
+  std::cout << "lights  entries  max/cluster  build ms  gpu ms  frame ms  ("
+            << model_path.filename() << ", " << width << 'x' << height << ", "
+            << LightClusters::X << 'x' << LightClusters::Y << 'x'
+            << LightClusters::Z << " clusters, " << iterations
+            << " iterations)" << std::endl;
+  for (uint count = 1; count <= 1024; count *= 2) {
+    while (lights.size() < count)
+      lights.push_back(ClusterLight{
+          glm::vec3(8.0f * unit(rng) - 4.0f, 3.0f * unit(rng),
+                    8.0f * unit(rng) - 4.0f),
+          1.5f + 1.5f * unit(rng),
+          glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.6f});
+    double build_ms{0.0}, gpu_ms{0.0};
+    std::chrono::duration<double> elapsed{0};
+    for (int i = -1; i < iterations; i++) { // i == -1: warm-up
+      auto start{std::chrono::steady_clock::now()};
+      clusters.build(lights, view, projection);
+      clusters.upload();
+      uniforms.beginFrame();
+      auto camera_block{uniforms.push(
+          CameraBlock{projection, view, glm::vec4(eye, 1.0f)})};
+      auto light_block{uniforms.push(light.block())};
+      auto object_block{uniforms.push(ObjectBlock{glm::mat4(1.0f)})};
+      uniforms.flush();
+      uniforms.bind<CameraBlock>(BlockBinding::Camera, camera_block);
+      uniforms.bind<LightBlock>(BlockBinding::Light, light_block);
+      uniforms.bind<ObjectBlock>(BlockBinding::Object, object_block);
+
+      glBeginQuery(GL_TIME_ELAPSED, timer);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      glUseProgram(shader.id());
+      glActiveTexture(GL_TEXTURE0);
+      glUniform1i(shader.getUniform("shadowMap"), 0);
+      glBindTexture(GL_TEXTURE_2D, light.depthTexture.name());
+      clusters.bind(shader, 10);
+      model.draw(shader, 1u);
+      glEndQuery(GL_TIME_ELAPSED);
+      glFinish();
+      uniforms.endFrame();
+      if (i >= 0) {
+        elapsed += std::chrono::steady_clock::now() - start;
+        build_ms += clusters.stats().buildMs;
+        GLuint64 ns;
+        glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &ns);
+        gpu_ms += ns * 1e-6;
+      }
+    }
+    auto &stats{clusters.stats()};
+    std::cout << std::setw(6) << count << std::setw(9) << stats.indices
+              << std::setw(13) << stats.maxPerCluster << std::setw(10)
+              << std::fixed << std::setprecision(3) << build_ms / iterations
+              << std::setw(8) << gpu_ms / iterations << std::setw(10)
+              << elapsed.count() * 1e3 / iterations << std::endl;
+  }
+  glDeleteQueries(1, &timer);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteRenderbuffers(1, &color);
+  glDeleteRenderbuffers(1, &depth);
+  glDeleteFramebuffers(1, &fbo);
+  uniforms.destory();
+  clusters.destory();
+  light.destory();
+  model.destory();
+  shader.destory();
+  return 0;
+}
+
+auto benchCull(const fs::path &base_path, const fs::path &model_path,
+               int iterations) -> int {
+  if (!GLExt::load(GLADloadproc(glfwGetProcAddress)))
+    return 1;
+  constexpr int width{1366}, height{768};
+  Shader loop_shader, indirect_shader, cull_shader;
+  loop_shader
+      .attach(base_path / "shader/shadow_mapping/shadow.vert",
+              GL_VERTEX_SHADER)
+      .attach(base_path / "shader/shadow_mapping/shadow.frag",
+              GL_FRAGMENT_SHADER)
+      .link();
+  indirect_shader
+      .attach(base_path / "shader/gpu_culling/indirect.vert", GL_VERTEX_SHADER,
+              {"DEPTH_ONLY"})
+      .attach(base_path / "shader/shadow_mapping/shadow.frag",
+              GL_FRAGMENT_SHADER)
+      .link();
+  cull_shader
+      .attach(base_path / "shader/gpu_culling/cull.comp", GL_COMPUTE_SHADER)
+      .link();
+  Model model{model_path};
+
+  GLuint fbo, color, depth;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glGenRenderbuffers(1, &color);
+  glBindRenderbuffer(GL_RENDERBUFFER, color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_R32F, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color);
+  glGenRenderbuffers(1, &depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, depth);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    std::cerr << "ERROR::benchCull -> framebuffer incomplete." << std::endl;
+  glViewport(0, 0, width, height);
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_CULL_FACE);
+  GLuint timer;
+  glGenQueries(1, &timer);
+
+  // shadow.vert and the DEPTH_ONLY variant project with lightSpaceMatrix,
+  // so the camera goes into the Light block. About half the grid is in view.
+  const glm::vec3 eye{0.0f, 3.0f, 6.0f};
+  const glm::mat4 view_projection{
+      glm::perspective(glm::radians(60.0f), width / static_cast<float>(height),
+                       0.1f, 100.0f) *
+      glm::lookAt(eye, glm::vec3(0.0f, 0.0f, -4.0f), glm::vec3(0, 1, 0))};
+  LightBlock camera_as_light{view_projection, glm::mat4(1.0f),
+                             glm::mat4(1.0f), glm::vec4(eye, 1.0f)};
+
+  std::cout << "objects  path      submit ms  gpu ms  frame ms  visible  "
+               "Mobj/s  (" << model_path.filename() << " x " << model.meshes.size()
+            << " meshes, " << width << 'x' << height << ", " << iterations
+            << " iterations)" << std::endl;
+  for (uint count : {1000u, 4000u, 10000u, 20000u, 50000u}) {
+    const uint side{static_cast<uint>(std::ceil(std::sqrt(float(count))))};
+    std::vector<glm::mat4> instances;
+    for (uint i = 0; i < count; i++)
+      instances.push_back(glm::scale(
+          glm::translate(glm::mat4(1.0f),
+                         glm::vec3(0.3f * (i % side) - 0.15f * side, 0.0f,
+                                   -0.3f * (i / side))),
+          glm::vec3(0.05f)));
+    IndirectBatch batch{model, instances, 1};
+    UniformRing uniforms{(count * model.meshes.size() + 2) * 256};
+    std::vector<GLintptr> objects; // reused so no allocation is timed
+    objects.reserve(instances.size());
+
+    for (bool indirect : {false, true}) {
+      double submit_ms{0.0}, gpu_ms{0.0};
+      std::size_t visible{0};
+      std::chrono::duration<double> elapsed{0};
+      for (int i = -1; i < iterations; i++) { // i == -1: warm-up
+        auto start{std::chrono::steady_clock::now()};
+        uniforms.beginFrame();
+        auto light_block{uniforms.push(camera_as_light)};
+        glBeginQuery(GL_TIME_ELAPSED, timer);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        std::size_t drawn{0};
+        if (indirect) {
+          uniforms.flush();
+          uniforms.bind<LightBlock>(BlockBinding::Light, light_block);
+          batch.cull(cull_shader, {view_projection});
+          glUseProgram(indirect_shader.id());
+          batch.draw(0);
+        } else {
+          objects.clear();
+          for (auto &instance : instances)
+            objects.push_back(uniforms.push(ObjectBlock{instance}));
+          uniforms.flush();
+          uniforms.bind<LightBlock>(BlockBinding::Light, light_block);
+          glUseProgram(loop_shader.id());
+          for (std::size_t o = 0; o < instances.size(); o++) {
+            const auto mvp{view_projection * instances[o]};
+            bool bound{false};
+            for (auto &mesh : model.meshes) {
+              if (IndirectBatch::outsideFrustum(mvp, mesh.boundsMin,
+                                                mesh.boundsMax))
+                continue;
+              if (!bound) {
+                uniforms.bind<ObjectBlock>(BlockBinding::Object, objects[o]);
+                bound = true;
+              }
+              mesh.bindVAO();
+              mesh.draw();
+              drawn++;
+            }
+          }
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        auto submitted{std::chrono::steady_clock::now()};
+        uniforms.endFrame();
+        glFinish();
+        if (i >= 0) {
+          submit_ms += std::chrono::duration<double, std::milli>(submitted -
+                                                                 start)
+                           .count();
+          elapsed += std::chrono::steady_clock::now() - start;
+          GLuint64 ns;
+          glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &ns);
+          gpu_ms += ns * 1e-6;
+          visible = indirect ? batch.visibleObjects(0) : drawn;
+        }
+      }
+      const double frame_ms{elapsed.count() * 1e3 / iterations};
+      std::cout << std::setw(7) << count << "  " << std::left << std::setw(8)
+                << (indirect ? "indirect" : "loop") << std::right
+                << std::fixed << std::setprecision(3) << std::setw(11)
+                << submit_ms / iterations << std::setw(8)
+                << gpu_ms / iterations << std::setw(10) << frame_ms
+                << std::setw(9) << visible << std::setw(8)
+                << std::setprecision(2) << visible / frame_ms * 1e-3
+                << std::endl;
+    }
+    uniforms.destory();
+    batch.destory();
+  }
+  glDeleteQueries(1, &timer);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteRenderbuffers(1, &color);
+  glDeleteRenderbuffers(1, &depth);
+  glDeleteFramebuffers(1, &fbo);
+  model.destory();
+  loop_shader.destory();
+  indirect_shader.destory();
+  cull_shader.destory();
+  return 0;
+}
+
+// Each load starts from an empty texture repository, so both paths decode
+// and upload every image.
+auto benchGlb(const fs::path &file, int iterations) -> int {
+  auto time{[&](auto load) {
+    std::size_t meshes{0};
+    std::chrono::duration<double, std::milli> elapsed{0};
+    for (int i = 0; i < iterations; i++) {
+      auto start{std::chrono::steady_clock::now()};
+      Model model{load()};
+      glFinish();
+      elapsed += std::chrono::steady_clock::now() - start;
+      meshes = model.meshes.size();
+      model.destory();
+      DefaultTexRepo.destory();
+      DefaultGpuRegistry.endFrame();
+    }
+    return std::make_pair(elapsed.count() / iterations, meshes);
+  }};
+  auto [assimp_ms, assimp_meshes] = time([&] {
+    return Model{file, Model::ViaAssimp{}};
+  });
+  auto [native_ms, native_meshes] = time([&] { return Model{file}; });
+
+  std::cout << "loader  ms/load  meshes  (" << file.filename() << ", "
+            << iterations << " iterations)" << std::endl;
+  std::cout << std::fixed << std::setprecision(3) << "assimp" << std::setw(9)
+            << assimp_ms << std::setw(8) << assimp_meshes << "\nnative"
+            << std::setw(9) << native_ms << std::setw(8) << native_meshes
+            << "\nspeedup " << assimp_ms / native_ms << 'x' << std::endl;
+  return 0;
+}
+
+// Rigs a model that has no bones, so the skinning benchmark runs on any
+// mesh: a chain of JOINTS nodes up its height, each vertex weighted to the
+// two nearest, and two clips to blend, a sway and a twist.
+auto rigChain(Model &model) -> void {
+  constexpr int JOINTS{16};
+  constexpr int KEYS{9};
+  constexpr float CLIP_SECONDS{2.0f};
+  float lo{0.0f}, hi{0.0f};
+  for (std::size_t m = 0; m < model.meshes.size(); m++) {
+    lo = m ? std::min(lo, model.meshes[m].boundsMin.y)
+           : model.meshes[m].boundsMin.y;
+    hi = m ? std::max(hi, model.meshes[m].boundsMax.y)
+           : model.meshes[m].boundsMax.y;
+  }
+  const float step{std::max(hi - lo, 1e-3f) / (JOINTS - 1)};
+
+  auto skeleton{std::make_unique<Skeleton>()};
+  for (int j = 0; j < JOINTS; j++) {
+    JointTransform bind;
+    bind.translation = glm::vec4(0.0f, j ? step : lo, 0.0f, 0.0f);
+    skeleton->nodes.push_back(
+        Skeleton::Node{"joint" + std::to_string(j), j - 1, bind});
+  }
+  for (auto [name, axis] : {std::pair{"sway", glm::vec3(0.0f, 0.0f, 1.0f)},
+                            std::pair{"twist", glm::vec3(0.0f, 1.0f, 0.0f)}}) {
+    AnimationClip clip;
+    clip.name = name;
+    clip.duration = CLIP_SECONDS;
+    for (int j = 1; j < JOINTS; j++) {
+      AnimationClip::Channel channel{j, {}, {}, {}};
+      for (int k = 0; k < KEYS; k++) {
+        const float t{CLIP_SECONDS * k / (KEYS - 1)};
+        const float half{0.5f * 0.15f *
+                         std::sin(glm::radians(360.0f) * t / CLIP_SECONDS +
+                                  0.3f * j)};
+        channel.rotation.times.push_back(t);
+        channel.rotation.values.push_back(
+            glm::vec4(axis * std::sin(half), std::cos(half)));
+      }
+      clip.channels.push_back(std::move(channel));
+    }
+    skeleton->clips.push_back(std::move(clip));
+  }
+
+  for (auto &mesh : model.meshes) {
+    mesh.bones.clear();
+    for (int j = 0; j < JOINTS; j++)
+      mesh.bones.push_back(Mesh::Bone{
+          "joint" + std::to_string(j),
+          glm::translate(glm::mat4(1.0f),
+                         glm::vec3(0.0f, -(lo + j * step), 0.0f))});
+    mesh.skin.resize(mesh.vertices.size());
+    for (std::size_t v = 0; v < mesh.vertices.size(); v++) {
+      const float f{std::clamp((mesh.vertices[v].position.y - lo) / step,
+                               0.0f, JOINTS - 1.0f)};
+      const int j{std::min(static_cast<int>(f), JOINTS - 2)};
+      auto &skin{mesh.skin[v]};
+      skin.joints = {static_cast<std::uint16_t>(j),
+                     static_cast<std::uint16_t>(j + 1), 0, 0};
+      skin.weights = glm::vec4(1.0f - (f - j), f - j, 0.0f, 0.0f);
+    }
+  }
+  model.skeleton = std::move(skeleton);
+}
+
+auto benchSkinning(const fs::path &base_path, const fs::path &model_path,
+                   int iterations) -> int {
+  // Characters whose skinned vertices would need more are skipped
+  constexpr std::size_t MAX_OUTPUT_BYTES{512u * 1024 * 1024};
+  Shader program;
+  program.attach(base_path / "shader/skinning/skin.vert", GL_VERTEX_SHADER)
+      .captureVaryings(GpuSkinning::VARYINGS)
+      .link();
+  Model model{model_path};
+  const bool synthetic{!model.skeleton || model.skeleton->clips.empty()};
+  if (synthetic)
+    rigChain(model);
+  const auto clips{model.skeleton->clips.size()};
+  std::size_t vertices{0};
+  for (auto &mesh : model.meshes)
+    vertices += mesh.vertices.size();
+  GLuint timer;
+  glGenQueries(1, &timer);
+  std::mt19937 rng{42};
+  std::uniform_real_distribution<float> unit{0.0f, 1.0f};
+
+  std::cout << "characters  cpu ms  upload ms  gpu ms  frame ms  "
+               "characters/frame  ("
+            << model_path.filename() << ", " << vertices << " vertices, "
+            << model.skeleton->nodes.size() << " nodes"
+            << (synthetic ? " (synthetic rig)" : "") << ", "
+            << std::thread::hardware_concurrency() << " threads, "
+            << iterations << " iterations)" << std::endl;
+  for (uint count = 1; count <= 1024; count *= 4) {
+    if (count * vertices * sizeof(Vertex) > MAX_OUTPUT_BYTES) {
+      std::cout << std::setw(10) << count << "  skipped, "
+                << count * vertices * sizeof(Vertex) / (1024 * 1024)
+                << " MiB of skinned vertices" << std::endl;
+      break;
+    }
+    std::vector<GpuSkinning::Character> characters;
+    for (uint c = 0; c < count; c++)
+      characters.push_back(GpuSkinning::Character{
+          c % clips, clips > 1 ? static_cast<long>((c + 1) % clips) : -1,
+          unit(rng), 0.8f + 0.4f * unit(rng), 10.0f * unit(rng)});
+    GpuSkinning skinning{model, characters};
+    double cpu_ms{0.0}, upload_ms{0.0}, gpu_ms{0.0};
+    std::chrono::duration<double> elapsed{0};
+    for (int i = -1; i < iterations; i++) { // i == -1: warm-up
+      auto start{std::chrono::steady_clock::now()};
+      skinning.animate(1.0f / 60.0f);
+      glBeginQuery(GL_TIME_ELAPSED, timer);
+      skinning.skin(program);
+      glEndQuery(GL_TIME_ELAPSED);
+      glFinish();
+      if (i >= 0) {
+        elapsed += std::chrono::steady_clock::now() - start;
+        cpu_ms += skinning.stats().animateMs;
+        upload_ms += skinning.stats().uploadMs;
+        GLuint64 ns;
+        glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &ns);
+        gpu_ms += ns * 1e-6;
+      }
+    }
+    // In the viewer the CPU and GPU halves overlap, so the slower one
+    // bounds how many characters fit a frame
+    const double bound_ms{
+        std::max((cpu_ms + upload_ms) / iterations, gpu_ms / iterations)};
+    std::cout << std::setw(10) << count << std::fixed << std::setprecision(3)
+              << std::setw(8) << cpu_ms / iterations << std::setw(11)
+              << upload_ms / iterations << std::setw(8) << gpu_ms / iterations
+              << std::setw(10) << elapsed.count() * 1e3 / iterations
+              << std::setw(18) << std::setprecision(0)
+              << count * (1000.0 / 60.0) / std::max(bound_ms, 1e-6)
+              << std::endl;
+    skinning.destory();
+  }
+  glDeleteQueries(1, &timer);
+  model.destory();
+  program.destory();
+  return 0;
+}
+
+auto usage() -> int {
+  std::cerr << "usage: shadow_bench raster [model] [iterations]\n"
+               "       shadow_bench point [model] [iterations]\n"
+               "       shadow_bench lights [model] [iterations]\n"
+               "       shadow_bench cull [model] [iterations]\n"
+               "       shadow_bench glb [file] [iterations]\n"
+               "       shadow_bench skinning [model] [iterations]"
+            << std::endl;
+  return 1;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2)
+    return usage();
+  const auto base_path{fs::current_path() / "../../"};
+  auto window{createHiddenContext()};
+
+  int result;
+  if (!std::strcmp(argv[1], "raster"))
+    result = benchRaster(argc > 2 ? fs::path{argv[2]}
+                                  : base_path / "res/nanosuit/nanosuit.obj",
+                         argc > 3 ? std::atoi(argv[3]) : 50);
+  else if (!std::strcmp(argv[1], "point"))
+    result = benchPoint(base_path,
+                        argc > 2 ? fs::path{argv[2]}
+                                 : base_path / "res/nanosuit/nanosuit.obj",
+                        argc > 3 ? std::atoi(argv[3]) : 200);
+  else if (!std::strcmp(argv[1], "lights"))
+    result = benchLights(base_path,
+                         argc > 2 ? fs::path{argv[2]}
+                                  : base_path / "res/nanosuit/nanosuit.obj",
+                         argc > 3 ? std::atoi(argv[3]) : 50);
+  else if (!std::strcmp(argv[1], "cull"))
+    result = benchCull(base_path,
+                       argc > 2 ? fs::path{argv[2]}
+                                : base_path / "res/cube/cube.obj",
+                       argc > 3 ? std::atoi(argv[3]) : 20);
+  else if (!std::strcmp(argv[1], "glb"))
+    result = benchGlb(argc > 2 ? fs::path{argv[2]}
+                               : base_path / "res/suzzane/suzzane.glb",
+                      argc > 3 ? std::atoi(argv[3]) : 20);
+  else if (!std::strcmp(argv[1], "skinning"))
+    result = benchSkinning(base_path,
+                           argc > 2 ? fs::path{argv[2]}
+                                    : base_path / "res/nanosuit/nanosuit.obj",
+                           argc > 3 ? std::atoi(argv[3]) : 50);
+  else
+    result = usage();
+  DefaultTexRepo.destory();
+  DefaultGpuRegistry.destory();
+  window.reset();
+  glfwTerminate();
+  return result;
+}
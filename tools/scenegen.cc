@@ -0,0 +1,158 @@
+// shadow_scenegen: writes a synthetic scene for `shadow_mapping --scene`,
+// for measuring how the renderer scales with instance and light counts.
+//
+//   shadow_scenegen <out.json> [--instances n] [--lights n] [--area w]
+//                   [--models name=path,...] [--seed s] [--districts]
+//                   [--height h] [--lap s]
+//
+// Instances sit on a jittered grid covering a w x w square around the
+// origin, cycling through the models with a random yaw and scale. Point
+// lights are scattered over the same square, the sun's shadow map is sized
+// to it, and the camera path circles it once in `--lap` seconds (30) at
+// `--height` (a tenth of w), so `--benchmark` flies over every instance.
+// Model paths are written as given; relative ones resolve against the
+// viewer's base directory.
+//
+// For `--stream`, a large w, a low path and `--districts` make a scene the
+// partition has to page through: the square is split into a grid of
+// districts with one model each, so far away districts draw models the
+// camera's surroundings don't.
+#include "scene.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+auto usage() -> int {
+  std::cerr << "usage: shadow_scenegen <out.json> [--instances n] "
+               "[--lights n] [--area w] [--models name=path,...] [--seed s] "
+               "[--districts] [--height h] [--lap s]"
+            << std::endl;
+  return 1;
+}
+
+// "a=x.obj,b=y.obj" -> models; false on a malformed entry.
+auto parseModels(const std::string &list, Scene &scene) -> bool {
+  scene.models.clear();
+  std::size_t start{0};
+  while (start <= list.size()) {
+    auto end{list.find(',', start)};
+    if (end == std::string::npos)
+      end = list.size();
+    const std::string entry{list.substr(start, end - start)};
+    const auto equals{entry.find('=')};
+    if (equals == std::string::npos || equals == 0 ||
+        equals + 1 == entry.size())
+      return false;
+    scene.models.push_back(
+        Scene::ModelEntry{entry.substr(0, equals), entry.substr(equals + 1)});
+    start = end + 1;
+  }
+  return !scene.models.empty();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2)
+    return usage();
+  fs::path out_path{argv[1]};
+  std::size_t instance_count{256}, light_count{0};
+  float area{40.0f};
+  float height{-1.0f}, lap_seconds{30.0f}; // height < 0: from the area
+  bool districts{false};
+  uint seed{1};
+  Scene scene;
+  scene.models = {{"nanosuit", "res/nanosuit/nanosuit.obj"},
+                  {"cube", "res/cube/cube.obj"}};
+  for (int i = 2; i < argc; i++) {
+    if (!std::strcmp(argv[i], "--instances") && i + 1 < argc)
+      instance_count = std::strtoul(argv[++i], nullptr, 10);
+    else if (!std::strcmp(argv[i], "--lights") && i + 1 < argc)
+      light_count = std::strtoul(argv[++i], nullptr, 10);
+    else if (!std::strcmp(argv[i], "--area") && i + 1 < argc)
+      area = std::strtof(argv[++i], nullptr);
+    else if (!std::strcmp(argv[i], "--models") && i + 1 < argc) {
+      if (!parseModels(argv[++i], scene))
+        return usage();
+    } else if (!std::strcmp(argv[i], "--seed") && i + 1 < argc)
+      seed = std::strtoul(argv[++i], nullptr, 10);
+    else if (!std::strcmp(argv[i], "--districts"))
+      districts = true;
+    else if (!std::strcmp(argv[i], "--height") && i + 1 < argc)
+      height = std::strtof(argv[++i], nullptr);
+    else if (!std::strcmp(argv[i], "--lap") && i + 1 < argc)
+      lap_seconds = std::strtof(argv[++i], nullptr);
+    else
+      return usage();
+  }
+  if (!instance_count || !(area > 0.0f) || !(lap_seconds > 0.0f))
+    return usage();
+  if (height < 0.0f)
+    height = std::max(2.0f, area * 0.1f);
+
+  std::mt19937 rng{seed};
+  std::uniform_real_distribution<float> unit{0.0f, 1.0f};
+  const float half{area * 0.5f};
+
+  // Smallest square grid holding every instance, one jittered cell each
+  const auto side{static_cast<std::size_t>(
+      std::ceil(std::sqrt(static_cast<float>(instance_count))))};
+  const float cell{area / side};
+  const auto district_side{static_cast<std::size_t>(
+      std::ceil(std::sqrt(static_cast<float>(scene.models.size()))))};
+  for (std::size_t i = 0; i < instance_count; i++) {
+    const std::size_t x{i % side}, z{i / side};
+    const std::size_t district{z * district_side / side * district_side +
+                               x * district_side / side};
+    Scene::Instance instance{(districts ? district : i) %
+                             scene.models.size()};
+    instance.position =
+        glm::vec3(-half + cell * (x + 0.2f + 0.6f * unit(rng)), 0.0f,
+                  -half + cell * (z + 0.2f + 0.6f * unit(rng)));
+    instance.rotation.y = 360.0f * unit(rng);
+    instance.scale = 0.75f + 0.5f * unit(rng);
+    scene.instances.push_back(instance);
+  }
+
+  for (std::size_t i = 0; i < light_count; i++) {
+    Scene::PointLightEntry light;
+    light.position = glm::vec3(-half + area * unit(rng), 0.5f + 2.5f * unit(rng),
+                               -half + area * unit(rng));
+    light.radius = 1.0f + 3.0f * unit(rng);
+    light.color = glm::vec3(0.2f) + 0.8f * glm::vec3(unit(rng), unit(rng),
+                                                     unit(rng));
+    scene.lights.push_back(light);
+  }
+
+  // The sun's ortho box must hold the whole square, corners included
+  scene.directional.position = glm::vec3(0.25f, 1.0f, 1.0f) * half;
+  scene.directional.extent = half * std::sqrt(2.0f);
+
+  // One lap around the square, a keyframe every 30 degrees, looking at the
+  // ground halfway between the camera and the center
+  constexpr std::size_t KEYFRAMES{12};
+  const float radius{half * 0.75f};
+  for (std::size_t i = 0; i <= KEYFRAMES; i++) {
+    const float angle{glm::radians(360.0f * i / KEYFRAMES)};
+    const glm::vec3 around{std::cos(angle), 0.0f, std::sin(angle)};
+    scene.camera.path.push_back(Scene::Keyframe{
+        lap_seconds * i / KEYFRAMES, around * radius + glm::vec3(0, height, 0),
+        around * radius * 0.5f});
+  }
+  scene.camera.position = scene.camera.path.front().position;
+
+  if (!scene.write(out_path))
+    return 1;
+  std::clog << "LOG::shadow_scenegen::\"Scene Written\": " << out_path << ", "
+            << scene.instances.size() << " instances of "
+            << scene.models.size() << " models, " << scene.lights.size()
+            << " lights" << std::endl;
+  return 0;
+}